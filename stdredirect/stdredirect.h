@@ -38,8 +38,6 @@
 #ifndef STDREDIRECT_H
 #define STDREDIRECT_H
 
-#ifdef _WIN32
-
 #if defined (_MSC_VER) && (_MSC_VER >= 1020)
 #pragma once
 #endif
@@ -49,19 +47,187 @@ extern "C" {
 #endif /* __cplusplus */
 
 
+#ifdef _WIN32
+
 #include <Windows.h>
 
 #include <conio.h>
 #include <io.h>
+
+/* shared reader on an I/O completion port, define STDREDIRECT_NO_REACTOR to read every redirection in a thread of its
+   own */
+#ifndef STDREDIRECT_NO_REACTOR
+#define STDREDIRECT_IOCP
+#endif
+
+#else
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <spawn.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+
+#ifdef __linux__
+#include <stdio_ext.h>
+#include <sys/syscall.h>
+#endif
+
+/* shared epoll reader, define STDREDIRECT_NO_REACTOR to read every redirection in a thread of its own */
+#if defined (__linux__) && !defined (STDREDIRECT_NO_REACTOR)
+#define STDREDIRECT_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+/* environment of this process, inherited by spawned children, not declared by every unistd.h */
+extern char** environ;
+
+#endif /* _WIN32 */
+
+/* one reader thread for all redirections in STDREDIRECT_READER_MODE_SHARED */
+#if defined (STDREDIRECT_EPOLL) || defined (STDREDIRECT_IOCP)
+#define STDREDIRECT_SHARED_READER
+#endif
+
+#include <limits.h>
+#include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* vectorized scanning, define STDREDIRECT_NO_SIMD to use the scalar fallback only */
+#ifndef STDREDIRECT_NO_SIMD
+#if defined (__AVX2__)
+#define STDREDIRECT_AVX2
+#elif (defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))) || (defined (_MSC_VER) && (defined (_M_X64) || defined (_M_IX86)))
+/* built for CPUs without AVX2, the UTF-8 stage checks for it at runtime */
+#define STDREDIRECT_AVX2_RUNTIME
+#endif
+#if defined (__SSE2__) || defined (_M_X64) || (defined (_M_IX86_FP) && _M_IX86_FP >= 2)
+#define STDREDIRECT_SSE2
+#endif
+#endif /* STDREDIRECT_NO_SIMD */
+
+#if defined (STDREDIRECT_AVX2) || defined (STDREDIRECT_AVX2_RUNTIME)
+#include <immintrin.h>
+#elif defined (STDREDIRECT_SSE2)
+#include <emmintrin.h>
+#endif
+#if defined (STDREDIRECT_AVX2_RUNTIME) && defined (_MSC_VER)
+#include <intrin.h>
+#endif
+
+/* functions using AVX2 in a build for CPUs without it */
+#if defined (STDREDIRECT_AVX2_RUNTIME) && defined (__GNUC__)
+#define STDREDIRECT_TARGET_AVX2 __attribute__ ((target ("avx2,popcnt")))
+#else
+#define STDREDIRECT_TARGET_AVX2
+#endif
 
 
 /** @brief Default buffered pipe reader buffer size. */
-const size_t STDREDIRECT_BUFFER_SIZE = 81;
+const size_t STDREDIRECT_BUFFER_SIZE = 64 * 1024;
+
+
+/** @brief Default maximum line length in line framing mode, longer lines are delivered in pieces. */
+const size_t STDREDIRECT_MAX_LINE_LENGTH = 64 * 1024;
+
+
+/** @brief Default number of pending bytes that triggers batch delivery. */
+const size_t STDREDIRECT_BATCH_SIZE = 64 * 1024;
+
+
+/** @brief Default time in microseconds after the first pending byte that triggers batch delivery. */
+const long long STDREDIRECT_BATCH_DELAY_US = 1000;
+
+
+/** @brief Default maximum number of segments per batch. */
+const size_t STDREDIRECT_BATCH_MAX_SEGMENTS = 1024;
+
+
+/** @brief Default ring capacity in asynchronous mode. */
+const size_t STDREDIRECT_RING_CAPACITY = 4 * 1024 * 1024;
+
+
+/** @brief Default interval in microseconds between statistics snapshots passed to the statistics callback. */
+const long long STDREDIRECT_STATS_INTERVAL_US = 1000000;
+
+
+/** @brief Default cap of the pipe capacity in adaptive mode, the default /proc/sys/fs/pipe-max-size on Linux. */
+const size_t STDREDIRECT_MAX_PIPE_SIZE = 1024 * 1024;
+
+
+/** @brief Default cap of the pipe reader buffer size in adaptive mode. */
+const size_t STDREDIRECT_MAX_BUFFER_SIZE = 1024 * 1024;
+
+
+/** @brief Interval in microseconds after which adaptive mode shrinks pipe and buffer if bursts stayed small. */
+const long long STDREDIRECT_ADAPT_INTERVAL_US = 1000000;
+
+
+/** @brief Interval in microseconds after which lines suppressed by collapsing or rate limiting are summarized. */
+const long long STDREDIRECT_SUMMARY_INTERVAL_US = 1000000;
+
+
+/** @brief Default size cap of the spill file of ::STDREDIRECT_FULL_POLICY_SPILL. */
+const long long STDREDIRECT_SPILL_QUOTA = 1024LL * 1024 * 1024;
+
+
+/** @brief Exit code passed to the exit callback of a child process whose exit status could not be determined. */
+const int STDREDIRECT_EXIT_CODE_UNKNOWN = INT_MIN;
+
+
+/** @brief Interval in microseconds at which the shared reader polls for the exit of a child process without pidfd. */
+const long long STDREDIRECT_EXIT_POLL_INTERVAL_US = 10000;
+
+
+/** @brief Number of UTF-16 code units passed to the UTF-16 callback at once at most, longer data is passed in pieces. */
+const size_t STDREDIRECT_UTF16_BUFFER_LENGTH = 64 * 1024;
+
+
+/** @brief Bytes of UTF-8 STDREDIRECT_utf8ToUtf16() validates at once, transcoding them while they are in the L1 cache. */
+const size_t STDREDIRECT_UTF8_PIECE_LENGTH = 8 * 1024;
+
+
+/** @brief Size of the pieces STDREDIRECT_inject() passes on in synchronous mode. */
+#define STDREDIRECT_INJECT_BUFFER_SIZE 4096
+
 
+/** @brief Number of queues STDREDIRECT_threadWrite() publishes lines to per redirection, threads map to them by id. */
+#define STDREDIRECT_THREAD_QUEUES 64
 
-/** @brief Thread exit timeout in ms. */
-const DWORD STDREDIRECT_THREAD_EXIT_TIMEOUT_MS = 5;
+
+/** @brief Capacity of each queue of STDREDIRECT_threadWrite(), a thread finding its queue full commits under the lock. */
+const size_t STDREDIRECT_THREAD_QUEUE_CAPACITY = 64 * 1024;
+
+
+/** @brief Number of chunk size histogram buckets, bucket i counts chunks of 2^i up to 2^(i+1) - 1 bytes. */
+#define STDREDIRECT_STATS_BUCKETS 32
+
+
+#ifdef _WIN32
+/** @brief Interval in ms at which unredirect unblocks a pipe reader kept waiting by a writable end inherited by a child,
+ *         and the timeout timer cancels a read started after it fired. */
+const DWORD STDREDIRECT_THREAD_EXIT_POLL_MS = 1;
+#endif /* _WIN32 */
 
 
 /** @brief Error types. */
@@ -71,7 +237,9 @@ typedef enum STDREDIRECT_ERROR {
     STDREDIRECT_ERROR_UNREDIRECT,       /**< unredirect failed                    */
     STDREDIRECT_ERROR_THREAD,           /**< error in pipe reader thread          */
     STDREDIRECT_ERROR_CREATE,           /**< allocating redirection object failed */
-    STDREDIRECT_ERROR_NULLPTR           /**< null-pointer error                   */
+    STDREDIRECT_ERROR_NULLPTR,          /**< null-pointer error                   */
+    STDREDIRECT_ERROR_SINK,             /**< writing to sink failed               */
+    STDREDIRECT_ERROR_NOT_REDIRECTED    /**< redirection is not redirected        */
                                              
 } STDREDIRECT_ERROR;                         
        
@@ -91,10 +259,287 @@ typedef enum STDREDIRECT_BEHAVIOUR {
 } STDREDIRECT_BEHAVIOUR;
 
 
+/** @brief Framing of the data passed to the callback. */
+typedef enum STDREDIRECT_FRAMING {
+    STDREDIRECT_FRAMING_RAW,            /**< whatever could be read from the pipe at once                                  */
+    STDREDIRECT_FRAMING_LINE            /**< exactly one line per call including its '\n', the last line may lack it       */
+} STDREDIRECT_FRAMING;
+
+
+/** @brief What the pipe reader does when the ring of an asynchronous redirection is full. */
+typedef enum STDREDIRECT_FULL_POLICY {
+    STDREDIRECT_FULL_POLICY_BLOCK,          /**< wait for the dispatcher, the pipe may fill up and block writers          */
+    STDREDIRECT_FULL_POLICY_DROP_NEWEST,    /**< drop the chunk that does not fit                                         */
+    STDREDIRECT_FULL_POLICY_DROP_OLDEST,    /**< drop the oldest chunks not yet taken by the dispatcher to make room      */
+    STDREDIRECT_FULL_POLICY_SPILL           /**< append chunks to a temporary file until the dispatcher caught up, drop
+                                                 the newest beyond STDREDIRECT_OPTIONS::spillQuota                      */
+} STDREDIRECT_FULL_POLICY;
+
+
+/** @brief Where STDREDIRECT_stripEscapes() is within an escape sequence, carried across reads. */
+typedef enum STDREDIRECT_ESCAPE_STATE {
+    STDREDIRECT_ESCAPE_STATE_TEXT,          /**< plain text, not within a sequence                                        */
+    STDREDIRECT_ESCAPE_STATE_ESCAPE,        /**< after ESC                                                                */
+    STDREDIRECT_ESCAPE_STATE_INTERMEDIATE,  /**< intermediate bytes of a two-byte sequence, e.g. ESC ( B                  */
+    STDREDIRECT_ESCAPE_STATE_CSI,           /**< parameters of a control sequence, ESC [ ... final byte                   */
+    STDREDIRECT_ESCAPE_STATE_OSC,           /**< operating system command, ESC ] ... BEL or ST                            */
+    STDREDIRECT_ESCAPE_STATE_STRING,        /**< DCS, SOS, PM or APC string, ESC P/X/^/_ ... ST                           */
+    STDREDIRECT_ESCAPE_STATE_STRING_ESCAPE  /**< ESC within a string, ESC \ (ST) ends it, anything else starts a new
+                                                 sequence                                                             */
+} STDREDIRECT_ESCAPE_STATE;
+
+
+/** @brief What the UTF-8 stage does with bytes that are not valid UTF-8, see STDREDIRECT_OPTIONS::isUtf8. */
+typedef enum STDREDIRECT_INVALID_UTF8 {
+    STDREDIRECT_INVALID_UTF8_REPLACE,       /**< replace every maximal invalid subsequence with U+FFFD                    */
+    STDREDIRECT_INVALID_UTF8_DROP,          /**< remove them                                                              */
+    STDREDIRECT_INVALID_UTF8_KEEP           /**< pass them on unchanged, only complete code points are still guaranteed   */
+} STDREDIRECT_INVALID_UTF8;
+
+
+/** @brief Which thread reads the pipe of a redirection. */
+typedef enum STDREDIRECT_READER_MODE {
+    STDREDIRECT_READER_MODE_SHARED,         /**< one reader thread waits on the pipes of all redirections (epoll on
+                                                 Linux, overlapped reads of named pipes on an I/O completion port on
+                                                 Windows), falls back to ::STDREDIRECT_READER_MODE_DEDICATED where not
+                                                 supported                                                              */
+    STDREDIRECT_READER_MODE_DEDICATED       /**< pipe reader thread per redirection                                   */
+} STDREDIRECT_READER_MODE;
+
+
 /** @brief Function pointer to callback function. */
 typedef void (*STDREDIRECT_CALLBACK)(const char* str);
 
 
+/** @brief Function pointer to data callback function.
+ *
+ *  Receives the bytes read from the pipe, @p data is not null-terminated and only valid during the call.
+ */
+typedef void (*STDREDIRECT_DATA_CALLBACK)(const char* data, size_t length, void* userdata);
+
+
+/** @brief Function pointer to UTF-16 callback function.
+ *
+ *  Receives the data transcoded to UTF-16, @p data is null-terminated (e.g. for OutputDebugStringW(), wchar_t is
+ *  16 bits on Windows), never ends within a surrogate pair and is only valid during the call. @p length is in code
+ *  units.
+ */
+typedef void (*STDREDIRECT_UTF16_CALLBACK)(const unsigned short* data, size_t length, void* userdata);
+
+
+/** @brief Data passed to the record callback, one per chunk (or line in line framing mode). */
+typedef struct STDREDIRECT_RECORD {
+    STDREDIRECT_STREAM        stream;           /**< stream the data was written to                                 */
+    long long                 timestamp;        /**< STDREDIRECT_now() when the data was read from the pipe         */
+    long long                 sequence;         /**< per-redirection sequence number, counts records from 0         */
+    long long                 globalSequence;   /**< global sequence number of the pipe read the data came from,
+                                                     increases across all redirections in read order               */
+    long long                 threadId;         /**< STDREDIRECT_threadId() of the thread that committed the data
+                                                     with STDREDIRECT_threadWrite(), 0 for data read from the pipe
+                                                     or passed to STDREDIRECT_inject()                              */
+    const char*               data;             /**< data, not null-terminated                                      */
+    size_t                    length;           /**< number of bytes                                                */
+} STDREDIRECT_RECORD;
+
+
+/** @brief Function pointer to record callback function.
+ *
+ *  Like STDREDIRECT_DATA_CALLBACK, but tagged with stream, read time and sequence numbers so output of several
+ *  redirections can be merged in the order it was read. The record is only valid during the call.
+ */
+typedef void (*STDREDIRECT_RECORD_CALLBACK)(const STDREDIRECT_RECORD* record, void* userdata);
+
+
+/** @brief Segment of a batch, points into the batch buffer. */
+typedef struct STDREDIRECT_SEGMENT {
+    const char*               data;             /**< segment bytes, not null-terminated                             */
+    size_t                    length;           /**< number of bytes                                                */
+} STDREDIRECT_SEGMENT;
+
+
+/** @brief Function pointer to batch callback function.
+ *
+ *  Receives the chunks (or lines in line framing mode) gathered since the last batch, segments are only valid
+ *  during the call.
+ */
+typedef void (*STDREDIRECT_BATCH_CALLBACK)(const STDREDIRECT_SEGMENT* segments, size_t count, void* userdata);
+
+
+/** @brief Redirection statistics, see STDREDIRECT_getStats().
+ *
+ *  Counters start at 0 on creation and keep counting across redirect/unredirect cycles. Times are in microseconds.
+ */
+typedef struct STDREDIRECT_STATS {
+    STDREDIRECT_STREAM        stream;           /**< redirected stream                                              */
+    long long                 timestamp;        /**< STDREDIRECT_now() when the snapshot was taken                  */
+    long long                 bytesRead;        /**< bytes read from the pipe                                       */
+    long long                 reads;            /**< read calls on the pipe, including the ones finding it empty    */
+    long long                 callbacks;        /**< callback invocations, one per chunk or line and one per batch  */
+    long long                 callbackTimeUs;   /**< time spent in callbacks                                        */
+    long long                 maxCallbackTimeUs;/**< longest callback invocation                                    */
+    long long                 busyTimeUs;       /**< time the pipe reader spent reading and processing output       */
+    long long                 blockedTimeUs;    /**< time the pipe reader waited for room in the full ring, writers
+                                                     block as soon as the pipe fills up meanwhile                   */
+    long long                 idleTimeUs;       /**< time the pipe reader waited for output while redirected        */
+    long long                 droppedChunks;    /**< chunks dropped, full ring                                      */
+    long long                 droppedBytes;     /**< bytes dropped, full ring                                       */
+    long long                 chunkSizes[STDREDIRECT_STATS_BUCKETS]; /**< number of chunks read per log2 size bucket */
+    long long                 largestBurst;     /**< most bytes drained from the pipe at once                       */
+    long long                 pipeSize;         /**< current pipe capacity, 0 if unknown                            */
+    long long                 bufferSize;       /**< current pipe reader buffer size                                */
+    long long                 collapsedLines;   /**< repeated lines collapsed into a summary                        */
+    long long                 collapsedBytes;   /**< bytes of repeated lines collapsed into a summary               */
+    long long                 rateLimitedLines; /**< lines (or chunks in raw framing) suppressed by the rate limit  */
+    long long                 rateLimitedBytes; /**< bytes suppressed by the rate limit                             */
+    long long                 spilledChunks;    /**< chunks written to the spill file, full ring                    */
+    long long                 spilledBytes;     /**< bytes written to the spill file, full ring                     */
+    long long                 strippedBytes;    /**< bytes of escape sequences stripped                             */
+    long long                 invalidUtf8Bytes; /**< bytes of invalid UTF-8 replaced, dropped or kept               */
+} STDREDIRECT_STATS;
+
+
+/** @brief Function pointer to statistics callback function.
+ *
+ *  Receives a snapshot every STDREDIRECT_OPTIONS::statsIntervalUs while redirected and a last one on unredirect.
+ */
+typedef void (*STDREDIRECT_STATS_CALLBACK)(const STDREDIRECT_STATS* stats, void* userdata);
+
+
+/** @brief Redirection options.
+ *
+ *  Use STDREDIRECT_defaultOptions() to initialize, then pass to STDREDIRECT_createWithOptions().
+ */
+typedef struct STDREDIRECT_OPTIONS {
+    STDREDIRECT_BEHAVIOUR     behaviour;        /**< redirection behaviour                                          */
+    STDREDIRECT_DATA_CALLBACK dataCallback;     /**< output callback                                                */
+    void*                     userdata;         /**< passed to dataCallback                                         */
+    size_t                    bufferSize;       /**< pipe reader buffer size, defaults to STDREDIRECT_BUFFER_SIZE    */
+    STDREDIRECT_FRAMING       framing;          /**< framing, defaults to ::STDREDIRECT_FRAMING_RAW                 */
+    size_t                    maxLineLength;    /**< line framing cap, defaults to STDREDIRECT_MAX_LINE_LENGTH       */
+    size_t                    ringCapacity;     /**< asynchronous mode ring capacity in bytes, 0 calls the callback
+                                                     on the pipe reader thread (default)                            */
+    STDREDIRECT_FULL_POLICY   fullPolicy;       /**< asynchronous mode full ring policy, defaults to
+                                                     ::STDREDIRECT_FULL_POLICY_BLOCK                                */
+    STDREDIRECT_BATCH_CALLBACK batchCallback;   /**< batch callback, also gets userdata                             */
+    size_t                    batchSize;        /**< deliver batch once this many bytes are pending, defaults to
+                                                     STDREDIRECT_BATCH_SIZE                                         */
+    long long                 batchDelayUs;     /**< deliver batch this many microseconds after its first byte,
+                                                     defaults to STDREDIRECT_BATCH_DELAY_US                         */
+    size_t                    batchMaxSegments; /**< deliver batch once it has this many segments, defaults to
+                                                     STDREDIRECT_BATCH_MAX_SEGMENTS                                 */
+    STDREDIRECT_RECORD_CALLBACK recordCallback; /**< record callback, also gets userdata                            */
+    STDREDIRECT_READER_MODE   readerMode;       /**< pipe reader thread, defaults to ::STDREDIRECT_READER_MODE_SHARED */
+    STDREDIRECT_STATS_CALLBACK statsCallback;   /**< statistics callback, called on the pipe reader thread, also
+                                                     gets userdata                                                  */
+    long long                 statsIntervalUs;  /**< statistics callback interval, defaults to
+                                                     STDREDIRECT_STATS_INTERVAL_US                                  */
+    size_t                    pipeSize;         /**< pipe capacity requested on redirect, 0 keeps the system default
+                                                     (default)                                                      */
+    int                       isAdaptive;       /**< grow pipe and pipe reader buffer during bursts, up to
+                                                     maxPipeSize and maxBufferSize, shrink them when bursts stay
+                                                     small, defaults to FALSE                                       */
+    size_t                    maxPipeSize;      /**< adaptive mode pipe capacity cap, defaults to
+                                                     STDREDIRECT_MAX_PIPE_SIZE                                      */
+    size_t                    maxBufferSize;    /**< adaptive mode pipe reader buffer cap, defaults to
+                                                     STDREDIRECT_MAX_BUFFER_SIZE                                    */
+    int                       isCollapsing;     /**< pass on consecutive identical lines once, followed by a
+                                                     "repeated N more times" summary, needs
+                                                     ::STDREDIRECT_FRAMING_LINE, defaults to FALSE                  */
+    size_t                    rateLimit;        /**< bytes per second passed on, excess lines are suppressed and
+                                                     summarized, 0 is unlimited (default)                           */
+    size_t                    rateBurst;        /**< bytes passed on at once after a quiet period, 0 allows one
+                                                     second worth of rateLimit (default)                            */
+    long long                 spillQuota;       /**< ::STDREDIRECT_FULL_POLICY_SPILL spill file size cap, defaults
+                                                     to STDREDIRECT_SPILL_QUOTA                                     */
+    const char*               spillDirectory;   /**< directory of the spill file, NULL uses TMPDIR or /tmp, the
+                                                     temporary directory on Windows (default)                      */
+    int                       isPersistent;     /**< keep pipe, pipe reader and dispatcher parked on unredirect, so
+                                                     the next redirect only points the stream at the pipe again;
+                                                     released by STDREDIRECT_destroy(), POSIX only, defaults to
+                                                     FALSE                                                          */
+    int                       isStrippingEscapes; /**< remove ANSI escape sequences (colors, cursor movement, titles)
+                                                     before framing, the original stream still gets them in
+                                                     ::STDREDIRECT_BEHAVIOUR_DUPLICATE, defaults to FALSE           */
+    int                       isUtf8;           /**< pass on complete UTF-8 code points only, one cut off at the end
+                                                     of a read is carried to the next, invalid bytes are handled as
+                                                     set by invalidUtf8, defaults to FALSE                          */
+    STDREDIRECT_INVALID_UTF8  invalidUtf8;      /**< handling of invalid UTF-8, defaults to
+                                                     ::STDREDIRECT_INVALID_UTF8_REPLACE                             */
+    STDREDIRECT_UTF16_CALLBACK utf16Callback;   /**< UTF-16 callback, implies isUtf8, also gets userdata            */
+} STDREDIRECT_OPTIONS;
+
+
+#if defined (_MSC_VER)
+/** @brief Atomic counter, use STDREDIRECT_atomicLoad() etc. to access. */
+typedef volatile LONG64 STDREDIRECT_ATOMIC;
+#else
+/** @brief Atomic counter, use STDREDIRECT_atomicLoad() etc. to access. */
+typedef volatile long long STDREDIRECT_ATOMIC;
+#endif /* _MSC_VER */
+
+
+#if defined (_MSC_VER)
+#define STDREDIRECT_THREAD_LOCAL __declspec(thread)                             /**< thread-local storage */
+#else
+#define STDREDIRECT_THREAD_LOCAL __thread                                       /**< thread-local storage */
+#endif /* _MSC_VER */
+
+
+#ifdef _WIN32
+typedef HANDLE             STDREDIRECT_THREAD;                                  /**< thread           */
+typedef CRITICAL_SECTION   STDREDIRECT_MUTEX;                                   /**< mutex            */
+typedef CONDITION_VARIABLE STDREDIRECT_CONDITION;                               /**< condition        */
+typedef DWORD (WINAPI *STDREDIRECT_THREAD_ROUTINE)(void* parameter);            /**< thread function  */
+#define STDREDIRECT_THREAD_RESULT DWORD WINAPI
+#else
+typedef pthread_t          STDREDIRECT_THREAD;                                  /**< thread           */
+typedef pthread_mutex_t    STDREDIRECT_MUTEX;                                   /**< mutex            */
+typedef pthread_cond_t     STDREDIRECT_CONDITION;                               /**< condition        */
+typedef void* (*STDREDIRECT_THREAD_ROUTINE)(void* parameter);                   /**< thread function  */
+#define STDREDIRECT_THREAD_RESULT void*
+#endif /* _WIN32 */
+
+
+/** @brief Lock-free single-producer/single-consumer byte ring.
+ *
+ *  Holds records of a STDREDIRECT_RING_RECORD header followed by the chunk, positions only ever increase.
+ */
+typedef struct STDREDIRECT_RING {
+    char*                 data;                 /**< ring memory                                            */
+    size_t                capacity;             /**< size of ring memory, power of two                      */
+    STDREDIRECT_ATOMIC    head;                 /**< end of last record, written by producer                */
+    char                  padding[64];          /**< keep head and tail in separate cache lines             */
+    STDREDIRECT_ATOMIC    tail;                 /**< start of oldest record, advanced by consumer, and by
+                                                     producer when dropping oldest records                  */
+} STDREDIRECT_RING;
+
+
+/** @brief Ring record header. */
+typedef struct STDREDIRECT_RING_RECORD {
+    size_t                length;               /**< number of chunk bytes following the header             */
+    long long             globalSequence;       /**< global sequence number of the chunk                    */
+    long long             timestamp;            /**< STDREDIRECT_now() when the chunk was read              */
+    long long             threadId;             /**< committing thread, 0 for the pipe                      */
+} STDREDIRECT_RING_RECORD;
+
+
+/** @brief Lines published by STDREDIRECT_threadWrite(), passed on by the pipe reader.
+ *
+ *  A thread claims the queue its id maps to for one record at a time, so an exiting thread holds nothing and threads
+ *  whose ids collide take turns. The pipe reader is the only consumer.
+ */
+typedef struct STDREDIRECT_THREAD_QUEUE {
+    STDREDIRECT_ATOMIC    ownerId;              /**< thread publishing a record, 0 if none                  */
+    STDREDIRECT_RING      ring;                 /**< published records, memory allocated on first use
+                                                     (injectLock)                                           */
+    char                  padding[64];          /**< keep queues in separate cache lines                    */
+} STDREDIRECT_THREAD_QUEUE;
+
+
+
+struct STDREDIRECT_PROCESS;
+
+
 /** @brief Redirection object for a given stream. 
  * 
  *  Use STDREDIRECT_create() to create one. 
@@ -104,9 +549,11 @@ typedef struct STDREDIRECT_REDIRECTION {
      *  Use the these variables to check the state of the redirection. Read only!
      */
     /*@{*/
-    BOOL                  isRedirected;     /**< [read] redirection is redirected   */
-    BOOL                  isValid;          /**< [read] redirection is valid        */
+    int                   isRedirected;     /**< [read] redirection is redirected   */
+    int                   isValid;          /**< [read] redirection is valid        */
     STDREDIRECT_ERROR     error;            /**< [read] redirection error           */
+    STDREDIRECT_ATOMIC    droppedChunks;    /**< [read] chunks dropped, full ring   */
+    STDREDIRECT_ATOMIC    droppedBytes;     /**< [read] bytes dropped, full ring    */
     /*@}*/                 
 
     /** @name Internal
@@ -114,21 +561,284 @@ typedef struct STDREDIRECT_REDIRECTION {
      */
     /*@{*/
     STDREDIRECT_STREAM    stream;                               /**< redirected standard stream                          */
-    STDREDIRECT_CALLBACK  callback;                             /**< output callback                                     */
+    long long             id;                                   /**< unique in the process, tells the redirection apart
+                                                                     from a destroyed one it took the memory of          */
+    STDREDIRECT_CALLBACK  callback;                             /**< output callback (null-terminated string)            */
+    STDREDIRECT_DATA_CALLBACK dataCallback;                     /**< output callback (length-delimited data)             */
+    void*                 userdata;                             /**< passed to dataCallback                              */
     STDREDIRECT_BEHAVIOUR behaviour  ;                          /**< redirection behaviour                               */
+    STDREDIRECT_FRAMING   framing;                              /**< framing of callback data                            */
+    STDREDIRECT_RECORD_CALLBACK recordCallback;                 /**< output callback (tagged records)                    */
+    STDREDIRECT_READER_MODE readerMode;                         /**< pipe reader thread actually used                    */
+    long long             sequence;                             /**< per-redirection sequence number of next record      */
+    long long             globalSequence;                       /**< global sequence number of the chunk being delivered */
+    long long             timestamp;                            /**< read time of the chunk being delivered              */
+    long long             threadId;                             /**< committing thread of the chunk being delivered, a
+                                                                     carried partial line of another one is flushed first */
+#ifdef _WIN32
     HANDLE                stdHandle;                            /**< console standard device handle                      */
     HANDLE                readablePipeEnd;                      /**< readable pipe end                                   */
     HANDLE                writablePipeEnd;                      /**< writable pipe end                                   */
     int                   writablePipeEndFileDescriptor;        /**< C-runtime file descriptor for writable pipe end     */
     HANDLE                thread;                               /**< pipe reader thread                                  */
     HANDLE                exitThreadEvent;                      /**< event to signal thread it should exit               */
-    char*                 buffer;                               /**< pipe reader buffer                                  */
+    PTP_TIMER             timeoutTimer;                         /**< cancels the pipe read when a batch, summary or
+                                                                     statistics are due                                  */
+    int                   isReading;                            /**< pipe reader is in ReadFile() (lock)                 */
+    int                   originalFileDescriptor;               /**< C-runtime duplicate of the original standard stream */
+    OVERLAPPED            overlapped;                           /**< read of the reactor, readable pipe end is a named
+                                                                     pipe opened for overlapped I/O                      */
+    int                   isReadPending;                        /**< reactor waits for the read to complete or start     */
+    int                   isRegistered;                         /**< pipe is read by the reactor (reactor lock)          */
+    int                   isUnregisterRequested;                /**< reactor drains pipe and drops it (reactor lock)     */
+    struct STDREDIRECT_REDIRECTION* nextRegistered;             /**< next redirection read by the reactor                */
+    int                   isEndOfFile;                          /**< pipe reached end of file                            */
+    int                   isExitPolled;                         /**< reactor polls for the exit of the child, no wait    */
+#else
+    int                   originalFileDescriptor;               /**< duplicate of the original standard stream           */
+    int                   readablePipeEnd;                      /**< readable pipe end (non-blocking)                    */
+    int                   writablePipeEnd;                      /**< writable pipe end                                   */
+    int                   exitPipeReadEnd;                      /**< readable end of pipe signalling thread to exit      */
+    int                   exitPipeWriteEnd;                     /**< writable end of pipe signalling thread to exit      */
+    int                   teePipeReadEnd;                       /**< readable end of pipe splicing duplicated output     */
+    int                   teePipeWriteEnd;                      /**< writable end of pipe splicing duplicated output     */
+    pthread_t             thread;                               /**< pipe reader thread                                  */
+    int                   isThreadRunning;                      /**< pipe reader thread was started and not yet joined   */
+    int                   isRegistered;                         /**< pipe is read by the reactor (reactor lock)          */
+    int                   isUnregisterRequested;                /**< reactor drains pipe and drops it (reactor lock)     */
+    struct STDREDIRECT_REDIRECTION* nextRegistered;             /**< next redirection read by the reactor                */
+    int                   isEndOfFile;                          /**< pipe reached end of file, child processes only      */
+    int                   isExitPolled;                         /**< reactor polls for the exit of the child, no pidfd   */
+    int                   commitPipeReadEnd;                    /**< readable end of pipe waking the pipe reader for
+                                                                     published lines (non-blocking)                      */
+    int                   commitPipeWriteEnd;                   /**< writable end of that pipe (non-blocking)            */
+#endif /* _WIN32 */
+    struct STDREDIRECT_PROCESS* process;                        /**< child process whose stream is read, NULL for a
+                                                                     standard stream of this process                     */
+    char*                 buffer;                               /**< pipe reader buffer, allocated on creation, resized
+                                                                     by the pipe reader in adaptive mode                 */
     size_t                bufferSize;                           /**< pipe reader buffer size                             */
+    size_t                minBufferSize;                        /**< initial pipe reader buffer size                     */
+    size_t                maxBufferSize;                        /**< largest pipe reader buffer size, the size of the
+                                                                     buffers taking chunks from it                       */
+    size_t                pipeSize;                             /**< current pipe capacity, 0 if unknown                 */
+    size_t                minPipeSize;                          /**< pipe capacity requested on redirect                 */
+    size_t                maxPipeSize;                          /**< largest pipe capacity                               */
+    int                   isAdaptive;                           /**< adapt pipe and buffer size to bursts                */
+    size_t                windowBurst;                          /**< largest burst since adaptDeadline was set           */
+    long long             adaptDeadline;                        /**< STDREDIRECT_now() at which sizes may shrink         */
+    char*                 lineBuffer;                           /**< partial line carried across reads (line framing)    */
+    size_t                lineLength;                           /**< length of partial line                              */
+    size_t                maxLineLength;                        /**< line buffer size                                    */
+    STDREDIRECT_RING      ring;                                 /**< pipe reader to dispatcher ring (asynchronous mode)  */
+    STDREDIRECT_FULL_POLICY fullPolicy;                         /**< full ring policy                                    */
+#ifdef _WIN32
+    HANDLE                spillFile;                            /**< spill file, deleted on close                        */
+#else
+    int                   spillFileDescriptor;                  /**< spill file, unlinked on creation                    */
+#endif /* _WIN32 */
+    long long             spillQuota;                           /**< spill file size cap                                 */
+    int                   isSpilling;                           /**< chunks go to the spill file until it is replayed,
+                                                                     pipe reader only                                    */
+    STDREDIRECT_ATOMIC    spillHead;                            /**< end of last spilled record, written by producer     */
+    STDREDIRECT_ATOMIC    spillTail;                            /**< start of oldest spilled record not yet replayed,
+                                                                     advanced by dispatcher, producer resets (waitLock)  */
+    char*                 dispatchBuffer;                       /**< record taken from ring by dispatcher                */
+    STDREDIRECT_THREAD    dispatchThread;                       /**< dispatcher thread                                   */
+    int                   isDispatcherRunning;                  /**< dispatcher thread was started and not yet joined    */
+    STDREDIRECT_MUTEX     waitLock;                             /**< protects sleeping on waitCondition and restarting
+                                                                     the spill file                                      */
+    STDREDIRECT_CONDITION waitCondition;                        /**< wakes a sleeping pipe reader or dispatcher          */
+    STDREDIRECT_ATOMIC    isDispatcherWaiting;                  /**< dispatcher sleeps until ring is non-empty           */
+    STDREDIRECT_ATOMIC    isReaderWaiting;                      /**< pipe reader sleeps until ring has room              */
+    STDREDIRECT_ATOMIC    isDispatcherExitRequested;            /**< dispatcher drains ring and exits                    */
+    STDREDIRECT_ATOMIC    isFlushRequested;                     /**< dispatcher drains ring, then delivers partial line,
+                                                                     summary and batch, see STDREDIRECT_flushAll()       */
+    STDREDIRECT_BATCH_CALLBACK batchCallback;                   /**< batch callback                                      */
+    char*                 batchBuffer;                          /**< pending batch bytes                                 */
+    size_t                batchLength;                          /**< number of pending batch bytes                       */
+    size_t                batchSize;                            /**< pending bytes that trigger delivery                 */
+    STDREDIRECT_SEGMENT*  batchSegments;                        /**< pending batch segments                              */
+    size_t                batchCount;                           /**< number of pending batch segments                    */
+    size_t                batchMaxSegments;                     /**< pending segments that trigger delivery              */
+    long long             batchDelayUs;                         /**< delay after first pending byte that triggers delivery */
+    long long             batchDeadline;                        /**< STDREDIRECT_now() at which pending batch is due     */
+    STDREDIRECT_STATS     stats;                                /**< counters, each written by one thread at a time      */
+    long long             redirectedTimeUs;                     /**< time redirected before the current redirection      */
+    long long             redirectedSince;                      /**< STDREDIRECT_now() of redirect, -1 if not redirected */
+    STDREDIRECT_STATS_CALLBACK statsCallback;                   /**< statistics callback                                 */
+    long long             statsIntervalUs;                      /**< statistics callback interval                        */
+    long long             statsDeadline;                        /**< STDREDIRECT_now() at which next snapshot is due     */
+    STDREDIRECT_MUTEX     injectLock;                           /**< serializes passing chunks on between the pipe reader
+                                                                     and STDREDIRECT_inject()                            */
+    int                   isInjectable;                         /**< STDREDIRECT_inject() is accepted (injectLock)       */
+    STDREDIRECT_THREAD_QUEUE* threadQueues;                     /**< STDREDIRECT_THREAD_QUEUES queues of
+                                                                     STDREDIRECT_threadWrite(), NULL until first used
+                                                                     (injectLock)                                        */
+    STDREDIRECT_ATOMIC    isQueueing;                           /**< threads may publish to threadQueues                 */
+    STDREDIRECT_ATOMIC    isCommitPending;                      /**< pipe reader was woken for published lines           */
+    int                   isPersistent;                         /**< park on unredirect instead of releasing             */
+    int                   isParked;                             /**< not redirected, pipe and threads kept               */
+    int                   isStrippingEscapes;                   /**< remove escape sequences before framing              */
+    STDREDIRECT_ESCAPE_STATE escapeState;                       /**< escape sequence state at the end of the last chunk  */
+    int                   isUtf8;                               /**< pass on complete UTF-8 code points only             */
+    STDREDIRECT_INVALID_UTF8 invalidUtf8;                       /**< handling of invalid UTF-8                           */
+    char                  utf8Tail[5];                          /**< code point cut off at the end of the last chunk,
+                                                                     room for the null-character                         */
+    size_t                utf8TailLength;                       /**< number of bytes of that code point, 0 if none       */
+    STDREDIRECT_UTF16_CALLBACK utf16Callback;                   /**< output callback (UTF-16)                            */
+    unsigned short*       utf16Buffer;                          /**< transcoded data, STDREDIRECT_UTF16_BUFFER_LENGTH
+                                                                     code units and the null-character                   */
+    int                   isCollapsing;                         /**< collapse consecutive identical lines                */
+    unsigned long long    lastHash;                             /**< hash of the last line passed on                     */
+    size_t                lastLength;                           /**< length of the last line passed on, 0 if none        */
+    long long             repeats;                              /**< repeats of the last line not yet summarized         */
+    size_t                rateLimit;                            /**< bytes per second passed on, 0 if unlimited          */
+    double                rateBurst;                            /**< token bucket size in bytes                          */
+    double                tokens;                               /**< bytes that may be passed on right away              */
+    long long             refilledAt;                           /**< STDREDIRECT_now() of the last token bucket refill   */
+    long long             limitedLines;                         /**< lines suppressed by the rate limit, not yet
+                                                                     summarized                                          */
+    long long             limitedBytes;                         /**< bytes of these lines                                */
+    long long             summaryDeadline;                      /**< STDREDIRECT_now() at which suppressed lines are
+                                                                     summarized                                          */
     /*@}*/
 
 } STDREDIRECT_REDIRECTION;
 
 
+#ifdef STDREDIRECT_EPOLL
+/** @brief Shared pipe reader of all redirections in ::STDREDIRECT_READER_MODE_SHARED.
+ *
+ *  Started on first use and kept running. Other threads only add redirections at the head of the registered list,
+ *  the reactor thread is the only one removing them, so it can walk the list without holding the lock.
+ */
+typedef struct STDREDIRECT_REACTOR {
+    int                       epollFileDescriptor;  /**< waits on wakeFileDescriptor and all registered pipes           */
+    int                       wakeFileDescriptor;   /**< eventfd waking the reactor thread                                */
+    pthread_t                 thread;               /**< reactor thread                                                   */
+    int                       isRunning;            /**< reactor thread was started                                       */
+    pthread_mutex_t           lock;                 /**< protects registered list and registration flags                  */
+    pthread_cond_t            condition;            /**< signals completed unregistrations                                */
+    STDREDIRECT_REDIRECTION*  registered;           /**< registered redirections, linked by nextRegistered                */
+} STDREDIRECT_REACTOR;
+
+
+/** @brief Shared pipe reader. */
+static STDREDIRECT_REACTOR STDREDIRECT_reactor = { -1, -1, 0, FALSE, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL };
+#endif /* STDREDIRECT_EPOLL */
+
+
+#ifdef STDREDIRECT_IOCP
+/** @brief Shared pipe reader of all redirections in ::STDREDIRECT_READER_MODE_SHARED.
+ *
+ *  Started on first use and kept running. The completion key of a pipe is its redirection, a packet without
+ *  OVERLAPPED asks the reactor thread to start reading a newly registered pipe, or reports the exit of the child
+ *  process once the pipe reached end of file, and one without key wakes it. Other threads only add redirections at
+ *  the head of the registered list, the reactor thread is the only one removing them, so it can walk the list without
+ *  holding the lock.
+ */
+typedef struct STDREDIRECT_REACTOR {
+    HANDLE                    completionPort;       /**< completes the reads of all registered pipes                      */
+    int                       isRunning;            /**< reactor thread was started                                       */
+    SRWLOCK                   lock;                 /**< protects registered list and registration flags                  */
+    CONDITION_VARIABLE        condition;            /**< signals completed unregistrations                                */
+    STDREDIRECT_REDIRECTION*  registered;           /**< registered redirections, linked by nextRegistered                */
+} STDREDIRECT_REACTOR;
+
+
+/** @brief Shared pipe reader. */
+static STDREDIRECT_REACTOR STDREDIRECT_reactor = { NULL, FALSE, SRWLOCK_INIT, CONDITION_VARIABLE_INIT, NULL };
+
+
+/** @brief Number of named pipes created for the shared reader, makes their names unique in the process. */
+static STDREDIRECT_ATOMIC STDREDIRECT_lastPipeId;
+#endif /* STDREDIRECT_IOCP */
+
+
+/** @brief Function pointer to exit callback function of a child process.
+ *
+ *  Called once after the child exited and everything it wrote to its captured streams was passed on. @p exitCode is
+ *  the exit code, minus the signal number if the child was killed by a signal (POSIX) or
+ *  STDREDIRECT_EXIT_CODE_UNKNOWN.
+ */
+typedef void (*STDREDIRECT_EXIT_CALLBACK)(struct STDREDIRECT_PROCESS* process, int exitCode, void* userdata);
+
+
+/** @brief Child process whose stdout and stderr are read by redirections.
+ *
+ *  Use STDREDIRECT_spawn() to create one.
+ */
+typedef struct STDREDIRECT_PROCESS {
+    /** @name State
+     *  Use the these variables to check the state of the process. Read only!
+     */
+    /*@{*/
+    STDREDIRECT_REDIRECTION* redirections[2];   /**< [read] redirections of stdout and stderr, NULL if inherited */
+    /*@}*/
+
+    /** @name Internal
+     *  DO NOT CHANGE THESE VARIABLES AT RUNTIME!
+     */
+    /*@{*/
+    STDREDIRECT_EXIT_CALLBACK exitCallback;     /**< exit callback                                              */
+    void*                 userdata;             /**< passed to exitCallback                                     */
+#ifdef _WIN32
+    HANDLE                processHandle;        /**< child process, NULL if not started                         */
+    HANDLE                waitHandle;           /**< thread pool wait posting the exit to the reactor between
+                                                     end of file and exit, NULL if none                         */
+#else
+    pid_t                 pid;                  /**< child process, -1 if not started                           */
+    int                   pidFileDescriptor;    /**< pidfd the reactor waits on between end of file and exit, -1
+                                                     if none                                                    */
+#endif /* _WIN32 */
+    STDREDIRECT_ATOMIC    numOpenStreams;       /**< captured streams not at end of file yet                    */
+    int                   exitCode;             /**< exit code passed to exitCallback (lock)                    */
+    int                   isExited;             /**< exitCallback returned (lock)                               */
+    STDREDIRECT_MUTEX     lock;                 /**< protects exit state                                        */
+    STDREDIRECT_CONDITION exitCondition;        /**< signals isExited                                           */
+    /*@}*/
+
+} STDREDIRECT_PROCESS;
+
+
+/** @brief Global sequence number, incremented for every chunk read from any pipe. */
+static STDREDIRECT_ATOMIC STDREDIRECT_globalSequence;
+
+
+/** @brief STDREDIRECT_REDIRECTION::id of the redirection created last. */
+static STDREDIRECT_ATOMIC STDREDIRECT_lastRedirectionId;
+
+
+#ifndef _WIN32
+/** @brief Duplicate of stdout taken by its first redirect, written to by STDREDIRECT_printToConsole(), -1 until then. */
+static STDREDIRECT_ATOMIC STDREDIRECT_consoleFileDescriptor = -1;
+#endif /* _WIN32 */
+
+
+/** @brief Output of one thread to one stream, collected until a line is complete. */
+typedef struct STDREDIRECT_THREAD_BUFFER {
+    char                     data[STDREDIRECT_INJECT_BUFFER_SIZE]; /**< partial line                                     */
+    size_t                   length;                               /**< number of collected bytes                        */
+    STDREDIRECT_REDIRECTION* redirection;                          /**< redirection the partial line is written to       */
+    STDREDIRECT_THREAD_QUEUE* queue;                               /**< queue lines are published to, NULL until the
+                                                                        first commit                                  */
+    long long                queueRedirectionId;                   /**< STDREDIRECT_REDIRECTION::id of its owner         */
+} STDREDIRECT_THREAD_BUFFER;
+
+
+/** @brief Per-thread buffers of STDREDIRECT_threadWrite(), indexed by ::STDREDIRECT_STREAM. */
+static STDREDIRECT_THREAD_LOCAL STDREDIRECT_THREAD_BUFFER STDREDIRECT_threadBuffers[2];
+
+
+/** @brief STDREDIRECT_threadId() of the calling thread, 0 until first asked for. */
+static STDREDIRECT_THREAD_LOCAL long long STDREDIRECT_cachedThreadId;
+
+
+/** @brief Number of callbacks the calling thread is in, their writes to an interposed stream bypass it. */
+static STDREDIRECT_THREAD_LOCAL int STDREDIRECT_callbackDepth;
+
+
 /** @brief Default stdout redirection object. */
 static STDREDIRECT_REDIRECTION* STDREDIRECT_stdoutRedirection;       
 /** @brief Default stderr redirection object. */
@@ -138,6 +848,8 @@ static STDREDIRECT_REDIRECTION* STDREDIRECT_stderrRedirection;
 /* forward declarations */
 
 static STDREDIRECT_REDIRECTION* STDREDIRECT_create(STDREDIRECT_STREAM stream, STDREDIRECT_CALLBACK callback, STDREDIRECT_BEHAVIOUR redirectionBehaviour);
+static STDREDIRECT_REDIRECTION* STDREDIRECT_createWithOptions(STDREDIRECT_STREAM stream, const STDREDIRECT_OPTIONS* options);
+static STDREDIRECT_OPTIONS      STDREDIRECT_defaultOptions();
 static STDREDIRECT_ERROR        STDREDIRECT_destroy(STDREDIRECT_REDIRECTION* redirection);
 static STDREDIRECT_ERROR        STDREDIRECT_redirect(STDREDIRECT_REDIRECTION* redirection); 
 static STDREDIRECT_ERROR        STDREDIRECT_redirectStdout(STDREDIRECT_CALLBACK stdoutCallback, STDREDIRECT_BEHAVIOUR redirectionBehaviour);
@@ -148,10 +860,155 @@ static STDREDIRECT_ERROR        STDREDIRECT_redirectAllToDebugger();
 static STDREDIRECT_ERROR        STDREDIRECT_duplicateStdoutToDebugger();
 static STDREDIRECT_ERROR        STDREDIRECT_duplicateStderrToDebugger();
 static STDREDIRECT_ERROR        STDREDIRECT_unredirect(STDREDIRECT_REDIRECTION* redirection);
+static STDREDIRECT_ERROR        STDREDIRECT_release(STDREDIRECT_REDIRECTION* redirection);
 static STDREDIRECT_ERROR        STDREDIRECT_unredirectStdout();
 static STDREDIRECT_ERROR        STDREDIRECT_unredirectStderr();
 static STDREDIRECT_ERROR        STDREDIRECT_unredirectAll();
+static STDREDIRECT_ERROR        STDREDIRECT_getStats(STDREDIRECT_REDIRECTION* redirection, STDREDIRECT_STATS* stats);
+static STDREDIRECT_ERROR        STDREDIRECT_inject(STDREDIRECT_REDIRECTION* redirection, const char* data, size_t length);
+static STDREDIRECT_ERROR        STDREDIRECT_injectFromThread(STDREDIRECT_REDIRECTION* redirection, const char* data, size_t length, long long threadId);
+static STDREDIRECT_ERROR        STDREDIRECT_threadWrite(STDREDIRECT_REDIRECTION* redirection, const char* data, size_t length);
+static int                      STDREDIRECT_threadPrintf(STDREDIRECT_REDIRECTION* redirection, const char* format, ...);
+static STDREDIRECT_ERROR        STDREDIRECT_threadFlush(STDREDIRECT_REDIRECTION* redirection);
+static long long                STDREDIRECT_threadId();
+static STDREDIRECT_ERROR        STDREDIRECT_commit(STDREDIRECT_REDIRECTION* redirection, const char* data, size_t length, long long threadId);
+static size_t                   STDREDIRECT_enqueue(STDREDIRECT_REDIRECTION* redirection, STDREDIRECT_THREAD_BUFFER* buffer, const char* data, size_t length, long long threadId);
+static STDREDIRECT_THREAD_QUEUE* STDREDIRECT_threadQueue(STDREDIRECT_REDIRECTION* redirection, long long threadId);
+static void                     STDREDIRECT_stopQueueing(STDREDIRECT_REDIRECTION* redirection);
+static STDREDIRECT_PROCESS*     STDREDIRECT_spawn(char* const argv[], char* const envp[], const STDREDIRECT_OPTIONS* stdoutOptions, const STDREDIRECT_OPTIONS* stderrOptions, STDREDIRECT_EXIT_CALLBACK exitCallback, void* userdata);
+static STDREDIRECT_ERROR        STDREDIRECT_waitProcess(STDREDIRECT_PROCESS* process, int* exitCode);
+static STDREDIRECT_ERROR        STDREDIRECT_destroyProcess(STDREDIRECT_PROCESS* process);
+static void                     STDREDIRECT_exited(STDREDIRECT_PROCESS* process, int exitCode);
+#ifdef _WIN32
+#ifdef STDREDIRECT_IOCP
+static VOID CALLBACK            STDREDIRECT_exitWaitCallback(PVOID parameter, BOOLEAN isTimedOut);
+#endif /* STDREDIRECT_IOCP */
+static VOID CALLBACK            STDREDIRECT_timeoutTimerCallback(PTP_CALLBACK_INSTANCE instance, PVOID context, PTP_TIMER timer);
+static char*                    STDREDIRECT_buildCommandLine(char* const argv[]);
+static char*                    STDREDIRECT_buildEnvironment(char* const envp[]);
+static HANDLE                   STDREDIRECT_inheritableHandle(HANDLE handle);
+#endif /* _WIN32 */
+static void                     STDREDIRECT_endOfFile(STDREDIRECT_REDIRECTION* redirection);
+static int                      STDREDIRECT_reap(STDREDIRECT_PROCESS* process, int isBlocking, int* exitCode);
+#ifdef _WIN32
 static void WINAPI              STDREDIRECT_bufferedPipeReader(STDREDIRECT_REDIRECTION* redirection);
+static void                     STDREDIRECT_passChunk(STDREDIRECT_REDIRECTION* redirection, DWORD numBytesRead);
+#else
+static void*                    STDREDIRECT_bufferedPipeReader(void* parameter);
+static int                      STDREDIRECT_drain(STDREDIRECT_REDIRECTION* redirection);
+static int                      STDREDIRECT_lockedDrain(STDREDIRECT_REDIRECTION* redirection);
+static int                      STDREDIRECT_snapshotThreadQueues(STDREDIRECT_REDIRECTION* redirection, long long* heads);
+static void                     STDREDIRECT_passThreadLines(STDREDIRECT_REDIRECTION* redirection, const long long* heads);
+static ssize_t                  STDREDIRECT_read(STDREDIRECT_REDIRECTION* redirection);
+#ifdef __linux__
+static void                     STDREDIRECT_splice(STDREDIRECT_REDIRECTION* redirection, size_t length);
+static void                     STDREDIRECT_stopSplicing(STDREDIRECT_REDIRECTION* redirection);
+#endif /* __linux__ */
+static int                      STDREDIRECT_writeAll(int fileDescriptor, const char* data, size_t length);
+#endif /* _WIN32 */
+#ifdef STDREDIRECT_EPOLL
+static void*                    STDREDIRECT_reactorThread(void* parameter);
+static int                      STDREDIRECT_register(STDREDIRECT_REDIRECTION* redirection);
+static void                     STDREDIRECT_unregister(STDREDIRECT_REDIRECTION* redirection);
+static void                     STDREDIRECT_wakeReactor();
+#endif /* STDREDIRECT_EPOLL */
+#ifdef STDREDIRECT_IOCP
+static DWORD WINAPI             STDREDIRECT_reactorThread(LPVOID parameter);
+static int                      STDREDIRECT_register(STDREDIRECT_REDIRECTION* redirection);
+static void                     STDREDIRECT_unregister(STDREDIRECT_REDIRECTION* redirection);
+static void                     STDREDIRECT_wakeReactor();
+static int                      STDREDIRECT_createOverlappedPipe(STDREDIRECT_REDIRECTION* redirection);
+static int                      STDREDIRECT_readOverlapped(STDREDIRECT_REDIRECTION* redirection);
+static int                      STDREDIRECT_completeRead(STDREDIRECT_REDIRECTION* redirection);
+#endif /* STDREDIRECT_IOCP */
+static void                     STDREDIRECT_process(STDREDIRECT_REDIRECTION* redirection, char* data, size_t length);
+static void                     STDREDIRECT_processUtf8(STDREDIRECT_REDIRECTION* redirection, char* data, size_t length);
+static void                     STDREDIRECT_frame(STDREDIRECT_REDIRECTION* redirection, char* data, size_t length);
+static void                     STDREDIRECT_replaceInvalidUtf8(STDREDIRECT_REDIRECTION* redirection);
+static void                     STDREDIRECT_flushUtf8(STDREDIRECT_REDIRECTION* redirection);
+static void                     STDREDIRECT_flush(STDREDIRECT_REDIRECTION* redirection);
+static void                     STDREDIRECT_flushAll(STDREDIRECT_REDIRECTION* redirection);
+static void                     STDREDIRECT_switchThread(STDREDIRECT_REDIRECTION* redirection, long long threadId);
+static void                     STDREDIRECT_deliver(STDREDIRECT_REDIRECTION* redirection, char* data, size_t length);
+static void                     STDREDIRECT_invokeCallbacks(STDREDIRECT_REDIRECTION* redirection, char* data, size_t length);
+static void                     STDREDIRECT_invokeUtf16Callback(STDREDIRECT_REDIRECTION* redirection, const char* data, size_t length);
+static int                      STDREDIRECT_isSuppressed(STDREDIRECT_REDIRECTION* redirection, const char* data, size_t length);
+static void                     STDREDIRECT_summarize(STDREDIRECT_REDIRECTION* redirection);
+static void                     STDREDIRECT_summarizeRepeats(STDREDIRECT_REDIRECTION* redirection);
+static void                     STDREDIRECT_summarizeRateLimit(STDREDIRECT_REDIRECTION* redirection);
+static void                     STDREDIRECT_flushExpiredSummary(STDREDIRECT_REDIRECTION* redirection);
+static long long                STDREDIRECT_summaryTimeout(STDREDIRECT_REDIRECTION* redirection);
+static unsigned long long       STDREDIRECT_hash(const char* data, size_t length);
+static void                     STDREDIRECT_appendToBatch(STDREDIRECT_REDIRECTION* redirection, const char* data, size_t length);
+static void                     STDREDIRECT_flushBatch(STDREDIRECT_REDIRECTION* redirection);
+static void                     STDREDIRECT_flushExpiredBatch(STDREDIRECT_REDIRECTION* redirection);
+static long long                STDREDIRECT_batchTimeout(STDREDIRECT_REDIRECTION* redirection);
+static long long                STDREDIRECT_nextTimeout(STDREDIRECT_REDIRECTION* redirection);
+static void                     STDREDIRECT_handleTimeouts(STDREDIRECT_REDIRECTION* redirection);
+static void                     STDREDIRECT_reportStats(STDREDIRECT_REDIRECTION* redirection);
+static void                     STDREDIRECT_countChunk(STDREDIRECT_REDIRECTION* redirection, size_t length);
+static void                     STDREDIRECT_countCallback(STDREDIRECT_REDIRECTION* redirection, long long start);
+static void                     STDREDIRECT_adapt(STDREDIRECT_REDIRECTION* redirection, size_t burst);
+static void                     STDREDIRECT_resizePipe(STDREDIRECT_REDIRECTION* redirection, size_t pipeSize);
+static void                     STDREDIRECT_resizeBuffer(STDREDIRECT_REDIRECTION* redirection, size_t bufferSize);
+static long long                STDREDIRECT_statLoad(long long* counter);
+static void                     STDREDIRECT_statStore(long long* counter, long long value);
+static void                     STDREDIRECT_statAdd(long long* counter, long long value);
+static long long                STDREDIRECT_now();
+static const char*              STDREDIRECT_findByte(const char* data, size_t length, char byte);
+static size_t                   STDREDIRECT_stripEscapes(STDREDIRECT_ESCAPE_STATE* state, char* data, size_t length);
+static size_t                   STDREDIRECT_skipAscii(const char* data, size_t length);
+static int                      STDREDIRECT_utf8SequenceLength(const unsigned char* data, size_t length);
+static size_t                   STDREDIRECT_validUtf8Length(const char* data, size_t length);
+static size_t                   STDREDIRECT_utf8ToUtf16(const char* data, size_t length, unsigned short* utf16);
+static size_t                   STDREDIRECT_validUtf8ToUtf16(const char* data, size_t length, unsigned short* utf16);
+static size_t                   STDREDIRECT_widenAscii(const char* data, size_t length, unsigned short* utf16);
+static size_t                   STDREDIRECT_decodeUtf8Sequence(const unsigned char* data, unsigned short* utf16, size_t* numUnits);
+#if defined (STDREDIRECT_AVX2) || defined (STDREDIRECT_AVX2_RUNTIME)
+static STDREDIRECT_TARGET_AVX2 size_t       STDREDIRECT_validUtf8Blocks(const char* data, size_t length);
+static STDREDIRECT_TARGET_AVX2 __m256i      STDREDIRECT_utf8Errors(__m256i input, __m256i previous);
+static STDREDIRECT_TARGET_AVX2 size_t       STDREDIRECT_utf8ToUtf16Blocks(const char* data, size_t length, unsigned short* utf16, size_t* numUnits);
+static STDREDIRECT_TARGET_AVX2 void         STDREDIRECT_decodeUtf16Lanes(__m256i first, __m256i second, __m256i third, __m256i lanes[2]);
+static STDREDIRECT_TARGET_AVX2 size_t       STDREDIRECT_packUtf16Lanes(__m256i lanes, unsigned int mask, unsigned short* utf16);
+static STDREDIRECT_TARGET_AVX2 unsigned int STDREDIRECT_countBits(unsigned int mask);
+#endif
+#if defined (STDREDIRECT_AVX2_RUNTIME)
+static int                      STDREDIRECT_hasAvx2();
+#endif
+static const char*              STDREDIRECT_findLastByte(const char* data, size_t length, char byte);
+static unsigned int             STDREDIRECT_countTrailingZeros(unsigned int mask);
+static void                     STDREDIRECT_push(STDREDIRECT_REDIRECTION* redirection, const char* data, size_t length, long long globalSequence, long long timestamp, long long threadId);
+static void                     STDREDIRECT_spill(STDREDIRECT_REDIRECTION* redirection, const STDREDIRECT_RING_RECORD* record, const char* data);
+static int                      STDREDIRECT_takeSpilled(STDREDIRECT_REDIRECTION* redirection, STDREDIRECT_RING_RECORD* record);
+static int                      STDREDIRECT_openSpillFile(STDREDIRECT_REDIRECTION* redirection, const char* directory);
+static void                     STDREDIRECT_closeSpillFile(STDREDIRECT_REDIRECTION* redirection);
+static int                      STDREDIRECT_truncateSpillFile(STDREDIRECT_REDIRECTION* redirection);
+static int                      STDREDIRECT_writeSpillFile(STDREDIRECT_REDIRECTION* redirection, long long position, const void* data, size_t length);
+static int                      STDREDIRECT_readSpillFile(STDREDIRECT_REDIRECTION* redirection, long long position, void* data, size_t length);
+static STDREDIRECT_THREAD_RESULT STDREDIRECT_dispatcher(void* parameter);
+static STDREDIRECT_ERROR        STDREDIRECT_startDispatcher(STDREDIRECT_REDIRECTION* redirection);
+static STDREDIRECT_ERROR        STDREDIRECT_stopDispatcher(STDREDIRECT_REDIRECTION* redirection);
+static void                     STDREDIRECT_flushDispatcher(STDREDIRECT_REDIRECTION* redirection);
+static void                     STDREDIRECT_wake(STDREDIRECT_REDIRECTION* redirection, STDREDIRECT_ATOMIC* isWaiting);
+static void                     STDREDIRECT_ringCopyIn(STDREDIRECT_RING* ring, long long position, const void* data, size_t length);
+static void                     STDREDIRECT_ringCopyOut(const STDREDIRECT_RING* ring, long long position, void* data, size_t length);
+static long long                STDREDIRECT_atomicLoad(STDREDIRECT_ATOMIC* value);
+static void                     STDREDIRECT_atomicStore(STDREDIRECT_ATOMIC* value, long long desired);
+static long long                STDREDIRECT_atomicAdd(STDREDIRECT_ATOMIC* value, long long addend);
+static int                      STDREDIRECT_atomicCompareExchange(STDREDIRECT_ATOMIC* value, long long expected, long long desired);
+static void                     STDREDIRECT_acquireFence();
+static int                      STDREDIRECT_startThread(STDREDIRECT_THREAD* thread, STDREDIRECT_THREAD_ROUTINE routine, void* parameter);
+static int                      STDREDIRECT_joinThread(STDREDIRECT_THREAD thread);
+static void                     STDREDIRECT_yield();
+static void                     STDREDIRECT_initMutex(STDREDIRECT_MUTEX* mutex);
+static void                     STDREDIRECT_destroyMutex(STDREDIRECT_MUTEX* mutex);
+static void                     STDREDIRECT_lock(STDREDIRECT_MUTEX* mutex);
+static void                     STDREDIRECT_unlock(STDREDIRECT_MUTEX* mutex);
+static void                     STDREDIRECT_initCondition(STDREDIRECT_CONDITION* condition);
+static void                     STDREDIRECT_destroyCondition(STDREDIRECT_CONDITION* condition);
+static void                     STDREDIRECT_wait(STDREDIRECT_CONDITION* condition, STDREDIRECT_MUTEX* mutex);
+static void                     STDREDIRECT_timedWait(STDREDIRECT_CONDITION* condition, STDREDIRECT_MUTEX* mutex, long long timeoutUs);
+static void                     STDREDIRECT_broadcast(STDREDIRECT_CONDITION* condition);
 static void                     STDREDIRECT_debuggerCallback(const char* str);
 static int                      STDREDIRECT_printToConsole(const char* format, ...);
 
@@ -164,32 +1021,305 @@ static int                      STDREDIRECT_printToConsole(const char* format, .
  * @return Pointer to allocated redirection object, NULL on error.
  */
 static STDREDIRECT_REDIRECTION* STDREDIRECT_create(STDREDIRECT_STREAM stream, STDREDIRECT_CALLBACK callback, STDREDIRECT_BEHAVIOUR redirectionBehaviour) {
-    STDREDIRECT_REDIRECTION* redirection = (STDREDIRECT_REDIRECTION*) malloc(sizeof(STDREDIRECT_REDIRECTION));
+    STDREDIRECT_REDIRECTION* redirection;
+    STDREDIRECT_OPTIONS      options = STDREDIRECT_defaultOptions();
+
+    options.behaviour = redirectionBehaviour;
+
+    redirection = STDREDIRECT_createWithOptions(stream, &options);
+    if (redirection) {
+        redirection->callback = callback;
+    }
+
+    return redirection;
+}
+
+
+/**
+ * @brief Allocate redirection object with options.
+ *
+ * The pipe reader buffer is allocated here and reused for every read.
+ *
+ * @param stream Stream to redirect.
+ * @param options Redirection options, see STDREDIRECT_defaultOptions().
+ * @return Pointer to allocated redirection object, NULL on error.
+ */
+static STDREDIRECT_REDIRECTION* STDREDIRECT_createWithOptions(STDREDIRECT_STREAM stream, const STDREDIRECT_OPTIONS* options) {
+    STDREDIRECT_REDIRECTION* redirection;
+    size_t                   maxBufferSize;
+
+    if (!options || options->bufferSize == 0 || (options->framing == STDREDIRECT_FRAMING_LINE && options->maxLineLength == 0)) {
+        return NULL;
+    }
+    if (options->batchCallback && (options->batchSize == 0 || options->batchMaxSegments == 0)) {
+        return NULL;
+    }
+    if (options->statsCallback && options->statsIntervalUs <= 0) {
+        return NULL;
+    }
+
+    /* chunks never exceed the largest pipe reader buffer, everything taking chunks from it is sized for that */
+    maxBufferSize = options->isAdaptive && options->maxBufferSize > options->bufferSize ? options->maxBufferSize : options->bufferSize;
+
+    redirection = (STDREDIRECT_REDIRECTION*) malloc(sizeof(STDREDIRECT_REDIRECTION));
     if (!redirection) {
         return NULL;
     }
 
+    /* one extra byte for the string-terminating null-character passed to STDREDIRECT_CALLBACK */
+    redirection->buffer = (char*) malloc(options->bufferSize + 1);
+    if (!redirection->buffer) {
+        free(redirection);
+        return NULL;
+    }
+
+    redirection->lineBuffer = NULL;
+    if (options->framing == STDREDIRECT_FRAMING_LINE) {
+        redirection->lineBuffer = (char*) malloc(options->maxLineLength + 1);
+        if (!redirection->lineBuffer) {
+            free(redirection->buffer);
+            free(redirection);
+            return NULL;
+        }
+    }
+
+    /* asynchronous mode: ring must hold at least one full read, dispatcher takes records into a buffer of its own */
+    redirection->ring.data = NULL;
+    redirection->ring.capacity = 0;
+    redirection->dispatchBuffer = NULL;
+    if (options->ringCapacity > 0) {
+        redirection->ring.capacity = 1;
+        while (redirection->ring.capacity < options->ringCapacity || redirection->ring.capacity < maxBufferSize + sizeof(STDREDIRECT_RING_RECORD)) {
+            redirection->ring.capacity *= 2;
+        }
+        redirection->ring.data = (char*) malloc(redirection->ring.capacity);
+        redirection->dispatchBuffer = (char*) malloc(maxBufferSize + 1);
+        if (!redirection->ring.data || !redirection->dispatchBuffer) {
+            free(redirection->ring.data);
+            free(redirection->dispatchBuffer);
+            free(redirection->lineBuffer);
+            free(redirection->buffer);
+            free(redirection);
+            return NULL;
+        }
+        STDREDIRECT_initMutex(&redirection->waitLock);
+        STDREDIRECT_initCondition(&redirection->waitCondition);
+    }
+
+    /* batch buffer holds up to batchSize bytes plus the largest chunk or line that completes the batch */
+    redirection->batchBuffer = NULL;
+    redirection->batchSegments = NULL;
+    if (options->batchCallback) {
+        redirection->batchBuffer = (char*) malloc(options->batchSize + (maxBufferSize > options->maxLineLength ? maxBufferSize : options->maxLineLength));
+        redirection->batchSegments = (STDREDIRECT_SEGMENT*) malloc(options->batchMaxSegments * sizeof(STDREDIRECT_SEGMENT));
+        if (!redirection->batchBuffer || !redirection->batchSegments) {
+            free(redirection->batchBuffer);
+            free(redirection->batchSegments);
+            if (redirection->ring.data) {
+                free(redirection->ring.data);
+                free(redirection->dispatchBuffer);
+                STDREDIRECT_destroyCondition(&redirection->waitCondition);
+                STDREDIRECT_destroyMutex(&redirection->waitLock);
+            }
+            free(redirection->lineBuffer);
+            free(redirection->buffer);
+            free(redirection);
+            return NULL;
+        }
+    }
+
     redirection->stream                            = stream;
-    redirection->callback                          = callback;
-    redirection->behaviour                         = redirectionBehaviour;
+    redirection->callback                          = NULL;
+    redirection->dataCallback                      = options->dataCallback;
+    redirection->userdata                          = options->userdata;
+    redirection->behaviour                         = options->behaviour;
+    redirection->recordCallback                    = options->recordCallback;
+    redirection->sequence                          = 0;
+    redirection->globalSequence                    = 0;
+    redirection->timestamp                         = 0;
+    redirection->threadId                          = 0;
+    redirection->id                                = STDREDIRECT_atomicAdd(&STDREDIRECT_lastRedirectionId, 1);
                                                    
     redirection->isRedirected                      = FALSE;
     redirection->isValid                           = FALSE;
     redirection->error                             = STDREDIRECT_ERROR_NO_ERROR;
                                                    
+#ifdef _WIN32
     redirection->stdHandle                         = NULL;
     redirection->readablePipeEnd                   = NULL;
     redirection->writablePipeEnd                   = NULL;
     redirection->writablePipeEndFileDescriptor     = -1;
     redirection->thread                            = NULL;
     redirection->exitThreadEvent                   = NULL;
-    redirection->buffer                            = NULL;
-    redirection->bufferSize                        = STDREDIRECT_BUFFER_SIZE;
+    redirection->timeoutTimer                      = NULL;
+    redirection->isReading                         = FALSE;
+    redirection->originalFileDescriptor            = -1;
+    redirection->isReadPending                     = FALSE;
+    redirection->isRegistered                      = FALSE;
+    redirection->isUnregisterRequested             = FALSE;
+    redirection->nextRegistered                    = NULL;
+    redirection->isEndOfFile                       = FALSE;
+    redirection->isExitPolled                      = FALSE;
+#else
+    redirection->originalFileDescriptor            = -1;
+    redirection->readablePipeEnd                   = -1;
+    redirection->writablePipeEnd                   = -1;
+    redirection->exitPipeReadEnd                   = -1;
+    redirection->exitPipeWriteEnd                  = -1;
+    redirection->teePipeReadEnd                    = -1;
+    redirection->teePipeWriteEnd                   = -1;
+    redirection->isThreadRunning                   = FALSE;
+    redirection->isRegistered                      = FALSE;
+    redirection->isUnregisterRequested             = FALSE;
+    redirection->nextRegistered                    = NULL;
+    redirection->isEndOfFile                       = FALSE;
+    redirection->isExitPolled                      = FALSE;
+    redirection->commitPipeReadEnd                 = -1;
+    redirection->commitPipeWriteEnd                = -1;
+#endif /* _WIN32 */
+    redirection->process                           = NULL;
+#ifdef STDREDIRECT_SHARED_READER
+    redirection->readerMode                        = options->readerMode;
+#else
+    redirection->readerMode                        = STDREDIRECT_READER_MODE_DEDICATED;
+#endif /* STDREDIRECT_SHARED_READER */
+    redirection->bufferSize                        = options->bufferSize;
+    redirection->minBufferSize                     = options->bufferSize;
+    redirection->maxBufferSize                     = maxBufferSize;
+    redirection->pipeSize                          = 0;
+    redirection->minPipeSize                       = options->pipeSize;
+    redirection->maxPipeSize                       = options->isAdaptive && options->maxPipeSize > options->pipeSize ? options->maxPipeSize : options->pipeSize;
+    redirection->isAdaptive                        = options->isAdaptive;
+    redirection->windowBurst                       = 0;
+    redirection->adaptDeadline                     = 0;
+    redirection->framing                           = options->framing;
+    redirection->lineLength                        = 0;
+    redirection->maxLineLength                     = options->maxLineLength;
+    redirection->ring.head                         = 0;
+    redirection->ring.tail                         = 0;
+    redirection->fullPolicy                        = options->fullPolicy;
+#ifdef _WIN32
+    redirection->spillFile                         = INVALID_HANDLE_VALUE;
+#else
+    redirection->spillFileDescriptor               = -1;
+#endif /* _WIN32 */
+    redirection->spillQuota                        = options->spillQuota;
+    redirection->isSpilling                        = FALSE;
+    redirection->spillHead                         = 0;
+    redirection->spillTail                         = 0;
+    redirection->isDispatcherRunning               = FALSE;
+    redirection->isDispatcherWaiting               = FALSE;
+    redirection->isReaderWaiting                   = FALSE;
+    redirection->isDispatcherExitRequested         = FALSE;
+    redirection->isFlushRequested                  = FALSE;
+    redirection->droppedChunks                     = 0;
+    redirection->droppedBytes                      = 0;
+    redirection->batchCallback                     = options->batchCallback;
+    redirection->batchLength                       = 0;
+    redirection->batchSize                         = options->batchSize;
+    redirection->batchCount                        = 0;
+    redirection->batchMaxSegments                  = options->batchMaxSegments;
+    redirection->batchDelayUs                      = options->batchDelayUs;
+    redirection->batchDeadline                     = 0;
+    redirection->redirectedTimeUs                  = 0;
+    redirection->redirectedSince                   = -1;
+    redirection->statsCallback                     = options->statsCallback;
+    redirection->statsIntervalUs                   = options->statsIntervalUs;
+    redirection->statsDeadline                     = 0;
+    redirection->isInjectable                      = FALSE;
+    redirection->threadQueues                      = NULL;
+    redirection->isQueueing                        = FALSE;
+    redirection->isCommitPending                   = FALSE;
+#ifdef _WIN32
+    redirection->isPersistent                      = FALSE;
+#else
+    redirection->isPersistent                      = options->isPersistent;
+#endif /* _WIN32 */
+    redirection->isParked                          = FALSE;
+    redirection->isStrippingEscapes                = options->isStrippingEscapes;
+    redirection->escapeState                       = STDREDIRECT_ESCAPE_STATE_TEXT;
+    redirection->isUtf8                            = options->isUtf8 || options->utf16Callback;
+    redirection->invalidUtf8                       = options->invalidUtf8;
+    redirection->utf8TailLength                    = 0;
+    redirection->utf16Callback                     = options->utf16Callback;
+    redirection->utf16Buffer                       = NULL;
+    redirection->isCollapsing                      = options->isCollapsing && options->framing == STDREDIRECT_FRAMING_LINE;
+    redirection->lastHash                          = 0;
+    redirection->lastLength                        = 0;
+    redirection->repeats                           = 0;
+    redirection->rateLimit                         = options->rateLimit;
+    redirection->rateBurst                         = (double) (options->rateBurst > 0 ? options->rateBurst : options->rateLimit);
+    redirection->tokens                            = redirection->rateBurst;
+    redirection->refilledAt                        = 0;
+    redirection->limitedLines                      = 0;
+    redirection->limitedBytes                      = 0;
+    redirection->summaryDeadline                   = 0;
+    STDREDIRECT_initMutex(&redirection->injectLock);
+    memset(&redirection->stats, 0, sizeof(redirection->stats));
+    redirection->stats.stream                      = stream;
+    redirection->stats.bufferSize                  = (long long) options->bufferSize;
+
+    /* spill file is created up front, not on the pipe reader thread once the ring is full */
+    if (redirection->ring.data && redirection->fullPolicy == STDREDIRECT_FULL_POLICY_SPILL && STDREDIRECT_openSpillFile(redirection, options->spillDirectory) == -1) {
+        STDREDIRECT_destroy(redirection);
+        return NULL;
+    }
+
+    if (redirection->utf16Callback) {
+        redirection->utf16Buffer = (unsigned short*) malloc((STDREDIRECT_UTF16_BUFFER_LENGTH + 1) * sizeof(unsigned short));
+        if (!redirection->utf16Buffer) {
+            STDREDIRECT_destroy(redirection);
+            return NULL;
+        }
+    }
 
     return redirection;
 }
 
 
+/**
+ * @brief Get default redirection options.
+ *
+ * @return Options with ::STDREDIRECT_BEHAVIOUR_REDIRECT, ::STDREDIRECT_FRAMING_RAW, no callback and a buffer of STDREDIRECT_BUFFER_SIZE bytes.
+ */
+static STDREDIRECT_OPTIONS STDREDIRECT_defaultOptions() {
+    STDREDIRECT_OPTIONS options;
+
+    options.behaviour        = STDREDIRECT_BEHAVIOUR_REDIRECT;
+    options.dataCallback     = NULL;
+    options.userdata         = NULL;
+    options.bufferSize       = STDREDIRECT_BUFFER_SIZE;
+    options.framing          = STDREDIRECT_FRAMING_RAW;
+    options.maxLineLength    = STDREDIRECT_MAX_LINE_LENGTH;
+    options.ringCapacity     = 0;
+    options.fullPolicy       = STDREDIRECT_FULL_POLICY_BLOCK;
+    options.batchCallback    = NULL;
+    options.batchSize        = STDREDIRECT_BATCH_SIZE;
+    options.batchDelayUs     = STDREDIRECT_BATCH_DELAY_US;
+    options.batchMaxSegments = STDREDIRECT_BATCH_MAX_SEGMENTS;
+    options.recordCallback   = NULL;
+    options.readerMode       = STDREDIRECT_READER_MODE_SHARED;
+    options.statsCallback    = NULL;
+    options.statsIntervalUs  = STDREDIRECT_STATS_INTERVAL_US;
+    options.pipeSize         = 0;
+    options.isAdaptive       = FALSE;
+    options.maxPipeSize      = STDREDIRECT_MAX_PIPE_SIZE;
+    options.maxBufferSize    = STDREDIRECT_MAX_BUFFER_SIZE;
+    options.isCollapsing     = FALSE;
+    options.rateLimit        = 0;
+    options.rateBurst        = 0;
+    options.spillQuota       = STDREDIRECT_SPILL_QUOTA;
+    options.spillDirectory   = NULL;
+    options.isPersistent     = FALSE;
+    options.isStrippingEscapes = FALSE;
+    options.isUtf8           = FALSE;
+    options.invalidUtf8      = STDREDIRECT_INVALID_UTF8_REPLACE;
+    options.utf16Callback    = NULL;
+
+    return options;
+}
+
+
 /**
  * @brief Destroy redirection object.
  *
@@ -197,11 +1327,35 @@ static STDREDIRECT_REDIRECTION* STDREDIRECT_create(STDREDIRECT_STREAM stream, ST
  * @return ::STDREDIRECT_ERROR
  */
 static STDREDIRECT_ERROR STDREDIRECT_destroy(STDREDIRECT_REDIRECTION* redirection) {
+    size_t i;
+
     if (redirection) {
         STDREDIRECT_ERROR unredirectError = STDREDIRECT_unredirect(redirection);
-        free(redirection);
-        redirection = NULL;
-
+        if (redirection->isParked && unredirectError == STDREDIRECT_ERROR_NO_ERROR) {
+            unredirectError = STDREDIRECT_release(redirection);
+        }
+        if (redirection->threadQueues) {
+            for (i = 0; i < STDREDIRECT_THREAD_QUEUES; ++i) {
+                free(redirection->threadQueues[i].ring.data);
+            }
+            free(redirection->threadQueues);
+        }
+        free(redirection->buffer);
+        free(redirection->lineBuffer);
+        free(redirection->batchBuffer);
+        free(redirection->batchSegments);
+        free(redirection->utf16Buffer);
+        if (redirection->ring.data) {
+            free(redirection->ring.data);
+            free(redirection->dispatchBuffer);
+            STDREDIRECT_destroyCondition(&redirection->waitCondition);
+            STDREDIRECT_destroyMutex(&redirection->waitLock);
+        }
+        STDREDIRECT_closeSpillFile(redirection);
+        STDREDIRECT_destroyMutex(&redirection->injectLock);
+        free(redirection);
+        redirection = NULL;
+
         return unredirectError;
     }
 
@@ -212,21 +1366,39 @@ static STDREDIRECT_ERROR STDREDIRECT_destroy(STDREDIRECT_REDIRECTION* redirectio
 /** 
  * @brief Redirect standard stream to callback.
  * 
- * Callback is called when pipe buffer is full, see STDREDIRECT_REDIRECTION::bufferSize (defaults to STDREDIRECT_BUFFER_SIZE) 
+ * Callback is called with whatever could be read from the pipe at once, at most STDREDIRECT_REDIRECTION::bufferSize bytes (defaults to STDREDIRECT_BUFFER_SIZE) 
  *
  * @param redirection Pointer to redirection object.
  * @return ::STDREDIRECT_ERROR
  */
+#ifdef _WIN32
 static STDREDIRECT_ERROR STDREDIRECT_redirect(STDREDIRECT_REDIRECTION* redirection) {
     /* unredirect if already redirected */
-    if (redirection->isRedirected && !STDREDIRECT_unredirect(redirection)) {
+    if (redirection->isRedirected && STDREDIRECT_unredirect(redirection) != STDREDIRECT_ERROR_NO_ERROR) {
         goto Error;
     }
 
-    /* create anonymous pipe */
-    if (!CreatePipe(&redirection->readablePipeEnd, &redirection->writablePipeEnd, 0, 0)) {
+    /* start the clock before the pipe reader looks at the statistics deadline */
+    STDREDIRECT_statStore(&redirection->redirectedSince, STDREDIRECT_now());
+    redirection->statsDeadline = redirection->redirectedSince + redirection->statsIntervalUs;
+    redirection->adaptDeadline = redirection->redirectedSince + STDREDIRECT_ADAPT_INTERVAL_US;
+    redirection->windowBurst = 0;
+
+    /* create pipe, its size cannot be changed later, so adaptive mode asks for the cap right away; the shared reader
+       needs a named pipe to read it overlapped, a dedicated reader blocks on an anonymous one */
+    redirection->pipeSize = redirection->isAdaptive ? redirection->maxPipeSize : redirection->minPipeSize;
+#ifdef STDREDIRECT_IOCP
+    if (redirection->readerMode == STDREDIRECT_READER_MODE_SHARED) {
+        if (STDREDIRECT_createOverlappedPipe(redirection) == -1) {
+            goto Error;
+        }
+    }
+    else
+#endif /* STDREDIRECT_IOCP */
+    if (!CreatePipe(&redirection->readablePipeEnd, &redirection->writablePipeEnd, 0, (DWORD) redirection->pipeSize)) {
         goto Error;
     }
+    STDREDIRECT_statStore(&redirection->stats.pipeSize, (long long) redirection->pipeSize);
 
     /* get current handle to selected stream */
     redirection->stdHandle = GetStdHandle(redirection->stream == STDREDIRECT_STREAM_STDOUT ? STD_OUTPUT_HANDLE : STD_ERROR_HANDLE);
@@ -234,35 +1406,255 @@ static STDREDIRECT_ERROR STDREDIRECT_redirect(STDREDIRECT_REDIRECTION* redirecti
         goto Error;
     }
 
-    /* set stream handle to writable pipe end */
-    if (!SetStdHandle(redirection->stream == STDREDIRECT_STREAM_STDOUT ? STD_OUTPUT_HANDLE : STD_ERROR_HANDLE, redirection->writablePipeEnd)) {
+    /* the writable pipe end of a child process is handed to the child by STDREDIRECT_spawn(), the streams of this
+       process stay as they are */
+    if (!redirection->process) {
+        /* set stream handle to writable pipe end */
+        if (!SetStdHandle(redirection->stream == STDREDIRECT_STREAM_STDOUT ? STD_OUTPUT_HANDLE : STD_ERROR_HANDLE, redirection->writablePipeEnd)) {
+            goto Error;
+        }
+
+        /* assign OS handle to C-runtime file descriptor */
+        redirection->writablePipeEndFileDescriptor = _open_osfhandle((intptr_t) redirection->writablePipeEnd, 0);
+        if (redirection->writablePipeEndFileDescriptor == -1) {
+            goto Error;
+        }
+
+        /* keep original standard stream file descriptor, fails if there is none */
+        redirection->originalFileDescriptor = _dup(redirection->stream == STDREDIRECT_STREAM_STDOUT ? _fileno(stdout) : _fileno(stderr));
+
+        /* reassign standard stream file descriptor to writable pipe end */
+        if (_dup2(redirection->writablePipeEndFileDescriptor, redirection->stream == STDREDIRECT_STREAM_STDOUT ? _fileno(stdout) : _fileno(stderr)) == -1) {
+            goto Error;
+        }
+    }
+
+    /* run dispatcher in separate thread */
+    if (STDREDIRECT_startDispatcher(redirection) != STDREDIRECT_ERROR_NO_ERROR) {
         goto Error;
     }
 
-    /* assign OS handle to C-runtime file descriptor */
-    redirection->writablePipeEndFileDescriptor = _open_osfhandle((intptr_t) redirection->writablePipeEnd, 0);
-    if (redirection->writablePipeEndFileDescriptor == -1) {
+#ifdef STDREDIRECT_IOCP
+    /* hand pipe to the shared reader */
+    if (redirection->readerMode == STDREDIRECT_READER_MODE_SHARED) {
+        if (STDREDIRECT_register(redirection) == -1) {
+            goto Error;
+        }
+    }
+    else
+#endif /* STDREDIRECT_IOCP */
+    {
+        /* create exit thread event */
+        redirection->exitThreadEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        if (redirection->exitThreadEvent == NULL) {
+            goto Error;
+        }
+
+        /* create timer cancelling the blocking pipe read once a batch, summary or statistics are due */
+        redirection->timeoutTimer = CreateThreadpoolTimer(STDREDIRECT_timeoutTimerCallback, redirection, NULL);
+        if (redirection->timeoutTimer == NULL) {
+            goto Error;
+        }
+
+        /* run pipe reader in separate thread */
+        redirection->thread = CreateThread(0, 0, (LPTHREAD_START_ROUTINE) STDREDIRECT_bufferedPipeReader, redirection, 0, 0);
+        if (redirection->thread == NULL) {
+            goto Error;
+        }
+    }
+
+    STDREDIRECT_lock(&redirection->injectLock);
+    redirection->isInjectable = TRUE;
+    STDREDIRECT_unlock(&redirection->injectLock);
+
+    redirection->isRedirected = TRUE;
+    redirection->isValid = TRUE;
+
+    return redirection->error = STDREDIRECT_ERROR_NO_ERROR;
+
+Error:
+    /* cleanup */
+    STDREDIRECT_unredirect(redirection);
+
+    return redirection->error = STDREDIRECT_ERROR_REDIRECT;
+}
+#else
+static STDREDIRECT_ERROR STDREDIRECT_redirect(STDREDIRECT_REDIRECTION* redirection) {
+    int pipeFileDescriptors[2];
+    int exitPipeFileDescriptors[2];
+    int commitPipeFileDescriptors[2];
+#ifdef __linux__
+    int teePipeFileDescriptors[2];
+#endif /* __linux__ */
+    int streamFileDescriptor = redirection->stream == STDREDIRECT_STREAM_STDOUT ? STDOUT_FILENO : STDERR_FILENO;
+    int consoleFileDescriptor;
+
+    /* unredirect if already redirected */
+    if (redirection->isRedirected && STDREDIRECT_unredirect(redirection) != STDREDIRECT_ERROR_NO_ERROR) {
         goto Error;
     }
 
-    /* reassign standard stream file descriptor to writable pipe end */
-    if (_dup2(redirection->writablePipeEndFileDescriptor, redirection->stream == STDREDIRECT_STREAM_STDOUT ? _fileno(stdout) : _fileno(stderr)) == -1) {
+    /* the first redirect of stdout by any redirection keeps the console for STDREDIRECT_printToConsole(), it stays open
+       until the process exits */
+    if (redirection->stream == STDREDIRECT_STREAM_STDOUT && !redirection->process && STDREDIRECT_atomicLoad(&STDREDIRECT_consoleFileDescriptor) == -1) {
+        consoleFileDescriptor = fcntl(streamFileDescriptor, F_DUPFD_CLOEXEC, 0);
+        if (consoleFileDescriptor != -1 && !STDREDIRECT_atomicCompareExchange(&STDREDIRECT_consoleFileDescriptor, -1, consoleFileDescriptor)) {
+            close(consoleFileDescriptor);
+        }
+    }
+
+    /* start the clock before the pipe reader looks at the statistics deadline, a parked one is still running */
+    STDREDIRECT_lock(&redirection->injectLock);
+    STDREDIRECT_statStore(&redirection->redirectedSince, STDREDIRECT_now());
+    redirection->statsDeadline = redirection->redirectedSince + redirection->statsIntervalUs;
+    redirection->adaptDeadline = redirection->redirectedSince + STDREDIRECT_ADAPT_INTERVAL_US;
+    redirection->windowBurst = 0;
+    STDREDIRECT_unlock(&redirection->injectLock);
+
+    /* from here on unredirect cleans up whatever has been set up so far */
+    redirection->isRedirected = TRUE;
+
+    /* parked: pipe and threads are still there, take a fresh duplicate of the stream, which may have been changed
+       meanwhile, and point it at the pipe again */
+    if (redirection->isParked) {
+        redirection->isParked = FALSE;
+        fflush(redirection->stream == STDREDIRECT_STREAM_STDOUT ? stdout : stderr);
+#ifdef __linux__
+        if (dup3(streamFileDescriptor, redirection->originalFileDescriptor, O_CLOEXEC) == -1) {
+            goto Error;
+        }
+#else
+        if (dup2(streamFileDescriptor, redirection->originalFileDescriptor) == -1) {
+            goto Error;
+        }
+        fcntl(redirection->originalFileDescriptor, F_SETFD, FD_CLOEXEC);
+#endif /* __linux__ */
+        if (dup2(redirection->writablePipeEnd, streamFileDescriptor) == -1) {
+            goto Error;
+        }
+
+        STDREDIRECT_lock(&redirection->injectLock);
+        redirection->isInjectable = TRUE;
+        STDREDIRECT_atomicStore(&redirection->isQueueing, redirection->commitPipeWriteEnd != -1);
+        STDREDIRECT_unlock(&redirection->injectLock);
+
+        redirection->isValid = TRUE;
+
+        return redirection->error = STDREDIRECT_ERROR_NO_ERROR;
+    }
+
+    /* create anonymous pipe, readable end is non-blocking so the reader can drain it */
+#ifdef __linux__
+    if (pipe2(pipeFileDescriptors, O_CLOEXEC) == -1) {
+        goto Error;
+    }
+#else
+    if (pipe(pipeFileDescriptors) == -1) {
+        goto Error;
+    }
+    fcntl(pipeFileDescriptors[0], F_SETFD, FD_CLOEXEC);
+    fcntl(pipeFileDescriptors[1], F_SETFD, FD_CLOEXEC);
+#endif /* __linux__ */
+    redirection->readablePipeEnd = pipeFileDescriptors[0];
+    redirection->writablePipeEnd = pipeFileDescriptors[1];
+    if (fcntl(redirection->readablePipeEnd, F_SETFL, fcntl(redirection->readablePipeEnd, F_GETFL) | O_NONBLOCK) == -1) {
         goto Error;
     }
+    redirection->pipeSize = 0;
+    STDREDIRECT_resizePipe(redirection, redirection->minPipeSize);
+    if (redirection->minPipeSize == 0) {
+        /* adaptive mode does not shrink the pipe below the system default */
+        redirection->minPipeSize = redirection->pipeSize;
+    }
 
-    /* create exit thread event */
-    redirection->exitThreadEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
-    if (redirection->exitThreadEvent == NULL) {
+    /* keep original stream so it can be restored and written to in duplicate mode */
+    redirection->originalFileDescriptor = fcntl(streamFileDescriptor, F_DUPFD_CLOEXEC, 0);
+    if (redirection->originalFileDescriptor == -1) {
         goto Error;
-    }      
+    }
+
+#ifdef __linux__
+    /* duplicate mode tees the pipe into a second pipe that is spliced to the original stream */
+    if (redirection->behaviour == STDREDIRECT_BEHAVIOUR_DUPLICATE) {
+        if (pipe2(teePipeFileDescriptors, O_CLOEXEC) == -1) {
+            goto Error;
+        }
+        redirection->teePipeReadEnd = teePipeFileDescriptors[0];
+        redirection->teePipeWriteEnd = teePipeFileDescriptors[1];
+    }
+#endif /* __linux__ */
+
+    /* create pipe used to wake the pipe reader for lines published by STDREDIRECT_threadWrite(), nobody writes those to
+       the stream of a child process */
+    if (!redirection->process) {
+#ifdef __linux__
+        if (pipe2(commitPipeFileDescriptors, O_CLOEXEC | O_NONBLOCK) == -1) {
+            goto Error;
+        }
+#else
+        if (pipe(commitPipeFileDescriptors) == -1) {
+            goto Error;
+        }
+        fcntl(commitPipeFileDescriptors[0], F_SETFD, FD_CLOEXEC);
+        fcntl(commitPipeFileDescriptors[1], F_SETFD, FD_CLOEXEC);
+        fcntl(commitPipeFileDescriptors[0], F_SETFL, fcntl(commitPipeFileDescriptors[0], F_GETFL) | O_NONBLOCK);
+        fcntl(commitPipeFileDescriptors[1], F_SETFL, fcntl(commitPipeFileDescriptors[1], F_GETFL) | O_NONBLOCK);
+#endif /* __linux__ */
+        redirection->commitPipeReadEnd = commitPipeFileDescriptors[0];
+        redirection->commitPipeWriteEnd = commitPipeFileDescriptors[1];
+    }
 
-    /* run pipe reader in separate thread */
-    redirection->thread = CreateThread(0, 0, (LPTHREAD_START_ROUTINE) STDREDIRECT_bufferedPipeReader, redirection, 0, 0);
-    if (redirection->thread == NULL) {
+    /* run dispatcher in separate thread */
+    if (STDREDIRECT_startDispatcher(redirection) != STDREDIRECT_ERROR_NO_ERROR) {
         goto Error;
     }
 
-    redirection->isRedirected = TRUE;
+#ifdef STDREDIRECT_EPOLL
+    /* hand pipe to the shared reader */
+    if (redirection->readerMode == STDREDIRECT_READER_MODE_SHARED) {
+        if (STDREDIRECT_register(redirection) == -1) {
+            goto Error;
+        }
+    }
+    else
+#endif /* STDREDIRECT_EPOLL */
+    {
+        /* create pipe used to wake the reader thread on unredirect */
+#ifdef __linux__
+        if (pipe2(exitPipeFileDescriptors, O_CLOEXEC) == -1) {
+            goto Error;
+        }
+#else
+        if (pipe(exitPipeFileDescriptors) == -1) {
+            goto Error;
+        }
+        fcntl(exitPipeFileDescriptors[0], F_SETFD, FD_CLOEXEC);
+        fcntl(exitPipeFileDescriptors[1], F_SETFD, FD_CLOEXEC);
+#endif /* __linux__ */
+        redirection->exitPipeReadEnd = exitPipeFileDescriptors[0];
+        redirection->exitPipeWriteEnd = exitPipeFileDescriptors[1];
+
+        /* run pipe reader in separate thread */
+        if (pthread_create(&redirection->thread, NULL, STDREDIRECT_bufferedPipeReader, redirection) != 0) {
+            goto Error;
+        }
+        redirection->isThreadRunning = TRUE;
+    }
+
+    /* write out pending output to the original stream, then reassign standard stream file descriptor to writable pipe
+       end, the one of a child process is handed to the child by STDREDIRECT_spawn() instead */
+    if (!redirection->process) {
+        fflush(redirection->stream == STDREDIRECT_STREAM_STDOUT ? stdout : stderr);
+        if (dup2(redirection->writablePipeEnd, streamFileDescriptor) == -1) {
+            goto Error;
+        }
+    }
+
+    STDREDIRECT_lock(&redirection->injectLock);
+    redirection->isInjectable = TRUE;
+    STDREDIRECT_atomicStore(&redirection->isQueueing, redirection->commitPipeWriteEnd != -1);
+    STDREDIRECT_unlock(&redirection->injectLock);
+
     redirection->isValid = TRUE;
 
     return redirection->error = STDREDIRECT_ERROR_NO_ERROR;
@@ -273,12 +1665,13 @@ Error:
 
     return redirection->error = STDREDIRECT_ERROR_REDIRECT;
 }
+#endif /* _WIN32 */
 
 
 /**
  * @brief Redirect stdout to callback.
  *
- * Callback is called when pipe buffer is full, see STDREDIRECT_REDIRECTION::bufferSize (defaults to STDREDIRECT_BUFFER_SIZE)
+ * Callback is called with whatever could be read from the pipe at once, at most STDREDIRECT_REDIRECTION::bufferSize bytes (defaults to STDREDIRECT_BUFFER_SIZE)
  *
  * @param stdoutCallback Pointer to callback function.
  * @return ::STDREDIRECT_ERROR
@@ -296,7 +1689,7 @@ static STDREDIRECT_ERROR STDREDIRECT_redirectStdout(STDREDIRECT_CALLBACK stdoutC
 /**
  * @brief Redirect stderr to callback.
  *
- * Callback is called when pipe buffer is full, see STDREDIRECT_REDIRECTION::bufferSize (defaults to STDREDIRECT_BUFFER_SIZE)
+ * Callback is called with whatever could be read from the pipe at once, at most STDREDIRECT_REDIRECTION::bufferSize bytes (defaults to STDREDIRECT_BUFFER_SIZE)
  *
  * @param stderrCallback Pointer to callback function.
  * @return ::STDREDIRECT_ERROR
@@ -379,7 +1772,9 @@ static STDREDIRECT_ERROR STDREDIRECT_duplicateStderrToDebugger() {
  * @param redirection Pointer to redirection object.
  * @return ::STDREDIRECT_ERROR
  */
+#ifdef _WIN32
 static STDREDIRECT_ERROR STDREDIRECT_unredirect(STDREDIRECT_REDIRECTION* redirection) {
+    int   streamFileDescriptor = redirection->stream == STDREDIRECT_STREAM_STDOUT ? _fileno(stdout) : _fileno(stderr);
     FILE* consoleFile;
 
     /* check if still redirected */
@@ -387,62 +1782,118 @@ static STDREDIRECT_ERROR STDREDIRECT_unredirect(STDREDIRECT_REDIRECTION* redirec
         return STDREDIRECT_ERROR_NO_ERROR;
     }
 
-    /* stop pipe reader thread */
-    if (redirection->thread) {
-        /* signal thread to exit */
-        if (!SetEvent(redirection->exitThreadEvent)) {
-            goto Error;
-        }
+    /* refuse further injections, waits for one in progress */
+    STDREDIRECT_lock(&redirection->injectLock);
+    redirection->isInjectable = FALSE;
+    STDREDIRECT_unlock(&redirection->injectLock);
+
+    /* the stream of a child process was never reassigned */
+    if (!redirection->process) {
+        /* write out pending output to the pipe */
+        fflush(redirection->stream == STDREDIRECT_STREAM_STDOUT ? stdout : stderr);
 
-        /* give thread time to exit, terminate otherwise */
-        if (WaitForSingleObject(redirection->thread, STDREDIRECT_THREAD_EXIT_TIMEOUT_MS) != WAIT_OBJECT_0 && !TerminateThread(redirection->thread, EXIT_SUCCESS)) {
+        /* restore std handle */
+        if (redirection->stdHandle && !SetStdHandle(redirection->stream == STDREDIRECT_STREAM_STDOUT ? STD_OUTPUT_HANDLE : STD_ERROR_HANDLE, redirection->stdHandle)) {
             goto Error;
         }
 
-        /* close thread handle*/
-        if (!CloseHandle(redirection->thread)) {
+        /* restore original standard stream file descriptor, re-open console if there was none */
+        if (redirection->originalFileDescriptor != -1) {
+            if (_dup2(redirection->originalFileDescriptor, streamFileDescriptor) == -1) {
+                goto Error;
+            }
+            _close(redirection->originalFileDescriptor);
+            redirection->originalFileDescriptor = -1;
+        }
+        else if (redirection->writablePipeEnd && freopen_s(&consoleFile, "CONOUT$", "w", redirection->stream == STDREDIRECT_STREAM_STDOUT ? stdout : stderr) != 0) {
             goto Error;
         }
-        redirection->thread = NULL;
     }
+    redirection->stdHandle = NULL;
 
-    /* close exit thread event handle */
-    if (redirection->exitThreadEvent && !CloseHandle(redirection->exitThreadEvent)) {
+    if (STDREDIRECT_release(redirection) != STDREDIRECT_ERROR_NO_ERROR) {
         goto Error;
     }
-    redirection->exitThreadEvent = NULL;      
 
-    /* free read buffer */
-    if (redirection->buffer) {
-        free(redirection->buffer);
-        redirection->buffer = NULL;
-        redirection->bufferSize = 0;
+    /* deliver partial line and pending batch, then the last statistics */
+    STDREDIRECT_lock(&redirection->injectLock);
+    STDREDIRECT_flushAll(redirection);
+    if (redirection->statsCallback) {
+        STDREDIRECT_reportStats(redirection);
     }
+    STDREDIRECT_unlock(&redirection->injectLock);
 
-    /* restore std handle */
-    if (redirection->stdHandle && !SetStdHandle(redirection->stream == STDREDIRECT_STREAM_STDOUT ? STD_OUTPUT_HANDLE : STD_ERROR_HANDLE, redirection->stdHandle)) {
-        goto Error;
+    if (redirection->redirectedSince != -1) {
+        STDREDIRECT_statStore(&redirection->redirectedTimeUs, redirection->redirectedTimeUs + STDREDIRECT_now() - redirection->redirectedSince);
+        STDREDIRECT_statStore(&redirection->redirectedSince, -1);
     }
-    redirection->stdHandle = NULL;
 
-    /* close writable pipe end file descriptor, underlying handle is closed automatically */
-    if (redirection->writablePipeEndFileDescriptor != -1 && _close(redirection->writablePipeEndFileDescriptor) == -1) {
-        goto Error;
+    redirection->isRedirected = FALSE;
+    redirection->isValid = TRUE;
+    
+    return redirection->error = STDREDIRECT_ERROR_NO_ERROR;
+
+Error:
+    /* critical error: unredirect failed */
+    _cprintf_s("STDREDIRECT CRITICAL ERROR: Could not un-redirect %s! Redirection is in invalid state.\n", redirection->stream == STDREDIRECT_STREAM_STDOUT ? "stdout" : "stderr");
+
+    redirection->isValid = FALSE;
+    
+    return redirection->error = STDREDIRECT_ERROR_UNREDIRECT;
+}
+
+#else
+static STDREDIRECT_ERROR STDREDIRECT_unredirect(STDREDIRECT_REDIRECTION* redirection) {
+    int streamFileDescriptor = redirection->stream == STDREDIRECT_STREAM_STDOUT ? STDOUT_FILENO : STDERR_FILENO;
+    int isParking;
+
+    /* check if still redirected */
+    if (!redirection->isRedirected) {
+        return STDREDIRECT_ERROR_NO_ERROR;
     }
-    redirection->writablePipeEnd = NULL;
-    redirection->writablePipeEndFileDescriptor = -1;
 
-    /* close readable pipe end */
-    if (redirection->readablePipeEnd && !CloseHandle(redirection->readablePipeEnd)) {
-        goto Error;
+    /* refuse further injections and published lines, waits for those in progress; only a complete redirection is
+       parked */
+    STDREDIRECT_lock(&redirection->injectLock);
+    isParking = redirection->isPersistent && redirection->isInjectable;
+    redirection->isInjectable = FALSE;
+    STDREDIRECT_unlock(&redirection->injectLock);
+    STDREDIRECT_stopQueueing(redirection);
+
+    /* write out pending output to the pipe, then restore original standard stream, the stream of a child process was
+       never reassigned */
+    if (!redirection->process) {
+        fflush(redirection->stream == STDREDIRECT_STREAM_STDOUT ? stdout : stderr);
+        if (redirection->originalFileDescriptor != -1 && dup2(redirection->originalFileDescriptor, streamFileDescriptor) == -1) {
+            goto Error;
+        }
     }
-    redirection->readablePipeEnd = NULL;
 
-    /* re-open console */
-    if (freopen_s(&consoleFile, "CONOUT$", "w", redirection->stream == STDREDIRECT_STREAM_STDOUT ? stdout : stderr) != 0) {
+    if (isParking) {
+        /* everything written so far is in the pipe, pass it on here instead of waiting for the pipe reader */
+        STDREDIRECT_lockedDrain(redirection);
+        STDREDIRECT_flushDispatcher(redirection);
+        redirection->isParked = TRUE;
+    }
+    else if (STDREDIRECT_release(redirection) != STDREDIRECT_ERROR_NO_ERROR) {
         goto Error;
     }
 
+    /* deliver partial line and pending batch unless a parked dispatcher did, then the last statistics */
+    STDREDIRECT_lock(&redirection->injectLock);
+    if (!redirection->isDispatcherRunning) {
+        STDREDIRECT_flushAll(redirection);
+    }
+    if (redirection->statsCallback) {
+        STDREDIRECT_reportStats(redirection);
+    }
+    STDREDIRECT_unlock(&redirection->injectLock);
+
+    if (redirection->redirectedSince != -1) {
+        STDREDIRECT_statStore(&redirection->redirectedTimeUs, redirection->redirectedTimeUs + STDREDIRECT_now() - redirection->redirectedSince);
+        STDREDIRECT_statStore(&redirection->redirectedSince, -1);
+    }
+
     redirection->isRedirected = FALSE;
     redirection->isValid = TRUE;
     
@@ -450,12 +1901,155 @@ static STDREDIRECT_ERROR STDREDIRECT_unredirect(STDREDIRECT_REDIRECTION* redirec
 
 Error:
     /* critical error: unredirect failed */
-    _cprintf_s("STDREDIRECT CRITICAL ERROR: Could not un-redirect %s! Redirection is in invalid state.\n", redirection->stream == STDREDIRECT_STREAM_STDOUT ? "stdout" : "stderr");
+    STDREDIRECT_printToConsole("STDREDIRECT CRITICAL ERROR: Could not un-redirect %s! Redirection is in invalid state.\n", redirection->stream == STDREDIRECT_STREAM_STDOUT ? "stdout" : "stderr");
 
     redirection->isValid = FALSE;
     
     return redirection->error = STDREDIRECT_ERROR_UNREDIRECT;
 }
+#endif /* _WIN32 */
+
+
+/**
+ * @brief Stop pipe reader and dispatcher, they pass on everything written so far before they exit, and close the
+ *        pipes. The stream must have been restored already.
+ *
+ * @param redirection Pointer to redirection object.
+ * @return ::STDREDIRECT_ERROR
+ */
+#ifdef _WIN32
+static STDREDIRECT_ERROR STDREDIRECT_release(STDREDIRECT_REDIRECTION* redirection) {
+    DWORD waitResult;
+
+    /* close writable pipe end file descriptor, underlying handle is closed automatically; the one of a child process
+       has none and is closed by STDREDIRECT_spawn() once the child has it */
+    if (redirection->writablePipeEndFileDescriptor != -1) {
+        if (_close(redirection->writablePipeEndFileDescriptor) == -1) {
+            return STDREDIRECT_ERROR_UNREDIRECT;
+        }
+    }
+    else if (redirection->writablePipeEnd && !CloseHandle(redirection->writablePipeEnd)) {
+        return STDREDIRECT_ERROR_UNREDIRECT;
+    }
+    redirection->writablePipeEnd = NULL;
+    redirection->writablePipeEndFileDescriptor = -1;
+
+    /* stop pipe reader thread, it reads until the pipe is empty and all writable ends are closed */
+    if (redirection->thread) {
+        if (!SetEvent(redirection->exitThreadEvent)) {
+            return STDREDIRECT_ERROR_THREAD;
+        }
+
+        /* a child process may keep an inherited writable end open, the pending read then has to be cancelled */
+        while ((waitResult = WaitForSingleObject(redirection->thread, STDREDIRECT_THREAD_EXIT_POLL_MS)) == WAIT_TIMEOUT) {
+            CancelSynchronousIo(redirection->thread);
+        }
+        if (waitResult != WAIT_OBJECT_0) {
+            return STDREDIRECT_ERROR_THREAD;
+        }
+
+        /* close thread handle*/
+        if (!CloseHandle(redirection->thread)) {
+            return STDREDIRECT_ERROR_THREAD;
+        }
+        redirection->thread = NULL;
+    }
+#ifdef STDREDIRECT_IOCP
+    STDREDIRECT_unregister(redirection);
+#endif /* STDREDIRECT_IOCP */
+
+    /* close timeout timer once its last callback returned, the pipe reader no longer arms it */
+    if (redirection->timeoutTimer) {
+        SetThreadpoolTimer(redirection->timeoutTimer, NULL, 0, 0);
+        WaitForThreadpoolTimerCallbacks(redirection->timeoutTimer, TRUE);
+        CloseThreadpoolTimer(redirection->timeoutTimer);
+        redirection->timeoutTimer = NULL;
+    }
+
+    /* stop dispatcher after it passed everything in the ring to the callback */
+    if (STDREDIRECT_stopDispatcher(redirection) != STDREDIRECT_ERROR_NO_ERROR) {
+        return STDREDIRECT_ERROR_THREAD;
+    }
+
+    /* close exit thread event handle */
+    if (redirection->exitThreadEvent && !CloseHandle(redirection->exitThreadEvent)) {
+        return STDREDIRECT_ERROR_THREAD;
+    }
+    redirection->exitThreadEvent = NULL;      
+
+    /* close readable pipe end */
+    if (redirection->readablePipeEnd && !CloseHandle(redirection->readablePipeEnd)) {
+        return STDREDIRECT_ERROR_UNREDIRECT;
+    }
+    redirection->readablePipeEnd = NULL;
+    redirection->isParked = FALSE;
+
+    return STDREDIRECT_ERROR_NO_ERROR;
+}
+#else
+static STDREDIRECT_ERROR STDREDIRECT_release(STDREDIRECT_REDIRECTION* redirection) {
+    /* stop pipe reader thread, it drains everything written so far before it exits */
+    if (redirection->isThreadRunning) {
+        if (STDREDIRECT_writeAll(redirection->exitPipeWriteEnd, "", 1) == -1) {
+            return STDREDIRECT_ERROR_THREAD;
+        }
+        if (pthread_join(redirection->thread, NULL) != 0) {
+            return STDREDIRECT_ERROR_THREAD;
+        }
+        redirection->isThreadRunning = FALSE;
+    }
+#ifdef STDREDIRECT_EPOLL
+    STDREDIRECT_unregister(redirection);
+#endif /* STDREDIRECT_EPOLL */
+
+    /* stop dispatcher after it passed everything in the ring to the callback */
+    if (STDREDIRECT_stopDispatcher(redirection) != STDREDIRECT_ERROR_NO_ERROR) {
+        return STDREDIRECT_ERROR_THREAD;
+    }
+
+    /* close duplicate of original stream and pipes */
+    if (redirection->originalFileDescriptor != -1) {
+        close(redirection->originalFileDescriptor);
+        redirection->originalFileDescriptor = -1;
+    }
+    if (redirection->writablePipeEnd != -1) {
+        close(redirection->writablePipeEnd);
+        redirection->writablePipeEnd = -1;
+    }
+    if (redirection->readablePipeEnd != -1) {
+        close(redirection->readablePipeEnd);
+        redirection->readablePipeEnd = -1;
+    }
+    if (redirection->exitPipeWriteEnd != -1) {
+        close(redirection->exitPipeWriteEnd);
+        redirection->exitPipeWriteEnd = -1;
+    }
+    if (redirection->teePipeWriteEnd != -1) {
+        close(redirection->teePipeWriteEnd);
+        redirection->teePipeWriteEnd = -1;
+    }
+    if (redirection->teePipeReadEnd != -1) {
+        close(redirection->teePipeReadEnd);
+        redirection->teePipeReadEnd = -1;
+    }
+    if (redirection->exitPipeReadEnd != -1) {
+        close(redirection->exitPipeReadEnd);
+        redirection->exitPipeReadEnd = -1;
+    }
+    if (redirection->commitPipeWriteEnd != -1) {
+        close(redirection->commitPipeWriteEnd);
+        redirection->commitPipeWriteEnd = -1;
+    }
+    if (redirection->commitPipeReadEnd != -1) {
+        close(redirection->commitPipeReadEnd);
+        redirection->commitPipeReadEnd = -1;
+    }
+    STDREDIRECT_atomicStore(&redirection->isCommitPending, FALSE);
+    redirection->isParked = FALSE;
+
+    return STDREDIRECT_ERROR_NO_ERROR;
+}
+#endif /* _WIN32 */
 
 
 /**
@@ -464,7 +2058,10 @@ Error:
  * @return ::STDREDIRECT_ERROR
  */
 static STDREDIRECT_ERROR STDREDIRECT_unredirectStdout() {
-    return STDREDIRECT_destroy(STDREDIRECT_stdoutRedirection);
+    STDREDIRECT_ERROR error = STDREDIRECT_destroy(STDREDIRECT_stdoutRedirection);
+    STDREDIRECT_stdoutRedirection = NULL;
+
+    return error;
 }
 
 
@@ -474,7 +2071,10 @@ static STDREDIRECT_ERROR STDREDIRECT_unredirectStdout() {
  * @return ::STDREDIRECT_ERROR
  */
 static STDREDIRECT_ERROR STDREDIRECT_unredirectStderr() {
-    return STDREDIRECT_destroy(STDREDIRECT_stderrRedirection);
+    STDREDIRECT_ERROR error = STDREDIRECT_destroy(STDREDIRECT_stderrRedirection);
+    STDREDIRECT_stderrRedirection = NULL;
+
+    return error;
 }
 
 
@@ -499,105 +2099,4965 @@ static STDREDIRECT_ERROR STDREDIRECT_unredirectAll() {
 
 
 /**
- * @brief Buffered pipe reader, runs in separate thread.
+ * @brief Get snapshot of redirection statistics.
+ *
+ * Safe to call from any thread at any time, the counters are read without locking while the pipe reader keeps
+ * updating them, so they may be a few chunks apart from each other.
  *
  * @param redirection Pointer to redirection object.
+ * @param stats Receives the statistics.
+ * @return ::STDREDIRECT_ERROR
  */
-static void WINAPI STDREDIRECT_bufferedPipeReader(STDREDIRECT_REDIRECTION* redirection) {
-    DWORD numBytesRead;
+static STDREDIRECT_ERROR STDREDIRECT_getStats(STDREDIRECT_REDIRECTION* redirection, STDREDIRECT_STATS* stats) {
+    long long redirectedSince;
+    long long redirectedTimeUs;
+    int       i;
 
-    /* allocate string buffer */
-    redirection->buffer = (char*) calloc(STDREDIRECT_BUFFER_SIZE, sizeof(char));
-    if (redirection->buffer) {
-        redirection->bufferSize = STDREDIRECT_BUFFER_SIZE;
-    }
-    else {
-        goto Error;
+    if (!redirection || !stats) {
+        return STDREDIRECT_ERROR_NULLPTR;
     }
 
-    /* read from pipe until exit thread event signal is received */
-    while (WaitForSingleObject(redirection->exitThreadEvent, 0) != WAIT_OBJECT_0) {
-        /* flush all streams so they become readable */
-        if (fflush(NULL) == EOF) {
-            goto Error;
-        }
-
-        /* TODO improve timing, sometimes characters are dropped/intercepted by another string */
+    stats->stream            = redirection->stream;
+    stats->timestamp         = STDREDIRECT_now();
+    stats->bytesRead         = STDREDIRECT_statLoad(&redirection->stats.bytesRead);
+    stats->reads             = STDREDIRECT_statLoad(&redirection->stats.reads);
+    stats->callbacks         = STDREDIRECT_statLoad(&redirection->stats.callbacks);
+    stats->callbackTimeUs    = STDREDIRECT_statLoad(&redirection->stats.callbackTimeUs);
+    stats->maxCallbackTimeUs = STDREDIRECT_statLoad(&redirection->stats.maxCallbackTimeUs);
+    stats->busyTimeUs        = STDREDIRECT_statLoad(&redirection->stats.busyTimeUs);
+    stats->blockedTimeUs     = STDREDIRECT_statLoad(&redirection->stats.blockedTimeUs);
+    stats->droppedChunks     = STDREDIRECT_atomicLoad(&redirection->droppedChunks);
+    stats->droppedBytes      = STDREDIRECT_atomicLoad(&redirection->droppedBytes);
+    for (i = 0; i < STDREDIRECT_STATS_BUCKETS; ++i) {
+        stats->chunkSizes[i] = STDREDIRECT_statLoad(&redirection->stats.chunkSizes[i]);
+    }
+    stats->largestBurst      = STDREDIRECT_statLoad(&redirection->stats.largestBurst);
+    stats->pipeSize          = STDREDIRECT_statLoad(&redirection->stats.pipeSize);
+    stats->bufferSize        = STDREDIRECT_statLoad(&redirection->stats.bufferSize);
+    stats->collapsedLines    = STDREDIRECT_statLoad(&redirection->stats.collapsedLines);
+    stats->collapsedBytes    = STDREDIRECT_statLoad(&redirection->stats.collapsedBytes);
+    stats->rateLimitedLines  = STDREDIRECT_statLoad(&redirection->stats.rateLimitedLines);
+    stats->rateLimitedBytes  = STDREDIRECT_statLoad(&redirection->stats.rateLimitedBytes);
+    stats->spilledChunks     = STDREDIRECT_statLoad(&redirection->stats.spilledChunks);
+    stats->spilledBytes      = STDREDIRECT_statLoad(&redirection->stats.spilledBytes);
+    stats->strippedBytes     = STDREDIRECT_statLoad(&redirection->stats.strippedBytes);
+    stats->invalidUtf8Bytes  = STDREDIRECT_statLoad(&redirection->stats.invalidUtf8Bytes);
 
-        /* read from readable pipe end, blocks until input is available */
-        /* read 1 character less to leave space for string-terminating null-character */
-        if (!ReadFile(redirection->readablePipeEnd, (void*) redirection->buffer, (DWORD) redirection->bufferSize - 1, &numBytesRead, NULL)) {
-            goto Error;
-        }
-        if (numBytesRead > 0) {
-            /* ensure string is null-terminated */
-            redirection->buffer[redirection->bufferSize - 1] = '\0';
+    /* whatever the pipe reader did not spend on output it spent waiting for it */
+    redirectedSince  = STDREDIRECT_statLoad(&redirection->redirectedSince);
+    redirectedTimeUs = STDREDIRECT_statLoad(&redirection->redirectedTimeUs);
+    if (redirectedSince != -1) {
+        redirectedTimeUs += stats->timestamp - redirectedSince;
+    }
+    stats->idleTimeUs = redirectedTimeUs - stats->busyTimeUs - stats->blockedTimeUs;
+    if (stats->idleTimeUs < 0) {
+        stats->idleTimeUs = 0;
+    }
 
-            /* duplicate output to console */
-            if (redirection->behaviour == STDREDIRECT_BEHAVIOUR_DUPLICATE) {
-                _cprintf_s(redirection->buffer);
-            }
+    return STDREDIRECT_ERROR_NO_ERROR;
+}
 
-            /* run string callback */
-            redirection->callback(redirection->buffer);
-        }
 
-        /* clear buffer */
-        memset(redirection->buffer, 0, redirection->bufferSize);
-    }
+/**
+ * @brief Pass data to the callbacks of a redirection as if it had been written to the redirected stream.
+ *
+ * Fast path for writers that know about the redirection, e.g. stdredirect::StreamBuffer, the data skips the write to
+ * the pipe and the read by the pipe reader. Output of the C stream is flushed first, on POSIX whatever is in the pipe
+ * is passed on before the data, so printf() followed by an injection keeps its order. On Windows the pipe reader may
+ * still be holding earlier output.
+ *
+ * In synchronous mode the callbacks run on the calling thread, never concurrently with the pipe reader. Data is passed
+ * on in pieces of at most STDREDIRECT_INJECT_BUFFER_SIZE bytes, asynchronous mode takes pieces of up to
+ * STDREDIRECT_REDIRECTION::bufferSize bytes. Injected bytes are counted in ::STDREDIRECT_STATS but not as reads.
+ *
+ * @param redirection Pointer to redirection object.
+ * @param data Data.
+ * @param length Number of bytes.
+ * @return ::STDREDIRECT_ERROR, ::STDREDIRECT_ERROR_NOT_REDIRECTED if the stream is not redirected, the caller writes the
+ *         data to the stream itself then.
+ */
+static STDREDIRECT_ERROR STDREDIRECT_inject(STDREDIRECT_REDIRECTION* redirection, const char* data, size_t length) {
+    return STDREDIRECT_injectFromThread(redirection, data, length, 0);
+}
 
-    ExitThread(EXIT_SUCCESS);
+
+/**
+ * @brief STDREDIRECT_inject() tagging the data with the thread that committed it.
+ *
+ * A partial line carried from data of another thread (or from the pipe) is delivered on its own first, so lines of
+ * different threads are never joined.
+ *
+ * @param redirection Pointer to redirection object.
+ * @param data Data.
+ * @param length Number of bytes.
+ * @param threadId Passed on as STDREDIRECT_RECORD::threadId, 0 for none.
+ * @return See STDREDIRECT_inject().
+ */
+static STDREDIRECT_ERROR STDREDIRECT_injectFromThread(STDREDIRECT_REDIRECTION* redirection, const char* data, size_t length, long long threadId) {
+    char      buffer[STDREDIRECT_INJECT_BUFFER_SIZE + 1];
+    size_t    numBytesToPass;
+    long long globalSequence;
+    long long timestamp;
+    FILE*     stream;
+    int       isFlushed;
+#ifdef _WIN32
+    DWORD     numBytesWritten;
+    size_t    numBytesDuplicated;
+#else
+    int       numBytesPending;
+#endif /* _WIN32 */
+
+    if (!redirection || (!data && length > 0)) {
+        return STDREDIRECT_ERROR_NULLPTR;
+    }
+
+    /* earlier output of the C stream goes first, an empty stdio buffer is not flushed */
+    stream = redirection->stream == STDREDIRECT_STREAM_STDOUT ? stdout : stderr;
+#ifdef __linux__
+    isFlushed = __fpending(stream) > 0;
+    if (isFlushed) {
+        fflush(stream);
+    }
+#else
+    isFlushed = TRUE;
+    fflush(stream);
+#endif /* __linux__ */
+
+    STDREDIRECT_lock(&redirection->injectLock);
+    if (!redirection->isInjectable) {
+        STDREDIRECT_unlock(&redirection->injectLock);
+        return STDREDIRECT_ERROR_NOT_REDIRECTED;
+    }
+#ifndef _WIN32
+    /* the pipe stays open while injections are accepted, it is only drained if it or a queue of
+       STDREDIRECT_threadWrite() may hold earlier output */
+    if (isFlushed || redirection->threadQueues || ioctl(redirection->readablePipeEnd, FIONREAD, &numBytesPending) == -1 || numBytesPending > 0) {
+        STDREDIRECT_drain(redirection);
+    }
+#else
+    (void) isFlushed;
+#endif /* _WIN32 */
+
+    /* duplicate output to original stream */
+    if (redirection->behaviour == STDREDIRECT_BEHAVIOUR_DUPLICATE) {
+#ifdef _WIN32
+        for (numBytesDuplicated = 0; numBytesDuplicated < length; numBytesDuplicated += numBytesWritten) {
+            if (!WriteFile(redirection->stdHandle, data + numBytesDuplicated, (DWORD) (length - numBytesDuplicated), &numBytesWritten, NULL)) {
+                break;
+            }
+        }
+#else
+        STDREDIRECT_writeAll(redirection->originalFileDescriptor, data, length);
+#endif /* _WIN32 */
+    }
+
+    while (length > 0) {
+        numBytesToPass = redirection->ring.data ? redirection->bufferSize : STDREDIRECT_INJECT_BUFFER_SIZE;
+        if (numBytesToPass > length) {
+            numBytesToPass = length;
+        }
+        globalSequence = STDREDIRECT_atomicAdd(&STDREDIRECT_globalSequence, 1);
+        timestamp = STDREDIRECT_now();
+        STDREDIRECT_countChunk(redirection, numBytesToPass);
+
+        if (redirection->ring.data) {
+            STDREDIRECT_push(redirection, data, numBytesToPass, globalSequence, timestamp, threadId);
+        }
+        else {
+            /* the callbacks may null-terminate the data in place */
+            memcpy(buffer, data, numBytesToPass);
+            STDREDIRECT_switchThread(redirection, threadId);
+            redirection->globalSequence = globalSequence;
+            redirection->timestamp = timestamp;
+            STDREDIRECT_process(redirection, buffer, numBytesToPass);
+        }
+
+        data += numBytesToPass;
+        length -= numBytesToPass;
+    }
+    STDREDIRECT_unlock(&redirection->injectLock);
+
+    /* one wakeup for all pieces, after unlocking so the dispatcher does not preempt a lock holder */
+    if (redirection->ring.data) {
+        STDREDIRECT_wake(redirection, &redirection->isDispatcherWaiting);
+    }
+
+    return STDREDIRECT_ERROR_NO_ERROR;
+}
+
+
+/**
+ * @brief Write to a redirection through a buffer of the calling thread, only whole lines are passed on.
+ *
+ * For output of many threads at once: each thread collects its output in a thread-local buffer without taking any
+ * lock, complete lines are committed and tagged with STDREDIRECT_threadId() in STDREDIRECT_RECORD::threadId. Lines of
+ * different threads are never mixed, however the writes were fragmented. Lines longer than
+ * STDREDIRECT_INJECT_BUFFER_SIZE are committed in pieces, a partial line stays in the buffer until it is completed or
+ * STDREDIRECT_threadFlush() is called, which a thread must do before it exits or the redirection is destroyed. While
+ * the stream is not redirected the output goes to the stream itself.
+ *
+ * On POSIX a commit publishes the lines to a lock-free queue of the thread and returns, the pipe reader passes them on
+ * oldest first, after whatever the thread wrote to the pipe before, and is woken once for all lines published while it
+ * was busy. Callbacks therefore run on the pipe reader, and output the thread writes to the pipe after a commit may
+ * overtake lines still queued. Only a queue full of lines the pipe reader has not taken yet makes the commit wait for
+ * the lock like STDREDIRECT_inject(), which Windows always does.
+ *
+ * Each thread has one buffer per stream, a partial line written to another redirection of the same stream is
+ * committed to its own redirection first. The buffers are per translation unit, like the default redirections, a line
+ * should be written from one of them.
+ *
+ * @param redirection Pointer to redirection object.
+ * @param data Data.
+ * @param length Number of bytes.
+ * @return ::STDREDIRECT_ERROR
+ */
+static STDREDIRECT_ERROR STDREDIRECT_threadWrite(STDREDIRECT_REDIRECTION* redirection, const char* data, size_t length) {
+    STDREDIRECT_THREAD_BUFFER* buffer;
+    const char*                newline;
+    size_t                     segmentLength;
+    size_t                     numBytesToCopy;
+    long long                  threadId;
+    STDREDIRECT_ERROR          error = STDREDIRECT_ERROR_NO_ERROR;
+
+    if (!redirection || (!data && length > 0)) {
+        return STDREDIRECT_ERROR_NULLPTR;
+    }
+
+    buffer = &STDREDIRECT_threadBuffers[redirection->stream];
+    threadId = STDREDIRECT_threadId();
+    if (buffer->length > 0 && buffer->redirection != redirection) {
+        STDREDIRECT_commit(buffer->redirection, buffer->data, buffer->length, threadId);
+        buffer->length = 0;
+    }
+    buffer->redirection = redirection;
+
+    while (length > 0) {
+        /* complete lines are committed straight from the data */
+        if (buffer->length == 0) {
+            newline = STDREDIRECT_findLastByte(data, length, '\n');
+            if (newline) {
+                segmentLength = (size_t) (newline - data) + 1;
+                error = STDREDIRECT_commit(redirection, data, segmentLength, threadId);
+                data += segmentLength;
+                length -= segmentLength;
+                continue;
+            }
+        }
+
+        /* collect partial line, commit it once completed or the buffer is full */
+        newline = STDREDIRECT_findByte(data, length, '\n');
+        segmentLength = newline ? (size_t) (newline - data) + 1 : length;
+        numBytesToCopy = sizeof(buffer->data) - buffer->length;
+        if (numBytesToCopy > segmentLength) {
+            numBytesToCopy = segmentLength;
+        }
+        memcpy(buffer->data + buffer->length, data, numBytesToCopy);
+        buffer->length += numBytesToCopy;
+        data += numBytesToCopy;
+        length -= numBytesToCopy;
+
+        if (buffer->length == sizeof(buffer->data) || (newline && numBytesToCopy == segmentLength)) {
+            error = STDREDIRECT_commit(redirection, buffer->data, buffer->length, threadId);
+            buffer->length = 0;
+        }
+    }
+
+    return error;
+}
+
+
+/**
+ * @brief Formatted STDREDIRECT_threadWrite().
+ *
+ * @param redirection Pointer to redirection object.
+ * @param format Formatted output string, see printf().
+ * @return Number of bytes written, negative on error.
+ */
+static int STDREDIRECT_threadPrintf(STDREDIRECT_REDIRECTION* redirection, const char* format, ...) {
+    char    buffer[STDREDIRECT_INJECT_BUFFER_SIZE];
+    char*   data = buffer;
+    int     length;
+    va_list argptr;
+
+    va_start(argptr, format);
+    length = vsnprintf(buffer, sizeof(buffer), format, argptr);
+    va_end(argptr);
+    if (length < 0) {
+        return length;
+    }
+
+    /* format again if the output does not fit on the stack */
+    if ((size_t) length >= sizeof(buffer)) {
+        data = (char*) malloc((size_t) length + 1);
+        if (!data) {
+            return -1;
+        }
+        va_start(argptr, format);
+        vsnprintf(data, (size_t) length + 1, format, argptr);
+        va_end(argptr);
+    }
+
+    if (STDREDIRECT_threadWrite(redirection, data, (size_t) length) != STDREDIRECT_ERROR_NO_ERROR) {
+        length = -1;
+    }
+
+    if (data != buffer) {
+        free(data);
+    }
+
+    return length;
+}
+
+
+/**
+ * @brief Commit the partial line collected by STDREDIRECT_threadWrite() on the calling thread.
+ *
+ * @param redirection Pointer to redirection object.
+ * @return ::STDREDIRECT_ERROR
+ */
+static STDREDIRECT_ERROR STDREDIRECT_threadFlush(STDREDIRECT_REDIRECTION* redirection) {
+    STDREDIRECT_THREAD_BUFFER* buffer;
+    STDREDIRECT_ERROR          error = STDREDIRECT_ERROR_NO_ERROR;
+
+    if (!redirection) {
+        return STDREDIRECT_ERROR_NULLPTR;
+    }
+
+    buffer = &STDREDIRECT_threadBuffers[redirection->stream];
+    if (buffer->length > 0 && buffer->redirection == redirection) {
+        error = STDREDIRECT_commit(redirection, buffer->data, buffer->length, STDREDIRECT_threadId());
+        buffer->length = 0;
+    }
+
+    return error;
+}
+
+
+/**
+ * @brief Get the id of the calling thread, as passed on in STDREDIRECT_RECORD::threadId.
+ *
+ * GetCurrentThreadId() on Windows, the kernel thread id on Linux, so it matches the debugger and top, pthread_self()
+ * elsewhere.
+ *
+ * @return Thread id, never 0.
+ */
+static long long STDREDIRECT_threadId() {
+    if (STDREDIRECT_cachedThreadId == 0) {
+#if defined (_WIN32)
+        STDREDIRECT_cachedThreadId = (long long) GetCurrentThreadId();
+#elif defined (__linux__)
+        STDREDIRECT_cachedThreadId = (long long) syscall(SYS_gettid);
+#else
+        STDREDIRECT_cachedThreadId = (long long) (size_t) pthread_self();
+#endif /* _WIN32 */
+    }
+
+    return STDREDIRECT_cachedThreadId;
+}
+
+
+/**
+ * @brief Pass lines of a thread to the redirection, or to the stream itself while it is not redirected.
+ *
+ * @param redirection Pointer to redirection object.
+ * @param data Data.
+ * @param length Number of bytes.
+ * @param threadId Committing thread.
+ * @return ::STDREDIRECT_ERROR
+ */
+static STDREDIRECT_ERROR STDREDIRECT_commit(STDREDIRECT_REDIRECTION* redirection, const char* data, size_t length, long long threadId) {
+    STDREDIRECT_ERROR error;
+    FILE*             stream;
+    size_t            numBytesPublished;
+
+    /* earlier output of the C stream goes to the pipe first, an empty stdio buffer is not flushed */
+    stream = redirection->stream == STDREDIRECT_STREAM_STDOUT ? stdout : stderr;
+#ifdef __linux__
+    if (__fpending(stream) > 0) {
+        fflush(stream);
+    }
+#else
+    fflush(stream);
+#endif /* __linux__ */
+
+    /* the rest of a line that did not fit the queue anymore waits for the lock */
+    numBytesPublished = STDREDIRECT_enqueue(redirection, &STDREDIRECT_threadBuffers[redirection->stream], data, length, threadId);
+    if (numBytesPublished == length) {
+        return STDREDIRECT_ERROR_NO_ERROR;
+    }
+    data += numBytesPublished;
+    length -= numBytesPublished;
+
+    error = STDREDIRECT_injectFromThread(redirection, data, length, threadId);
+    if (error == STDREDIRECT_ERROR_NOT_REDIRECTED) {
+        stream = redirection->stream == STDREDIRECT_STREAM_STDOUT ? stdout : stderr;
+#ifdef _WIN32
+        fwrite(data, 1, length, stream);
+        fflush(stream);
+#else
+        fflush(stream);
+        STDREDIRECT_writeAll(fileno(stream), data, length);
+#endif /* _WIN32 */
+        error = STDREDIRECT_ERROR_NO_ERROR;
+    }
+
+    return error;
+}
+
+
+/**
+ * @brief Publish lines of the calling thread to its queue, for the pipe reader to pass on.
+ *
+ * Takes no lock. The compare-exchange claiming the queue only fails while a thread whose id maps to the same queue
+ * publishes, and the pipe reader is only woken if it was not woken since it last looked at the queues.
+ *
+ * @param redirection Pointer to redirection object.
+ * @param buffer Buffer of the calling thread for the stream of the redirection.
+ * @param data Data.
+ * @param length Number of bytes.
+ * @param threadId Committing thread.
+ * @return Number of bytes published, fewer than @p length if the queue is full, 0 if the redirection takes no lines.
+ */
+static size_t STDREDIRECT_enqueue(STDREDIRECT_REDIRECTION* redirection, STDREDIRECT_THREAD_BUFFER* buffer, const char* data, size_t length, long long threadId) {
+    STDREDIRECT_RING_RECORD record;
+    STDREDIRECT_RING*       ring;
+    long long               head;
+    size_t                  numBytesPublished = 0;
+
+    if (!STDREDIRECT_atomicLoad(&redirection->isQueueing)) {
+        return 0;
+    }
+    if (!buffer->queue || buffer->queueRedirectionId != redirection->id) {
+        buffer->queue = STDREDIRECT_threadQueue(redirection, threadId);
+        buffer->queueRedirectionId = redirection->id;
+        if (!buffer->queue) {
+            return 0;
+        }
+    }
+    ring = &buffer->queue->ring;
+
+    /* unredirect stops the queueing first and then waits for claims, so a claim still seeing it on has the pipe
+       reader pass the lines on */
+    while (!STDREDIRECT_atomicCompareExchange(&buffer->queue->ownerId, 0, threadId)) {
+        STDREDIRECT_yield();
+    }
+    if (STDREDIRECT_atomicLoad(&redirection->isQueueing)) {
+        head                  = STDREDIRECT_atomicLoad(&ring->head);
+        record.globalSequence = 0;
+        record.timestamp      = STDREDIRECT_now();
+        record.threadId       = threadId;
+        while (numBytesPublished < length) {
+            record.length = length - numBytesPublished < STDREDIRECT_INJECT_BUFFER_SIZE ? length - numBytesPublished : STDREDIRECT_INJECT_BUFFER_SIZE;
+            if ((long long) ring->capacity - (head - STDREDIRECT_atomicLoad(&ring->tail)) < (long long) (sizeof(record) + record.length)) {
+                break;
+            }
+            STDREDIRECT_ringCopyIn(ring, head, &record, sizeof(record));
+            STDREDIRECT_ringCopyIn(ring, head + (long long) sizeof(record), data + numBytesPublished, record.length);
+            head += (long long) (sizeof(record) + record.length);
+            numBytesPublished += record.length;
+        }
+        STDREDIRECT_atomicStore(&ring->head, head);
+
+#ifndef _WIN32
+        if (numBytesPublished > 0 && !STDREDIRECT_atomicLoad(&redirection->isCommitPending) && STDREDIRECT_atomicCompareExchange(&redirection->isCommitPending, FALSE, TRUE)) {
+            STDREDIRECT_writeAll(redirection->commitPipeWriteEnd, "", 1);
+        }
+#endif /* _WIN32 */
+    }
+    STDREDIRECT_atomicStore(&buffer->queue->ownerId, 0);
+
+    return numBytesPublished;
+}
+
+
+/**
+ * @brief Get the queue a thread publishes its lines to, allocating it on first use.
+ *
+ * @param redirection Pointer to redirection object.
+ * @param threadId Committing thread.
+ * @return Queue, NULL if out of memory.
+ */
+static STDREDIRECT_THREAD_QUEUE* STDREDIRECT_threadQueue(STDREDIRECT_REDIRECTION* redirection, long long threadId) {
+    STDREDIRECT_THREAD_QUEUE* queue = NULL;
+
+    STDREDIRECT_lock(&redirection->injectLock);
+    if (!redirection->threadQueues) {
+        redirection->threadQueues = (STDREDIRECT_THREAD_QUEUE*) calloc(STDREDIRECT_THREAD_QUEUES, sizeof(STDREDIRECT_THREAD_QUEUE));
+    }
+    if (redirection->threadQueues) {
+        /* Fibonacci hashing spreads consecutive kernel thread ids and aligned pthread_t values alike */
+        queue = &redirection->threadQueues[(size_t) (((unsigned long long) threadId * 0x9E3779B97F4A7C15ULL) >> 32) % STDREDIRECT_THREAD_QUEUES];
+        if (!queue->ring.data) {
+            queue->ring.data = (char*) malloc(STDREDIRECT_THREAD_QUEUE_CAPACITY);
+            queue->ring.capacity = STDREDIRECT_THREAD_QUEUE_CAPACITY;
+        }
+        if (!queue->ring.data) {
+            queue = NULL;
+        }
+    }
+    STDREDIRECT_unlock(&redirection->injectLock);
+
+    return queue;
+}
+
+
+/**
+ * @brief Stop threads publishing lines and wait for those publishing right now, their lines are passed on by the last
+ *        drain of the pipe. Later commits take the lock and find the redirection not injectable.
+ *
+ * @param redirection Pointer to redirection object.
+ */
+static void STDREDIRECT_stopQueueing(STDREDIRECT_REDIRECTION* redirection) {
+    STDREDIRECT_THREAD_QUEUE* threadQueues;
+    size_t                    i;
+
+    STDREDIRECT_atomicStore(&redirection->isQueueing, FALSE);
+
+    STDREDIRECT_lock(&redirection->injectLock);
+    threadQueues = redirection->threadQueues;
+    STDREDIRECT_unlock(&redirection->injectLock);
+
+    if (threadQueues) {
+        for (i = 0; i < STDREDIRECT_THREAD_QUEUES; ++i) {
+            while (STDREDIRECT_atomicLoad(&threadQueues[i].ownerId) != 0) {
+                STDREDIRECT_yield();
+            }
+        }
+    }
+}
+
+
+/**
+ * @brief Spawn child process with its stdout and stderr read by redirections.
+ *
+ * Every captured stream of the child gets a redirection created with the given options, its output reaches the same
+ * callbacks, framing, batching and ring as output of this process, ::STDREDIRECT_BEHAVIOUR_DUPLICATE passes it on to
+ * the stream of this process as well. The streams of this process are left alone. In ::STDREDIRECT_READER_MODE_SHARED
+ * the pipes of all children are read by the shared reactor thread, which also learns of their exits without a thread
+ * per child, otherwise every captured stream is read by a thread of its own. STDREDIRECT_OPTIONS::isPersistent is
+ * ignored.
+ *
+ * The exit callback runs once the child has exited and its captured streams reached end of file, i.e. after everything
+ * written to them by the child, and by descendants that inherited them, was passed on.
+ *
+ * @param argv Null-terminated argument vector, argv[0] is the program, looked up in PATH.
+ * @param envp Null-terminated environment, NULL to inherit the one of this process.
+ * @param stdoutOptions Options of the stdout redirection, NULL to let the child inherit stdout.
+ * @param stderrOptions Options of the stderr redirection, NULL to let the child inherit stderr.
+ * @param exitCallback Exit callback, may be NULL.
+ * @param userdata Passed to exitCallback.
+ * @return Pointer to process object, NULL if no stream is captured or the child could not be started.
+ */
+#ifdef _WIN32
+static STDREDIRECT_PROCESS* STDREDIRECT_spawn(char* const argv[], char* const envp[], const STDREDIRECT_OPTIONS* stdoutOptions, const STDREDIRECT_OPTIONS* stderrOptions, STDREDIRECT_EXIT_CALLBACK exitCallback, void* userdata) {
+    STDREDIRECT_PROCESS*         process;
+    const STDREDIRECT_OPTIONS*   options[2];
+    STARTUPINFOEXA               startupInfo;
+    PROCESS_INFORMATION          processInformation;
+    LPPROC_THREAD_ATTRIBUTE_LIST attributeList              = NULL;
+    SIZE_T                       attributeListSize          = 0;
+    int                          isAttributeListInitialized = FALSE;
+    HANDLE                       standardHandles[3]         = { NULL, NULL, NULL };
+    HANDLE                       inheritedHandles[3];
+    DWORD                        numInheritedHandles        = 0;
+    char*                        commandLine                = NULL;
+    char*                        environment                = NULL;
+    size_t                       i;
+
+    if (!argv || !argv[0] || (!stdoutOptions && !stderrOptions)) {
+        return NULL;
+    }
+
+    process = (STDREDIRECT_PROCESS*) malloc(sizeof(STDREDIRECT_PROCESS));
+    if (!process) {
+        return NULL;
+    }
+    process->redirections[STDREDIRECT_STREAM_STDOUT] = NULL;
+    process->redirections[STDREDIRECT_STREAM_STDERR] = NULL;
+    process->exitCallback                            = exitCallback;
+    process->userdata                                = userdata;
+    process->processHandle                           = NULL;
+    process->waitHandle                              = NULL;
+    process->numOpenStreams                          = 0;
+    process->exitCode                                = STDREDIRECT_EXIT_CODE_UNKNOWN;
+    process->isExited                                = FALSE;
+    STDREDIRECT_initMutex(&process->lock);
+    STDREDIRECT_initCondition(&process->exitCondition);
+
+    /* create pipes and start their readers, the streams of this process stay as they are */
+    options[STDREDIRECT_STREAM_STDOUT] = stdoutOptions;
+    options[STDREDIRECT_STREAM_STDERR] = stderrOptions;
+    for (i = 0; i < 2; ++i) {
+        if (!options[i]) {
+            continue;
+        }
+        process->redirections[i] = STDREDIRECT_createWithOptions((STDREDIRECT_STREAM) i, options[i]);
+        if (!process->redirections[i]) {
+            goto Error;
+        }
+        process->redirections[i]->process = process;
+        if (STDREDIRECT_redirect(process->redirections[i]) != STDREDIRECT_ERROR_NO_ERROR) {
+            goto Error;
+        }
+    }
+
+    commandLine = STDREDIRECT_buildCommandLine(argv);
+    if (!commandLine) {
+        goto Error;
+    }
+    if (envp) {
+        environment = STDREDIRECT_buildEnvironment(envp);
+        if (!environment) {
+            goto Error;
+        }
+    }
+
+    /* inheritable duplicates of stdin, the writable pipe ends and the streams the child inherits, only these are
+       passed on, so children spawned concurrently do not keep each other's pipes open */
+    standardHandles[0] = STDREDIRECT_inheritableHandle(GetStdHandle(STD_INPUT_HANDLE));
+    for (i = 0; i < 2; ++i) {
+        standardHandles[i + 1] = STDREDIRECT_inheritableHandle(process->redirections[i] ? process->redirections[i]->writablePipeEnd : GetStdHandle(i == STDREDIRECT_STREAM_STDOUT ? STD_OUTPUT_HANDLE : STD_ERROR_HANDLE));
+    }
+    for (i = 0; i < 3; ++i) {
+        if (standardHandles[i]) {
+            inheritedHandles[numInheritedHandles++] = standardHandles[i];
+        }
+    }
+    InitializeProcThreadAttributeList(NULL, 1, 0, &attributeListSize);
+    attributeList = (LPPROC_THREAD_ATTRIBUTE_LIST) malloc(attributeListSize);
+    if (!attributeList || !InitializeProcThreadAttributeList(attributeList, 1, 0, &attributeListSize)) {
+        goto Error;
+    }
+    isAttributeListInitialized = TRUE;
+    if (numInheritedHandles > 0 && !UpdateProcThreadAttribute(attributeList, 0, PROC_THREAD_ATTRIBUTE_HANDLE_LIST, inheritedHandles, numInheritedHandles * sizeof(HANDLE), NULL, NULL)) {
+        goto Error;
+    }
+
+    ZeroMemory(&startupInfo, sizeof(startupInfo));
+    startupInfo.StartupInfo.cb         = sizeof(startupInfo);
+    startupInfo.StartupInfo.dwFlags    = STARTF_USESTDHANDLES;
+    startupInfo.StartupInfo.hStdInput  = standardHandles[0];
+    startupInfo.StartupInfo.hStdOutput = standardHandles[1];
+    startupInfo.StartupInfo.hStdError  = standardHandles[2];
+    startupInfo.lpAttributeList        = attributeList;
+    if (!CreateProcessA(NULL, commandLine, NULL, NULL, numInheritedHandles > 0, EXTENDED_STARTUPINFO_PRESENT, environment, NULL, &startupInfo.StartupInfo, &processInformation)) {
+        goto Error;
+    }
+    CloseHandle(processInformation.hThread);
+    process->processHandle = processInformation.hProcess;
+
+    /* only the child holds the writable pipe ends now, the pipes break once it and its descendants are done, then the
+       reader waits for the exit; the streams are counted only now, so the pipes of a child that was never started
+       do not report an exit */
+    for (i = 0; i < 3; ++i) {
+        if (standardHandles[i]) {
+            CloseHandle(standardHandles[i]);
+        }
+    }
+    for (i = 0; i < 2; ++i) {
+        if (process->redirections[i]) {
+            STDREDIRECT_atomicAdd(&process->numOpenStreams, 1);
+            CloseHandle(process->redirections[i]->writablePipeEnd);
+            process->redirections[i]->writablePipeEnd = NULL;
+        }
+    }
+
+    DeleteProcThreadAttributeList(attributeList);
+    free(attributeList);
+    free(environment);
+    free(commandLine);
+
+    return process;
+
+Error:
+    /* cleanup */
+    for (i = 0; i < 3; ++i) {
+        if (standardHandles[i]) {
+            CloseHandle(standardHandles[i]);
+        }
+    }
+    if (isAttributeListInitialized) {
+        DeleteProcThreadAttributeList(attributeList);
+    }
+    free(attributeList);
+    free(environment);
+    free(commandLine);
+    STDREDIRECT_destroyProcess(process);
+
+    return NULL;
+}
+#else
+static STDREDIRECT_PROCESS* STDREDIRECT_spawn(char* const argv[], char* const envp[], const STDREDIRECT_OPTIONS* stdoutOptions, const STDREDIRECT_OPTIONS* stderrOptions, STDREDIRECT_EXIT_CALLBACK exitCallback, void* userdata) {
+    STDREDIRECT_PROCESS*       process;
+    const STDREDIRECT_OPTIONS* options[2];
+    posix_spawn_file_actions_t fileActions;
+    int                        isFileActionsInitialized = FALSE;
+    size_t                     i;
+
+    if (!argv || !argv[0] || (!stdoutOptions && !stderrOptions)) {
+        return NULL;
+    }
+
+    process = (STDREDIRECT_PROCESS*) malloc(sizeof(STDREDIRECT_PROCESS));
+    if (!process) {
+        return NULL;
+    }
+    process->redirections[STDREDIRECT_STREAM_STDOUT] = NULL;
+    process->redirections[STDREDIRECT_STREAM_STDERR] = NULL;
+    process->exitCallback                            = exitCallback;
+    process->userdata                                = userdata;
+    process->pid                                     = -1;
+    process->pidFileDescriptor                       = -1;
+    process->numOpenStreams                          = 0;
+    process->exitCode                                = STDREDIRECT_EXIT_CODE_UNKNOWN;
+    process->isExited                                = FALSE;
+    STDREDIRECT_initMutex(&process->lock);
+    STDREDIRECT_initCondition(&process->exitCondition);
+
+    /* create pipes and hand them to their readers, the streams of this process stay as they are */
+    options[STDREDIRECT_STREAM_STDOUT] = stdoutOptions;
+    options[STDREDIRECT_STREAM_STDERR] = stderrOptions;
+    for (i = 0; i < 2; ++i) {
+        if (!options[i]) {
+            continue;
+        }
+        process->redirections[i] = STDREDIRECT_createWithOptions((STDREDIRECT_STREAM) i, options[i]);
+        if (!process->redirections[i]) {
+            goto Error;
+        }
+        process->redirections[i]->process = process;
+        process->redirections[i]->isPersistent = FALSE;
+        if (STDREDIRECT_redirect(process->redirections[i]) != STDREDIRECT_ERROR_NO_ERROR) {
+            goto Error;
+        }
+        STDREDIRECT_atomicAdd(&process->numOpenStreams, 1);
+    }
+
+    /* the writable pipe ends become the streams of the child, all other pipe ends are closed on exec */
+    if (posix_spawn_file_actions_init(&fileActions) != 0) {
+        goto Error;
+    }
+    isFileActionsInitialized = TRUE;
+    for (i = 0; i < 2; ++i) {
+        if (process->redirections[i] && posix_spawn_file_actions_adddup2(&fileActions, process->redirections[i]->writablePipeEnd, i == STDREDIRECT_STREAM_STDOUT ? STDOUT_FILENO : STDERR_FILENO) != 0) {
+            goto Error;
+        }
+    }
+    if (posix_spawnp(&process->pid, argv[0], &fileActions, NULL, argv, envp ? envp : environ) != 0) {
+        process->pid = -1;
+        goto Error;
+    }
+    posix_spawn_file_actions_destroy(&fileActions);
+
+    /* only the child holds the writable pipe ends now, the pipes reach end of file once it and its descendants are
+       done, then the reader reaps it */
+    for (i = 0; i < 2; ++i) {
+        if (process->redirections[i]) {
+            close(process->redirections[i]->writablePipeEnd);
+            process->redirections[i]->writablePipeEnd = -1;
+        }
+    }
+
+    return process;
 
 Error:
     /* cleanup */
+    if (isFileActionsInitialized) {
+        posix_spawn_file_actions_destroy(&fileActions);
+    }
+    STDREDIRECT_destroyProcess(process);
+
+    return NULL;
+}
+#endif /* _WIN32 */
+
+
+/**
+ * @brief Wait until the exit callback of a child process has returned.
+ *
+ * Must not be called from a callback of the process, which runs on its pipe reader.
+ *
+ * @param process Pointer to process object.
+ * @param exitCode Set to the exit code passed to the exit callback, may be NULL.
+ * @return ::STDREDIRECT_ERROR
+ */
+static STDREDIRECT_ERROR STDREDIRECT_waitProcess(STDREDIRECT_PROCESS* process, int* exitCode) {
+    if (!process) {
+        return STDREDIRECT_ERROR_NULLPTR;
+    }
+
+    STDREDIRECT_lock(&process->lock);
+    while (!process->isExited) {
+        STDREDIRECT_wait(&process->exitCondition, &process->lock);
+    }
+    if (exitCode) {
+        *exitCode = process->exitCode;
+    }
+    STDREDIRECT_unlock(&process->lock);
+
+    return STDREDIRECT_ERROR_NO_ERROR;
+}
+
+
+/**
+ * @brief Wait for child process to exit, then free it and its redirections.
+ *
+ * Must not be called from a callback of the process.
+ *
+ * @param process Pointer to process object.
+ * @return ::STDREDIRECT_ERROR
+ */
+static STDREDIRECT_ERROR STDREDIRECT_destroyProcess(STDREDIRECT_PROCESS* process) {
+    STDREDIRECT_ERROR error = STDREDIRECT_ERROR_NO_ERROR;
+    size_t            i;
+
+    if (!process) {
+        return STDREDIRECT_ERROR_NULLPTR;
+    }
+
+#ifdef _WIN32
+    if (process->processHandle) {
+        STDREDIRECT_waitProcess(process, NULL);
+
+        /* wait for the thread pool callback posting the exit to return */
+        if (process->waitHandle) {
+            UnregisterWaitEx(process->waitHandle, INVALID_HANDLE_VALUE);
+        }
+        CloseHandle(process->processHandle);
+    }
+#else
+    if (process->pid != -1) {
+        STDREDIRECT_waitProcess(process, NULL);
+    }
+#endif /* _WIN32 */
+
+    for (i = 0; i < 2; ++i) {
+        if (process->redirections[i] && STDREDIRECT_destroy(process->redirections[i]) != STDREDIRECT_ERROR_NO_ERROR) {
+            error = STDREDIRECT_ERROR_UNREDIRECT;
+        }
+    }
+    STDREDIRECT_destroyCondition(&process->exitCondition);
+    STDREDIRECT_destroyMutex(&process->lock);
+    free(process);
+
+    return error;
+}
+
+
+/**
+ * @brief Pass on what is left of the output of an exited child process, then report the exit.
+ *
+ * @param process Pointer to process object.
+ * @param exitCode Exit code passed to the exit callback.
+ */
+static void STDREDIRECT_exited(STDREDIRECT_PROCESS* process, int exitCode) {
+    STDREDIRECT_REDIRECTION* redirection;
+    size_t                   i;
+
+    /* partial lines, summaries and pending batches, in asynchronous mode after the ring */
+    for (i = 0; i < 2; ++i) {
+        redirection = process->redirections[i];
+        if (!redirection) {
+            continue;
+        }
+        if (redirection->isDispatcherRunning) {
+            STDREDIRECT_flushDispatcher(redirection);
+        }
+        else {
+            STDREDIRECT_lock(&redirection->injectLock);
+            STDREDIRECT_flushAll(redirection);
+            STDREDIRECT_unlock(&redirection->injectLock);
+        }
+    }
+
+    if (process->exitCallback) {
+        process->exitCallback(process, exitCode, process->userdata);
+    }
+
+    STDREDIRECT_lock(&process->lock);
+    process->exitCode = exitCode;
+    process->isExited = TRUE;
+    STDREDIRECT_broadcast(&process->exitCondition);
+    STDREDIRECT_unlock(&process->lock);
+}
+
+
+#ifdef _WIN32
+#ifdef STDREDIRECT_IOCP
+/**
+ * @brief Thread pool callback run when a child process exits after its captured streams reached end of file.
+ *
+ * Runs in the wait thread, which waits for many processes at once, and only posts the exit to the reactor, which
+ * reports it after everything it read.
+ *
+ * @param parameter Pointer to the redirection that reached end of file last.
+ * @param isTimedOut Unused, the wait has no timeout.
+ */
+static VOID CALLBACK STDREDIRECT_exitWaitCallback(PVOID parameter, BOOLEAN isTimedOut) {
+    (void) isTimedOut;
+
+    PostQueuedCompletionStatus(STDREDIRECT_reactor.completionPort, 0, (ULONG_PTR) parameter, NULL);
+}
+#endif /* STDREDIRECT_IOCP */
+
+
+/**
+ * @brief Quote argument vector into a command line, so the C runtime of the child splits it into the same arguments.
+ *
+ * @param argv Null-terminated argument vector.
+ * @return Command line, free() it; NULL on error.
+ */
+static char* STDREDIRECT_buildCommandLine(char* const argv[]) {
+    char*       commandLine;
+    char*       position;
+    const char* argument;
+    size_t      length = 1;
+    size_t      numBackslashes;
+    size_t      i;
+    size_t      j;
+
+    /* at worst every character is escaped, plus quotes and separator */
+    for (i = 0; argv[i]; ++i) {
+        length += 2 * strlen(argv[i]) + 3;
+    }
+    commandLine = (char*) malloc(length);
+    if (!commandLine) {
+        return NULL;
+    }
+
+    position = commandLine;
+    for (i = 0; argv[i]; ++i) {
+        if (i > 0) {
+            *position++ = ' ';
+        }
+        *position++ = '"';
+        for (argument = argv[i]; ; ++argument) {
+            /* backslashes are only special in front of a quote */
+            for (numBackslashes = 0; *argument == '\\'; ++argument) {
+                ++numBackslashes;
+            }
+            if (*argument == '\0') {
+                for (j = 0; j < 2 * numBackslashes; ++j) {
+                    *position++ = '\\';
+                }
+                break;
+            }
+            if (*argument == '"') {
+                numBackslashes = 2 * numBackslashes + 1;
+            }
+            for (j = 0; j < numBackslashes; ++j) {
+                *position++ = '\\';
+            }
+            *position++ = *argument;
+        }
+        *position++ = '"';
+    }
+    *position = '\0';
+
+    return commandLine;
+}
+
+
+/**
+ * @brief Join environment variables into an environment block.
+ *
+ * @param envp Null-terminated array of "name=value" strings.
+ * @return Environment block, free() it; NULL on error.
+ */
+static char* STDREDIRECT_buildEnvironment(char* const envp[]) {
+    char*  environment;
+    size_t length = 2;
+    size_t offset = 0;
+    size_t i;
+
+    for (i = 0; envp[i]; ++i) {
+        length += strlen(envp[i]) + 1;
+    }
+    environment = (char*) malloc(length);
+    if (!environment) {
+        return NULL;
+    }
+
+    for (i = 0; envp[i]; ++i) {
+        memcpy(environment + offset, envp[i], strlen(envp[i]) + 1);
+        offset += strlen(envp[i]) + 1;
+    }
+    environment[offset++] = '\0';
+    environment[offset] = '\0';
+
+    return environment;
+}
+
+
+/**
+ * @brief Duplicate handle as inheritable.
+ *
+ * @param handle Handle, may be NULL or INVALID_HANDLE_VALUE.
+ * @return Inheritable duplicate, NULL if there is none.
+ */
+static HANDLE STDREDIRECT_inheritableHandle(HANDLE handle) {
+    HANDLE duplicate;
+
+    if (!handle || handle == INVALID_HANDLE_VALUE) {
+        return NULL;
+    }
+    if (!DuplicateHandle(GetCurrentProcess(), handle, GetCurrentProcess(), &duplicate, 0, TRUE, DUPLICATE_SAME_ACCESS)) {
+        return NULL;
+    }
+
+    return duplicate;
+}
+#endif /* _WIN32 */
+
+
+/**
+ * @brief Note end of file on the pipe of a child process, runs on its pipe reader.
+ *
+ * Once all captured streams are closed the child is reaped. If it has not exited yet the shared reader watches its
+ * pidfd on Linux, or has a thread pool wait thread post the exit to the completion port on Windows, or polls for the
+ * exit on its timeout where neither is possible, rather than block; a dedicated reader waits for it.
+ *
+ * @param redirection Pointer to redirection object.
+ */
+static void STDREDIRECT_endOfFile(STDREDIRECT_REDIRECTION* redirection) {
+    STDREDIRECT_PROCESS* process  = redirection->process;
+    int                  exitCode = 0;
+#if defined (STDREDIRECT_EPOLL) && defined (SYS_pidfd_open)
+    struct epoll_event   event;
+#endif /* STDREDIRECT_EPOLL && SYS_pidfd_open */
+
+    redirection->isEndOfFile = TRUE;
+    if (!process || STDREDIRECT_atomicAdd(&process->numOpenStreams, -1) != 0) {
+        return;
+    }
+
+    if (!STDREDIRECT_reap(process, FALSE, &exitCode)) {
+#ifdef STDREDIRECT_SHARED_READER
+        if (redirection->readerMode == STDREDIRECT_READER_MODE_SHARED) {
+#if defined (STDREDIRECT_EPOLL) && defined (SYS_pidfd_open)
+            process->pidFileDescriptor = (int) syscall(SYS_pidfd_open, process->pid, 0);
+            if (process->pidFileDescriptor != -1) {
+                event.events   = EPOLLIN;
+                event.data.ptr = redirection;
+                if (epoll_ctl(STDREDIRECT_reactor.epollFileDescriptor, EPOLL_CTL_ADD, process->pidFileDescriptor, &event) == 0) {
+                    return;
+                }
+                close(process->pidFileDescriptor);
+                process->pidFileDescriptor = -1;
+            }
+#endif /* STDREDIRECT_EPOLL && SYS_pidfd_open */
+#ifdef STDREDIRECT_IOCP
+            /* a wait thread of the thread pool waits for many processes at once */
+            if (RegisterWaitForSingleObject(&process->waitHandle, process->processHandle, STDREDIRECT_exitWaitCallback, redirection, INFINITE, WT_EXECUTEONLYONCE | WT_EXECUTEINWAITTHREAD)) {
+                return;
+            }
+            process->waitHandle = NULL;
+#endif /* STDREDIRECT_IOCP */
+
+            /* no pidfd (old kernel, seccomp, out of file descriptors) or wait, the reactor must not block on the child */
+            redirection->isExitPolled = TRUE;
+            return;
+        }
+#endif /* STDREDIRECT_SHARED_READER */
+
+        /* the child closed its streams, so it usually exits right away */
+        STDREDIRECT_reap(process, TRUE, &exitCode);
+    }
+
+    STDREDIRECT_exited(process, exitCode);
+}
+
+
+/**
+ * @brief Collect exit status of child process.
+ *
+ * @param process Pointer to process object.
+ * @param isBlocking Wait for the child to exit.
+ * @param exitCode Set to the exit code, minus the signal number if the child was killed by a signal (POSIX) or
+ *        STDREDIRECT_EXIT_CODE_UNKNOWN if it was reaped elsewhere or cannot be queried.
+ * @return TRUE once the child has exited, FALSE if it is still running.
+ */
+#ifdef _WIN32
+static int STDREDIRECT_reap(STDREDIRECT_PROCESS* process, int isBlocking, int* exitCode) {
+    DWORD waitResult;
+    DWORD processExitCode;
+
+    waitResult = WaitForSingleObject(process->processHandle, isBlocking ? INFINITE : 0);
+    if (waitResult == WAIT_TIMEOUT) {
+        return FALSE;
+    }
+
+    if (waitResult != WAIT_OBJECT_0 || !GetExitCodeProcess(process->processHandle, &processExitCode)) {
+        *exitCode = STDREDIRECT_EXIT_CODE_UNKNOWN;
+    }
+    else {
+        *exitCode = (int) processExitCode;
+    }
+
+    return TRUE;
+}
+#else
+static int STDREDIRECT_reap(STDREDIRECT_PROCESS* process, int isBlocking, int* exitCode) {
+    pid_t result;
+    int   status;
+
+    do {
+        result = waitpid(process->pid, &status, isBlocking ? 0 : WNOHANG);
+    } while (result == -1 && errno == EINTR);
+
+    if (result == 0) {
+        return FALSE;
+    }
+
+    if (result == -1) {
+        *exitCode = STDREDIRECT_EXIT_CODE_UNKNOWN;
+    }
+    else if (WIFEXITED(status)) {
+        *exitCode = WEXITSTATUS(status);
+    }
+    else if (WIFSIGNALED(status)) {
+        *exitCode = -WTERMSIG(status);
+    }
+    else {
+        *exitCode = STDREDIRECT_EXIT_CODE_UNKNOWN;
+    }
+
+    return TRUE;
+}
+#endif /* _WIN32 */
+
+
+/**
+ * @brief Buffered pipe reader, runs in separate thread.
+ *
+ * Reads until the pipe is empty and all its writable ends are closed, so everything written before unredirect is
+ * passed on. On Windows it also stops at an empty pipe once the exit thread event is signalled, as a writable end may
+ * have been inherited by a child process.
+ *
+ * @param redirection Pointer to redirection object.
+ */
+#ifdef _WIN32
+static void WINAPI STDREDIRECT_bufferedPipeReader(STDREDIRECT_REDIRECTION* redirection) {
+    DWORD     numBytesRead;
+    DWORD     numBytesAvailable;
+    DWORD     lastError;
+    BOOL      isRead;
+    FILETIME  dueTime;
+    long long timeout;
+
+    /* read from pipe until all writable ends are closed */
+    for (;;) {
+        /* flush all streams so they become readable */
+        if (fflush(NULL) == EOF) {
+            goto Error;
+        }
+
+        /* anonymous pipes cannot be read with a timeout, the timer cancels the read when the next timeout is due and
+           again every STDREDIRECT_THREAD_EXIT_POLL_MS until it is re-armed, in case the read had not started yet */
+        STDREDIRECT_handleTimeouts(redirection);
+        timeout = STDREDIRECT_nextTimeout(redirection);
+        if (timeout == -1) {
+            SetThreadpoolTimer(redirection->timeoutTimer, NULL, 0, 0);
+        }
+        else {
+            /* relative due time in 100 ns units */
+            timeout = -(timeout * 10 + 1);
+            dueTime.dwLowDateTime  = (DWORD) timeout;
+            dueTime.dwHighDateTime = (DWORD) ((unsigned long long) timeout >> 32);
+            SetThreadpoolTimer(redirection->timeoutTimer, &dueTime, STDREDIRECT_THREAD_EXIT_POLL_MS, 0);
+        }
+
+        /* asked to exit: stop once the pipe is empty */
+        if (WaitForSingleObject(redirection->exitThreadEvent, 0) == WAIT_OBJECT_0) {
+            if (!PeekNamedPipe(redirection->readablePipeEnd, NULL, 0, NULL, &numBytesAvailable, NULL) || numBytesAvailable == 0) {
+                goto Exit;
+            }
+        }
+
+        /* read from readable pipe end, blocks until input is available or the timer or unredirect cancels the read */
+        STDREDIRECT_lock(&redirection->injectLock);
+        redirection->isReading = TRUE;
+        STDREDIRECT_unlock(&redirection->injectLock);
+        isRead = ReadFile(redirection->readablePipeEnd, (void*) redirection->buffer, (DWORD) redirection->bufferSize, &numBytesRead, NULL);
+        lastError = GetLastError();
+        STDREDIRECT_lock(&redirection->injectLock);
+        redirection->isReading = FALSE;
+        STDREDIRECT_unlock(&redirection->injectLock);
+        if (!isRead) {
+            if (lastError == ERROR_BROKEN_PIPE) {
+                STDREDIRECT_endOfFile(redirection);
+                goto Exit;
+            }
+            if (lastError == ERROR_OPERATION_ABORTED) {
+                continue;
+            }
+            goto Error;
+        }
+        STDREDIRECT_passChunk(redirection, numBytesRead);
+    }
+
+Exit:
+    ExitThread(EXIT_SUCCESS);
+
+Error:
+    /* cleanup */
+
+    /* close handle and set thread handle to null before unredirect so it doesn't wait for this thread */
+    CloseHandle(redirection->thread);
+    redirection->thread = NULL;
+    STDREDIRECT_unredirect(redirection);
+
+    redirection->error = STDREDIRECT_ERROR_THREAD;
+
+    ExitThread(EXIT_FAILURE);
+}
+
+
+/**
+ * @brief Pass chunk read into the pipe reader buffer on, runs on the pipe reader or reactor thread.
+ *
+ * @param redirection Pointer to redirection object.
+ * @param numBytesRead Number of bytes read, an empty read is only counted.
+ */
+static void STDREDIRECT_passChunk(STDREDIRECT_REDIRECTION* redirection, DWORD numBytesRead) {
+    DWORD     numBytesAvailable;
+    DWORD     numBytesDuplicated;
+    DWORD     numBytesWritten;
+    long long globalSequence;
+    long long timestamp;
+    long long blockedTimeUs;
+
+    STDREDIRECT_statAdd(&redirection->stats.reads, 1);
+    if (numBytesRead == 0) {
+        return;
+    }
+
+    STDREDIRECT_lock(&redirection->injectLock);
+    timestamp = STDREDIRECT_now();
+    blockedTimeUs = redirection->stats.blockedTimeUs;
+    STDREDIRECT_countChunk(redirection, numBytesRead);
+
+    /* duplicate output to original stream, the data is written as is and must not be used as format string */
+    if (redirection->behaviour == STDREDIRECT_BEHAVIOUR_DUPLICATE) {
+        for (numBytesDuplicated = 0; numBytesDuplicated < numBytesRead; numBytesDuplicated += numBytesWritten) {
+            if (!WriteFile(redirection->stdHandle, redirection->buffer + numBytesDuplicated, numBytesRead - numBytesDuplicated, &numBytesWritten, NULL)) {
+                break;
+            }
+        }
+    }
+
+    globalSequence = STDREDIRECT_atomicAdd(&STDREDIRECT_globalSequence, 1);
+    if (redirection->ring.data) {
+        STDREDIRECT_push(redirection, redirection->buffer, numBytesRead, globalSequence, timestamp, 0);
+        STDREDIRECT_wake(redirection, &redirection->isDispatcherWaiting);
+    }
+    else {
+        STDREDIRECT_switchThread(redirection, 0);
+        redirection->globalSequence = globalSequence;
+        redirection->timestamp = timestamp;
+        STDREDIRECT_process(redirection, redirection->buffer, numBytesRead);
+    }
+
+    /* time waiting for room in the ring is not busy */
+    STDREDIRECT_statAdd(&redirection->stats.busyTimeUs, STDREDIRECT_now() - timestamp - (redirection->stats.blockedTimeUs - blockedTimeUs));
+
+    /* the burst is what was read plus what is still waiting in the pipe */
+    numBytesAvailable = 0;
+    if (redirection->isAdaptive) {
+        PeekNamedPipe(redirection->readablePipeEnd, NULL, 0, NULL, &numBytesAvailable, NULL);
+    }
+    STDREDIRECT_adapt(redirection, (size_t) numBytesRead + numBytesAvailable);
+    STDREDIRECT_unlock(&redirection->injectLock);
+}
+
+
+/**
+ * @brief Thread pool callback cancelling the pipe read once a batch, summary or statistics are due.
+ *
+ * Only a pending ReadFile() of the pipe reader is cancelled, not I/O of the callbacks it runs.
+ *
+ * @param instance Unused.
+ * @param context Pointer to redirection object.
+ * @param timer Unused.
+ */
+static VOID CALLBACK STDREDIRECT_timeoutTimerCallback(PTP_CALLBACK_INSTANCE instance, PVOID context, PTP_TIMER timer) {
+    STDREDIRECT_REDIRECTION* redirection = (STDREDIRECT_REDIRECTION*) context;
+
+    (void) instance;
+    (void) timer;
+
+    STDREDIRECT_lock(&redirection->injectLock);
+    if (redirection->isReading && redirection->thread) {
+        CancelSynchronousIo(redirection->thread);
+    }
+    STDREDIRECT_unlock(&redirection->injectLock);
+}
+#else
+static void* STDREDIRECT_bufferedPipeReader(void* parameter) {
+    STDREDIRECT_REDIRECTION* redirection = (STDREDIRECT_REDIRECTION*) parameter;
+    struct pollfd            pollFileDescriptors[3];
+    int                      isExitRequested = FALSE;
+    int                      result;
+    long long                timeout;
+#ifdef __linux__
+    struct timespec          timeoutSpec;
+#endif /* __linux__ */
+
+    pollFileDescriptors[0].fd     = redirection->readablePipeEnd;
+    pollFileDescriptors[0].events = POLLIN;
+    pollFileDescriptors[1].fd     = redirection->exitPipeReadEnd;
+    pollFileDescriptors[1].events = POLLIN;
+    pollFileDescriptors[2].fd     = redirection->commitPipeReadEnd;
+    pollFileDescriptors[2].events = POLLIN;
+
+    while (!isExitRequested) {
+        /* block until output is available or published, unredirect asks the thread to exit or a pending batch or
+           statistics are due */
+        timeout = STDREDIRECT_nextTimeout(redirection);
+#ifdef __linux__
+        timeoutSpec.tv_sec  = (time_t) (timeout / 1000000);
+        timeoutSpec.tv_nsec = (long) (timeout % 1000000 * 1000);
+        if (ppoll(pollFileDescriptors, 3, timeout == -1 ? NULL : &timeoutSpec, NULL) == -1) {
+#else
+        if (poll(pollFileDescriptors, 3, timeout == -1 ? -1 : (int) ((timeout + 999) / 1000)) == -1) {
+#endif /* __linux__ */
+            if (errno == EINTR) {
+                continue;
+            }
+            goto Error;
+        }
+        if (pollFileDescriptors[1].revents) {
+            isExitRequested = TRUE;
+        }
+
+        /* drain pipe, on exit request this picks up everything written before the stream was restored */
+        result = STDREDIRECT_lockedDrain(redirection);
+        if (result == -1) {
+            goto Error;
+        }
+
+        /* all writable ends closed by a child process, stop polling the pipe */
+        if (result == 1 && !redirection->isEndOfFile) {
+            pollFileDescriptors[0].fd = -1;
+            STDREDIRECT_endOfFile(redirection);
+        }
+
+        STDREDIRECT_handleTimeouts(redirection);
+    }
+
+    return NULL;
+
+Error:
+    redirection->error = STDREDIRECT_ERROR_THREAD;
+
+    return NULL;
+}
+
+
+/**
+ * @brief Read everything currently in the pipe and pass it on, runs on the pipe reader or reactor thread, in
+ *        STDREDIRECT_inject() or STDREDIRECT_unredirect(), always with STDREDIRECT_REDIRECTION::injectLock held.
+ *
+ * @param redirection Pointer to redirection object.
+ * @return 0 once the pipe is empty, 1 once all its writable ends are closed, -1 on error.
+ */
+static int STDREDIRECT_drain(STDREDIRECT_REDIRECTION* redirection) {
+    ssize_t   numBytesRead;
+    long long globalSequence;
+    long long timestamp;
+    long long start         = STDREDIRECT_now();
+    long long blockedTimeUs = redirection->stats.blockedTimeUs;
+    long long heads[STDREDIRECT_THREAD_QUEUES];
+    size_t    burst         = 0;
+    int       isQueued;
+    int       result;
+
+    /* lines published up to here go after whatever their threads wrote to the pipe before */
+    isQueued = STDREDIRECT_snapshotThreadQueues(redirection, heads);
+
+    for (;;) {
+        numBytesRead = STDREDIRECT_read(redirection);
+        STDREDIRECT_statAdd(&redirection->stats.reads, 1);
+        if (numBytesRead > 0) {
+            globalSequence = STDREDIRECT_atomicAdd(&STDREDIRECT_globalSequence, 1);
+            timestamp = STDREDIRECT_now();
+            STDREDIRECT_countChunk(redirection, (size_t) numBytesRead);
+            burst += (size_t) numBytesRead;
+
+            if (redirection->ring.data) {
+                STDREDIRECT_push(redirection, redirection->buffer, (size_t) numBytesRead, globalSequence, timestamp, 0);
+                STDREDIRECT_wake(redirection, &redirection->isDispatcherWaiting);
+            }
+            else {
+                STDREDIRECT_switchThread(redirection, 0);
+                redirection->globalSequence = globalSequence;
+                redirection->timestamp = timestamp;
+                STDREDIRECT_process(redirection, redirection->buffer, (size_t) numBytesRead);
+            }
+        }
+        else if (numBytesRead == -1 && errno == EINTR) {
+            continue;
+        }
+        else {
+            result = numBytesRead == 0 ? 1 : errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+            break;
+        }
+    }
+
+    if (isQueued) {
+        STDREDIRECT_passThreadLines(redirection, heads);
+    }
+
+    /* time waiting for room in the ring is not busy */
+    STDREDIRECT_statAdd(&redirection->stats.busyTimeUs, STDREDIRECT_now() - start - (redirection->stats.blockedTimeUs - blockedTimeUs));
+
+    if (burst > 0) {
+        STDREDIRECT_adapt(redirection, burst);
+    }
+
+    return result;
+}
+
+
+/**
+ * @brief STDREDIRECT_drain() taking STDREDIRECT_REDIRECTION::injectLock, runs on the pipe reader or reactor thread or
+ *        in STDREDIRECT_unredirect() when parking.
+ *
+ * @param redirection Pointer to redirection object.
+ * @return 0 once the pipe is empty, 1 once all its writable ends are closed, -1 on error.
+ */
+static int STDREDIRECT_lockedDrain(STDREDIRECT_REDIRECTION* redirection) {
+    int result;
+
+    STDREDIRECT_lock(&redirection->injectLock);
+    result = STDREDIRECT_drain(redirection);
+    STDREDIRECT_unlock(&redirection->injectLock);
+
+    return result;
+}
+
+
+/**
+ * @brief Note how far the queues of STDREDIRECT_threadWrite() are filled, runs in STDREDIRECT_drain().
+ *
+ * Takes back the flag of the woken pipe reader first, so a thread publishing later wakes it again.
+ *
+ * @param redirection Pointer to redirection object.
+ * @param heads Receives the head of every queue, STDREDIRECT_THREAD_QUEUES entries.
+ * @return TRUE if any queue holds lines.
+ */
+static int STDREDIRECT_snapshotThreadQueues(STDREDIRECT_REDIRECTION* redirection, long long* heads) {
+    STDREDIRECT_RING* ring;
+    char              wakeups[64];
+    int               isQueued = FALSE;
+    size_t            i;
+
+    if (!redirection->threadQueues) {
+        return FALSE;
+    }
+
+    STDREDIRECT_atomicStore(&redirection->isCommitPending, FALSE);
+    while (read(redirection->commitPipeReadEnd, wakeups, sizeof(wakeups)) > 0) {
+    }
+
+    for (i = 0; i < STDREDIRECT_THREAD_QUEUES; ++i) {
+        ring = &redirection->threadQueues[i].ring;
+        heads[i] = ring->data ? STDREDIRECT_atomicLoad(&ring->head) : 0;
+        if (heads[i] != STDREDIRECT_atomicLoad(&ring->tail)) {
+            isQueued = TRUE;
+        }
+    }
+
+    return isQueued;
+}
+
+
+/**
+ * @brief Pass on the lines of STDREDIRECT_threadWrite() published up to the given heads, oldest first; the lines of
+ *        one thread are in one queue and keep their order.
+ *
+ * @param redirection Pointer to redirection object.
+ * @param heads Heads noted by STDREDIRECT_snapshotThreadQueues().
+ */
+static void STDREDIRECT_passThreadLines(STDREDIRECT_REDIRECTION* redirection, const long long* heads) {
+    char                    buffer[STDREDIRECT_INJECT_BUFFER_SIZE + 1];
+    STDREDIRECT_RING*       ring;
+    STDREDIRECT_RING_RECORD record;
+    STDREDIRECT_RING_RECORD oldest;
+    long long               tail;
+    long long               globalSequence;
+    size_t                  oldestIndex;
+    size_t                  i;
+
+    for (;;) {
+        oldestIndex = STDREDIRECT_THREAD_QUEUES;
+        for (i = 0; i < STDREDIRECT_THREAD_QUEUES; ++i) {
+            ring = &redirection->threadQueues[i].ring;
+            tail = STDREDIRECT_atomicLoad(&ring->tail);
+            if (tail != heads[i]) {
+                STDREDIRECT_ringCopyOut(ring, tail, &record, sizeof(record));
+                if (oldestIndex == STDREDIRECT_THREAD_QUEUES || record.timestamp < oldest.timestamp) {
+                    oldest = record;
+                    oldestIndex = i;
+                }
+            }
+        }
+        if (oldestIndex == STDREDIRECT_THREAD_QUEUES) {
+            break;
+        }
+
+        /* the callbacks may null-terminate the data in place */
+        ring = &redirection->threadQueues[oldestIndex].ring;
+        tail = STDREDIRECT_atomicLoad(&ring->tail);
+        STDREDIRECT_ringCopyOut(ring, tail + (long long) sizeof(oldest), buffer, oldest.length);
+        STDREDIRECT_atomicStore(&ring->tail, tail + (long long) (sizeof(oldest) + oldest.length));
+
+        if (redirection->behaviour == STDREDIRECT_BEHAVIOUR_DUPLICATE) {
+            STDREDIRECT_writeAll(redirection->originalFileDescriptor, buffer, oldest.length);
+        }
+
+        globalSequence = STDREDIRECT_atomicAdd(&STDREDIRECT_globalSequence, 1);
+        STDREDIRECT_countChunk(redirection, oldest.length);
+        if (redirection->ring.data) {
+            STDREDIRECT_push(redirection, buffer, oldest.length, globalSequence, oldest.timestamp, oldest.threadId);
+            STDREDIRECT_wake(redirection, &redirection->isDispatcherWaiting);
+        }
+        else {
+            STDREDIRECT_switchThread(redirection, oldest.threadId);
+            redirection->globalSequence = globalSequence;
+            redirection->timestamp = oldest.timestamp;
+            STDREDIRECT_process(redirection, buffer, oldest.length);
+        }
+    }
+}
+
+
+/**
+ * @brief Read chunk from the pipe into the pipe reader buffer, in duplicate mode also pass it on to the original stream.
+ *
+ * On Linux the chunk is tee()d into a second pipe and spliced from there to the original stream, so duplicating it
+ * needs no copy through user space. Where the original stream does not support splicing (e.g. files opened with
+ * O_APPEND, terminals on older kernels) the chunk is written from the buffer instead and splicing is not tried again.
+ *
+ * @param redirection Pointer to redirection object.
+ * @return Number of bytes read, -1 on error, see read().
+ */
+static ssize_t STDREDIRECT_read(STDREDIRECT_REDIRECTION* redirection) {
+    ssize_t numBytesRead;
+#ifdef __linux__
+    ssize_t numBytesTeed;
+
+    if (redirection->teePipeReadEnd != -1) {
+        /* duplicate without consuming, then consume the same bytes, the reader is the only one reading the pipe */
+        numBytesTeed = tee(redirection->readablePipeEnd, redirection->teePipeWriteEnd, redirection->bufferSize, SPLICE_F_NONBLOCK);
+        if (numBytesTeed > 0) {
+            do {
+                numBytesRead = read(redirection->readablePipeEnd, redirection->buffer, (size_t) numBytesTeed);
+            } while (numBytesRead == -1 && errno == EINTR);
+            STDREDIRECT_splice(redirection, (size_t) numBytesTeed);
+
+            return numBytesRead;
+        }
+        if (numBytesTeed == 0 || errno != EINVAL) {
+            return numBytesTeed;
+        }
+
+        /* tee() not supported */
+        STDREDIRECT_stopSplicing(redirection);
+    }
+#endif /* __linux__ */
+
+    numBytesRead = read(redirection->readablePipeEnd, redirection->buffer, redirection->bufferSize);
+    if (numBytesRead > 0 && redirection->behaviour == STDREDIRECT_BEHAVIOUR_DUPLICATE) {
+        STDREDIRECT_writeAll(redirection->originalFileDescriptor, redirection->buffer, (size_t) numBytesRead);
+    }
+
+    return numBytesRead;
+}
+
+
+#ifdef __linux__
+/**
+ * @brief Splice duplicated chunk from the tee pipe to the original stream.
+ *
+ * @param redirection Pointer to redirection object.
+ * @param length Number of bytes in the tee pipe, the same bytes are at the start of the pipe reader buffer.
+ */
+static void STDREDIRECT_splice(STDREDIRECT_REDIRECTION* redirection, size_t length) {
+    size_t  numBytesSpliced = 0;
+    ssize_t result;
+
+    while (numBytesSpliced < length) {
+        result = splice(redirection->teePipeReadEnd, NULL, redirection->originalFileDescriptor, NULL, length - numBytesSpliced, SPLICE_F_MOVE);
+        if (result > 0) {
+            numBytesSpliced += (size_t) result;
+        }
+        else if (result == -1 && errno == EINTR) {
+            continue;
+        }
+        else {
+            break;
+        }
+    }
+    if (numBytesSpliced == length) {
+        return;
+    }
+
+    /* original stream does not support splicing, write the rest from the buffer; on other errors the rest is lost
+       just like with write() */
+    if (errno == EINVAL) {
+        STDREDIRECT_writeAll(redirection->originalFileDescriptor, redirection->buffer + numBytesSpliced, length - numBytesSpliced);
+    }
+    STDREDIRECT_stopSplicing(redirection);
+}
+
+
+/**
+ * @brief Close tee pipe, duplicate mode falls back to write().
+ *
+ * @param redirection Pointer to redirection object.
+ */
+static void STDREDIRECT_stopSplicing(STDREDIRECT_REDIRECTION* redirection) {
+    close(redirection->teePipeWriteEnd);
+    close(redirection->teePipeReadEnd);
+    redirection->teePipeWriteEnd = -1;
+    redirection->teePipeReadEnd = -1;
+}
+#endif /* __linux__ */
+
+
+/**
+ * @brief Write whole buffer to file descriptor, retrying on partial writes.
+ *
+ * @param fileDescriptor File descriptor.
+ * @param data Data to write.
+ * @param length Number of bytes to write.
+ * @return 0 on success, -1 on error.
+ */
+static int STDREDIRECT_writeAll(int fileDescriptor, const char* data, size_t length) {
+    ssize_t numBytesWritten;
+
+    while (length > 0) {
+        numBytesWritten = write(fileDescriptor, data, length);
+        if (numBytesWritten == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += numBytesWritten;
+        length -= (size_t) numBytesWritten;
+    }
+
+    return 0;
+}
+#endif /* _WIN32 */
+
+
+#ifdef STDREDIRECT_EPOLL
+/**
+ * @brief Shared pipe reader, runs in separate thread.
+ *
+ * Drains every registered pipe that becomes readable and delivers due batches of synchronous redirections. A
+ * redirection asking to be unregistered has its pipe drained one last time before it is dropped. The pipe of a child
+ * process is dropped at end of file, if the child has not exited by then its pidfd is watched in its place.
+ *
+ * @param parameter Unused.
+ * @return NULL.
+ */
+static void* STDREDIRECT_reactorThread(void* parameter) {
+    STDREDIRECT_REACTOR*      reactor = &STDREDIRECT_reactor;
+    struct epoll_event        events[64];
+    STDREDIRECT_REDIRECTION*  redirection;
+    STDREDIRECT_REDIRECTION*  unregistered;
+    STDREDIRECT_REDIRECTION** link;
+    STDREDIRECT_PROCESS*      process;
+    eventfd_t                 wakeCount;
+    long long                 timeout;
+    long long                 batchTimeout;
+    int                       numEvents;
+    int                       result;
+    int                       exitCode = 0;
+    int                       i;
+
+    (void) parameter;
+
+    for (;;) {
+        /* deliver due batches and statistics and find the earliest pending one, nodes are only unlinked by this thread */
+        timeout = -1;
+        pthread_mutex_lock(&reactor->lock);
+        redirection = reactor->registered;
+        pthread_mutex_unlock(&reactor->lock);
+        for (; redirection; redirection = redirection->nextRegistered) {
+            STDREDIRECT_handleTimeouts(redirection);
+            batchTimeout = STDREDIRECT_nextTimeout(redirection);
+            if (batchTimeout != -1 && (timeout == -1 || batchTimeout < timeout)) {
+                timeout = batchTimeout;
+            }
+        }
+
+        /* block until output is available, a redirection asks to be unregistered or a pending batch or statistics are due */
+        numEvents = epoll_wait(reactor->epollFileDescriptor, events, (int) (sizeof(events) / sizeof(events[0])), timeout == -1 ? -1 : (int) ((timeout + 999) / 1000));
+        for (i = 0; i < numEvents; ++i) {
+            redirection = (STDREDIRECT_REDIRECTION*) events[i].data.ptr;
+            if (redirection == NULL) {
+                eventfd_read(reactor->wakeFileDescriptor, &wakeCount);
+            }
+            else if (redirection->isEndOfFile) {
+                /* pidfd of the child process became readable, the process may be destroyed as soon as it is reported */
+                process = redirection->process;
+                if (STDREDIRECT_reap(process, FALSE, &exitCode)) {
+                    epoll_ctl(reactor->epollFileDescriptor, EPOLL_CTL_DEL, process->pidFileDescriptor, NULL);
+                    close(process->pidFileDescriptor);
+                    process->pidFileDescriptor = -1;
+                    STDREDIRECT_exited(process, exitCode);
+                }
+            }
+            else {
+                result = STDREDIRECT_lockedDrain(redirection);
+                if (result != 0) {
+                    /* stop watching the broken or closed pipe, it is dropped on unregister */
+                    epoll_ctl(reactor->epollFileDescriptor, EPOLL_CTL_DEL, redirection->readablePipeEnd, NULL);
+                }
+                if (result == -1) {
+                    redirection->error = STDREDIRECT_ERROR_THREAD;
+                }
+                else if (result == 1) {
+                    STDREDIRECT_endOfFile(redirection);
+                }
+            }
+        }
+
+        /* take redirections asking to be unregistered off the list */
+        unregistered = NULL;
+        pthread_mutex_lock(&reactor->lock);
+        for (link = &reactor->registered; *link; ) {
+            redirection = *link;
+            if (redirection->isUnregisterRequested) {
+                *link = redirection->nextRegistered;
+                redirection->nextRegistered = unregistered;
+                unregistered = redirection;
+            }
+            else {
+                link = &redirection->nextRegistered;
+            }
+        }
+        pthread_mutex_unlock(&reactor->lock);
+
+        /* drain their pipes, this picks up everything written before the stream was restored */
+        for (redirection = unregistered; redirection; redirection = redirection->nextRegistered) {
+            if (STDREDIRECT_lockedDrain(redirection) == -1) {
+                redirection->error = STDREDIRECT_ERROR_THREAD;
+            }
+            epoll_ctl(reactor->epollFileDescriptor, EPOLL_CTL_DEL, redirection->readablePipeEnd, NULL);
+            if (redirection->commitPipeReadEnd != -1) {
+                epoll_ctl(reactor->epollFileDescriptor, EPOLL_CTL_DEL, redirection->commitPipeReadEnd, NULL);
+            }
+        }
+
+        /* acknowledge, the redirections may be freed right after */
+        if (unregistered) {
+            pthread_mutex_lock(&reactor->lock);
+            while (unregistered) {
+                redirection = unregistered;
+                unregistered = redirection->nextRegistered;
+                redirection->nextRegistered = NULL;
+                redirection->isRegistered = FALSE;
+            }
+            pthread_cond_broadcast(&reactor->condition);
+            pthread_mutex_unlock(&reactor->lock);
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief Hand pipe of redirection to the shared reader, starts the reactor thread on first use.
+ *
+ * @param redirection Pointer to redirection object.
+ * @return 0 on success, -1 on error.
+ */
+static int STDREDIRECT_register(STDREDIRECT_REDIRECTION* redirection) {
+    STDREDIRECT_REACTOR* reactor = &STDREDIRECT_reactor;
+    struct epoll_event   event;
+
+    pthread_mutex_lock(&reactor->lock);
+
+    if (!reactor->isRunning) {
+        reactor->epollFileDescriptor = epoll_create1(EPOLL_CLOEXEC);
+        reactor->wakeFileDescriptor = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (reactor->epollFileDescriptor == -1 || reactor->wakeFileDescriptor == -1) {
+            goto Error;
+        }
+
+        /* wake event carries no redirection */
+        event.events   = EPOLLIN;
+        event.data.ptr = NULL;
+        if (epoll_ctl(reactor->epollFileDescriptor, EPOLL_CTL_ADD, reactor->wakeFileDescriptor, &event) == -1) {
+            goto Error;
+        }
+
+        /* reactor thread is kept running for later redirections */
+        if (pthread_create(&reactor->thread, NULL, STDREDIRECT_reactorThread, NULL) != 0) {
+            goto Error;
+        }
+        pthread_detach(reactor->thread);
+        reactor->isRunning = TRUE;
+    }
+
+    event.events   = EPOLLIN;
+    event.data.ptr = redirection;
+    if (epoll_ctl(reactor->epollFileDescriptor, EPOLL_CTL_ADD, redirection->readablePipeEnd, &event) == -1) {
+        goto Error;
+    }
+    if (redirection->commitPipeReadEnd != -1 && epoll_ctl(reactor->epollFileDescriptor, EPOLL_CTL_ADD, redirection->commitPipeReadEnd, &event) == -1) {
+        epoll_ctl(reactor->epollFileDescriptor, EPOLL_CTL_DEL, redirection->readablePipeEnd, NULL);
+        goto Error;
+    }
+
+    redirection->isRegistered = TRUE;
+    redirection->isUnregisterRequested = FALSE;
+    redirection->nextRegistered = reactor->registered;
+    reactor->registered = redirection;
+
+    pthread_mutex_unlock(&reactor->lock);
+
+    return 0;
+
+Error:
+    /* cleanup */
+    if (!reactor->isRunning) {
+        if (reactor->epollFileDescriptor != -1) {
+            close(reactor->epollFileDescriptor);
+            reactor->epollFileDescriptor = -1;
+        }
+        if (reactor->wakeFileDescriptor != -1) {
+            close(reactor->wakeFileDescriptor);
+            reactor->wakeFileDescriptor = -1;
+        }
+    }
+
+    pthread_mutex_unlock(&reactor->lock);
+
+    return -1;
+}
+
+
+/**
+ * @brief Take pipe of redirection away from the shared reader once it drained it.
+ *
+ * Does nothing if the redirection is not registered. Must not be called from a callback, which runs on the reactor
+ * thread.
+ *
+ * @param redirection Pointer to redirection object.
+ */
+static void STDREDIRECT_unregister(STDREDIRECT_REDIRECTION* redirection) {
+    STDREDIRECT_REACTOR* reactor = &STDREDIRECT_reactor;
+
+    pthread_mutex_lock(&reactor->lock);
+    if (redirection->isRegistered) {
+        redirection->isUnregisterRequested = TRUE;
+        STDREDIRECT_wakeReactor();
+        while (redirection->isRegistered) {
+            pthread_cond_wait(&reactor->condition, &reactor->lock);
+        }
+        redirection->isUnregisterRequested = FALSE;
+    }
+    pthread_mutex_unlock(&reactor->lock);
+}
+
+
+/** @brief Wake reactor thread so it picks up unregister requests. */
+static void STDREDIRECT_wakeReactor() {
+    eventfd_write(STDREDIRECT_reactor.wakeFileDescriptor, 1);
+}
+#endif /* STDREDIRECT_EPOLL */
+
+
+#ifdef STDREDIRECT_IOCP
+/**
+ * @brief Shared pipe reader, runs in separate thread.
+ *
+ * Keeps an overlapped read pending on every registered pipe and passes on what completes, reads that complete right
+ * away are passed on without going through the completion port, so a busy pipe is drained in one go. Also delivers due
+ * batches of synchronous redirections. A redirection asking to be unregistered is dropped once its pipe is broken or
+ * its pending read, which means the pipe is empty, is cancelled. The exit of a child process is posted to the
+ * completion port once its pipes are broken, so it is reported after all its output.
+ *
+ * @param parameter Unused.
+ * @return 0.
+ */
+static DWORD WINAPI STDREDIRECT_reactorThread(LPVOID parameter) {
+    STDREDIRECT_REACTOR*      reactor = &STDREDIRECT_reactor;
+    OVERLAPPED_ENTRY          entries[64];
+    ULONG                     numEntries;
+    STDREDIRECT_REDIRECTION*  redirection;
+    STDREDIRECT_REDIRECTION*  unregistered;
+    STDREDIRECT_REDIRECTION** link;
+    long long                 timeout;
+    long long                 batchTimeout;
+    int                       result;
+    int                       exitCode = 0;
+    ULONG                     i;
+
+    (void) parameter;
+
+    for (;;) {
+        /* deliver due batches and statistics and find the earliest pending one, nodes are only unlinked by this thread */
+        timeout = -1;
+        AcquireSRWLockExclusive(&reactor->lock);
+        redirection = reactor->registered;
+        ReleaseSRWLockExclusive(&reactor->lock);
+        for (; redirection; redirection = redirection->nextRegistered) {
+            STDREDIRECT_handleTimeouts(redirection);
+            batchTimeout = STDREDIRECT_nextTimeout(redirection);
+            if (batchTimeout != -1 && (timeout == -1 || batchTimeout < timeout)) {
+                timeout = batchTimeout;
+            }
+        }
+
+        /* block until a read completes, a redirection is registered or asks to be unregistered or a pending batch or
+           statistics are due */
+        if (!GetQueuedCompletionStatusEx(reactor->completionPort, entries, (ULONG) (sizeof(entries) / sizeof(entries[0])), &numEntries, timeout == -1 ? INFINITE : (DWORD) ((timeout + 999) / 1000), FALSE)) {
+            numEntries = 0;
+        }
+        for (i = 0; i < numEntries; ++i) {
+            redirection = (STDREDIRECT_REDIRECTION*) entries[i].lpCompletionKey;
+            if (redirection == NULL) {
+                continue;
+            }
+            if (!entries[i].lpOverlapped && redirection->isEndOfFile) {
+                /* child process exited, it may be destroyed as soon as it is reported */
+                if (STDREDIRECT_reap(redirection->process, FALSE, &exitCode)) {
+                    STDREDIRECT_exited(redirection->process, exitCode);
+                }
+                continue;
+            }
+
+            /* a newly registered pipe is read here, so the callbacks only ever run on this thread */
+            if (entries[i].lpOverlapped) {
+                result = STDREDIRECT_completeRead(redirection);
+            }
+            else {
+                redirection->isReadPending = FALSE;
+                result = STDREDIRECT_readOverlapped(redirection);
+            }
+            if (result == -1) {
+                redirection->error = STDREDIRECT_ERROR_THREAD;
+            }
+            else if (result == 1 && !redirection->isEndOfFile) {
+                STDREDIRECT_endOfFile(redirection);
+            }
+        }
+
+        /* take redirections asking to be unregistered off the list once no read is pending, a pending read means the
+           pipe was empty, a writable end inherited by a child process may keep it from breaking */
+        unregistered = NULL;
+        AcquireSRWLockExclusive(&reactor->lock);
+        for (link = &reactor->registered; *link; ) {
+            redirection = *link;
+            if (redirection->isUnregisterRequested && !redirection->isReadPending) {
+                *link = redirection->nextRegistered;
+                redirection->nextRegistered = unregistered;
+                unregistered = redirection;
+            }
+            else {
+                if (redirection->isUnregisterRequested) {
+                    CancelIoEx(redirection->readablePipeEnd, &redirection->overlapped);
+                }
+                link = &redirection->nextRegistered;
+            }
+        }
+
+        /* acknowledge, the redirections may be freed right after */
+        if (unregistered) {
+            while (unregistered) {
+                redirection = unregistered;
+                unregistered = redirection->nextRegistered;
+                redirection->nextRegistered = NULL;
+                redirection->isRegistered = FALSE;
+            }
+            WakeAllConditionVariable(&reactor->condition);
+        }
+        ReleaseSRWLockExclusive(&reactor->lock);
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Hand pipe of redirection to the shared reader, starts the reactor thread on first use.
+ *
+ * @param redirection Pointer to redirection object, its readable pipe end must come from
+ *        STDREDIRECT_createOverlappedPipe().
+ * @return 0 on success, -1 on error.
+ */
+static int STDREDIRECT_register(STDREDIRECT_REDIRECTION* redirection) {
+    STDREDIRECT_REACTOR* reactor = &STDREDIRECT_reactor;
+    HANDLE               thread;
+
+    AcquireSRWLockExclusive(&reactor->lock);
+
+    if (!reactor->isRunning) {
+        reactor->completionPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+        if (reactor->completionPort == NULL) {
+            goto Error;
+        }
+
+        /* reactor thread is kept running for later redirections */
+        thread = CreateThread(NULL, 0, STDREDIRECT_reactorThread, NULL, 0, NULL);
+        if (thread == NULL) {
+            goto Error;
+        }
+        CloseHandle(thread);
+        reactor->isRunning = TRUE;
+    }
+
+    /* reads completing right away are passed on by the reactor thread without a completion packet */
+    if (!CreateIoCompletionPort(redirection->readablePipeEnd, reactor->completionPort, (ULONG_PTR) redirection, 0) || !SetFileCompletionNotificationModes(redirection->readablePipeEnd, FILE_SKIP_COMPLETION_PORT_ON_SUCCESS | FILE_SKIP_SET_EVENT_ON_HANDLE)) {
+        goto Error;
+    }
+
+    /* a packet without OVERLAPPED makes the reactor thread start reading, it counts as pending read, so the
+       redirection is not dropped before */
+    redirection->isRegistered = TRUE;
+    redirection->isUnregisterRequested = FALSE;
+    redirection->isReadPending = TRUE;
+    redirection->isEndOfFile = FALSE;
+    if (!PostQueuedCompletionStatus(reactor->completionPort, 0, (ULONG_PTR) redirection, NULL)) {
+        redirection->isRegistered = FALSE;
+        goto Error;
+    }
+    redirection->nextRegistered = reactor->registered;
+    reactor->registered = redirection;
+
+    ReleaseSRWLockExclusive(&reactor->lock);
+
+    return 0;
+
+Error:
+    /* cleanup */
+    if (!reactor->isRunning && reactor->completionPort) {
+        CloseHandle(reactor->completionPort);
+        reactor->completionPort = NULL;
+    }
+
+    ReleaseSRWLockExclusive(&reactor->lock);
+
+    return -1;
+}
+
+
+/**
+ * @brief Take pipe of redirection away from the shared reader once it drained it.
+ *
+ * Does nothing if the redirection is not registered. Must not be called from a callback, which runs on the reactor
+ * thread.
+ *
+ * @param redirection Pointer to redirection object.
+ */
+static void STDREDIRECT_unregister(STDREDIRECT_REDIRECTION* redirection) {
+    STDREDIRECT_REACTOR* reactor = &STDREDIRECT_reactor;
+
+    AcquireSRWLockExclusive(&reactor->lock);
+    if (redirection->isRegistered) {
+        redirection->isUnregisterRequested = TRUE;
+        STDREDIRECT_wakeReactor();
+        while (redirection->isRegistered) {
+            SleepConditionVariableSRW(&reactor->condition, &reactor->lock, INFINITE, 0);
+        }
+        redirection->isUnregisterRequested = FALSE;
+    }
+    ReleaseSRWLockExclusive(&reactor->lock);
+}
+
+
+/** @brief Wake reactor thread so it picks up unregister requests. */
+static void STDREDIRECT_wakeReactor() {
+    PostQueuedCompletionStatus(STDREDIRECT_reactor.completionPort, 0, 0, NULL);
+}
+
+
+/**
+ * @brief Create pipe whose readable end can be read overlapped, anonymous pipes cannot.
+ *
+ * The readable end is the only instance of a named pipe unique in the process that rejects remote clients, the
+ * writable end is a synchronous client handle like the one of an anonymous pipe.
+ *
+ * @param redirection Pointer to redirection object, gets both pipe ends, STDREDIRECT_REDIRECTION::pipeSize is the
+ *        requested capacity, 0 for the system default.
+ * @return 0 on success, -1 on error.
+ */
+static int STDREDIRECT_createOverlappedPipe(STDREDIRECT_REDIRECTION* redirection) {
+    char name[64];
+
+    sprintf_s(name, sizeof(name), "\\\\.\\pipe\\stdredirect-%lu-%lld", (unsigned long) GetCurrentProcessId(), STDREDIRECT_atomicAdd(&STDREDIRECT_lastPipeId, 1));
+
+    redirection->readablePipeEnd = CreateNamedPipeA(name, PIPE_ACCESS_INBOUND | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE, PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS, 1, 0, (DWORD) redirection->pipeSize, 0, NULL);
+    if (redirection->readablePipeEnd == INVALID_HANDLE_VALUE) {
+        redirection->readablePipeEnd = NULL;
+        return -1;
+    }
+
+    redirection->writablePipeEnd = CreateFileA(name, GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (redirection->writablePipeEnd == INVALID_HANDLE_VALUE) {
+        redirection->writablePipeEnd = NULL;
+        CloseHandle(redirection->readablePipeEnd);
+        redirection->readablePipeEnd = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Read pipe until a read is pending, passing on every chunk that is ready right away, runs on the reactor
+ *        thread.
+ *
+ * @param redirection Pointer to redirection object.
+ * @return 0 once a read is pending, 1 once all writable ends are closed, -1 on error.
+ */
+static int STDREDIRECT_readOverlapped(STDREDIRECT_REDIRECTION* redirection) {
+    DWORD numBytesRead;
+    DWORD lastError;
+
+    for (;;) {
+        ZeroMemory(&redirection->overlapped, sizeof(redirection->overlapped));
+        if (!ReadFile(redirection->readablePipeEnd, (void*) redirection->buffer, (DWORD) redirection->bufferSize, NULL, &redirection->overlapped)) {
+            lastError = GetLastError();
+            if (lastError == ERROR_IO_PENDING) {
+                redirection->isReadPending = TRUE;
+                return 0;
+            }
+            return lastError == ERROR_BROKEN_PIPE ? 1 : -1;
+        }
+
+        /* completed right away, no packet is queued */
+        if (!GetOverlappedResult(redirection->readablePipeEnd, &redirection->overlapped, &numBytesRead, FALSE)) {
+            return -1;
+        }
+        STDREDIRECT_passChunk(redirection, numBytesRead);
+    }
+}
+
+
+/**
+ * @brief Pass on the chunk of a completed read, then read on, runs on the reactor thread.
+ *
+ * @param redirection Pointer to redirection object.
+ * @return 0 once a read is pending or the read was cancelled on unregister, 1 once all writable ends are closed, -1 on
+ *         error.
+ */
+static int STDREDIRECT_completeRead(STDREDIRECT_REDIRECTION* redirection) {
+    DWORD numBytesRead;
+    DWORD lastError;
+
+    redirection->isReadPending = FALSE;
+    if (!GetOverlappedResult(redirection->readablePipeEnd, &redirection->overlapped, &numBytesRead, FALSE)) {
+        lastError = GetLastError();
+        if (lastError == ERROR_OPERATION_ABORTED) {
+            return 0;
+        }
+        return lastError == ERROR_BROKEN_PIPE ? 1 : -1;
+    }
+    STDREDIRECT_passChunk(redirection, numBytesRead);
+
+    return STDREDIRECT_readOverlapped(redirection);
+}
+#endif /* STDREDIRECT_IOCP */
+
+
+/**
+ * @brief Pass data read from the pipe on to the callback: strip escape sequences, complete UTF-8 code points, frame.
+ *
+ * Escape sequences are stripped from @p data in place first.
+ *
+ * @param redirection Pointer to redirection object.
+ * @param data Data, must have room for one more byte to null-terminate it.
+ * @param length Number of bytes.
+ */
+static void STDREDIRECT_process(STDREDIRECT_REDIRECTION* redirection, char* data, size_t length) {
+    size_t strippedLength;
+
+    if (redirection->isStrippingEscapes) {
+        strippedLength = STDREDIRECT_stripEscapes(&redirection->escapeState, data, length);
+        if (strippedLength < length) {
+            STDREDIRECT_statAdd(&redirection->stats.strippedBytes, (long long) (length - strippedLength));
+        }
+        length = strippedLength;
+    }
+
+    if (redirection->isUtf8) {
+        STDREDIRECT_processUtf8(redirection, data, length);
+    }
+    else {
+        STDREDIRECT_frame(redirection, data, length);
+    }
+}
+
+
+/**
+ * @brief Frame complete UTF-8 code points only and handle invalid UTF-8.
+ *
+ * Valid runs are found with the vectorized STDREDIRECT_validUtf8Length() and framed straight from @p data. A code
+ * point cut off at the end is carried to the next chunk in STDREDIRECT_REDIRECTION::utf8Tail and framed on its own
+ * once complete. Replacing or dropping invalid bytes frames the valid runs around them separately, so raw chunks
+ * are split there.
+ *
+ * @param redirection Pointer to redirection object.
+ * @param data Data, must have room for one more byte to null-terminate it.
+ * @param length Number of bytes.
+ */
+static void STDREDIRECT_processUtf8(STDREDIRECT_REDIRECTION* redirection, char* data, size_t length) {
+    char*  start;
+    size_t validLength;
+    int    sequenceLength;
+
+    /* complete the code point cut off at the end of the last chunk */
+    while (redirection->utf8TailLength > 0 && length > 0) {
+        redirection->utf8Tail[redirection->utf8TailLength++] = *data++;
+        --length;
+        sequenceLength = STDREDIRECT_utf8SequenceLength((const unsigned char*) redirection->utf8Tail, redirection->utf8TailLength);
+        if (sequenceLength > 0) {
+            STDREDIRECT_frame(redirection, redirection->utf8Tail, (size_t) sequenceLength);
+            redirection->utf8TailLength = 0;
+        }
+        else if (sequenceLength < 0) {
+            /* the byte ending it is looked at again as the start of the chunk */
+            --data;
+            ++length;
+            redirection->utf8TailLength = 0;
+            STDREDIRECT_statAdd(&redirection->stats.invalidUtf8Bytes, -sequenceLength);
+            if (redirection->invalidUtf8 == STDREDIRECT_INVALID_UTF8_KEEP) {
+                STDREDIRECT_frame(redirection, redirection->utf8Tail, (size_t) -sequenceLength);
+            }
+            STDREDIRECT_replaceInvalidUtf8(redirection);
+        }
+    }
+
+    start = data;
+    while (length > 0) {
+        validLength = STDREDIRECT_validUtf8Length(data, length);
+        data += validLength;
+        length -= validLength;
+        if (length == 0) {
+            break;
+        }
+
+        sequenceLength = STDREDIRECT_utf8SequenceLength((const unsigned char*) data, length);
+        if (sequenceLength == 0) {
+            /* cut off at the end */
+            break;
+        }
+
+        STDREDIRECT_statAdd(&redirection->stats.invalidUtf8Bytes, -sequenceLength);
+        if (redirection->invalidUtf8 != STDREDIRECT_INVALID_UTF8_KEEP) {
+            if (data > start) {
+                STDREDIRECT_frame(redirection, start, (size_t) (data - start));
+            }
+            STDREDIRECT_replaceInvalidUtf8(redirection);
+            start = data - sequenceLength;
+        }
+        data -= sequenceLength;
+        length += sequenceLength;
+    }
+
+    if (data > start) {
+        STDREDIRECT_frame(redirection, start, (size_t) (data - start));
+    }
+    if (length > 0) {
+        memcpy(redirection->utf8Tail, data, length);
+        redirection->utf8TailLength = length;
+    }
+}
+
+
+/**
+ * @brief Frame U+FFFD in place of invalid UTF-8 with ::STDREDIRECT_INVALID_UTF8_REPLACE.
+ *
+ * @param redirection Pointer to redirection object.
+ */
+static void STDREDIRECT_replaceInvalidUtf8(STDREDIRECT_REDIRECTION* redirection) {
+    char replacement[4] = "\xef\xbf\xbd";
+
+    if (redirection->invalidUtf8 == STDREDIRECT_INVALID_UTF8_REPLACE) {
+        STDREDIRECT_frame(redirection, replacement, 3);
+    }
+}
+
+
+/**
+ * @brief Handle code point cut off at the end of the last chunk as invalid, its rest is not coming anymore.
+ *
+ * @param redirection Pointer to redirection object.
+ */
+static void STDREDIRECT_flushUtf8(STDREDIRECT_REDIRECTION* redirection) {
+    size_t length = redirection->utf8TailLength;
+
+    if (length > 0) {
+        redirection->utf8TailLength = 0;
+        STDREDIRECT_statAdd(&redirection->stats.invalidUtf8Bytes, (long long) length);
+        if (redirection->invalidUtf8 == STDREDIRECT_INVALID_UTF8_KEEP) {
+            STDREDIRECT_frame(redirection, redirection->utf8Tail, length);
+        }
+        STDREDIRECT_replaceInvalidUtf8(redirection);
+    }
+}
+
+
+/**
+ * @brief Frame data and pass it on to the callback.
+ *
+ * In line framing mode complete lines are delivered straight from @p data, a trailing partial line is carried over
+ * to the next read in STDREDIRECT_REDIRECTION::lineBuffer.
+ *
+ * @param redirection Pointer to redirection object.
+ * @param data Data, must have room for one more byte to null-terminate it.
+ * @param length Number of bytes.
+ */
+static void STDREDIRECT_frame(STDREDIRECT_REDIRECTION* redirection, char* data, size_t length) {
+    const char* newline;
+    size_t      segmentLength;
+    size_t      copied;
+    size_t      numBytesToCopy;
+
+    if (redirection->framing == STDREDIRECT_FRAMING_RAW) {
+        if (length > 0) {
+            STDREDIRECT_deliver(redirection, data, length);
+        }
+        return;
+    }
+
+    while (length > 0) {
+        newline = STDREDIRECT_findByte(data, length, '\n');
+        segmentLength = newline ? (size_t) (newline - data) + 1 : length;
+
+        if (newline && redirection->lineLength == 0 && segmentLength <= redirection->maxLineLength) {
+            /* complete line within read buffer */
+            STDREDIRECT_deliver(redirection, data, segmentLength);
+        }
+        else {
+            /* carry partial line, lines exceeding the cap are delivered in pieces of maxLineLength bytes */
+            for (copied = 0; copied < segmentLength; copied += numBytesToCopy) {
+                numBytesToCopy = redirection->maxLineLength - redirection->lineLength;
+                if (numBytesToCopy > segmentLength - copied) {
+                    numBytesToCopy = segmentLength - copied;
+                }
+                memcpy(redirection->lineBuffer + redirection->lineLength, data + copied, numBytesToCopy);
+                redirection->lineLength += numBytesToCopy;
+
+                if (redirection->lineLength == redirection->maxLineLength) {
+                    STDREDIRECT_flush(redirection);
+                }
+            }
+            if (newline) {
+                STDREDIRECT_flush(redirection);
+            }
+        }
+
+        data += segmentLength;
+        length -= segmentLength;
+    }
+}
+
+
+/**
+ * @brief Deliver carried partial line, if any.
+ *
+ * Not to be confused with batches, see STDREDIRECT_flushBatch().
+ *
+ * @param redirection Pointer to redirection object.
+ */
+static void STDREDIRECT_flush(STDREDIRECT_REDIRECTION* redirection) {
+    if (redirection->lineLength > 0) {
+        STDREDIRECT_deliver(redirection, redirection->lineBuffer, redirection->lineLength);
+        redirection->lineLength = 0;
+    }
+}
+
+
+/**
+ * @brief Deliver carried partial line, summary of suppressed lines and pending batch, if any.
+ *
+ * Called on unredirect after all threads stopped. The first line after the next redirect is never collapsed, nor
+ * taken for the rest of an escape sequence or UTF-8 code point cut off by it.
+ *
+ * @param redirection Pointer to redirection object.
+ */
+static void STDREDIRECT_flushAll(STDREDIRECT_REDIRECTION* redirection) {
+    STDREDIRECT_flushUtf8(redirection);
+    STDREDIRECT_flush(redirection);
+    redirection->escapeState = STDREDIRECT_ESCAPE_STATE_TEXT;
+    STDREDIRECT_summarize(redirection);
+    redirection->lastLength = 0;
+    STDREDIRECT_flushBatch(redirection);
+}
+
+
+/**
+ * @brief Set the committing thread of the chunk to be delivered, a partial line carried from another thread is
+ *        delivered first. An escape sequence or UTF-8 code point cut off by the other thread's output is not
+ *        continued.
+ *
+ * @param redirection Pointer to redirection object.
+ * @param threadId Committing thread, 0 for the pipe.
+ */
+static void STDREDIRECT_switchThread(STDREDIRECT_REDIRECTION* redirection, long long threadId) {
+    if (redirection->threadId != threadId) {
+        STDREDIRECT_flushUtf8(redirection);
+        STDREDIRECT_flush(redirection);
+        redirection->threadId = threadId;
+        redirection->escapeState = STDREDIRECT_ESCAPE_STATE_TEXT;
+    }
+}
+
+
+/**
+ * @brief Pass data to the redirection callback, unless it is collapsed or rate limited.
+ *
+ * @param redirection Pointer to redirection object.
+ * @param data Data, must have room for one more byte to null-terminate it.
+ * @param length Number of bytes.
+ */
+static void STDREDIRECT_deliver(STDREDIRECT_REDIRECTION* redirection, char* data, size_t length) {
+    if ((redirection->isCollapsing || redirection->rateLimit > 0) && STDREDIRECT_isSuppressed(redirection, data, length)) {
+        return;
+    }
+
+    STDREDIRECT_invokeCallbacks(redirection, data, length);
+}
+
+
+/**
+ * @brief Pass data to the redirection callbacks.
+ *
+ * @param redirection Pointer to redirection object.
+ * @param data Data, must have room for one more byte to null-terminate it.
+ * @param length Number of bytes.
+ */
+static void STDREDIRECT_invokeCallbacks(STDREDIRECT_REDIRECTION* redirection, char* data, size_t length) {
+    char               terminatedByte;
+    STDREDIRECT_RECORD record;
+    long long          start = STDREDIRECT_now();
+
+    ++STDREDIRECT_callbackDepth;
+    if (redirection->dataCallback) {
+        redirection->dataCallback(data, length, redirection->userdata);
+    }
+    if (redirection->utf16Callback) {
+        STDREDIRECT_invokeUtf16Callback(redirection, data, length);
+    }
+    if (redirection->recordCallback) {
+        record.stream         = redirection->stream;
+        record.timestamp      = redirection->timestamp;
+        record.sequence       = redirection->sequence++;
+        record.globalSequence = redirection->globalSequence;
+        record.threadId       = redirection->threadId;
+        record.data           = data;
+        record.length         = length;
+        redirection->recordCallback(&record, redirection->userdata);
+    }
+    if (redirection->callback) {
+        /* ensure string is null-terminated, the byte may belong to the next line */
+        terminatedByte = data[length];
+        data[length] = '\0';
+        redirection->callback(data);
+        data[length] = terminatedByte;
+    }
+    --STDREDIRECT_callbackDepth;
+    if (redirection->dataCallback || redirection->utf16Callback || redirection->recordCallback || redirection->callback) {
+        STDREDIRECT_countCallback(redirection, start);
+    }
+    if (redirection->batchCallback) {
+        STDREDIRECT_appendToBatch(redirection, data, length);
+    }
+}
+
+
+/**
+ * @brief Transcode data to UTF-16 and pass it to the UTF-16 callback, in pieces of up to
+ *        STDREDIRECT_UTF16_BUFFER_LENGTH code units cut between code points.
+ *
+ * @param redirection Pointer to redirection object.
+ * @param data Data, complete UTF-8 code points.
+ * @param length Number of bytes.
+ */
+static void STDREDIRECT_invokeUtf16Callback(STDREDIRECT_REDIRECTION* redirection, const char* data, size_t length) {
+    size_t pieceLength;
+    size_t numUnits;
+
+    while (length > 0) {
+        /* every byte becomes one code unit at most, cut before a lead byte, surrogate pairs stay together */
+        pieceLength = length;
+        if (pieceLength > STDREDIRECT_UTF16_BUFFER_LENGTH) {
+            pieceLength = STDREDIRECT_UTF16_BUFFER_LENGTH;
+            while (pieceLength > STDREDIRECT_UTF16_BUFFER_LENGTH - 3 && ((unsigned char) data[pieceLength] & 0xc0) == 0x80) {
+                --pieceLength;
+            }
+        }
+
+        numUnits = STDREDIRECT_utf8ToUtf16(data, pieceLength, redirection->utf16Buffer);
+        redirection->utf16Buffer[numUnits] = 0;
+        redirection->utf16Callback(redirection->utf16Buffer, numUnits, redirection->userdata);
+
+        data += pieceLength;
+        length -= pieceLength;
+    }
+}
+
+
+/**
+ * @brief Collapse repeated lines and apply the rate limit, runs where the callbacks are called.
+ *
+ * A line equal to the previous one, by length and 64 bit hash, is counted instead of passed on. The token bucket
+ * refills with rateLimit bytes per second up to rateBurst; a line passes if the bucket holds enough tokens for it,
+ * or is full, so lines longer than the bucket are not suppressed forever. Summaries of the suppressed lines are
+ * passed on when the next line passes, once per STDREDIRECT_SUMMARY_INTERVAL_US otherwise.
+ *
+ * @param redirection Pointer to redirection object.
+ * @param data Data.
+ * @param length Number of bytes, greater than 0.
+ * @return TRUE if the line is suppressed, FALSE if it is to be passed on.
+ */
+static int STDREDIRECT_isSuppressed(STDREDIRECT_REDIRECTION* redirection, const char* data, size_t length) {
+    unsigned long long hash;
+    long long          now;
+
+    if (redirection->isCollapsing) {
+        hash = STDREDIRECT_hash(data, length);
+        if (length == redirection->lastLength && hash == redirection->lastHash) {
+            if (redirection->repeats++ == 0 && redirection->limitedLines == 0) {
+                redirection->summaryDeadline = STDREDIRECT_now() + STDREDIRECT_SUMMARY_INTERVAL_US;
+            }
+            STDREDIRECT_statAdd(&redirection->stats.collapsedLines, 1);
+            STDREDIRECT_statAdd(&redirection->stats.collapsedBytes, (long long) length);
+            return TRUE;
+        }
+        STDREDIRECT_summarizeRepeats(redirection);
+        redirection->lastHash = hash;
+        redirection->lastLength = length;
+    }
+
+    if (redirection->rateLimit > 0) {
+        /* the time the chunk was read is good enough and saves a clock read per line */
+        now = redirection->timestamp;
+        if (now > redirection->refilledAt) {
+            redirection->tokens += (double) (now - redirection->refilledAt) * (double) redirection->rateLimit / 1e6;
+            if (redirection->tokens > redirection->rateBurst) {
+                redirection->tokens = redirection->rateBurst;
+            }
+            redirection->refilledAt = now;
+        }
+
+        if (redirection->tokens < (double) length && redirection->tokens < redirection->rateBurst) {
+            if (redirection->limitedLines++ == 0 && redirection->repeats == 0) {
+                redirection->summaryDeadline = now + STDREDIRECT_SUMMARY_INTERVAL_US;
+            }
+            redirection->limitedBytes += (long long) length;
+            STDREDIRECT_statAdd(&redirection->stats.rateLimitedLines, 1);
+            STDREDIRECT_statAdd(&redirection->stats.rateLimitedBytes, (long long) length);
+            return TRUE;
+        }
+        STDREDIRECT_summarizeRateLimit(redirection);
+        redirection->tokens -= (double) length;
+    }
+
+    return FALSE;
+}
+
+
+/**
+ * @brief Pass on summaries of collapsed and rate limited lines, if any.
+ *
+ * @param redirection Pointer to redirection object.
+ */
+static void STDREDIRECT_summarize(STDREDIRECT_REDIRECTION* redirection) {
+    STDREDIRECT_summarizeRepeats(redirection);
+    STDREDIRECT_summarizeRateLimit(redirection);
+}
+
+
+/**
+ * @brief Pass on "repeated N more times" summary of collapsed lines, if any.
+ *
+ * @param redirection Pointer to redirection object.
+ */
+static void STDREDIRECT_summarizeRepeats(STDREDIRECT_REDIRECTION* redirection) {
+    char summary[64];
+    int  length;
+
+    if (redirection->repeats > 0) {
+        length = snprintf(summary, sizeof(summary), "[last line repeated %lld more times]\n", redirection->repeats);
+        redirection->repeats = 0;
+        STDREDIRECT_invokeCallbacks(redirection, summary, (size_t) length);
+    }
+}
+
+
+/**
+ * @brief Pass on summary of rate limited lines, if any.
+ *
+ * @param redirection Pointer to redirection object.
+ */
+static void STDREDIRECT_summarizeRateLimit(STDREDIRECT_REDIRECTION* redirection) {
+    char summary[96];
+    int  length;
+
+    if (redirection->limitedLines > 0) {
+        length = snprintf(summary, sizeof(summary), "[rate limit suppressed %lld lines, %lld bytes]\n", redirection->limitedLines, redirection->limitedBytes);
+        redirection->limitedLines = 0;
+        redirection->limitedBytes = 0;
+        STDREDIRECT_invokeCallbacks(redirection, summary, (size_t) length);
+    }
+}
+
+
+/**
+ * @brief Pass on summaries of suppressed lines if they are due.
+ *
+ * @param redirection Pointer to redirection object.
+ */
+static void STDREDIRECT_flushExpiredSummary(STDREDIRECT_REDIRECTION* redirection) {
+    if ((redirection->repeats > 0 || redirection->limitedLines > 0) && STDREDIRECT_now() >= redirection->summaryDeadline) {
+        STDREDIRECT_summarize(redirection);
+    }
+}
+
+
+/**
+ * @brief Time until summaries of suppressed lines are due.
+ *
+ * @param redirection Pointer to redirection object.
+ * @return Microseconds until the summaries are due, 0 if overdue, -1 if no line was suppressed.
+ */
+static long long STDREDIRECT_summaryTimeout(STDREDIRECT_REDIRECTION* redirection) {
+    long long timeout;
+
+    if (redirection->repeats == 0 && redirection->limitedLines == 0) {
+        return -1;
+    }
+
+    timeout = redirection->summaryDeadline - STDREDIRECT_now();
+
+    return timeout > 0 ? timeout : 0;
+}
+
+
+/**
+ * @brief 64 bit hash of a line, eight bytes per multiplication.
+ *
+ * @param data Data.
+ * @param length Number of bytes.
+ * @return Hash.
+ */
+static unsigned long long STDREDIRECT_hash(const char* data, size_t length) {
+    unsigned long long hash = 0x9E3779B97F4A7C15ULL ^ (unsigned long long) length;
+    unsigned long long word;
+
+    for (; length >= 8; data += 8, length -= 8) {
+        memcpy(&word, data, 8);
+        hash = (hash ^ word) * 0xFF51AFD7ED558CCDULL;
+        hash ^= hash >> 32;
+    }
+    word = 0;
+    memcpy(&word, data, length);
+    hash = (hash ^ word) * 0xC4CEB9FE1A85EC53ULL;
+    hash ^= hash >> 29;
+
+    return hash;
+}
+
+
+/**
+ * @brief Append chunk or line to pending batch, deliver batch if size thresholds are reached.
+ *
+ * @param redirection Pointer to redirection object.
+ * @param data Data.
+ * @param length Number of bytes.
+ */
+static void STDREDIRECT_appendToBatch(STDREDIRECT_REDIRECTION* redirection, const char* data, size_t length) {
+    if (redirection->batchCount == 0) {
+        redirection->batchDeadline = STDREDIRECT_now() + redirection->batchDelayUs;
+    }
+
+    memcpy(redirection->batchBuffer + redirection->batchLength, data, length);
+    redirection->batchSegments[redirection->batchCount].data = redirection->batchBuffer + redirection->batchLength;
+    redirection->batchSegments[redirection->batchCount].length = length;
+    redirection->batchLength += length;
+    ++redirection->batchCount;
+
+    if (redirection->batchLength >= redirection->batchSize || redirection->batchCount == redirection->batchMaxSegments) {
+        STDREDIRECT_flushBatch(redirection);
+    }
+}
+
+
+/**
+ * @brief Deliver pending batch, if any.
+ *
+ * @param redirection Pointer to redirection object.
+ */
+static void STDREDIRECT_flushBatch(STDREDIRECT_REDIRECTION* redirection) {
+    long long start;
+
+    if (redirection->batchCount > 0) {
+        start = STDREDIRECT_now();
+        ++STDREDIRECT_callbackDepth;
+        redirection->batchCallback(redirection->batchSegments, redirection->batchCount, redirection->userdata);
+        --STDREDIRECT_callbackDepth;
+        STDREDIRECT_countCallback(redirection, start);
+        redirection->batchLength = 0;
+        redirection->batchCount = 0;
+    }
+}
+
+
+/**
+ * @brief Deliver pending batch if its delay has elapsed.
+ *
+ * @param redirection Pointer to redirection object.
+ */
+static void STDREDIRECT_flushExpiredBatch(STDREDIRECT_REDIRECTION* redirection) {
+    if (redirection->batchCount > 0 && STDREDIRECT_now() >= redirection->batchDeadline) {
+        STDREDIRECT_flushBatch(redirection);
+    }
+}
+
+
+/**
+ * @brief Time until pending batch is due.
+ *
+ * @param redirection Pointer to redirection object.
+ * @return Microseconds until the pending batch is due, 0 if overdue, -1 if there is no pending batch.
+ */
+static long long STDREDIRECT_batchTimeout(STDREDIRECT_REDIRECTION* redirection) {
+    long long timeout;
+
+    if (redirection->batchCount == 0) {
+        return -1;
+    }
+
+    timeout = redirection->batchDeadline - STDREDIRECT_now();
+
+    return timeout > 0 ? timeout : 0;
+}
+
+
+/**
+ * @brief Time until the pipe reader has to deliver a pending batch, summary or statistics, or poll for a child exit.
+ *
+ * Batches and summaries of asynchronous redirections are delivered by the dispatcher and not considered here.
+ *
+ * @param redirection Pointer to redirection object.
+ * @return Microseconds until the earliest is due, 0 if overdue, -1 if there is nothing pending.
+ */
+static long long STDREDIRECT_nextTimeout(STDREDIRECT_REDIRECTION* redirection) {
+    long long timeout      = redirection->ring.data ? -1 : STDREDIRECT_batchTimeout(redirection);
+    long long summaryTimeout;
+    long long statsTimeout;
+
+    if (!redirection->ring.data) {
+        summaryTimeout = STDREDIRECT_summaryTimeout(redirection);
+        if (summaryTimeout != -1 && (timeout == -1 || summaryTimeout < timeout)) {
+            timeout = summaryTimeout;
+        }
+    }
+
+    /* no snapshots while parked */
+    if (redirection->statsCallback && STDREDIRECT_statLoad(&redirection->redirectedSince) != -1) {
+        statsTimeout = redirection->statsDeadline - STDREDIRECT_now();
+        if (statsTimeout < 0) {
+            statsTimeout = 0;
+        }
+        if (timeout == -1 || statsTimeout < timeout) {
+            timeout = statsTimeout;
+        }
+    }
+
+#ifdef STDREDIRECT_SHARED_READER
+    if (redirection->isExitPolled && (timeout == -1 || STDREDIRECT_EXIT_POLL_INTERVAL_US < timeout)) {
+        timeout = STDREDIRECT_EXIT_POLL_INTERVAL_US;
+    }
+#endif /* STDREDIRECT_SHARED_READER */
+
+    return timeout;
+}
+
+
+/**
+ * @brief Deliver pending batch, summary and statistics if they are due, runs on the pipe reader or reactor thread.
+ *
+ * The reactor also reports the exit of a child process it polls for, see STDREDIRECT_endOfFile().
+ *
+ * @param redirection Pointer to redirection object.
+ */
+static void STDREDIRECT_handleTimeouts(STDREDIRECT_REDIRECTION* redirection) {
+    long long now;
+#ifdef STDREDIRECT_SHARED_READER
+    int       exitCode = 0;
+#endif /* STDREDIRECT_SHARED_READER */
+
+    STDREDIRECT_lock(&redirection->injectLock);
+    if (!redirection->ring.data) {
+        STDREDIRECT_flushExpiredSummary(redirection);
+        STDREDIRECT_flushExpiredBatch(redirection);
+    }
+
+    if (redirection->statsCallback && STDREDIRECT_statLoad(&redirection->redirectedSince) != -1) {
+        now = STDREDIRECT_now();
+        if (now >= redirection->statsDeadline) {
+            /* keep the interval, but do not catch up on snapshots missed by a long callback */
+            redirection->statsDeadline += redirection->statsIntervalUs;
+            if (redirection->statsDeadline <= now) {
+                redirection->statsDeadline = now + redirection->statsIntervalUs;
+            }
+            STDREDIRECT_reportStats(redirection);
+        }
+    }
+    STDREDIRECT_unlock(&redirection->injectLock);
+
+#ifdef STDREDIRECT_SHARED_READER
+    /* the process and its redirections are only freed once the reactor dropped them */
+    if (redirection->isExitPolled && STDREDIRECT_reap(redirection->process, FALSE, &exitCode)) {
+        redirection->isExitPolled = FALSE;
+        STDREDIRECT_exited(redirection->process, exitCode);
+    }
+#endif /* STDREDIRECT_SHARED_READER */
+}
+
+
+/**
+ * @brief Pass statistics snapshot to the statistics callback.
+ *
+ * @param redirection Pointer to redirection object.
+ */
+static void STDREDIRECT_reportStats(STDREDIRECT_REDIRECTION* redirection) {
+    STDREDIRECT_STATS stats;
+
+    STDREDIRECT_getStats(redirection, &stats);
+    ++STDREDIRECT_callbackDepth;
+    redirection->statsCallback(&stats, redirection->userdata);
+    --STDREDIRECT_callbackDepth;
+}
+
+
+/**
+ * @brief Count chunk read from the pipe.
+ *
+ * @param redirection Pointer to redirection object.
+ * @param length Number of bytes, greater than 0.
+ */
+static void STDREDIRECT_countChunk(STDREDIRECT_REDIRECTION* redirection, size_t length) {
+    size_t remaining = length;
+    int    bucket    = 0;
+
+    while (remaining > 1 && bucket < STDREDIRECT_STATS_BUCKETS - 1) {
+        remaining >>= 1;
+        ++bucket;
+    }
+
+    STDREDIRECT_statAdd(&redirection->stats.bytesRead, (long long) length);
+    STDREDIRECT_statAdd(&redirection->stats.chunkSizes[bucket], 1);
+}
+
+
+/**
+ * @brief Count callback invocation.
+ *
+ * @param redirection Pointer to redirection object.
+ * @param start STDREDIRECT_now() before the callback was called.
+ */
+static void STDREDIRECT_countCallback(STDREDIRECT_REDIRECTION* redirection, long long start) {
+    long long duration = STDREDIRECT_now() - start;
+
+    STDREDIRECT_statAdd(&redirection->stats.callbacks, 1);
+    STDREDIRECT_statAdd(&redirection->stats.callbackTimeUs, duration);
+    if (duration > redirection->stats.maxCallbackTimeUs) {
+        STDREDIRECT_statStore(&redirection->stats.maxCallbackTimeUs, duration);
+    }
+}
+
+
+/**
+ * @brief Adapt pipe capacity and pipe reader buffer size to a burst, runs on the pipe reader or reactor thread.
+ *
+ * A burst filling half the pipe or needing more than one read grows pipe and buffer right away to twice the burst,
+ * so the next one fits without blocking the writer. They shrink by half once per STDREDIRECT_ADAPT_INTERVAL_US in
+ * which no burst needed more than a quarter of them.
+ *
+ * @param redirection Pointer to redirection object.
+ * @param burst Number of bytes drained from the pipe at once.
+ */
+static void STDREDIRECT_adapt(STDREDIRECT_REDIRECTION* redirection, size_t burst) {
+    size_t    size;
+    long long now;
+
+    if ((long long) burst > redirection->stats.largestBurst) {
+        STDREDIRECT_statStore(&redirection->stats.largestBurst, (long long) burst);
+    }
+    if (!redirection->isAdaptive) {
+        return;
+    }
+    if (burst > redirection->windowBurst) {
+        redirection->windowBurst = burst;
+    }
+
+    /* grow */
+    if (redirection->pipeSize > 0 && burst >= redirection->pipeSize / 2 && redirection->pipeSize < redirection->maxPipeSize) {
+        for (size = redirection->pipeSize; size < 2 * burst && size < redirection->maxPipeSize; size *= 2);
+        STDREDIRECT_resizePipe(redirection, size < redirection->maxPipeSize ? size : redirection->maxPipeSize);
+    }
+    if (burst > redirection->bufferSize && redirection->bufferSize < redirection->maxBufferSize) {
+        for (size = redirection->bufferSize; size < 2 * burst && size < redirection->maxBufferSize; size *= 2);
+        STDREDIRECT_resizeBuffer(redirection, size < redirection->maxBufferSize ? size : redirection->maxBufferSize);
+    }
+
+    /* shrink */
+    now = STDREDIRECT_now();
+    if (now >= redirection->adaptDeadline) {
+        if (redirection->windowBurst < redirection->pipeSize / 4 && redirection->pipeSize > redirection->minPipeSize) {
+            STDREDIRECT_resizePipe(redirection, redirection->pipeSize / 2 > redirection->minPipeSize ? redirection->pipeSize / 2 : redirection->minPipeSize);
+        }
+        if (redirection->windowBurst < redirection->bufferSize / 4 && redirection->bufferSize > redirection->minBufferSize) {
+            STDREDIRECT_resizeBuffer(redirection, redirection->bufferSize / 2 > redirection->minBufferSize ? redirection->bufferSize / 2 : redirection->minBufferSize);
+        }
+        redirection->windowBurst = 0;
+        redirection->adaptDeadline = now + STDREDIRECT_ADAPT_INTERVAL_US;
+    }
+}
+
+
+/**
+ * @brief Set pipe capacity where supported (Linux), and find out the current one.
+ *
+ * The kernel rounds the size up to a power of two pages. If it refuses to grow the pipe (above
+ * /proc/sys/fs/pipe-max-size for unprivileged processes), the current capacity becomes the cap.
+ *
+ * @param redirection Pointer to redirection object.
+ * @param pipeSize Requested capacity, 0 only finds out the current one.
+ */
+static void STDREDIRECT_resizePipe(STDREDIRECT_REDIRECTION* redirection, size_t pipeSize) {
+#if !defined (_WIN32) && defined (F_SETPIPE_SZ)
+    int result    = -1;
+    int isRefused = FALSE;
+
+    if (pipeSize > 0) {
+        result = fcntl(redirection->readablePipeEnd, F_SETPIPE_SZ, (int) pipeSize);
+        isRefused = result == -1 && errno == EPERM;
+    }
+    if (result == -1) {
+        /* shrinking below the current contents fails with EBUSY, keep the size */
+        result = fcntl(redirection->readablePipeEnd, F_GETPIPE_SZ);
+        if (result != -1 && isRefused && (size_t) result < redirection->maxPipeSize) {
+            redirection->maxPipeSize = (size_t) result;
+        }
+    }
+    if (result != -1) {
+        redirection->pipeSize = (size_t) result;
+        STDREDIRECT_statStore(&redirection->stats.pipeSize, result);
+    }
+#else
+    (void) redirection;
+    (void) pipeSize;
+#endif /* !_WIN32 && F_SETPIPE_SZ */
+}
+
+
+/**
+ * @brief Resize pipe reader buffer, keeps the current one if allocation fails.
+ *
+ * @param redirection Pointer to redirection object.
+ * @param bufferSize New size, at most STDREDIRECT_REDIRECTION::maxBufferSize.
+ */
+static void STDREDIRECT_resizeBuffer(STDREDIRECT_REDIRECTION* redirection, size_t bufferSize) {
+    char* buffer = (char*) realloc(redirection->buffer, bufferSize + 1);
+
+    if (buffer) {
+        redirection->buffer = buffer;
+        redirection->bufferSize = bufferSize;
+        STDREDIRECT_statStore(&redirection->stats.bufferSize, (long long) bufferSize);
+    }
+}
+
+
+/**
+ * @brief Monotonic clock.
+ *
+ * @return Microseconds since an unspecified point in time.
+ */
+static long long STDREDIRECT_now() {
+#ifdef _WIN32
+    LARGE_INTEGER counter;
+    LARGE_INTEGER frequency;
+
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+
+    return (long long) (counter.QuadPart / frequency.QuadPart * 1000000 + counter.QuadPart % frequency.QuadPart * 1000000 / frequency.QuadPart);
+#else
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (long long) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+#endif /* _WIN32 */
+}
+
+
+/**
+ * @brief Find first occurrence of a byte, vectorized with AVX2/SSE2 where available.
+ *
+ * @param data Data to scan.
+ * @param length Number of bytes.
+ * @param byte Byte to search for.
+ * @return Pointer to first occurrence, NULL if not found.
+ */
+static const char* STDREDIRECT_findByte(const char* data, size_t length, char byte) {
+#if defined (STDREDIRECT_AVX2)
+    const __m256i pattern256 = _mm256_set1_epi8(byte);
+    unsigned int  mask256;
+#endif
+#if defined (STDREDIRECT_SSE2)
+    const __m128i pattern = _mm_set1_epi8(byte);
+    unsigned int  mask;
+#endif
+
+#if defined (STDREDIRECT_AVX2)
+    while (length >= 64) {
+        __m256i first  = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) data), pattern256);
+        __m256i second = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) (data + 32)), pattern256);
+
+        if (!_mm256_testz_si256(_mm256_or_si256(first, second), _mm256_or_si256(first, second))) {
+            mask256 = (unsigned int) _mm256_movemask_epi8(first);
+            if (mask256) {
+                return data + STDREDIRECT_countTrailingZeros(mask256);
+            }
+            return data + 32 + STDREDIRECT_countTrailingZeros((unsigned int) _mm256_movemask_epi8(second));
+        }
+        data += 64;
+        length -= 64;
+    }
+#endif
+#if defined (STDREDIRECT_SSE2)
+    while (length >= 64) {
+        __m128i first  = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) data), pattern);
+        __m128i second = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (data + 16)), pattern);
+        __m128i third  = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (data + 32)), pattern);
+        __m128i fourth = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (data + 48)), pattern);
+
+        if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(first, second), _mm_or_si128(third, fourth)))) {
+            mask = (unsigned int) _mm_movemask_epi8(first)
+                 | (unsigned int) _mm_movemask_epi8(second) << 16;
+            if (mask) {
+                return data + STDREDIRECT_countTrailingZeros(mask);
+            }
+            mask = (unsigned int) _mm_movemask_epi8(third)
+                 | (unsigned int) _mm_movemask_epi8(fourth) << 16;
+            return data + 32 + STDREDIRECT_countTrailingZeros(mask);
+        }
+        data += 64;
+        length -= 64;
+    }
+    while (length >= 16) {
+        mask = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) data), pattern));
+        if (mask) {
+            return data + STDREDIRECT_countTrailingZeros(mask);
+        }
+        data += 16;
+        length -= 16;
+    }
+#endif
+
+    /* scalar fallback and tail */
+    for (; length > 0; ++data, --length) {
+        if (*data == byte) {
+            return data;
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief Remove ANSI escape sequences in place.
+ *
+ * Plain text is skipped with the vectorized STDREDIRECT_findByte() scan for ESC and moved down over removed
+ * sequences, only the bytes of a sequence go through the scalar state machine. Removes CSI sequences (colors, cursor
+ * movement), OSC sequences ended by BEL or ST (window titles, hyperlinks), DCS/SOS/PM/APC strings and two-byte
+ * sequences. A sequence cut off at the end of @p data is continued with the next call through @p state. A byte that
+ * cannot be part of the sequence it appears in ends it and is kept, a newline also ends an unterminated string, so a
+ * stray ESC does not swallow the rest of the output.
+ *
+ * @param state Escape sequence state, ::STDREDIRECT_ESCAPE_STATE_TEXT initially.
+ * @param data Data.
+ * @param length Number of bytes.
+ * @return Number of bytes left at the start of @p data.
+ */
+static size_t STDREDIRECT_stripEscapes(STDREDIRECT_ESCAPE_STATE* state, char* data, size_t length) {
+    STDREDIRECT_ESCAPE_STATE current = *state;
+    const char*              escape;
+    size_t                   textLength;
+    size_t                   in      = 0;
+    size_t                   out     = 0;
+    unsigned char            byte;
+
+    /* state is copied to a local, stores through data may alias it */
+    while (in < length) {
+        if (current == STDREDIRECT_ESCAPE_STATE_TEXT) {
+            /* keep plain text up to the next ESC */
+            escape = STDREDIRECT_findByte(data + in, length - in, '\x1b');
+            textLength = escape ? (size_t) (escape - (data + in)) : length - in;
+            if (out != in) {
+                memmove(data + out, data + in, textLength);
+            }
+            in += textLength;
+            out += textLength;
+            if (escape) {
+                current = STDREDIRECT_ESCAPE_STATE_ESCAPE;
+                ++in;
+            }
+            continue;
+        }
+
+        if (current == STDREDIRECT_ESCAPE_STATE_CSI) {
+            /* skip parameter and intermediate bytes of colors and cursor movement in one go */
+            while (in < length && (unsigned char) data[in] >= 0x20 && (unsigned char) data[in] <= 0x3f) {
+                ++in;
+            }
+            if (in == length) {
+                break;
+            }
+        }
+
+        byte = (unsigned char) data[in++];
+        switch (current) {
+        case STDREDIRECT_ESCAPE_STATE_ESCAPE:
+            if (byte == '[') {
+                current = STDREDIRECT_ESCAPE_STATE_CSI;
+            }
+            else if (byte == ']') {
+                current = STDREDIRECT_ESCAPE_STATE_OSC;
+            }
+            else if (byte == 'P' || byte == 'X' || byte == '^' || byte == '_') {
+                current = STDREDIRECT_ESCAPE_STATE_STRING;
+            }
+            else if (byte >= 0x20 && byte <= 0x2f) {
+                current = STDREDIRECT_ESCAPE_STATE_INTERMEDIATE;
+            }
+            else if (byte >= 0x30 && byte <= 0x7e) {
+                current = STDREDIRECT_ESCAPE_STATE_TEXT;
+            }
+            else if (byte != 0x1b) {
+                data[out++] = (char) byte;
+                current = STDREDIRECT_ESCAPE_STATE_TEXT;
+            }
+            break;
+        case STDREDIRECT_ESCAPE_STATE_INTERMEDIATE:
+            if (byte >= 0x30 && byte <= 0x7e) {
+                current = STDREDIRECT_ESCAPE_STATE_TEXT;
+            }
+            else if (byte == 0x1b) {
+                current = STDREDIRECT_ESCAPE_STATE_ESCAPE;
+            }
+            else if (byte < 0x20 || byte > 0x2f) {
+                data[out++] = (char) byte;
+                current = STDREDIRECT_ESCAPE_STATE_TEXT;
+            }
+            break;
+        case STDREDIRECT_ESCAPE_STATE_CSI:
+            if (byte >= 0x40 && byte <= 0x7e) {
+                current = STDREDIRECT_ESCAPE_STATE_TEXT;
+            }
+            else if (byte == 0x1b) {
+                current = STDREDIRECT_ESCAPE_STATE_ESCAPE;
+            }
+            else if (byte < 0x20 || byte > 0x3f) {
+                data[out++] = (char) byte;
+                current = STDREDIRECT_ESCAPE_STATE_TEXT;
+            }
+            break;
+        case STDREDIRECT_ESCAPE_STATE_OSC:
+        case STDREDIRECT_ESCAPE_STATE_STRING:
+            if (byte == 0x07 && current == STDREDIRECT_ESCAPE_STATE_OSC) {
+                current = STDREDIRECT_ESCAPE_STATE_TEXT;
+            }
+            else if (byte == 0x1b) {
+                current = STDREDIRECT_ESCAPE_STATE_STRING_ESCAPE;
+            }
+            else if (byte == '\n') {
+                data[out++] = (char) byte;
+                current = STDREDIRECT_ESCAPE_STATE_TEXT;
+            }
+            break;
+        case STDREDIRECT_ESCAPE_STATE_STRING_ESCAPE:
+            if (byte == '\\') {
+                current = STDREDIRECT_ESCAPE_STATE_TEXT;
+            }
+            else {
+                /* the ESC starts another sequence */
+                current = STDREDIRECT_ESCAPE_STATE_ESCAPE;
+                --in;
+            }
+            break;
+        default:
+            current = STDREDIRECT_ESCAPE_STATE_TEXT;
+            break;
+        }
+    }
+
+    *state = current;
+
+    return out;
+}
+
+
+/**
+ * @brief Count leading ASCII bytes, vectorized with AVX2/SSE2 where available.
+ *
+ * @param data Data to scan.
+ * @param length Number of bytes.
+ * @return Number of bytes before the first byte >= 0x80, @p length if there is none.
+ */
+static size_t STDREDIRECT_skipAscii(const char* data, size_t length) {
+    size_t       i = 0;
+#if defined (STDREDIRECT_SSE2)
+    unsigned int mask;
+#endif
+
+#if defined (STDREDIRECT_AVX2)
+    while (length - i >= 32) {
+        mask = (unsigned int) _mm256_movemask_epi8(_mm256_loadu_si256((const __m256i*) (data + i)));
+        if (mask) {
+            return i + STDREDIRECT_countTrailingZeros(mask);
+        }
+        i += 32;
+    }
+#endif
+#if defined (STDREDIRECT_SSE2)
+    while (length - i >= 16) {
+        mask = (unsigned int) _mm_movemask_epi8(_mm_loadu_si128((const __m128i*) (data + i)));
+        if (mask) {
+            return i + STDREDIRECT_countTrailingZeros(mask);
+        }
+        i += 16;
+    }
+#endif
+
+    /* scalar fallback and tail */
+    while (i < length && (unsigned char) data[i] < 0x80) {
+        ++i;
+    }
+
+    return i;
+}
+
+
+/**
+ * @brief Check the UTF-8 sequence at the start of data.
+ *
+ * Follows the Unicode definition of well-formed UTF-8: no overlong forms, no surrogates, nothing above U+10FFFF.
+ *
+ * @param data Data, at least one byte.
+ * @param length Number of bytes.
+ * @return Length of the complete, valid sequence, 0 if it is valid so far but cut off at the end of @p data, minus
+ *         the length of the maximal invalid subsequence (to be replaced with one U+FFFD) otherwise.
+ */
+static int STDREDIRECT_utf8SequenceLength(const unsigned char* data, size_t length) {
+    int           sequenceLength;
+    int           i;
+    unsigned char lower = 0x80;
+    unsigned char upper = 0xbf;
+
+    if (data[0] < 0x80) {
+        return 1;
+    }
+    if (data[0] < 0xc2) {
+        /* continuation byte or overlong two-byte form */
+        return -1;
+    }
+    if (data[0] < 0xe0) {
+        sequenceLength = 2;
+    }
+    else if (data[0] < 0xf0) {
+        sequenceLength = 3;
+        lower = data[0] == 0xe0 ? 0xa0 : 0x80;
+        upper = data[0] == 0xed ? 0x9f : 0xbf;
+    }
+    else if (data[0] < 0xf5) {
+        sequenceLength = 4;
+        lower = data[0] == 0xf0 ? 0x90 : 0x80;
+        upper = data[0] == 0xf4 ? 0x8f : 0xbf;
+    }
+    else {
+        return -1;
+    }
+
+    /* only the second byte has a narrower range */
+    for (i = 1; i < sequenceLength; ++i) {
+        if ((size_t) i == length) {
+            return 0;
+        }
+        if (data[i] < lower || data[i] > upper) {
+            return -i;
+        }
+        lower = 0x80;
+        upper = 0xbf;
+    }
+
+    return sequenceLength;
+}
+
+
+#if defined (STDREDIRECT_AVX2) || defined (STDREDIRECT_AVX2_RUNTIME)
+/* error classes of the lookup tables of Keiser and Lemire, a pair of bytes is invalid if all three tables of
+   STDREDIRECT_UTF8_LOOKUP have a bit of the same class set for it */
+#define STDREDIRECT_UTF8_TOO_SHORT      0x01 /* lead byte followed by ASCII or another lead byte        */
+#define STDREDIRECT_UTF8_TOO_LONG       0x02 /* ASCII followed by a continuation byte                   */
+#define STDREDIRECT_UTF8_OVERLONG_3     0x04 /* 11100000 100_____                                       */
+#define STDREDIRECT_UTF8_TOO_LARGE      0x08 /* 11110100 1001____ and above, beyond U+10FFFF            */
+#define STDREDIRECT_UTF8_SURROGATE      0x10 /* 11101101 101_____                                       */
+#define STDREDIRECT_UTF8_OVERLONG_2     0x20 /* 1100000_ 10______                                       */
+#define STDREDIRECT_UTF8_TOO_LARGE_1000 0x40 /* 11110101 1000____ and above                             */
+#define STDREDIRECT_UTF8_OVERLONG_4     0x40 /* 11110000 1000____                                       */
+#define STDREDIRECT_UTF8_TWO_CONTS      0x80 /* continuation byte after another, fine in third and fourth
+                                                bytes only                                              */
+#define STDREDIRECT_UTF8_CARRY          (STDREDIRECT_UTF8_TOO_SHORT | STDREDIRECT_UTF8_TOO_LONG | STDREDIRECT_UTF8_TWO_CONTS)
+
+/** @brief Error classes by high nibble of the first byte, low nibble of the first byte and high nibble of the second byte of a pair. */
+static const unsigned char STDREDIRECT_UTF8_LOOKUP[3][16] = {
+    {
+        /* 0_______ ASCII */
+        STDREDIRECT_UTF8_TOO_LONG, STDREDIRECT_UTF8_TOO_LONG, STDREDIRECT_UTF8_TOO_LONG, STDREDIRECT_UTF8_TOO_LONG,
+        STDREDIRECT_UTF8_TOO_LONG, STDREDIRECT_UTF8_TOO_LONG, STDREDIRECT_UTF8_TOO_LONG, STDREDIRECT_UTF8_TOO_LONG,
+        /* 10______ continuation */
+        STDREDIRECT_UTF8_TWO_CONTS, STDREDIRECT_UTF8_TWO_CONTS, STDREDIRECT_UTF8_TWO_CONTS, STDREDIRECT_UTF8_TWO_CONTS,
+        /* 1100____, 1101____ two bytes */
+        STDREDIRECT_UTF8_TOO_SHORT | STDREDIRECT_UTF8_OVERLONG_2,
+        STDREDIRECT_UTF8_TOO_SHORT,
+        /* 1110____ three bytes */
+        STDREDIRECT_UTF8_TOO_SHORT | STDREDIRECT_UTF8_OVERLONG_3 | STDREDIRECT_UTF8_SURROGATE,
+        /* 1111____ four bytes */
+        STDREDIRECT_UTF8_TOO_SHORT | STDREDIRECT_UTF8_TOO_LARGE | STDREDIRECT_UTF8_TOO_LARGE_1000 | STDREDIRECT_UTF8_OVERLONG_4
+    },
+    {
+        /* ____0000, ____0001 */
+        STDREDIRECT_UTF8_CARRY | STDREDIRECT_UTF8_OVERLONG_3 | STDREDIRECT_UTF8_OVERLONG_2 | STDREDIRECT_UTF8_OVERLONG_4,
+        STDREDIRECT_UTF8_CARRY | STDREDIRECT_UTF8_OVERLONG_2,
+        /* ____001_ */
+        STDREDIRECT_UTF8_CARRY,
+        STDREDIRECT_UTF8_CARRY,
+        /* ____0100 */
+        STDREDIRECT_UTF8_CARRY | STDREDIRECT_UTF8_TOO_LARGE,
+        /* ____0101 to ____1100 */
+        STDREDIRECT_UTF8_CARRY | STDREDIRECT_UTF8_TOO_LARGE | STDREDIRECT_UTF8_TOO_LARGE_1000,
+        STDREDIRECT_UTF8_CARRY | STDREDIRECT_UTF8_TOO_LARGE | STDREDIRECT_UTF8_TOO_LARGE_1000,
+        STDREDIRECT_UTF8_CARRY | STDREDIRECT_UTF8_TOO_LARGE | STDREDIRECT_UTF8_TOO_LARGE_1000,
+        STDREDIRECT_UTF8_CARRY | STDREDIRECT_UTF8_TOO_LARGE | STDREDIRECT_UTF8_TOO_LARGE_1000,
+        STDREDIRECT_UTF8_CARRY | STDREDIRECT_UTF8_TOO_LARGE | STDREDIRECT_UTF8_TOO_LARGE_1000,
+        STDREDIRECT_UTF8_CARRY | STDREDIRECT_UTF8_TOO_LARGE | STDREDIRECT_UTF8_TOO_LARGE_1000,
+        STDREDIRECT_UTF8_CARRY | STDREDIRECT_UTF8_TOO_LARGE | STDREDIRECT_UTF8_TOO_LARGE_1000,
+        STDREDIRECT_UTF8_CARRY | STDREDIRECT_UTF8_TOO_LARGE | STDREDIRECT_UTF8_TOO_LARGE_1000,
+        /* ____1101 */
+        STDREDIRECT_UTF8_CARRY | STDREDIRECT_UTF8_TOO_LARGE | STDREDIRECT_UTF8_TOO_LARGE_1000 | STDREDIRECT_UTF8_SURROGATE,
+        /* ____111_ */
+        STDREDIRECT_UTF8_CARRY | STDREDIRECT_UTF8_TOO_LARGE | STDREDIRECT_UTF8_TOO_LARGE_1000,
+        STDREDIRECT_UTF8_CARRY | STDREDIRECT_UTF8_TOO_LARGE | STDREDIRECT_UTF8_TOO_LARGE_1000
+    },
+    {
+        /* 0_______ ASCII */
+        STDREDIRECT_UTF8_TOO_SHORT, STDREDIRECT_UTF8_TOO_SHORT, STDREDIRECT_UTF8_TOO_SHORT, STDREDIRECT_UTF8_TOO_SHORT,
+        STDREDIRECT_UTF8_TOO_SHORT, STDREDIRECT_UTF8_TOO_SHORT, STDREDIRECT_UTF8_TOO_SHORT, STDREDIRECT_UTF8_TOO_SHORT,
+        /* 1000____ */
+        STDREDIRECT_UTF8_TOO_LONG | STDREDIRECT_UTF8_OVERLONG_2 | STDREDIRECT_UTF8_TWO_CONTS | STDREDIRECT_UTF8_OVERLONG_3 | STDREDIRECT_UTF8_TOO_LARGE_1000 | STDREDIRECT_UTF8_OVERLONG_4,
+        /* 1001____ */
+        STDREDIRECT_UTF8_TOO_LONG | STDREDIRECT_UTF8_OVERLONG_2 | STDREDIRECT_UTF8_TWO_CONTS | STDREDIRECT_UTF8_OVERLONG_3 | STDREDIRECT_UTF8_TOO_LARGE,
+        /* 101_____ */
+        STDREDIRECT_UTF8_TOO_LONG | STDREDIRECT_UTF8_OVERLONG_2 | STDREDIRECT_UTF8_TWO_CONTS | STDREDIRECT_UTF8_SURROGATE | STDREDIRECT_UTF8_TOO_LARGE,
+        STDREDIRECT_UTF8_TOO_LONG | STDREDIRECT_UTF8_OVERLONG_2 | STDREDIRECT_UTF8_TWO_CONTS | STDREDIRECT_UTF8_SURROGATE | STDREDIRECT_UTF8_TOO_LARGE,
+        /* 11______ lead byte */
+        STDREDIRECT_UTF8_TOO_SHORT, STDREDIRECT_UTF8_TOO_SHORT, STDREDIRECT_UTF8_TOO_SHORT, STDREDIRECT_UTF8_TOO_SHORT
+    }
+};
+
+#undef STDREDIRECT_UTF8_TOO_SHORT
+#undef STDREDIRECT_UTF8_TOO_LONG
+#undef STDREDIRECT_UTF8_OVERLONG_3
+#undef STDREDIRECT_UTF8_TOO_LARGE
+#undef STDREDIRECT_UTF8_SURROGATE
+#undef STDREDIRECT_UTF8_OVERLONG_2
+#undef STDREDIRECT_UTF8_TOO_LARGE_1000
+#undef STDREDIRECT_UTF8_OVERLONG_4
+#undef STDREDIRECT_UTF8_TWO_CONTS
+#undef STDREDIRECT_UTF8_CARRY
+
+/** @brief Lanes set in a mask of 8, packed to the front: byte k is the offset of the k-th lane set, in bytes. */
+static const unsigned char STDREDIRECT_UTF16_LANES[256][8] = {
+    {  0,  0,  0,  0,  0,  0,  0,  0 }, {  0,  0,  0,  0,  0,  0,  0,  0 }, {  2,  0,  0,  0,  0,  0,  0,  0 }, {  0,  2,  0,  0,  0,  0,  0,  0 },
+    {  4,  0,  0,  0,  0,  0,  0,  0 }, {  0,  4,  0,  0,  0,  0,  0,  0 }, {  2,  4,  0,  0,  0,  0,  0,  0 }, {  0,  2,  4,  0,  0,  0,  0,  0 },
+    {  6,  0,  0,  0,  0,  0,  0,  0 }, {  0,  6,  0,  0,  0,  0,  0,  0 }, {  2,  6,  0,  0,  0,  0,  0,  0 }, {  0,  2,  6,  0,  0,  0,  0,  0 },
+    {  4,  6,  0,  0,  0,  0,  0,  0 }, {  0,  4,  6,  0,  0,  0,  0,  0 }, {  2,  4,  6,  0,  0,  0,  0,  0 }, {  0,  2,  4,  6,  0,  0,  0,  0 },
+    {  8,  0,  0,  0,  0,  0,  0,  0 }, {  0,  8,  0,  0,  0,  0,  0,  0 }, {  2,  8,  0,  0,  0,  0,  0,  0 }, {  0,  2,  8,  0,  0,  0,  0,  0 },
+    {  4,  8,  0,  0,  0,  0,  0,  0 }, {  0,  4,  8,  0,  0,  0,  0,  0 }, {  2,  4,  8,  0,  0,  0,  0,  0 }, {  0,  2,  4,  8,  0,  0,  0,  0 },
+    {  6,  8,  0,  0,  0,  0,  0,  0 }, {  0,  6,  8,  0,  0,  0,  0,  0 }, {  2,  6,  8,  0,  0,  0,  0,  0 }, {  0,  2,  6,  8,  0,  0,  0,  0 },
+    {  4,  6,  8,  0,  0,  0,  0,  0 }, {  0,  4,  6,  8,  0,  0,  0,  0 }, {  2,  4,  6,  8,  0,  0,  0,  0 }, {  0,  2,  4,  6,  8,  0,  0,  0 },
+    { 10,  0,  0,  0,  0,  0,  0,  0 }, {  0, 10,  0,  0,  0,  0,  0,  0 }, {  2, 10,  0,  0,  0,  0,  0,  0 }, {  0,  2, 10,  0,  0,  0,  0,  0 },
+    {  4, 10,  0,  0,  0,  0,  0,  0 }, {  0,  4, 10,  0,  0,  0,  0,  0 }, {  2,  4, 10,  0,  0,  0,  0,  0 }, {  0,  2,  4, 10,  0,  0,  0,  0 },
+    {  6, 10,  0,  0,  0,  0,  0,  0 }, {  0,  6, 10,  0,  0,  0,  0,  0 }, {  2,  6, 10,  0,  0,  0,  0,  0 }, {  0,  2,  6, 10,  0,  0,  0,  0 },
+    {  4,  6, 10,  0,  0,  0,  0,  0 }, {  0,  4,  6, 10,  0,  0,  0,  0 }, {  2,  4,  6, 10,  0,  0,  0,  0 }, {  0,  2,  4,  6, 10,  0,  0,  0 },
+    {  8, 10,  0,  0,  0,  0,  0,  0 }, {  0,  8, 10,  0,  0,  0,  0,  0 }, {  2,  8, 10,  0,  0,  0,  0,  0 }, {  0,  2,  8, 10,  0,  0,  0,  0 },
+    {  4,  8, 10,  0,  0,  0,  0,  0 }, {  0,  4,  8, 10,  0,  0,  0,  0 }, {  2,  4,  8, 10,  0,  0,  0,  0 }, {  0,  2,  4,  8, 10,  0,  0,  0 },
+    {  6,  8, 10,  0,  0,  0,  0,  0 }, {  0,  6,  8, 10,  0,  0,  0,  0 }, {  2,  6,  8, 10,  0,  0,  0,  0 }, {  0,  2,  6,  8, 10,  0,  0,  0 },
+    {  4,  6,  8, 10,  0,  0,  0,  0 }, {  0,  4,  6,  8, 10,  0,  0,  0 }, {  2,  4,  6,  8, 10,  0,  0,  0 }, {  0,  2,  4,  6,  8, 10,  0,  0 },
+    { 12,  0,  0,  0,  0,  0,  0,  0 }, {  0, 12,  0,  0,  0,  0,  0,  0 }, {  2, 12,  0,  0,  0,  0,  0,  0 }, {  0,  2, 12,  0,  0,  0,  0,  0 },
+    {  4, 12,  0,  0,  0,  0,  0,  0 }, {  0,  4, 12,  0,  0,  0,  0,  0 }, {  2,  4, 12,  0,  0,  0,  0,  0 }, {  0,  2,  4, 12,  0,  0,  0,  0 },
+    {  6, 12,  0,  0,  0,  0,  0,  0 }, {  0,  6, 12,  0,  0,  0,  0,  0 }, {  2,  6, 12,  0,  0,  0,  0,  0 }, {  0,  2,  6, 12,  0,  0,  0,  0 },
+    {  4,  6, 12,  0,  0,  0,  0,  0 }, {  0,  4,  6, 12,  0,  0,  0,  0 }, {  2,  4,  6, 12,  0,  0,  0,  0 }, {  0,  2,  4,  6, 12,  0,  0,  0 },
+    {  8, 12,  0,  0,  0,  0,  0,  0 }, {  0,  8, 12,  0,  0,  0,  0,  0 }, {  2,  8, 12,  0,  0,  0,  0,  0 }, {  0,  2,  8, 12,  0,  0,  0,  0 },
+    {  4,  8, 12,  0,  0,  0,  0,  0 }, {  0,  4,  8, 12,  0,  0,  0,  0 }, {  2,  4,  8, 12,  0,  0,  0,  0 }, {  0,  2,  4,  8, 12,  0,  0,  0 },
+    {  6,  8, 12,  0,  0,  0,  0,  0 }, {  0,  6,  8, 12,  0,  0,  0,  0 }, {  2,  6,  8, 12,  0,  0,  0,  0 }, {  0,  2,  6,  8, 12,  0,  0,  0 },
+    {  4,  6,  8, 12,  0,  0,  0,  0 }, {  0,  4,  6,  8, 12,  0,  0,  0 }, {  2,  4,  6,  8, 12,  0,  0,  0 }, {  0,  2,  4,  6,  8, 12,  0,  0 },
+    { 10, 12,  0,  0,  0,  0,  0,  0 }, {  0, 10, 12,  0,  0,  0,  0,  0 }, {  2, 10, 12,  0,  0,  0,  0,  0 }, {  0,  2, 10, 12,  0,  0,  0,  0 },
+    {  4, 10, 12,  0,  0,  0,  0,  0 }, {  0,  4, 10, 12,  0,  0,  0,  0 }, {  2,  4, 10, 12,  0,  0,  0,  0 }, {  0,  2,  4, 10, 12,  0,  0,  0 },
+    {  6, 10, 12,  0,  0,  0,  0,  0 }, {  0,  6, 10, 12,  0,  0,  0,  0 }, {  2,  6, 10, 12,  0,  0,  0,  0 }, {  0,  2,  6, 10, 12,  0,  0,  0 },
+    {  4,  6, 10, 12,  0,  0,  0,  0 }, {  0,  4,  6, 10, 12,  0,  0,  0 }, {  2,  4,  6, 10, 12,  0,  0,  0 }, {  0,  2,  4,  6, 10, 12,  0,  0 },
+    {  8, 10, 12,  0,  0,  0,  0,  0 }, {  0,  8, 10, 12,  0,  0,  0,  0 }, {  2,  8, 10, 12,  0,  0,  0,  0 }, {  0,  2,  8, 10, 12,  0,  0,  0 },
+    {  4,  8, 10, 12,  0,  0,  0,  0 }, {  0,  4,  8, 10, 12,  0,  0,  0 }, {  2,  4,  8, 10, 12,  0,  0,  0 }, {  0,  2,  4,  8, 10, 12,  0,  0 },
+    {  6,  8, 10, 12,  0,  0,  0,  0 }, {  0,  6,  8, 10, 12,  0,  0,  0 }, {  2,  6,  8, 10, 12,  0,  0,  0 }, {  0,  2,  6,  8, 10, 12,  0,  0 },
+    {  4,  6,  8, 10, 12,  0,  0,  0 }, {  0,  4,  6,  8, 10, 12,  0,  0 }, {  2,  4,  6,  8, 10, 12,  0,  0 }, {  0,  2,  4,  6,  8, 10, 12,  0 },
+    { 14,  0,  0,  0,  0,  0,  0,  0 }, {  0, 14,  0,  0,  0,  0,  0,  0 }, {  2, 14,  0,  0,  0,  0,  0,  0 }, {  0,  2, 14,  0,  0,  0,  0,  0 },
+    {  4, 14,  0,  0,  0,  0,  0,  0 }, {  0,  4, 14,  0,  0,  0,  0,  0 }, {  2,  4, 14,  0,  0,  0,  0,  0 }, {  0,  2,  4, 14,  0,  0,  0,  0 },
+    {  6, 14,  0,  0,  0,  0,  0,  0 }, {  0,  6, 14,  0,  0,  0,  0,  0 }, {  2,  6, 14,  0,  0,  0,  0,  0 }, {  0,  2,  6, 14,  0,  0,  0,  0 },
+    {  4,  6, 14,  0,  0,  0,  0,  0 }, {  0,  4,  6, 14,  0,  0,  0,  0 }, {  2,  4,  6, 14,  0,  0,  0,  0 }, {  0,  2,  4,  6, 14,  0,  0,  0 },
+    {  8, 14,  0,  0,  0,  0,  0,  0 }, {  0,  8, 14,  0,  0,  0,  0,  0 }, {  2,  8, 14,  0,  0,  0,  0,  0 }, {  0,  2,  8, 14,  0,  0,  0,  0 },
+    {  4,  8, 14,  0,  0,  0,  0,  0 }, {  0,  4,  8, 14,  0,  0,  0,  0 }, {  2,  4,  8, 14,  0,  0,  0,  0 }, {  0,  2,  4,  8, 14,  0,  0,  0 },
+    {  6,  8, 14,  0,  0,  0,  0,  0 }, {  0,  6,  8, 14,  0,  0,  0,  0 }, {  2,  6,  8, 14,  0,  0,  0,  0 }, {  0,  2,  6,  8, 14,  0,  0,  0 },
+    {  4,  6,  8, 14,  0,  0,  0,  0 }, {  0,  4,  6,  8, 14,  0,  0,  0 }, {  2,  4,  6,  8, 14,  0,  0,  0 }, {  0,  2,  4,  6,  8, 14,  0,  0 },
+    { 10, 14,  0,  0,  0,  0,  0,  0 }, {  0, 10, 14,  0,  0,  0,  0,  0 }, {  2, 10, 14,  0,  0,  0,  0,  0 }, {  0,  2, 10, 14,  0,  0,  0,  0 },
+    {  4, 10, 14,  0,  0,  0,  0,  0 }, {  0,  4, 10, 14,  0,  0,  0,  0 }, {  2,  4, 10, 14,  0,  0,  0,  0 }, {  0,  2,  4, 10, 14,  0,  0,  0 },
+    {  6, 10, 14,  0,  0,  0,  0,  0 }, {  0,  6, 10, 14,  0,  0,  0,  0 }, {  2,  6, 10, 14,  0,  0,  0,  0 }, {  0,  2,  6, 10, 14,  0,  0,  0 },
+    {  4,  6, 10, 14,  0,  0,  0,  0 }, {  0,  4,  6, 10, 14,  0,  0,  0 }, {  2,  4,  6, 10, 14,  0,  0,  0 }, {  0,  2,  4,  6, 10, 14,  0,  0 },
+    {  8, 10, 14,  0,  0,  0,  0,  0 }, {  0,  8, 10, 14,  0,  0,  0,  0 }, {  2,  8, 10, 14,  0,  0,  0,  0 }, {  0,  2,  8, 10, 14,  0,  0,  0 },
+    {  4,  8, 10, 14,  0,  0,  0,  0 }, {  0,  4,  8, 10, 14,  0,  0,  0 }, {  2,  4,  8, 10, 14,  0,  0,  0 }, {  0,  2,  4,  8, 10, 14,  0,  0 },
+    {  6,  8, 10, 14,  0,  0,  0,  0 }, {  0,  6,  8, 10, 14,  0,  0,  0 }, {  2,  6,  8, 10, 14,  0,  0,  0 }, {  0,  2,  6,  8, 10, 14,  0,  0 },
+    {  4,  6,  8, 10, 14,  0,  0,  0 }, {  0,  4,  6,  8, 10, 14,  0,  0 }, {  2,  4,  6,  8, 10, 14,  0,  0 }, {  0,  2,  4,  6,  8, 10, 14,  0 },
+    { 12, 14,  0,  0,  0,  0,  0,  0 }, {  0, 12, 14,  0,  0,  0,  0,  0 }, {  2, 12, 14,  0,  0,  0,  0,  0 }, {  0,  2, 12, 14,  0,  0,  0,  0 },
+    {  4, 12, 14,  0,  0,  0,  0,  0 }, {  0,  4, 12, 14,  0,  0,  0,  0 }, {  2,  4, 12, 14,  0,  0,  0,  0 }, {  0,  2,  4, 12, 14,  0,  0,  0 },
+    {  6, 12, 14,  0,  0,  0,  0,  0 }, {  0,  6, 12, 14,  0,  0,  0,  0 }, {  2,  6, 12, 14,  0,  0,  0,  0 }, {  0,  2,  6, 12, 14,  0,  0,  0 },
+    {  4,  6, 12, 14,  0,  0,  0,  0 }, {  0,  4,  6, 12, 14,  0,  0,  0 }, {  2,  4,  6, 12, 14,  0,  0,  0 }, {  0,  2,  4,  6, 12, 14,  0,  0 },
+    {  8, 12, 14,  0,  0,  0,  0,  0 }, {  0,  8, 12, 14,  0,  0,  0,  0 }, {  2,  8, 12, 14,  0,  0,  0,  0 }, {  0,  2,  8, 12, 14,  0,  0,  0 },
+    {  4,  8, 12, 14,  0,  0,  0,  0 }, {  0,  4,  8, 12, 14,  0,  0,  0 }, {  2,  4,  8, 12, 14,  0,  0,  0 }, {  0,  2,  4,  8, 12, 14,  0,  0 },
+    {  6,  8, 12, 14,  0,  0,  0,  0 }, {  0,  6,  8, 12, 14,  0,  0,  0 }, {  2,  6,  8, 12, 14,  0,  0,  0 }, {  0,  2,  6,  8, 12, 14,  0,  0 },
+    {  4,  6,  8, 12, 14,  0,  0,  0 }, {  0,  4,  6,  8, 12, 14,  0,  0 }, {  2,  4,  6,  8, 12, 14,  0,  0 }, {  0,  2,  4,  6,  8, 12, 14,  0 },
+    { 10, 12, 14,  0,  0,  0,  0,  0 }, {  0, 10, 12, 14,  0,  0,  0,  0 }, {  2, 10, 12, 14,  0,  0,  0,  0 }, {  0,  2, 10, 12, 14,  0,  0,  0 },
+    {  4, 10, 12, 14,  0,  0,  0,  0 }, {  0,  4, 10, 12, 14,  0,  0,  0 }, {  2,  4, 10, 12, 14,  0,  0,  0 }, {  0,  2,  4, 10, 12, 14,  0,  0 },
+    {  6, 10, 12, 14,  0,  0,  0,  0 }, {  0,  6, 10, 12, 14,  0,  0,  0 }, {  2,  6, 10, 12, 14,  0,  0,  0 }, {  0,  2,  6, 10, 12, 14,  0,  0 },
+    {  4,  6, 10, 12, 14,  0,  0,  0 }, {  0,  4,  6, 10, 12, 14,  0,  0 }, {  2,  4,  6, 10, 12, 14,  0,  0 }, {  0,  2,  4,  6, 10, 12, 14,  0 },
+    {  8, 10, 12, 14,  0,  0,  0,  0 }, {  0,  8, 10, 12, 14,  0,  0,  0 }, {  2,  8, 10, 12, 14,  0,  0,  0 }, {  0,  2,  8, 10, 12, 14,  0,  0 },
+    {  4,  8, 10, 12, 14,  0,  0,  0 }, {  0,  4,  8, 10, 12, 14,  0,  0 }, {  2,  4,  8, 10, 12, 14,  0,  0 }, {  0,  2,  4,  8, 10, 12, 14,  0 },
+    {  6,  8, 10, 12, 14,  0,  0,  0 }, {  0,  6,  8, 10, 12, 14,  0,  0 }, {  2,  6,  8, 10, 12, 14,  0,  0 }, {  0,  2,  6,  8, 10, 12, 14,  0 },
+    {  4,  6,  8, 10, 12, 14,  0,  0 }, {  0,  4,  6,  8, 10, 12, 14,  0 }, {  2,  4,  6,  8, 10, 12, 14,  0 }, {  0,  2,  4,  6,  8, 10, 12, 14 }
+};
+#endif /* STDREDIRECT_AVX2 || STDREDIRECT_AVX2_RUNTIME */
+
+
+/**
+ * @brief Length of the valid UTF-8 at the start of data.
+ *
+ * With AVX2, checked at runtime if the build is for CPUs without it, 32 bytes at a time are checked with
+ * STDREDIRECT_validUtf8Blocks(), multibyte text as well as ASCII. The rest, and a block with an error, are checked one
+ * sequence at a time: runs of ASCII are skipped with STDREDIRECT_skipAscii(), three-byte forms inline.
+ *
+ * @param data Data.
+ * @param length Number of bytes.
+ * @return Number of bytes up to the first invalid or cut off sequence, @p length if all of it is valid.
+ */
+static size_t STDREDIRECT_validUtf8Length(const char* data, size_t length) {
+    const unsigned char* bytes = (const unsigned char*) data;
+    size_t               i     = 0;
+    int                  sequenceLength;
+
+#if defined (STDREDIRECT_AVX2)
+    i = STDREDIRECT_validUtf8Blocks(data, length);
+#elif defined (STDREDIRECT_AVX2_RUNTIME)
+    if (STDREDIRECT_hasAvx2()) {
+        i = STDREDIRECT_validUtf8Blocks(data, length);
+    }
+#endif
+
+    while (i < length) {
+        if (bytes[i] < 0x80) {
+            i += STDREDIRECT_skipAscii(data + i, length - i);
+            continue;
+        }
+        if ((bytes[i] & 0xf0) == 0xe0 && length - i >= 3 && (bytes[i + 1] & 0xc0) == 0x80 && (bytes[i + 2] & 0xc0) == 0x80
+            && (bytes[i] != 0xe0 || bytes[i + 1] >= 0xa0) && (bytes[i] != 0xed || bytes[i + 1] < 0xa0)) {
+            /* three-byte forms (most of CJK) checked inline, no overlong forms or surrogates */
+            i += 3;
+            continue;
+        }
+        sequenceLength = STDREDIRECT_utf8SequenceLength(bytes + i, length - i);
+        if (sequenceLength <= 0) {
+            break;
+        }
+        i += (size_t) sequenceLength;
+    }
+
+    return i;
+}
+
+
+#if defined (STDREDIRECT_AVX2) || defined (STDREDIRECT_AVX2_RUNTIME)
+/**
+ * @brief Check UTF-8 32 bytes at a time with AVX2, up to the first block with an error.
+ *
+ * Blocks of ASCII only need the block before to end with a whole sequence, the others are checked with
+ * STDREDIRECT_utf8Errors().
+ *
+ * @param data Data.
+ * @param length Number of bytes.
+ * @return Number of bytes of valid, whole sequences before the first block with an error or the last bytes that do
+ *         not fill a block; the rest is left to the caller.
+ */
+static STDREDIRECT_TARGET_AVX2 size_t STDREDIRECT_validUtf8Blocks(const char* data, size_t length) {
+    const unsigned char* bytes    = (const unsigned char*) data;
+    size_t               i        = 0;
+    size_t               j;
+    __m256i              previous = _mm256_setzero_si256();
+    __m256i              input;
+    __m256i              errors;
+
+    while (length - i >= 32) {
+        input = _mm256_loadu_si256((const __m256i*) (data + i));
+        if (_mm256_movemask_epi8(input) == 0) {
+            if (i > 0 && (bytes[i - 1] >= 0xc0 || bytes[i - 2] >= 0xe0 || bytes[i - 3] >= 0xf0)) {
+                break;
+            }
+        }
+        else {
+            errors = STDREDIRECT_utf8Errors(input, previous);
+            if (!_mm256_testz_si256(errors, errors)) {
+                break;
+            }
+        }
+        previous = input;
+        i += 32;
+    }
+
+    /* blocks end anywhere, go back to the start of a sequence cut off at the end of the last one */
+    for (j = 1; j <= 3 && j <= i; ++j) {
+        if ((bytes[i - j] & 0xc0) != 0x80) {
+            if (bytes[i - j] >= 0xff - (0xff >> (j + 1))) {
+                i -= j;
+            }
+            break;
+        }
+    }
+
+    return i;
+}
+
+
+/**
+ * @brief Find invalid UTF-8 in 32 bytes with the lookup tables of Keiser and Lemire.
+ *
+ * Every byte is checked together with the byte before through STDREDIRECT_UTF8_LOOKUP, and against the two and
+ * three bytes before for the continuation bytes a three or four byte sequence needs. A sequence cut off at the end is
+ * not an error, the next block finds it.
+ *
+ * @param input 32 bytes of UTF-8.
+ * @param previous The 32 bytes before, zero for none.
+ * @return Bytes that are not zero where the UTF-8 is invalid.
+ */
+static STDREDIRECT_TARGET_AVX2 __m256i STDREDIRECT_utf8Errors(__m256i input, __m256i previous) {
+    const __m256i lowNibbles = _mm256_set1_epi8(0x0f);
+    __m256i       shifted    = _mm256_permute2x128_si256(previous, input, 0x21);
+    __m256i       previous1  = _mm256_alignr_epi8(input, shifted, 15);
+    __m256i       special;
+    __m256i       mustContinue;
+
+    special = _mm256_and_si256(
+        _mm256_and_si256(
+            _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) STDREDIRECT_UTF8_LOOKUP[0])), _mm256_and_si256(_mm256_srli_epi16(previous1, 4), lowNibbles)),
+            _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) STDREDIRECT_UTF8_LOOKUP[1])), _mm256_and_si256(previous1, lowNibbles))),
+        _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) STDREDIRECT_UTF8_LOOKUP[2])), _mm256_and_si256(_mm256_srli_epi16(input, 4), lowNibbles)));
+
+    /* only 111_____ two bytes before and 1111____ three bytes before saturate to 0x80 and above */
+    mustContinue = _mm256_or_si256(_mm256_subs_epu8(_mm256_alignr_epi8(input, shifted, 14), _mm256_set1_epi8((char) (0xe0 - 0x80))),
+                                   _mm256_subs_epu8(_mm256_alignr_epi8(input, shifted, 13), _mm256_set1_epi8((char) (0xf0 - 0x80))));
+
+    return _mm256_xor_si256(_mm256_and_si256(mustContinue, _mm256_set1_epi8((char) 0x80)), special);
+}
+#endif /* STDREDIRECT_AVX2 || STDREDIRECT_AVX2_RUNTIME */
+
+
+/**
+ * @brief Transcode UTF-8 to UTF-16.
+ *
+ * Runs of ASCII are widened right away. The valid runs STDREDIRECT_validUtf8Length() finds in pieces of
+ * STDREDIRECT_UTF8_PIECE_LENGTH after them are transcoded by STDREDIRECT_validUtf8ToUtf16() without checking them again. Invalid and cut off sequences become U+FFFD, like
+ * STDREDIRECT_INVALID_UTF8_REPLACE does.
+ *
+ * @param data UTF-8 data.
+ * @param length Number of bytes.
+ * @param utf16 Output, room for @p length code units, no more are written.
+ * @return Number of code units written.
+ */
+static size_t STDREDIRECT_utf8ToUtf16(const char* data, size_t length, unsigned short* utf16) {
+    size_t i        = 0;
+    size_t numUnits = 0;
+    size_t validLength;
+    int    sequenceLength;
+
+    while (i < length) {
+        /* leading ASCII is widened in one pass, without validating it first */
+        validLength = STDREDIRECT_widenAscii(data + i, length - i, utf16 + numUnits);
+        i += validLength;
+        numUnits += validLength;
+        if (i == length) {
+            break;
+        }
+
+        validLength = STDREDIRECT_validUtf8Length(data + i, length - i < STDREDIRECT_UTF8_PIECE_LENGTH ? length - i : STDREDIRECT_UTF8_PIECE_LENGTH);
+        numUnits += STDREDIRECT_validUtf8ToUtf16(data + i, validLength, utf16 + numUnits);
+        i += validLength;
+
+        if (i < length && validLength < STDREDIRECT_UTF8_PIECE_LENGTH) {
+            /* invalid, or cut off at the end of the piece but not of the data */
+            sequenceLength = STDREDIRECT_utf8SequenceLength((const unsigned char*) data + i, length - i);
+            if (sequenceLength > 0) {
+                i += STDREDIRECT_decodeUtf8Sequence((const unsigned char*) data + i, utf16, &numUnits);
+            }
+            else {
+                utf16[numUnits++] = 0xfffd;
+                i += sequenceLength < 0 ? (size_t) -sequenceLength : length - i;
+            }
+        }
+    }
+
+    return numUnits;
+}
+
+
+/**
+ * @brief Transcode valid UTF-8 to UTF-16, vectorized with AVX2/SSE2 where available.
+ *
+ * With AVX2, checked at runtime if the build is for CPUs without it, blocks of 32 bytes are transcoded at once by
+ * STDREDIRECT_utf8ToUtf16Blocks(). Without, runs of ASCII are widened 16 bytes at a time with SSE2 and multibyte
+ * sequences decoded one by one.
+ *
+ * @param data Valid UTF-8 data, whole sequences.
+ * @param length Number of bytes.
+ * @param utf16 Output, room for @p length code units, no more are written.
+ * @return Number of code units written.
+ */
+static size_t STDREDIRECT_validUtf8ToUtf16(const char* data, size_t length, unsigned short* utf16) {
+    const unsigned char* bytes    = (const unsigned char*) data;
+    size_t               i        = 0;
+    size_t               numUnits = 0;
+    size_t               asciiLength;
+
+#if defined (STDREDIRECT_AVX2)
+    i = STDREDIRECT_utf8ToUtf16Blocks(data, length, utf16, &numUnits);
+#elif defined (STDREDIRECT_AVX2_RUNTIME)
+    if (STDREDIRECT_hasAvx2()) {
+        i = STDREDIRECT_utf8ToUtf16Blocks(data, length, utf16, &numUnits);
+    }
+#endif
+
+    while (i < length) {
+        if (bytes[i] >= 0x80) {
+            i += STDREDIRECT_decodeUtf8Sequence(bytes + i, utf16, &numUnits);
+        }
+        else {
+            asciiLength = STDREDIRECT_widenAscii(data + i, length - i, utf16 + numUnits);
+            i += asciiLength;
+            numUnits += asciiLength;
+        }
+    }
+
+    return numUnits;
+}
+
+
+/**
+ * @brief Widen the run of ASCII at the start of @p data to UTF-16, 16 bytes at a time with SSE2.
+ *
+ * ASCII is valid wherever a sequence may start, so this needs no validation first.
+ *
+ * @param data UTF-8 data.
+ * @param length Number of bytes.
+ * @param utf16 Output, room for @p length code units, no more are written.
+ * @return Number of ASCII bytes widened, up to the first non-ASCII byte.
+ */
+static size_t STDREDIRECT_widenAscii(const char* data, size_t length, unsigned short* utf16) {
+    const unsigned char* bytes = (const unsigned char*) data;
+    size_t               i     = 0;
+#if defined (STDREDIRECT_SSE2)
+    unsigned int         mask;
+    __m128i              chunk;
+
+    while (length - i >= 16) {
+        chunk = _mm_loadu_si128((const __m128i*) (data + i));
+        _mm_storeu_si128((__m128i*) (utf16 + i), _mm_unpacklo_epi8(chunk, _mm_setzero_si128()));
+        _mm_storeu_si128((__m128i*) (utf16 + i + 8), _mm_unpackhi_epi8(chunk, _mm_setzero_si128()));
+        mask = (unsigned int) _mm_movemask_epi8(chunk);
+        if (mask) {
+            return i + STDREDIRECT_countTrailingZeros(mask);
+        }
+        i += 16;
+    }
+#endif
+
+    /* scalar fallback and tail, up to the next non-ASCII byte */
+    while (i < length && bytes[i] < 0x80) {
+        utf16[i] = bytes[i];
+        ++i;
+    }
+
+    return i;
+}
+
+
+/**
+ * @brief Decode one valid multibyte sequence to UTF-16.
+ *
+ * @param data Valid UTF-8, starting with a lead byte.
+ * @param utf16 Output.
+ * @param numUnits Number of code units in @p utf16, advanced by the ones written.
+ * @return Length of the sequence.
+ */
+static size_t STDREDIRECT_decodeUtf8Sequence(const unsigned char* data, unsigned short* utf16, size_t* numUnits) {
+    unsigned int codePoint;
+
+    if (data[0] < 0xe0) {
+        utf16[(*numUnits)++] = (unsigned short) ((data[0] & 0x1f) << 6 | (data[1] & 0x3f));
+
+        return 2;
+    }
+    if (data[0] < 0xf0) {
+        utf16[(*numUnits)++] = (unsigned short) ((data[0] & 0x0f) << 12 | (data[1] & 0x3f) << 6 | (data[2] & 0x3f));
+
+        return 3;
+    }
+
+    /* four bytes take a surrogate pair */
+    codePoint = (unsigned int) (data[0] & 0x07) << 18 | (unsigned int) (data[1] & 0x3f) << 12 | (unsigned int) (data[2] & 0x3f) << 6 | (unsigned int) (data[3] & 0x3f);
+    codePoint -= 0x10000;
+    utf16[(*numUnits)++] = (unsigned short) (0xd800 | codePoint >> 10);
+    utf16[(*numUnits)++] = (unsigned short) (0xdc00 | (codePoint & 0x3ff));
+
+    return 4;
+}
+
+
+#if defined (STDREDIRECT_AVX2) || defined (STDREDIRECT_AVX2_RUNTIME)
+/**
+ * @brief Transcode valid UTF-8 to UTF-16 32 bytes at a time with AVX2.
+ *
+ * Every byte of a block is decoded as if a sequence started there by STDREDIRECT_decodeUtf16Lanes() and the code
+ * units of the bytes that do start one are packed to the front by STDREDIRECT_packUtf16Lanes(). A sequence cut off at
+ * the end of a block is completed from the bytes after it, so every block is 32 bytes and no branch depends on where
+ * the sequences of mixed text begin. Blocks with four-byte forms are decoded one by one.
+ *
+ * @param data Valid UTF-8 data, whole sequences.
+ * @param length Number of bytes.
+ * @param utf16 Output, room for @p length code units.
+ * @param numUnits Set to the number of code units written.
+ * @return Number of bytes transcoded, a whole number of sequences, less than 34 are left.
+ */
+static STDREDIRECT_TARGET_AVX2 size_t STDREDIRECT_utf8ToUtf16Blocks(const char* data, size_t length, unsigned short* utf16, size_t* numUnits) {
+    const unsigned char* bytes = (const unsigned char*) data;
+    size_t               i     = 0;
+    size_t               count = 0;
+    size_t               numLow;
+    size_t               end;
+    unsigned int         mask;
+    __m256i              input;
+    __m256i              fourByte;
+    __m256i              lanes[2];
+
+    while (length - i >= 34) {
+        input = _mm256_loadu_si256((const __m256i*) (data + i));
+        if (_mm256_movemask_epi8(input) == 0) {
+            _mm256_storeu_si256((__m256i*) (utf16 + count), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(input)));
+            _mm256_storeu_si256((__m256i*) (utf16 + count + 16), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(input, 1)));
+            i += 32;
+            count += 32;
+            continue;
+        }
+        fourByte = _mm256_subs_epu8(input, _mm256_set1_epi8((char) 0xef));
+        if (!_mm256_testz_si256(fourByte, fourByte)) {
+            /* four-byte forms are decoded one by one, the rest of a sequence begun in the block before was with it */
+            for (end = i + 32; i < end; ) {
+                if (bytes[i] < 0x80) {
+                    utf16[count++] = bytes[i++];
+                }
+                else if (bytes[i] < 0xc0) {
+                    ++i;
+                }
+                else {
+                    *numUnits = count;
+                    i += STDREDIRECT_decodeUtf8Sequence(bytes + i, utf16, numUnits);
+                    count = *numUnits;
+                }
+            }
+            continue;
+        }
+
+        /* the sequences starting in the block, the bytes after it complete the ones cut off at its end; continuation
+           bytes are the signed bytes below 0xc0 */
+        mask = ~(unsigned int) _mm256_movemask_epi8(_mm256_cmpgt_epi8(_mm256_set1_epi8((char) 0xc0), input));
+        STDREDIRECT_decodeUtf16Lanes(input, _mm256_loadu_si256((const __m256i*) (data + i + 1)), _mm256_loadu_si256((const __m256i*) (data + i + 2)), lanes);
+        numLow = STDREDIRECT_packUtf16Lanes(lanes[0], mask & 0xffff, utf16 + count);
+        count += numLow + STDREDIRECT_packUtf16Lanes(lanes[1], mask >> 16, utf16 + count + numLow);
+        i += 32;
+    }
+
+    /* the rest of a sequence begun in the last block */
+    while (i < length && (bytes[i] & 0xc0) == 0x80) {
+        ++i;
+    }
+    *numUnits = count;
+
+    return i;
+}
+
+
+/**
+ * @brief Decode 32 bytes of valid UTF-8 as if a one to three byte sequence started at each.
+ *
+ * The low and the high bytes of the code units are computed 32 at a time, then interleaved.
+ *
+ * @param first UTF-8 data.
+ * @param second The data one byte later.
+ * @param third The data two bytes later.
+ * @param lanes Set to the code units of the first and the last 16 bytes, garbage in the lanes of continuation bytes.
+ */
+static STDREDIRECT_TARGET_AVX2 void STDREDIRECT_decodeUtf16Lanes(__m256i first, __m256i second, __m256i third, __m256i lanes[2]) {
+    const __m256i low6       = _mm256_set1_epi8(0x3f);
+    const __m256i high2      = _mm256_set1_epi8((char) 0xc0);
+    __m256i       isAscii    = _mm256_cmpgt_epi8(first, _mm256_set1_epi8(-1));
+    __m256i       isThree    = _mm256_cmpgt_epi8(first, _mm256_set1_epi8((char) 0xdf));
+    __m256i       low;
+    __m256i       high;
+
+    /* there are no 8 bit shifts, the bits shifted into a byte from its neighbour are masked */
+    low  = _mm256_blendv_epi8(
+        _mm256_or_si256(_mm256_and_si256(_mm256_slli_epi16(first, 6), high2), _mm256_and_si256(second, low6)),
+        _mm256_or_si256(_mm256_and_si256(_mm256_slli_epi16(second, 6), high2), _mm256_and_si256(third, low6)),
+        isThree);
+    high = _mm256_blendv_epi8(
+        _mm256_and_si256(_mm256_srli_epi16(first, 2), _mm256_set1_epi8(0x07)),
+        _mm256_or_si256(_mm256_and_si256(_mm256_slli_epi16(first, 4), _mm256_set1_epi8((char) 0xf0)), _mm256_and_si256(_mm256_srli_epi16(second, 2), _mm256_set1_epi8(0x0f))),
+        isThree);
+    low  = _mm256_blendv_epi8(low, first, isAscii);
+    high = _mm256_andnot_si256(isAscii, high);
+
+    /* quadwords in order 0, 2, 1, 3, so that each unpack covers 16 consecutive bytes */
+    low      = _mm256_permute4x64_epi64(low, 0xd8);
+    high     = _mm256_permute4x64_epi64(high, 0xd8);
+    lanes[0] = _mm256_unpacklo_epi8(low, high);
+    lanes[1] = _mm256_unpackhi_epi8(low, high);
+}
+
+
+/**
+ * @brief Pack the lanes set in mask to the front and store them, 8 lanes at a time.
+ *
+ * @param lanes 16 lanes of 16 bits.
+ * @param mask Lanes to store, bit 0 for the first.
+ * @param utf16 Output, room for 16 code units, the ones after the code units stored are overwritten.
+ * @return Number of code units stored.
+ */
+static STDREDIRECT_TARGET_AVX2 size_t STDREDIRECT_packUtf16Lanes(__m256i lanes, unsigned int mask, unsigned short* utf16) {
+    size_t  numLow = STDREDIRECT_countBits(mask & 0xff);
+    __m256i indices;
+
+    /* the table has the index of the low byte of each lane, the high byte follows */
+    indices = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadl_epi64((const __m128i*) STDREDIRECT_UTF16_LANES[mask & 0xff])), _mm_loadl_epi64((const __m128i*) STDREDIRECT_UTF16_LANES[mask >> 8]), 1);
+    lanes   = _mm256_shuffle_epi8(lanes, _mm256_unpacklo_epi8(indices, _mm256_add_epi8(indices, _mm256_set1_epi8(1))));
+
+    _mm_storeu_si128((__m128i*) utf16, _mm256_castsi256_si128(lanes));
+    _mm_storeu_si128((__m128i*) (utf16 + numLow), _mm256_extracti128_si256(lanes, 1));
+
+    return numLow + STDREDIRECT_countBits(mask >> 8);
+}
+
+
+/**
+ * @brief Count the bits set, with POPCNT, which every CPU with AVX2 has.
+ *
+ * @param mask Mask.
+ * @return Number of bits set.
+ */
+static STDREDIRECT_TARGET_AVX2 unsigned int STDREDIRECT_countBits(unsigned int mask) {
+#if defined (_MSC_VER)
+    return __popcnt(mask);
+#else
+    return (unsigned int) __builtin_popcount(mask);
+#endif /* _MSC_VER */
+}
+#endif /* STDREDIRECT_AVX2 || STDREDIRECT_AVX2_RUNTIME */
+
+
+#if defined (STDREDIRECT_AVX2_RUNTIME)
+/**
+ * @brief Check whether the CPU and the OS support AVX2, for a build for CPUs without it.
+ *
+ * @return TRUE if the AVX2 code can run.
+ */
+static int STDREDIRECT_hasAvx2() {
+#if defined (_MSC_VER)
+    /* CPUID is slow, in a virtual machine it traps, so the answer is kept */
+    static STDREDIRECT_ATOMIC hasAvx2 = -1;
+    long long                 result  = STDREDIRECT_atomicLoad(&hasAvx2);
+    int                       info[4];
+
+    if (result == -1) {
+        result = FALSE;
+        __cpuid(info, 0);
+        if (info[0] >= 7) {
+            /* AVX, and the OS saving the YMM registers */
+            __cpuid(info, 1);
+            if ((info[2] & 0x18000000) == 0x18000000 && (_xgetbv(0) & 6) == 6) {
+                __cpuidex(info, 7, 0);
+                result = (info[1] & 0x20) != 0;
+            }
+        }
+        STDREDIRECT_atomicStore(&hasAvx2, result);
+    }
+
+    return (int) result;
+#else
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+#endif /* _MSC_VER */
+}
+#endif /* STDREDIRECT_AVX2_RUNTIME */
+
+
+/**
+ * @brief Find last occurrence of a byte, scanning backwards; writes usually end at or just before a newline.
+ *
+ * @param data Data to scan.
+ * @param length Number of bytes.
+ * @param byte Byte to search for.
+ * @return Pointer to last occurrence, NULL if not found.
+ */
+static const char* STDREDIRECT_findLastByte(const char* data, size_t length, char byte) {
+    while (length > 0) {
+        if (data[--length] == byte) {
+            return data + length;
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * @brief Index of lowest set bit.
+ *
+ * @param mask Non-zero bit mask.
+ * @return Number of trailing zero bits.
+ */
+static unsigned int STDREDIRECT_countTrailingZeros(unsigned int mask) {
+#if defined (_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+
+    return (unsigned int) index;
+#else
+    return (unsigned int) __builtin_ctz(mask);
+#endif /* _MSC_VER */
+}
+
+
+/**
+ * @brief Copy chunk into the ring of an asynchronous redirection, runs on the pipe reader thread.
+ *
+ * Applies STDREDIRECT_REDIRECTION::fullPolicy if the chunk does not fit. The caller wakes the dispatcher once it pushed
+ * all its chunks.
+ *
+ * @param redirection Pointer to redirection object.
+ * @param data Chunk.
+ * @param length Number of bytes, at most STDREDIRECT_REDIRECTION::maxBufferSize.
+ * @param globalSequence Global sequence number of the chunk.
+ * @param timestamp Read time of the chunk.
+ * @param threadId Committing thread of the chunk, 0 for the pipe.
+ */
+static void STDREDIRECT_push(STDREDIRECT_REDIRECTION* redirection, const char* data, size_t length, long long globalSequence, long long timestamp, long long threadId) {
+    STDREDIRECT_RING*       ring       = &redirection->ring;
+    long long               head       = STDREDIRECT_atomicLoad(&ring->head);
+    long long               recordSize = (long long) (sizeof(STDREDIRECT_RING_RECORD) + length);
+    long long               tail;
+    long long               start;
+    STDREDIRECT_RING_RECORD record;
+    STDREDIRECT_RING_RECORD oldest;
+
+    record.length         = length;
+    record.globalSequence = globalSequence;
+    record.timestamp      = timestamp;
+    record.threadId       = threadId;
+
+    /* once spilling, chunks keep going to the spill file until the dispatcher replayed it, so they stay in order */
+    if (redirection->isSpilling && !STDREDIRECT_truncateSpillFile(redirection)) {
+        STDREDIRECT_spill(redirection, &record, data);
+        return;
+    }
+
+    for (;;) {
+        tail = STDREDIRECT_atomicLoad(&ring->tail);
+        if ((long long) ring->capacity - (head - tail) >= recordSize) {
+            break;
+        }
+
+        /* the caller wakes the dispatcher after pushing, a full ring cannot wait for that */
+        STDREDIRECT_wake(redirection, &redirection->isDispatcherWaiting);
+
+        if (redirection->fullPolicy == STDREDIRECT_FULL_POLICY_SPILL) {
+            STDREDIRECT_spill(redirection, &record, data);
+            return;
+        }
+        else if (redirection->fullPolicy == STDREDIRECT_FULL_POLICY_DROP_NEWEST) {
+            STDREDIRECT_atomicAdd(&redirection->droppedChunks, 1);
+            STDREDIRECT_atomicAdd(&redirection->droppedBytes, (long long) length);
+            return;
+        }
+        else if (redirection->fullPolicy == STDREDIRECT_FULL_POLICY_DROP_OLDEST) {
+            /* only the producer writes the ring, so the header at tail is intact; the dispatcher notices when its
+               own compare-exchange on tail fails */
+            STDREDIRECT_ringCopyOut(ring, tail, &oldest, sizeof(oldest));
+            if (STDREDIRECT_atomicCompareExchange(&ring->tail, tail, tail + (long long) (sizeof(oldest) + oldest.length))) {
+                STDREDIRECT_atomicAdd(&redirection->droppedChunks, 1);
+                STDREDIRECT_atomicAdd(&redirection->droppedBytes, (long long) oldest.length);
+            }
+        }
+        else {
+            /* sleep until the dispatcher made room */
+            start = STDREDIRECT_now();
+            STDREDIRECT_lock(&redirection->waitLock);
+            STDREDIRECT_atomicStore(&redirection->isReaderWaiting, TRUE);
+            if ((long long) ring->capacity - (head - STDREDIRECT_atomicLoad(&ring->tail)) < recordSize) {
+                STDREDIRECT_wait(&redirection->waitCondition, &redirection->waitLock);
+            }
+            STDREDIRECT_atomicStore(&redirection->isReaderWaiting, FALSE);
+            STDREDIRECT_unlock(&redirection->waitLock);
+            STDREDIRECT_statAdd(&redirection->stats.blockedTimeUs, STDREDIRECT_now() - start);
+        }
+    }
+
+    STDREDIRECT_ringCopyIn(ring, head, &record, sizeof(record));
+    STDREDIRECT_ringCopyIn(ring, head + (long long) sizeof(record), data, length);
+    STDREDIRECT_atomicStore(&ring->head, head + recordSize);
+}
+
+
+/**
+ * @brief Dispatcher of an asynchronous redirection, runs in separate thread.
+ *
+ * Takes records from the ring and passes them on to the callback until asked to exit and the ring is empty. Records
+ * spilled while the ring was full are newer than all records in the ring, they are replayed once it is empty. A flush
+ * request is answered once ring and spill file are empty.
+ *
+ * @param parameter Pointer to redirection object.
+ * @return 0.
+ */
+static STDREDIRECT_THREAD_RESULT STDREDIRECT_dispatcher(void* parameter) {
+    STDREDIRECT_REDIRECTION* redirection = (STDREDIRECT_REDIRECTION*) parameter;
+    STDREDIRECT_RING*        ring        = &redirection->ring;
+    STDREDIRECT_RING_RECORD  record;
+    long long                tail;
+    long long                batchTimeout;
+    long long                summaryTimeout;
+    int                      isExitRequested;
+    int                      isFlushRequested;
+#ifdef __linux__
+    struct sched_param       schedParam;
+    int                      schedPolicy;
+
+    /* a woken dispatcher does not preempt the thread that pushed, an injecting writer sharing its CPU goes on and the
+       records are passed on once it blocks or its time slice ends; real-time policies are kept */
+    if (pthread_getschedparam(pthread_self(), &schedPolicy, &schedParam) == 0 && schedPolicy == SCHED_OTHER) {
+        pthread_setschedparam(pthread_self(), SCHED_BATCH, &schedParam);
+    }
+#endif /* __linux__ */
+
+    for (;;) {
+        /* check requests before looking at the ring, so nothing pushed before a request is missed */
+        isExitRequested = (int) STDREDIRECT_atomicLoad(&redirection->isDispatcherExitRequested);
+        isFlushRequested = (int) STDREDIRECT_atomicLoad(&redirection->isFlushRequested);
+        tail = STDREDIRECT_atomicLoad(&ring->tail);
+
+        if (tail == STDREDIRECT_atomicLoad(&ring->head)) {
+            if (STDREDIRECT_takeSpilled(redirection, &record)) {
+                STDREDIRECT_switchThread(redirection, record.threadId);
+                redirection->globalSequence = record.globalSequence;
+                redirection->timestamp = record.timestamp;
+                STDREDIRECT_process(redirection, redirection->dispatchBuffer, record.length);
+                continue;
+            }
+            if (isExitRequested) {
+                break;
+            }
+            if (isFlushRequested) {
+                STDREDIRECT_flushAll(redirection);
+                STDREDIRECT_lock(&redirection->waitLock);
+                STDREDIRECT_atomicStore(&redirection->isFlushRequested, FALSE);
+                STDREDIRECT_broadcast(&redirection->waitCondition);
+                STDREDIRECT_unlock(&redirection->waitLock);
+                continue;
+            }
+
+            /* sleep until the pipe reader pushed or spilled a record or a request arrives */
+            STDREDIRECT_lock(&redirection->waitLock);
+            STDREDIRECT_atomicStore(&redirection->isDispatcherWaiting, TRUE);
+            if (tail == STDREDIRECT_atomicLoad(&ring->head) && STDREDIRECT_atomicLoad(&redirection->spillTail) >= STDREDIRECT_atomicLoad(&redirection->spillHead)
+                && !STDREDIRECT_atomicLoad(&redirection->isDispatcherExitRequested) && !STDREDIRECT_atomicLoad(&redirection->isFlushRequested)) {
+                batchTimeout = STDREDIRECT_batchTimeout(redirection);
+                summaryTimeout = STDREDIRECT_summaryTimeout(redirection);
+                if (summaryTimeout != -1 && (batchTimeout == -1 || summaryTimeout < batchTimeout)) {
+                    batchTimeout = summaryTimeout;
+                }
+                if (batchTimeout == -1) {
+                    STDREDIRECT_wait(&redirection->waitCondition, &redirection->waitLock);
+                }
+                else if (batchTimeout > 0) {
+                    STDREDIRECT_timedWait(&redirection->waitCondition, &redirection->waitLock, batchTimeout);
+                }
+            }
+            STDREDIRECT_atomicStore(&redirection->isDispatcherWaiting, FALSE);
+            STDREDIRECT_unlock(&redirection->waitLock);
+
+            STDREDIRECT_flushExpiredSummary(redirection);
+            STDREDIRECT_flushExpiredBatch(redirection);
+            continue;
+        }
+
+        /* take record out of the ring; if the pipe reader dropped it meanwhile, the copy may be torn and the
+           compare-exchange fails */
+        STDREDIRECT_ringCopyOut(ring, tail, &record, sizeof(record));
+        if (record.length > redirection->maxBufferSize) {
+            continue;
+        }
+        STDREDIRECT_ringCopyOut(ring, tail + (long long) sizeof(record), redirection->dispatchBuffer, record.length);
+        if (!STDREDIRECT_atomicCompareExchange(&ring->tail, tail, tail + (long long) (sizeof(record) + record.length))) {
+            continue;
+        }
+        STDREDIRECT_wake(redirection, &redirection->isReaderWaiting);
+
+        STDREDIRECT_switchThread(redirection, record.threadId);
+        redirection->globalSequence = record.globalSequence;
+        redirection->timestamp = record.timestamp;
+        STDREDIRECT_process(redirection, redirection->dispatchBuffer, record.length);
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Append a chunk to the spill file of a full ring, runs on the pipe reader thread.
+ *
+ * The chunk is dropped if the spill file would exceed STDREDIRECT_REDIRECTION::spillQuota or cannot be written.
+ *
+ * @param redirection Pointer to redirection object.
+ * @param record Header of the chunk.
+ * @param data Chunk.
+ */
+static void STDREDIRECT_spill(STDREDIRECT_REDIRECTION* redirection, const STDREDIRECT_RING_RECORD* record, const char* data) {
+    long long head       = STDREDIRECT_atomicLoad(&redirection->spillHead);
+    long long recordSize = (long long) (sizeof(*record) + record->length);
+
+    if (head + recordSize > redirection->spillQuota
+        || STDREDIRECT_writeSpillFile(redirection, head, record, sizeof(*record)) == -1
+        || STDREDIRECT_writeSpillFile(redirection, head + (long long) sizeof(*record), data, record->length) == -1) {
+        STDREDIRECT_atomicAdd(&redirection->droppedChunks, 1);
+        STDREDIRECT_atomicAdd(&redirection->droppedBytes, (long long) record->length);
+        return;
+    }
+
+    STDREDIRECT_atomicStore(&redirection->spillHead, head + recordSize);
+    redirection->isSpilling = TRUE;
+    STDREDIRECT_statAdd(&redirection->stats.spilledChunks, 1);
+    STDREDIRECT_statAdd(&redirection->stats.spilledBytes, (long long) record->length);
+
+    STDREDIRECT_wake(redirection, &redirection->isDispatcherWaiting);
+}
+
+
+/**
+ * @brief Take the oldest spilled record into STDREDIRECT_REDIRECTION::dispatchBuffer, runs on the dispatcher thread.
+ *
+ * If the spill file cannot be read, everything spilled so far is counted as dropped.
+ *
+ * @param redirection Pointer to redirection object.
+ * @param record Receives the header of the record.
+ * @return TRUE if a record was taken, FALSE if nothing is spilled.
+ */
+static int STDREDIRECT_takeSpilled(STDREDIRECT_REDIRECTION* redirection, STDREDIRECT_RING_RECORD* record) {
+    long long tail;
+    long long head;
+
+    if (redirection->fullPolicy != STDREDIRECT_FULL_POLICY_SPILL) {
+        return FALSE;
+    }
+
+    /* the pipe reader cannot start the file over between reading the offsets and advancing tail, see
+       STDREDIRECT_truncateSpillFile(); it only appends behind head meanwhile */
+    STDREDIRECT_lock(&redirection->waitLock);
+    tail = STDREDIRECT_atomicLoad(&redirection->spillTail);
+    head = STDREDIRECT_atomicLoad(&redirection->spillHead);
+    if (tail >= head) {
+        STDREDIRECT_unlock(&redirection->waitLock);
+        return FALSE;
+    }
+
+    if (STDREDIRECT_readSpillFile(redirection, tail, record, sizeof(*record)) == -1 || record->length > redirection->maxBufferSize
+        || STDREDIRECT_readSpillFile(redirection, tail + (long long) sizeof(*record), redirection->dispatchBuffer, record->length) == -1) {
+        STDREDIRECT_atomicAdd(&redirection->droppedChunks, 1);
+        STDREDIRECT_atomicAdd(&redirection->droppedBytes, head - tail);
+        STDREDIRECT_atomicStore(&redirection->spillTail, head);
+        STDREDIRECT_unlock(&redirection->waitLock);
+        return FALSE;
+    }
+
+    STDREDIRECT_atomicStore(&redirection->spillTail, tail + (long long) (sizeof(*record) + record->length));
+    STDREDIRECT_unlock(&redirection->waitLock);
+
+    return TRUE;
+}
+
+
+/**
+ * @brief Create the spill file of a redirection, removed from the directory right away (deleted on close on Windows).
+ *
+ * @param redirection Pointer to redirection object.
+ * @param directory Directory, NULL for the default.
+ * @return 0 on success, -1 on error.
+ */
+static int STDREDIRECT_openSpillFile(STDREDIRECT_REDIRECTION* redirection, const char* directory) {
+#ifdef _WIN32
+    char temporaryDirectory[MAX_PATH + 1];
+    char path[MAX_PATH + 1];
+
+    if (!directory) {
+        if (GetTempPathA(sizeof(temporaryDirectory), temporaryDirectory) == 0) {
+            return -1;
+        }
+        directory = temporaryDirectory;
+    }
+    if (GetTempFileNameA(directory, "std", 0, path) == 0) {
+        return -1;
+    }
+
+    redirection->spillFile = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+    if (redirection->spillFile == INVALID_HANDLE_VALUE) {
+        DeleteFileA(path);
+        return -1;
+    }
+#else
+    static const char name[] = "/stdredirect-spill-XXXXXX";
+    char*             path;
+
+    if (!directory) {
+        directory = getenv("TMPDIR");
+    }
+    if (!directory || !*directory) {
+        directory = "/tmp";
+    }
+
+    path = (char*) malloc(strlen(directory) + sizeof(name));
+    if (!path) {
+        return -1;
+    }
+    strcpy(path, directory);
+    strcat(path, name);
+
+    redirection->spillFileDescriptor = mkstemp(path);
+    if (redirection->spillFileDescriptor != -1) {
+        unlink(path);
+        fcntl(redirection->spillFileDescriptor, F_SETFD, FD_CLOEXEC);
+    }
+    free(path);
+
+    if (redirection->spillFileDescriptor == -1) {
+        return -1;
+    }
+#endif /* _WIN32 */
+
+    return 0;
+}
+
+
+/**
+ * @brief Close the spill file of a redirection, if any.
+ *
+ * @param redirection Pointer to redirection object.
+ */
+static void STDREDIRECT_closeSpillFile(STDREDIRECT_REDIRECTION* redirection) {
+#ifdef _WIN32
+    if (redirection->spillFile != INVALID_HANDLE_VALUE) {
+        CloseHandle(redirection->spillFile);
+        redirection->spillFile = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (redirection->spillFileDescriptor != -1) {
+        close(redirection->spillFileDescriptor);
+        redirection->spillFileDescriptor = -1;
+    }
+#endif /* _WIN32 */
+}
+
+
+/**
+ * @brief Start the spill file over if the dispatcher replayed all of it, runs on the pipe reader thread.
+ *
+ * Both offsets are reset under STDREDIRECT_REDIRECTION::waitLock, which the dispatcher holds while it takes a record,
+ * so it never pairs an offset of the old file with one of the new. Truncating frees the disk space of the burst, only
+ * the pipe reader writes the file.
+ *
+ * @param redirection Pointer to redirection object.
+ * @return TRUE if the file was started over, FALSE if spilled records are left.
+ */
+static int STDREDIRECT_truncateSpillFile(STDREDIRECT_REDIRECTION* redirection) {
+#ifdef _WIN32
+    LARGE_INTEGER start;
+#endif /* _WIN32 */
+
+    STDREDIRECT_lock(&redirection->waitLock);
+    if (STDREDIRECT_atomicLoad(&redirection->spillTail) != STDREDIRECT_atomicLoad(&redirection->spillHead)) {
+        STDREDIRECT_unlock(&redirection->waitLock);
+        return FALSE;
+    }
+    STDREDIRECT_atomicStore(&redirection->spillHead, 0);
+    STDREDIRECT_atomicStore(&redirection->spillTail, 0);
+    STDREDIRECT_unlock(&redirection->waitLock);
+    redirection->isSpilling = FALSE;
+
+#ifdef _WIN32
+    start.QuadPart = 0;
+    if (SetFilePointerEx(redirection->spillFile, start, NULL, FILE_BEGIN)) {
+        SetEndOfFile(redirection->spillFile);
+    }
+#else
+    if (ftruncate(redirection->spillFileDescriptor, 0) == -1) {
+        /* keeps its size, it is overwritten from the start */
+    }
+#endif /* _WIN32 */
 
-    /* close handle and set thread handle to null before unredirect so it doesn't try to terminate this thread */
-    CloseHandle(redirection->thread);
-    redirection->thread = NULL;
-    STDREDIRECT_unredirect(redirection);
+    return TRUE;
+}
 
-    redirection->error = STDREDIRECT_ERROR_THREAD;
 
-    ExitThread(EXIT_FAILURE);
+/**
+ * @brief Write to the spill file at a position.
+ *
+ * @param redirection Pointer to redirection object.
+ * @param position File position.
+ * @param data Data.
+ * @param length Number of bytes.
+ * @return 0 on success, -1 on error.
+ */
+static int STDREDIRECT_writeSpillFile(STDREDIRECT_REDIRECTION* redirection, long long position, const void* data, size_t length) {
+#ifdef _WIN32
+    OVERLAPPED overlapped;
+    DWORD      numBytesWritten;
+
+    while (length > 0) {
+        memset(&overlapped, 0, sizeof(overlapped));
+        overlapped.Offset     = (DWORD) position;
+        overlapped.OffsetHigh = (DWORD) (position >> 32);
+        if (!WriteFile(redirection->spillFile, data, length > 0x40000000 ? 0x40000000 : (DWORD) length, &numBytesWritten, &overlapped) || numBytesWritten == 0) {
+            return -1;
+        }
+        data = (const char*) data + numBytesWritten;
+        length -= numBytesWritten;
+        position += numBytesWritten;
+    }
+#else
+    ssize_t numBytesWritten;
+
+    while (length > 0) {
+        numBytesWritten = pwrite(redirection->spillFileDescriptor, data, length, (off_t) position);
+        if (numBytesWritten == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data = (const char*) data + numBytesWritten;
+        length -= (size_t) numBytesWritten;
+        position += numBytesWritten;
+    }
+#endif /* _WIN32 */
+
+    return 0;
+}
+
+
+/**
+ * @brief Read from the spill file at a position.
+ *
+ * @param redirection Pointer to redirection object.
+ * @param position File position.
+ * @param data Receives the data.
+ * @param length Number of bytes.
+ * @return 0 on success, -1 on error or end of file.
+ */
+static int STDREDIRECT_readSpillFile(STDREDIRECT_REDIRECTION* redirection, long long position, void* data, size_t length) {
+#ifdef _WIN32
+    OVERLAPPED overlapped;
+    DWORD      numBytesRead;
+
+    while (length > 0) {
+        memset(&overlapped, 0, sizeof(overlapped));
+        overlapped.Offset     = (DWORD) position;
+        overlapped.OffsetHigh = (DWORD) (position >> 32);
+        if (!ReadFile(redirection->spillFile, data, length > 0x40000000 ? 0x40000000 : (DWORD) length, &numBytesRead, &overlapped) || numBytesRead == 0) {
+            return -1;
+        }
+        data = (char*) data + numBytesRead;
+        length -= numBytesRead;
+        position += numBytesRead;
+    }
+#else
+    ssize_t numBytesRead;
+
+    while (length > 0) {
+        numBytesRead = pread(redirection->spillFileDescriptor, data, length, (off_t) position);
+        if (numBytesRead <= 0) {
+            if (numBytesRead == -1 && errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data = (char*) data + numBytesRead;
+        length -= (size_t) numBytesRead;
+        position += numBytesRead;
+    }
+#endif /* _WIN32 */
+
+    return 0;
+}
+
+
+/**
+ * @brief Start dispatcher thread of an asynchronous redirection.
+ *
+ * @param redirection Pointer to redirection object.
+ * @return ::STDREDIRECT_ERROR
+ */
+static STDREDIRECT_ERROR STDREDIRECT_startDispatcher(STDREDIRECT_REDIRECTION* redirection) {
+    if (!redirection->ring.data || redirection->isDispatcherRunning) {
+        return STDREDIRECT_ERROR_NO_ERROR;
+    }
+
+    STDREDIRECT_atomicStore(&redirection->isDispatcherExitRequested, FALSE);
+    if (STDREDIRECT_startThread(&redirection->dispatchThread, &STDREDIRECT_dispatcher, redirection) == -1) {
+        return STDREDIRECT_ERROR_THREAD;
+    }
+    redirection->isDispatcherRunning = TRUE;
+
+    return STDREDIRECT_ERROR_NO_ERROR;
+}
+
+
+/**
+ * @brief Stop dispatcher thread of an asynchronous redirection once the ring is empty.
+ *
+ * The pipe reader must have stopped already.
+ *
+ * @param redirection Pointer to redirection object.
+ * @return ::STDREDIRECT_ERROR
+ */
+static STDREDIRECT_ERROR STDREDIRECT_stopDispatcher(STDREDIRECT_REDIRECTION* redirection) {
+    if (!redirection->isDispatcherRunning) {
+        return STDREDIRECT_ERROR_NO_ERROR;
+    }
+
+    STDREDIRECT_atomicStore(&redirection->isDispatcherExitRequested, TRUE);
+    STDREDIRECT_lock(&redirection->waitLock);
+    STDREDIRECT_broadcast(&redirection->waitCondition);
+    STDREDIRECT_unlock(&redirection->waitLock);
+
+    if (STDREDIRECT_joinThread(redirection->dispatchThread) == -1) {
+        return STDREDIRECT_ERROR_THREAD;
+    }
+    redirection->isDispatcherRunning = FALSE;
+
+    return STDREDIRECT_ERROR_NO_ERROR;
+}
+
+
+/**
+ * @brief Wait until the dispatcher of an asynchronous redirection passed everything pushed so far to the callback,
+ *        including partial line and pending batch.
+ *
+ * @param redirection Pointer to redirection object.
+ */
+static void STDREDIRECT_flushDispatcher(STDREDIRECT_REDIRECTION* redirection) {
+    if (!redirection->isDispatcherRunning) {
+        return;
+    }
+
+    STDREDIRECT_lock(&redirection->waitLock);
+    STDREDIRECT_atomicStore(&redirection->isFlushRequested, TRUE);
+    STDREDIRECT_broadcast(&redirection->waitCondition);
+    while (STDREDIRECT_atomicLoad(&redirection->isFlushRequested)) {
+        STDREDIRECT_wait(&redirection->waitCondition, &redirection->waitLock);
+    }
+    STDREDIRECT_unlock(&redirection->waitLock);
+}
+
+
+/**
+ * @brief Wake pipe reader or dispatcher if it announced it is going to sleep.
+ *
+ * @param redirection Pointer to redirection object.
+ * @param isWaiting Waiting flag of the thread to wake.
+ */
+static void STDREDIRECT_wake(STDREDIRECT_REDIRECTION* redirection, STDREDIRECT_ATOMIC* isWaiting) {
+    /* only the first waker clears the flag and broadcasts, taking the lock once makes sure the sleeper is waiting on
+       the condition; the broadcast comes after unlocking so the woken thread does not block on the lock again */
+    if (STDREDIRECT_atomicLoad(isWaiting) && STDREDIRECT_atomicCompareExchange(isWaiting, TRUE, FALSE)) {
+        STDREDIRECT_lock(&redirection->waitLock);
+        STDREDIRECT_unlock(&redirection->waitLock);
+        STDREDIRECT_broadcast(&redirection->waitCondition);
+    }
+}
+
+
+/**
+ * @brief Copy bytes into ring, wrapping around at the end.
+ *
+ * @param ring Ring.
+ * @param position Ring position.
+ * @param data Source.
+ * @param length Number of bytes.
+ */
+static void STDREDIRECT_ringCopyIn(STDREDIRECT_RING* ring, long long position, const void* data, size_t length) {
+    size_t offset = (size_t) position & (ring->capacity - 1);
+    size_t first  = ring->capacity - offset < length ? ring->capacity - offset : length;
+
+    memcpy(ring->data + offset, data, first);
+    memcpy(ring->data, (const char*) data + first, length - first);
+}
+
+
+/**
+ * @brief Copy bytes out of ring, wrapping around at the end.
+ *
+ * @param ring Ring.
+ * @param position Ring position.
+ * @param data Destination.
+ * @param length Number of bytes.
+ */
+static void STDREDIRECT_ringCopyOut(const STDREDIRECT_RING* ring, long long position, void* data, size_t length) {
+    size_t offset = (size_t) position & (ring->capacity - 1);
+    size_t first  = ring->capacity - offset < length ? ring->capacity - offset : length;
+
+    memcpy(data, ring->data + offset, first);
+    memcpy((char*) data + first, ring->data, length - first);
+}
+
+
+/**
+ * @brief Sequentially consistent atomic load.
+ *
+ * @param value Atomic.
+ * @return Current value.
+ */
+static long long STDREDIRECT_atomicLoad(STDREDIRECT_ATOMIC* value) {
+#if defined (_MSC_VER)
+    return InterlockedCompareExchange64(value, 0, 0);
+#else
+    return __atomic_load_n(value, __ATOMIC_SEQ_CST);
+#endif /* _MSC_VER */
+}
+
+
+/**
+ * @brief Sequentially consistent atomic store.
+ *
+ * @param value Atomic.
+ * @param desired New value.
+ */
+static void STDREDIRECT_atomicStore(STDREDIRECT_ATOMIC* value, long long desired) {
+#if defined (_MSC_VER)
+    InterlockedExchange64(value, desired);
+#else
+    __atomic_store_n(value, desired, __ATOMIC_SEQ_CST);
+#endif /* _MSC_VER */
+}
+
+
+/**
+ * @brief Atomic add.
+ *
+ * @param value Atomic.
+ * @param addend Value to add.
+ * @return New value.
+ */
+static long long STDREDIRECT_atomicAdd(STDREDIRECT_ATOMIC* value, long long addend) {
+#if defined (_MSC_VER)
+    return InterlockedExchangeAdd64(value, addend) + addend;
+#else
+    return __atomic_add_fetch(value, addend, __ATOMIC_SEQ_CST);
+#endif /* _MSC_VER */
+}
+
+
+/**
+ * @brief Atomic compare-exchange.
+ *
+ * @param value Atomic.
+ * @param expected Expected current value.
+ * @param desired New value.
+ * @return Non-zero if value was @p expected and has been replaced.
+ */
+static int STDREDIRECT_atomicCompareExchange(STDREDIRECT_ATOMIC* value, long long expected, long long desired) {
+#if defined (_MSC_VER)
+    return InterlockedCompareExchange64(value, desired, expected) == expected;
+#else
+    return __atomic_compare_exchange_n(value, &expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#endif /* _MSC_VER */
+}
+
+
+/**
+ * @brief Acquire fence, plain loads before it are not reordered with loads and stores after it.
+ *
+ * For a reader checking after an unsynchronized copy that the data was not overwritten meanwhile.
+ */
+static void STDREDIRECT_acquireFence() {
+#if defined (_MSC_VER)
+    MemoryBarrier();
+#else
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+#endif /* _MSC_VER */
+}
+
+
+/**
+ * @brief Load statistics counter.
+ *
+ * Counters have a single writer at a time, so they need atomicity but no ordering and no locked instructions.
+ *
+ * @param counter Counter.
+ * @return Current value.
+ */
+static long long STDREDIRECT_statLoad(long long* counter) {
+#if defined (_MSC_VER) && !defined (_WIN64)
+    return InterlockedCompareExchange64((volatile LONG64*) counter, 0, 0);
+#elif defined (_MSC_VER)
+    return *(volatile long long*) counter;
+#else
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+#endif /* _MSC_VER */
+}
+
+
+/**
+ * @brief Store statistics counter.
+ *
+ * @param counter Counter.
+ * @param value New value.
+ */
+static void STDREDIRECT_statStore(long long* counter, long long value) {
+#if defined (_MSC_VER) && !defined (_WIN64)
+    InterlockedExchange64((volatile LONG64*) counter, value);
+#elif defined (_MSC_VER)
+    *(volatile long long*) counter = value;
+#else
+    __atomic_store_n(counter, value, __ATOMIC_RELAXED);
+#endif /* _MSC_VER */
+}
+
+
+/**
+ * @brief Add to statistics counter, only the thread currently writing the counter may call this.
+ *
+ * @param counter Counter.
+ * @param value Value to add.
+ */
+static void STDREDIRECT_statAdd(long long* counter, long long value) {
+    STDREDIRECT_statStore(counter, STDREDIRECT_statLoad(counter) + value);
+}
+
+
+/**
+ * @brief Start thread.
+ *
+ * @param thread Receives thread.
+ * @param routine Thread function.
+ * @param parameter Passed to thread function.
+ * @return 0 on success, -1 on error.
+ */
+static int STDREDIRECT_startThread(STDREDIRECT_THREAD* thread, STDREDIRECT_THREAD_ROUTINE routine, void* parameter) {
+#ifdef _WIN32
+    *thread = CreateThread(0, 0, routine, parameter, 0, 0);
+
+    return *thread == NULL ? -1 : 0;
+#else
+    return pthread_create(thread, NULL, routine, parameter) == 0 ? 0 : -1;
+#endif /* _WIN32 */
+}
+
+
+/**
+ * @brief Wait for thread to exit and release it.
+ *
+ * @param thread Thread.
+ * @return 0 on success, -1 on error.
+ */
+static int STDREDIRECT_joinThread(STDREDIRECT_THREAD thread) {
+#ifdef _WIN32
+    if (WaitForSingleObject(thread, INFINITE) != WAIT_OBJECT_0) {
+        return -1;
+    }
+
+    return CloseHandle(thread) ? 0 : -1;
+#else
+    return pthread_join(thread, NULL) == 0 ? 0 : -1;
+#endif /* _WIN32 */
+}
+
+
+/** @brief Give the processor to another thread, while waiting for one to release a claim. */
+static void STDREDIRECT_yield() {
+#ifdef _WIN32
+    SwitchToThread();
+#else
+    sched_yield();
+#endif /* _WIN32 */
+}
+
+
+/** @brief Initialize mutex. */
+static void STDREDIRECT_initMutex(STDREDIRECT_MUTEX* mutex) {
+#ifdef _WIN32
+    InitializeCriticalSection(mutex);
+#else
+    pthread_mutex_init(mutex, NULL);
+#endif /* _WIN32 */
+}
+
+
+/** @brief Destroy mutex. */
+static void STDREDIRECT_destroyMutex(STDREDIRECT_MUTEX* mutex) {
+#ifdef _WIN32
+    DeleteCriticalSection(mutex);
+#else
+    pthread_mutex_destroy(mutex);
+#endif /* _WIN32 */
+}
+
+
+/** @brief Lock mutex. */
+static void STDREDIRECT_lock(STDREDIRECT_MUTEX* mutex) {
+#ifdef _WIN32
+    EnterCriticalSection(mutex);
+#else
+    pthread_mutex_lock(mutex);
+#endif /* _WIN32 */
+}
+
+
+/** @brief Unlock mutex. */
+static void STDREDIRECT_unlock(STDREDIRECT_MUTEX* mutex) {
+#ifdef _WIN32
+    LeaveCriticalSection(mutex);
+#else
+    pthread_mutex_unlock(mutex);
+#endif /* _WIN32 */
+}
+
+
+/** @brief Initialize condition. */
+static void STDREDIRECT_initCondition(STDREDIRECT_CONDITION* condition) {
+#ifdef _WIN32
+    InitializeConditionVariable(condition);
+#elif defined (__linux__)
+    pthread_condattr_t attributes;
+
+    /* timed waits use the monotonic clock */
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(condition, &attributes);
+    pthread_condattr_destroy(&attributes);
+#else
+    pthread_cond_init(condition, NULL);
+#endif /* _WIN32 */
+}
+
+
+/** @brief Destroy condition. */
+static void STDREDIRECT_destroyCondition(STDREDIRECT_CONDITION* condition) {
+#ifdef _WIN32
+    (void) condition;
+#else
+    pthread_cond_destroy(condition);
+#endif /* _WIN32 */
+}
+
+
+/** @brief Wait on condition, @p mutex must be locked. */
+static void STDREDIRECT_wait(STDREDIRECT_CONDITION* condition, STDREDIRECT_MUTEX* mutex) {
+#ifdef _WIN32
+    SleepConditionVariableCS(condition, mutex, INFINITE);
+#else
+    pthread_cond_wait(condition, mutex);
+#endif /* _WIN32 */
+}
+
+
+/** @brief Wait on condition for at most @p timeoutUs microseconds, @p mutex must be locked. */
+static void STDREDIRECT_timedWait(STDREDIRECT_CONDITION* condition, STDREDIRECT_MUTEX* mutex, long long timeoutUs) {
+#ifdef _WIN32
+    SleepConditionVariableCS(condition, mutex, (DWORD) ((timeoutUs + 999) / 1000));
+#else
+    struct timespec deadline;
+
+#ifdef __linux__
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+#else
+    clock_gettime(CLOCK_REALTIME, &deadline);
+#endif /* __linux__ */
+    deadline.tv_sec += (time_t) (timeoutUs / 1000000);
+    deadline.tv_nsec += (long) (timeoutUs % 1000000 * 1000);
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(condition, mutex, &deadline);
+#endif /* _WIN32 */
+}
+
+
+/** @brief Wake all threads waiting on condition. */
+static void STDREDIRECT_broadcast(STDREDIRECT_CONDITION* condition) {
+#ifdef _WIN32
+    WakeAllConditionVariable(condition);
+#else
+    pthread_cond_broadcast(condition);
+#endif /* _WIN32 */
 }
 
 
 /**
  * @brief Default debugger callback.
  *
- * Forwards string to Windows function OutputDebugString().
+ * Forwards string to Windows function OutputDebugString(), on POSIX systems to syslog() with priority LOG_DEBUG.
  *
  * @param str String.
  */
 static void STDREDIRECT_debuggerCallback(const char* str) {
+#ifdef _WIN32
     OutputDebugString(str);
+#else
+    syslog(LOG_DEBUG, "%s", str);
+#endif /* _WIN32 */
 }
 
 
 /**
  * @brief Print directly to console, bypassing redirection.
  *
- * Just calls _cprintf_s().
+ * Just calls _cprintf_s(). On POSIX systems the output is written to stdout as it was before any redirection first
+ * redirected it, whichever redirections are active now.
  *
  * @param format Formatted output string, see _cprintf_s().
  * @return See _cprintf_s().
  */
 static int STDREDIRECT_printToConsole(const char* format, ...) {
     int result;
+#ifndef _WIN32
+    int consoleFileDescriptor = (int) STDREDIRECT_atomicLoad(&STDREDIRECT_consoleFileDescriptor);
+#endif /* _WIN32 */
     
     va_list argptr;
     va_start(argptr, format);
+#ifdef _WIN32
     result = _vcprintf_s(format, argptr);
+#else
+    result = vdprintf(consoleFileDescriptor != -1 ? consoleFileDescriptor : STDOUT_FILENO, format, argptr);
+#endif /* _WIN32 */
     va_end(argptr);
 
     return result;
 }
 
 
+#if defined (STDREDIRECT_INTERPOSE_WRITE) && defined (__linux__)
+/** @brief Redirections receiving write() calls on stdout and stderr, indexed by ::STDREDIRECT_STREAM. */
+static STDREDIRECT_REDIRECTION* volatile STDREDIRECT_interposed[2];
+
+
+/** @brief Calling thread is in STDREDIRECT_threadWrite() for an interposed write(). */
+static STDREDIRECT_THREAD_LOCAL int STDREDIRECT_isInterposing;
+
+
+/**
+ * @brief Pass write() calls on a standard stream to STDREDIRECT_threadWrite() of a redirection.
+ *
+ * Define STDREDIRECT_INTERPOSE_WRITE before including stdredirect.h in one translation unit of the executable, it then
+ * defines write() itself, which takes precedence over the C library's. Only write() calls through the dynamic symbol
+ * are seen, glibc stdio writes internally, printf() and std::cout keep going through the pipe; use
+ * STDREDIRECT_threadPrintf() or stdredirect::ThreadStreamRedirect for them. Set before the writing threads start.
+ *
+ * @param stream Stream whose write() calls are interposed.
+ * @param redirection Pointer to redirection object of @p stream, NULL to stop interposing.
+ */
+static void STDREDIRECT_interposeWrite(STDREDIRECT_STREAM stream, STDREDIRECT_REDIRECTION* redirection) {
+    STDREDIRECT_interposed[stream] = redirection;
+}
+
+
+/**
+ * @brief write() routing stdout and stderr to the interposed redirections, see STDREDIRECT_interposeWrite().
+ *
+ * Writes of the callbacks to an interposed stream go to the original stream, committing them would wait for the lock
+ * held by the caller of the callback, or for the ring the dispatcher itself empties. All other file descriptors go to
+ * the system call.
+ */
+ssize_t write(int fileDescriptor, const void* data, size_t length) {
+    STDREDIRECT_REDIRECTION* redirection = NULL;
+    int                      originalFileDescriptor;
+
+    if (fileDescriptor == STDOUT_FILENO || fileDescriptor == STDERR_FILENO) {
+        redirection = STDREDIRECT_interposed[fileDescriptor == STDOUT_FILENO ? STDREDIRECT_STREAM_STDOUT : STDREDIRECT_STREAM_STDERR];
+    }
+    /* a callback may run in the drain of an interposed write(), the pipe would pass its write on to it again */
+    if (redirection && STDREDIRECT_callbackDepth > 0) {
+        originalFileDescriptor = redirection->originalFileDescriptor;
+        if (originalFileDescriptor != -1) {
+            fileDescriptor = originalFileDescriptor;
+        }
+        redirection = NULL;
+    }
+    else if (STDREDIRECT_isInterposing) {
+        redirection = NULL;
+    }
+    if (!redirection) {
+        return (ssize_t) syscall(SYS_write, fileDescriptor, data, length);
+    }
+
+    STDREDIRECT_isInterposing = TRUE;
+    STDREDIRECT_threadWrite(redirection, (const char*) data, length);
+    STDREDIRECT_isInterposing = FALSE;
+
+    return (ssize_t) length;
+}
+#endif /* STDREDIRECT_INTERPOSE_WRITE && __linux__ */
+
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
 
-#endif /* _WIN32 */
-
 #endif /* STDREDIRECT_H */
@@ -0,0 +1,713 @@
+/***********************************************************************************************************************
+* stdredirect.hpp
+*
+* C++ iostreams layer of stdredirect, passes std::cout/std::cerr/std::clog output to the callbacks without the pipe.
+* https://github.com/biosmanager/stdredirect
+*
+*
+* MIT License
+*
+* Copyright (c) 2018 Matthias Albrecht
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+***********************************************************************************************************************/
+
+/**
+ * @file stdredirect.hpp
+ * @author Matthias Albrecht
+ * @brief C++ layer of stdredirect: RAII redirection with any callable as sink, coroutine consumers and iostreams
+ *        without the pipe.
+ *
+ * stdredirect::Redirection (C++11) owns a redirection and passes its output to a callable sink, stateful lambdas
+ * included, instead of a global callback function:
+ *
+ *     size_t numBytes = 0;
+ *     auto redirection = stdredirect::makeRedirection<STDREDIRECT_FRAMING_LINE>(STDREDIRECT_STREAM_STDOUT,
+ *         [&numBytes](const char* data, size_t length) { numBytes += length; });
+ *     printf("passed to the lambda\n");
+ *     redirection.unredirect();
+ *
+ * stdredirect::AsyncReader (C++20) lets a coroutine co_await the output line by line (or chunk by chunk). The
+ * consumer is suspended while there is nothing to read and handed to an executor, e.g. one posting to the event loop
+ * of the consumer, once there is:
+ *
+ *     stdredirect::AsyncReader<EventLoopExecutor> reader(STDREDIRECT_STREAM_STDOUT, EventLoopExecutor(loop));
+ *     while (std::optional<std::string_view> line = co_await reader.next()) {
+ *         consume(*line);
+ *     }
+ *
+ * stdredirect::StreamRedirect installs a stdredirect::StreamBuffer on std::cout or on std::cerr and std::clog. Their
+ * output is collected in memory and handed to STDREDIRECT_inject(), so it reaches the callbacks of the redirection
+ * without the write to the pipe, the wakeup of the pipe reader and the read. printf() and write() output keeps going
+ * through the pipe, STDREDIRECT_inject() passes that on first so both keep their order.
+ *
+ *     STDREDIRECT_REDIRECTION* redirection = STDREDIRECT_createWithOptions(STDREDIRECT_STREAM_STDOUT, &options);
+ *     STDREDIRECT_redirect(redirection);
+ *     {
+ *         stdredirect::StreamRedirect streamRedirect(redirection);
+ *         std::cout << "passed to the callback without the pipe" << std::endl;
+ *     }
+ *     STDREDIRECT_destroy(redirection);
+ *
+ * stdredirect::ThreadStreamRedirect does the same through per-thread buffers, lines of threads writing at once stay
+ * whole and are tagged with the writing thread.
+ */
+
+#ifndef STDREDIRECT_HPP
+#define STDREDIRECT_HPP
+
+#if defined (_MSC_VER) && (_MSC_VER >= 1020)
+#pragma once
+#endif
+
+#include "stdredirect.h"
+
+#include <iostream>
+#include <streambuf>
+
+#if __cplusplus >= 201103L || (defined (_MSC_VER) && _MSC_VER >= 1900)
+#define STDREDIRECT_CPP11
+#include <memory>
+#include <type_traits>
+#include <utility>
+#endif
+
+#if __cplusplus >= 202002L || (defined (_MSVC_LANG) && _MSVC_LANG >= 202002L)
+#if defined (__has_include)
+#if __has_include(<coroutine>)
+#define STDREDIRECT_CPP20
+#include <coroutine>
+#include <optional>
+#include <string>
+#include <string_view>
+#endif
+#endif
+#endif
+
+
+namespace stdredirect {
+
+
+/**
+ * @brief Stream buffer passing its output to a redirection.
+ *
+ * Output is collected until a newline, a flush (e.g. std::endl) or STDREDIRECT_INJECT_BUFFER_SIZE bytes, then passed to
+ * STDREDIRECT_inject(). While the redirection is not redirected it goes to the fallback stream buffer instead. Safe to
+ * use from several threads, like std::cout with synchronized stdio. Callbacks of a synchronous redirection run on the
+ * writing thread and must not write to the stream themselves.
+ */
+class StreamBuffer : public std::streambuf {
+public:
+    /**
+     * @brief Create stream buffer.
+     *
+     * @param target Pointer to redirection object, must outlive the stream buffer.
+     * @param previous Receives the output while @p target is not redirected, usually the previous stream buffer.
+     */
+    StreamBuffer(STDREDIRECT_REDIRECTION* target, std::streambuf* previous)
+        : redirection(target)
+        , fallback(previous)
+        , length(0) {
+        STDREDIRECT_initMutex(&lock);
+    }
+
+    /** @brief Pass on pending output and destroy stream buffer. */
+    virtual ~StreamBuffer() {
+        sync();
+        STDREDIRECT_destroyMutex(&lock);
+    }
+
+protected:
+    virtual int_type overflow(int_type character) {
+        char data;
+
+        if (traits_type::eq_int_type(character, traits_type::eof())) {
+            return traits_type::not_eof(character);
+        }
+
+        data = traits_type::to_char_type(character);
+        xsputn(&data, 1);
+
+        return character;
+    }
+
+    virtual std::streamsize xsputn(const char* data, std::streamsize count) {
+        std::streamsize numBytesToCopy;
+        std::streamsize copied;
+
+        STDREDIRECT_lock(&lock);
+        for (copied = 0; copied < count; copied += numBytesToCopy) {
+            if (length == sizeof(buffer)) {
+                pass();
+            }
+            numBytesToCopy = (std::streamsize) (sizeof(buffer) - length);
+            if (numBytesToCopy > count - copied) {
+                numBytesToCopy = count - copied;
+            }
+            memcpy(buffer + length, data + copied, (size_t) numBytesToCopy);
+            length += (size_t) numBytesToCopy;
+        }
+        if (count > 0 && STDREDIRECT_findByte(data, (size_t) count, '\n')) {
+            pass();
+        }
+        STDREDIRECT_unlock(&lock);
+
+        return count;
+    }
+
+    virtual int sync() {
+        int result;
+
+        STDREDIRECT_lock(&lock);
+        pass();
+        result = fallback ? fallback->pubsync() : 0;
+        STDREDIRECT_unlock(&lock);
+
+        return result;
+    }
+
+private:
+    /** @brief Pass collected output to the redirection or to the fallback, called with lock held. */
+    void pass() {
+        if (length == 0) {
+            return;
+        }
+        if (STDREDIRECT_inject(redirection, buffer, length) == STDREDIRECT_ERROR_NOT_REDIRECTED && fallback) {
+            fallback->sputn(buffer, (std::streamsize) length);
+        }
+        length = 0;
+    }
+
+    StreamBuffer(const StreamBuffer&);
+    StreamBuffer& operator=(const StreamBuffer&);
+
+    STDREDIRECT_REDIRECTION* redirection;                                   /**< redirection receiving the output     */
+    std::streambuf*          fallback;                                      /**< output while not redirected          */
+    STDREDIRECT_MUTEX        lock;                                          /**< guards buffer                        */
+    char                     buffer[STDREDIRECT_INJECT_BUFFER_SIZE];        /**< collected output                     */
+    size_t                   length;                                        /**< number of collected bytes            */
+};
+
+
+/**
+ * @brief Stream buffer passing its output to a redirection through STDREDIRECT_threadWrite().
+ *
+ * Every thread collects its output in a buffer of its own without taking a lock, so threads writing one message in
+ * several operator<< calls never interleave mid-line and each line is tagged with the writing thread in
+ * STDREDIRECT_RECORD::threadId. A partial line is passed on by std::flush or std::endl on the same thread, a thread
+ * must flush before it exits. While the redirection is not redirected the output goes to the C stream.
+ */
+class ThreadStreamBuffer : public std::streambuf {
+public:
+    /**
+     * @brief Create stream buffer.
+     *
+     * @param target Pointer to redirection object, must outlive the stream buffer.
+     * @param previous Previous stream buffer, synced along with this one.
+     */
+    ThreadStreamBuffer(STDREDIRECT_REDIRECTION* target, std::streambuf* previous)
+        : redirection(target)
+        , fallback(previous) {
+    }
+
+    /** @brief Pass on pending output of the destroying thread and destroy stream buffer. */
+    virtual ~ThreadStreamBuffer() {
+        sync();
+    }
+
+protected:
+    virtual int_type overflow(int_type character) {
+        char data;
+
+        if (traits_type::eq_int_type(character, traits_type::eof())) {
+            return traits_type::not_eof(character);
+        }
+
+        data = traits_type::to_char_type(character);
+        STDREDIRECT_threadWrite(redirection, &data, 1);
+
+        return character;
+    }
+
+    virtual std::streamsize xsputn(const char* data, std::streamsize count) {
+        STDREDIRECT_threadWrite(redirection, data, (size_t) count);
+
+        return count;
+    }
+
+    virtual int sync() {
+        STDREDIRECT_threadFlush(redirection);
+
+        return fallback ? fallback->pubsync() : 0;
+    }
+
+private:
+    ThreadStreamBuffer(const ThreadStreamBuffer&);
+    ThreadStreamBuffer& operator=(const ThreadStreamBuffer&);
+
+    STDREDIRECT_REDIRECTION* redirection;                                   /**< redirection receiving the output     */
+    std::streambuf*          fallback;                                      /**< previous stream buffer               */
+};
+
+
+/**
+ * @brief Installs a stream buffer on std::cout (stdout redirection) or on std::cerr and std::clog (stderr redirection)
+ *        and restores the previous stream buffers on destruction.
+ *
+ * The redirection must outlive the stream redirect, its redirect and unredirect may happen at any time in between.
+ * Use StreamRedirect (StreamBuffer) or ThreadStreamRedirect (ThreadStreamBuffer).
+ */
+template <typename Buffer>
+class BasicStreamRedirect {
+public:
+    /**
+     * @brief Install stream buffer.
+     *
+     * @param redirection Pointer to redirection object.
+     */
+    explicit BasicStreamRedirect(STDREDIRECT_REDIRECTION* redirection)
+        : isStdout(redirection->stream == STDREDIRECT_STREAM_STDOUT)
+        , previousBuffer(isStdout ? std::cout.rdbuf() : std::cerr.rdbuf())
+        , previousLogBuffer(isStdout ? NULL : std::clog.rdbuf())
+        , streamBuffer(redirection, previousBuffer) {
+        if (isStdout) {
+            std::cout.flush();
+            std::cout.rdbuf(&streamBuffer);
+        }
+        else {
+            std::cerr.flush();
+            std::clog.flush();
+            std::cerr.rdbuf(&streamBuffer);
+            std::clog.rdbuf(&streamBuffer);
+        }
+    }
+
+    /** @brief Restore previous stream buffers. */
+    ~BasicStreamRedirect() {
+        if (isStdout) {
+            std::cout.flush();
+            std::cout.rdbuf(previousBuffer);
+        }
+        else {
+            std::cerr.flush();
+            std::clog.flush();
+            std::cerr.rdbuf(previousBuffer);
+            std::clog.rdbuf(previousLogBuffer);
+        }
+    }
+
+private:
+    BasicStreamRedirect(const BasicStreamRedirect&);
+    BasicStreamRedirect& operator=(const BasicStreamRedirect&);
+
+    int             isStdout;                   /**< installed on std::cout, otherwise on std::cerr and std::clog */
+    std::streambuf* previousBuffer;             /**< previous stream buffer of std::cout or std::cerr             */
+    std::streambuf* previousLogBuffer;          /**< previous stream buffer of std::clog                          */
+    Buffer          streamBuffer;               /**< installed stream buffer                                      */
+};
+
+
+/** @brief Installs a StreamBuffer, output of all threads is collected in one locked buffer. */
+typedef BasicStreamRedirect<StreamBuffer> StreamRedirect;
+
+
+/** @brief Installs a ThreadStreamBuffer, output is collected per thread and tagged with the writing thread. */
+typedef BasicStreamRedirect<ThreadStreamBuffer> ThreadStreamRedirect;
+
+
+#ifdef STDREDIRECT_CPP11
+/**
+ * @brief Redirection passing its output to a callable sink, redirects on construction and unredirects on destruction.
+ *
+ * The sink is called as sink(const char* data, size_t length) on the pipe reader thread, or on the dispatcher thread
+ * in asynchronous mode, so it must be safe to call from there while the owner keeps running. Framing and behaviour are
+ * fixed by the type, the sink is called from a callback instantiated for it, so the call can be inlined. Move-only, the
+ * sink stays at the same address when the redirection is moved.
+ *
+ * @tparam Sink Callable type.
+ * @tparam Framing ::STDREDIRECT_FRAMING.
+ * @tparam Behaviour ::STDREDIRECT_BEHAVIOUR.
+ */
+template <typename Sink, STDREDIRECT_FRAMING Framing = STDREDIRECT_FRAMING_RAW, STDREDIRECT_BEHAVIOUR Behaviour = STDREDIRECT_BEHAVIOUR_REDIRECT>
+class Redirection {
+public:
+    /**
+     * @brief Create redirection and redirect, check getError() for the outcome.
+     *
+     * @param stream Stream to redirect.
+     * @param sink Callable receiving the output.
+     * @param options Further options, callbacks, userdata, framing and behaviour are set by the redirection.
+     */
+    Redirection(STDREDIRECT_STREAM stream, Sink sink, STDREDIRECT_OPTIONS options = STDREDIRECT_defaultOptions())
+        : sinkObject(new Sink(std::move(sink)))
+        , redirection(NULL)
+        , error(STDREDIRECT_ERROR_NO_ERROR) {
+        options.dataCallback = &Redirection::dataCallback;
+        options.userdata     = sinkObject.get();
+        options.framing      = Framing;
+        options.behaviour    = Behaviour;
+
+        redirection = STDREDIRECT_createWithOptions(stream, &options);
+        error = redirection ? STDREDIRECT_redirect(redirection) : STDREDIRECT_ERROR_CREATE;
+    }
+
+    Redirection(Redirection&& other) noexcept
+        : sinkObject(std::move(other.sinkObject))
+        , redirection(other.redirection)
+        , error(other.error) {
+        other.redirection = NULL;
+    }
+
+    Redirection& operator=(Redirection&& other) noexcept {
+        if (this != &other) {
+            STDREDIRECT_destroy(redirection);
+            sinkObject        = std::move(other.sinkObject);
+            redirection       = other.redirection;
+            error             = other.error;
+            other.redirection = NULL;
+        }
+
+        return *this;
+    }
+
+    Redirection(const Redirection&) = delete;
+    Redirection& operator=(const Redirection&) = delete;
+
+    /** @brief Unredirect, passing everything written before to the sink, and destroy redirection. */
+    ~Redirection() {
+        STDREDIRECT_destroy(redirection);
+    }
+
+    /** @brief Redirect again after unredirect(). */
+    STDREDIRECT_ERROR redirect() {
+        return error = redirection ? STDREDIRECT_redirect(redirection) : STDREDIRECT_ERROR_NULLPTR;
+    }
+
+    /** @brief Unredirect, everything written before is passed to the sink before this returns. */
+    STDREDIRECT_ERROR unredirect() {
+        return error = redirection ? STDREDIRECT_unredirect(redirection) : STDREDIRECT_ERROR_NULLPTR;
+    }
+
+    /** @brief Pass data to the sink as if it had been written to the stream, see STDREDIRECT_inject(). */
+    STDREDIRECT_ERROR inject(const char* data, size_t length) {
+        return STDREDIRECT_inject(redirection, data, length);
+    }
+
+    /** @brief Snapshot of the statistics, see STDREDIRECT_getStats(). */
+    STDREDIRECT_ERROR getStats(STDREDIRECT_STATS* stats) const {
+        return STDREDIRECT_getStats(redirection, stats);
+    }
+
+    /** @brief Result of the last redirect or unredirect. */
+    STDREDIRECT_ERROR getError() const {
+        return error;
+    }
+
+    /** @brief Underlying redirection object, e.g. for StreamRedirect, NULL after it was moved from. */
+    STDREDIRECT_REDIRECTION* get() const {
+        return redirection;
+    }
+
+    /** @brief Sink, only safe to use while the redirection does not call it, e.g. after unredirect(). */
+    Sink& getSink() {
+        return *sinkObject;
+    }
+
+private:
+    /** @brief Data callback calling the sink. */
+    static void dataCallback(const char* data, size_t length, void* userdata) {
+        (*static_cast<Sink*>(userdata))(data, length);
+    }
+
+    std::unique_ptr<Sink>    sinkObject;        /**< sink, on the heap so it survives moves of the redirection */
+    STDREDIRECT_REDIRECTION* redirection;       /**< redirection object, NULL after it was moved from          */
+    STDREDIRECT_ERROR        error;             /**< result of the last redirect or unredirect                 */
+};
+
+
+/**
+ * @brief Create redirection with the sink type deduced, see Redirection.
+ *
+ * @param stream Stream to redirect.
+ * @param sink Callable receiving the output.
+ * @param options Further options.
+ * @return Redirection, redirected unless getError() says otherwise.
+ */
+template <STDREDIRECT_FRAMING Framing = STDREDIRECT_FRAMING_RAW, STDREDIRECT_BEHAVIOUR Behaviour = STDREDIRECT_BEHAVIOUR_REDIRECT, typename Sink>
+Redirection<typename std::decay<Sink>::type, Framing, Behaviour> makeRedirection(STDREDIRECT_STREAM stream, Sink&& sink, STDREDIRECT_OPTIONS options = STDREDIRECT_defaultOptions()) {
+    return Redirection<typename std::decay<Sink>::type, Framing, Behaviour>(stream, std::forward<Sink>(sink), options);
+}
+#endif /* STDREDIRECT_CPP11 */
+
+
+#ifdef STDREDIRECT_CPP20
+/** @brief Executor resuming the consumer right away, on the pipe reader (or dispatcher) thread. */
+struct InlineExecutor {
+    void operator()(std::coroutine_handle<> consumer) const {
+        consumer.resume();
+    }
+};
+
+
+/**
+ * @brief Redirection whose output a coroutine takes with co_await next(), redirects on construction.
+ *
+ * The data callback copies each line (or chunk in raw framing) into a ring of @p capacity bytes. A consumer finding
+ * the ring empty is suspended and passed to executor(std::coroutine_handle<>) by the next callback, so no thread waits
+ * for it. If the consumer falls behind and the ring fills up, the callback waits for room, which blocks the pipe reader
+ * and eventually the writers (or, in asynchronous mode, fills the ring of the redirection first). close() lifts that
+ * backpressure, passes everything written before to the ring and ends the consumer.
+ *
+ * One consumer at a time. The reader must not be destroyed while a consumer is suspended on it; close() it and let
+ * the consumer see the end first.
+ *
+ * @tparam Executor Callable resuming a suspended consumer, called on the pipe reader thread, e.g. by posting it to an
+ *         event loop. Must not resume it in the caller if the consumer closes the reader, use an event loop then.
+ * @tparam Framing ::STDREDIRECT_FRAMING.
+ */
+template <typename Executor = InlineExecutor, STDREDIRECT_FRAMING Framing = STDREDIRECT_FRAMING_LINE>
+class AsyncReader {
+public:
+    /** @brief Awaitable returned by next(). */
+    class Awaitable {
+    public:
+        explicit Awaitable(AsyncReader* owner)
+            : reader(owner) {
+        }
+
+        bool await_ready() {
+            bool isReady;
+
+            STDREDIRECT_lock(&reader->lock);
+            isReady = reader->isReadable();
+            STDREDIRECT_unlock(&reader->lock);
+
+            return isReady;
+        }
+
+        bool await_suspend(std::coroutine_handle<> consumer) {
+            bool isSuspended;
+
+            /* output may have arrived since await_ready() */
+            STDREDIRECT_lock(&reader->lock);
+            isSuspended = !reader->isReadable();
+            if (isSuspended) {
+                reader->consumer = consumer;
+            }
+            STDREDIRECT_unlock(&reader->lock);
+
+            return isSuspended;
+        }
+
+        /** @return Next line or chunk, valid until the next call of next(), std::nullopt once the reader is closed. */
+        std::optional<std::string_view> await_resume() {
+            return reader->take();
+        }
+
+    private:
+        AsyncReader* reader;
+    };
+
+    /**
+     * @brief Create redirection and redirect, check getError() for the outcome.
+     *
+     * @param stream Stream to redirect.
+     * @param executor Resumes a suspended consumer.
+     * @param capacity Ring capacity in bytes, rounded up to a power of two that holds the largest line or chunk.
+     * @param options Further options, callbacks, userdata and framing are set by the reader.
+     */
+    AsyncReader(STDREDIRECT_STREAM stream, Executor executor = Executor(), size_t capacity = 1024 * 1024, STDREDIRECT_OPTIONS options = STDREDIRECT_defaultOptions())
+        : resumer(std::move(executor))
+        , redirection(NULL)
+        , error(STDREDIRECT_ERROR_NO_ERROR)
+        , isClosing(false)
+        , isClosed(false) {
+        size_t largest = options.isAdaptive && options.maxBufferSize > options.bufferSize ? options.maxBufferSize : options.bufferSize;
+
+        if (options.maxLineLength > largest) {
+            largest = options.maxLineLength;
+        }
+        for (ring.capacity = 64; ring.capacity < capacity || ring.capacity < sizeof(size_t) + largest; ring.capacity *= 2);
+        ring.data = new char[ring.capacity];
+        ring.head = 0;
+        ring.tail = 0;
+        STDREDIRECT_initMutex(&lock);
+        STDREDIRECT_initCondition(&roomCondition);
+
+        options.dataCallback = &AsyncReader::dataCallback;
+        options.userdata     = this;
+        options.framing      = Framing;
+
+        redirection = STDREDIRECT_createWithOptions(stream, &options);
+        error = redirection ? STDREDIRECT_redirect(redirection) : STDREDIRECT_ERROR_CREATE;
+    }
+
+    AsyncReader(const AsyncReader&) = delete;
+    AsyncReader& operator=(const AsyncReader&) = delete;
+
+    /** @brief Close and destroy redirection. */
+    ~AsyncReader() {
+        close();
+        STDREDIRECT_destroy(redirection);
+        STDREDIRECT_destroyCondition(&roomCondition);
+        STDREDIRECT_destroyMutex(&lock);
+        delete[] ring.data;
+    }
+
+    /** @brief Awaitable for the next line or chunk, see Awaitable::await_resume(). */
+    Awaitable next() {
+        return Awaitable(this);
+    }
+
+    /**
+     * @brief Unredirect, everything written before stays readable, then next() returns std::nullopt.
+     *
+     * A suspended consumer is resumed through the executor.
+     */
+    STDREDIRECT_ERROR close() {
+        std::coroutine_handle<> waiting;
+
+        STDREDIRECT_lock(&lock);
+        if (isClosed) {
+            STDREDIRECT_unlock(&lock);
+            return error;
+        }
+        isClosing = true;
+        STDREDIRECT_broadcast(&roomCondition);
+        STDREDIRECT_unlock(&lock);
+
+        if (redirection && error == STDREDIRECT_ERROR_NO_ERROR) {
+            error = STDREDIRECT_unredirect(redirection);
+        }
+
+        STDREDIRECT_lock(&lock);
+        isClosed = true;
+        waiting  = consumer;
+        consumer = nullptr;
+        STDREDIRECT_unlock(&lock);
+
+        if (waiting) {
+            resumer(waiting);
+        }
+
+        return error;
+    }
+
+    /** @brief Snapshot of the statistics, see STDREDIRECT_getStats(). */
+    STDREDIRECT_ERROR getStats(STDREDIRECT_STATS* stats) const {
+        return STDREDIRECT_getStats(redirection, stats);
+    }
+
+    /** @brief Result of the redirect or close(). */
+    STDREDIRECT_ERROR getError() const {
+        return error;
+    }
+
+    /** @brief Underlying redirection object, e.g. for StreamRedirect. */
+    STDREDIRECT_REDIRECTION* get() const {
+        return redirection;
+    }
+
+private:
+    /** @brief Data callback copying into the ring, waits for room unless closing, resumes a suspended consumer. */
+    static void dataCallback(const char* data, size_t length, void* userdata) {
+        AsyncReader*            reader = static_cast<AsyncReader*>(userdata);
+        std::coroutine_handle<> waiting;
+
+        STDREDIRECT_lock(&reader->lock);
+        while (reader->used() + sizeof(length) + length > reader->ring.capacity) {
+            if (reader->isClosing) {
+                reader->grow();
+            }
+            else {
+                STDREDIRECT_wait(&reader->roomCondition, &reader->lock);
+            }
+        }
+        STDREDIRECT_ringCopyIn(&reader->ring, reader->ring.head, &length, sizeof(length));
+        STDREDIRECT_ringCopyIn(&reader->ring, reader->ring.head + (long long) sizeof(length), data, length);
+        reader->ring.head = reader->ring.head + (long long) (sizeof(length) + length);
+        waiting = reader->consumer;
+        reader->consumer = nullptr;
+        STDREDIRECT_unlock(&reader->lock);
+
+        if (waiting) {
+            reader->resumer(waiting);
+        }
+    }
+
+    /** @brief Take the oldest line or chunk out of the ring into current, wakes a waiting callback. */
+    std::optional<std::string_view> take() {
+        size_t length;
+
+        STDREDIRECT_lock(&lock);
+        if (used() == 0) {
+            STDREDIRECT_unlock(&lock);
+            return std::nullopt;
+        }
+        STDREDIRECT_ringCopyOut(&ring, ring.tail, &length, sizeof(length));
+        current.resize(length);
+        STDREDIRECT_ringCopyOut(&ring, ring.tail + (long long) sizeof(length), &current[0], length);
+        ring.tail = ring.tail + (long long) (sizeof(length) + length);
+        STDREDIRECT_broadcast(&roomCondition);
+        STDREDIRECT_unlock(&lock);
+
+        return std::string_view(current);
+    }
+
+    /** @brief Next call of take() does not need to wait, called with lock held. */
+    bool isReadable() const {
+        return used() > 0 || isClosed;
+    }
+
+    /** @brief Number of bytes in the ring, called with lock held. */
+    size_t used() const {
+        return (size_t) (ring.head - ring.tail);
+    }
+
+    /** @brief Double the ring capacity, keeping its contents, called with lock held. */
+    void grow() {
+        size_t numBytes = used();
+        char*  data     = new char[2 * ring.capacity];
+
+        STDREDIRECT_ringCopyOut(&ring, ring.tail, data, numBytes);
+        delete[] ring.data;
+        ring.data     = data;
+        ring.capacity = 2 * ring.capacity;
+        ring.tail     = 0;
+        ring.head     = (long long) numBytes;
+    }
+
+    Executor                 resumer;           /**< resumes a suspended consumer                                 */
+    STDREDIRECT_REDIRECTION* redirection;       /**< redirection object                                           */
+    STDREDIRECT_ERROR        error;             /**< result of the redirect or close()                            */
+    STDREDIRECT_RING         ring;              /**< lines or chunks not yet taken, each after its size_t length  */
+    STDREDIRECT_MUTEX        lock;              /**< guards ring, consumer and the flags                          */
+    STDREDIRECT_CONDITION    roomCondition;     /**< signalled when the consumer took from the ring or on close   */
+    std::coroutine_handle<>  consumer;          /**< suspended consumer, null if none                             */
+    std::string              current;           /**< line or chunk last returned by next()                        */
+    bool                     isClosing;         /**< callback grows the ring instead of waiting for room          */
+    bool                     isClosed;          /**< unredirected, next() ends once the ring is empty             */
+};
+#endif /* STDREDIRECT_CPP20 */
+
+
+} /* namespace stdredirect */
+
+#endif /* STDREDIRECT_HPP */
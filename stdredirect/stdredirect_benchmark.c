@@ -0,0 +1,2421 @@
+/***********************************************************************************************************************
+* stdredirect_benchmark.c
+*
+* Capture throughput through a redirection compared against writing the same data to a plain file.
+* POSIX only, build with CMake or e.g. "cc -O2 -pthread stdredirect_benchmark.c -o stdredirect_benchmark".
+*
+* Usage: stdredirect_benchmark [--json] [scenario] [megabytes]
+*   --json       print one JSON object per result row instead of tables, for comparing runs
+*
+*   throughput   redirected write throughput vs. plain file for several write sizes (default 256 MB)
+*   callback     MB/s and callbacks per MB of the null-terminated string callback with the former 81 byte
+*                buffer vs. the length-delimited data callback with the default buffer (default 1024 MB)
+*   scan         newline scan throughput of STDREDIRECT_findByte() vs. memchr() in memory (default 1024 MB)
+*   batch        batch callback throughput and write-to-callback latency over size/delay thresholds (default 128 MB)
+*   streams      stdout and stderr written alternately, shared epoll reader vs. reader thread per stream (default 256 MB)
+*   duplicate    CPU time per GB of duplicate mode into a file, write() vs. tee()/splice() (default 1024 MB)
+*   filesink     memory-mapped file sink vs. string callback calling fwrite() (default 1024 MB)
+*   latency      p50/p99/p999 latency from write() to callback entry for several write sizes, sync vs. async
+*   cycle        cost of a redirect/unredirect cycle for each reader mode, sync vs. async, with and without persistence
+*   stall        time writers spend blocked in write() under slow callbacks, sync vs. async (default 4 MB)
+*   burst        writer stall time during bursts with fixed vs. adaptive pipe and buffer size (default 32 MB)
+*   route        GB/s of routing log lines to alert/trace/default sinks with stdredirect_router.h vs. a memmem()
+*                chain per line, in memory and through the pipe (default 1024 MB)
+*   inject       p50/p99 latency and writer cost per line through the pipe vs. STDREDIRECT_inject(), the path of
+*                stdredirect::StreamBuffer in stdredirect.hpp, sync vs. async
+*   fanout       writer MB/s with a file, a forwarder and a slow debugger sink behind one callback vs. subscribers of
+*                stdredirect_fanout.h, with the debugger waited for or lapped (default 16 MB)
+*   filter       cost per line of line collapsing and rate limiting on distinct lines, and time to get a flood of
+*                identical lines through a 10 us callback with and without them (default 1024 MB)
+*   spill        writer stall and lost output while the sink is unavailable for 250 ms, blocking vs. dropping vs.
+*                spilling to disk with a 1 MB ring (default 64 MB)
+*   threads      8 threads writing lines in 3 fragments each, write() to the pipe vs. STDREDIRECT_threadWrite() vs.
+*                interposed write(), also with a callback echoing every line with write(): MB/s, lines torn mid-line
+*                and lines tagged with the wrong thread, fails on either unless written with plain write() (default
+*                64 MB)
+*   capture      cost of capturing one line of stdout/stderr around an assertion and MB/s of a large capture, string-
+*                building callback vs. stdredirect_capture.h, plain, nested and tagged (default 256 MB)
+*   spawn        16 and 256 child processes writing to stdout and stderr at once, STDREDIRECT_spawn() with the shared
+*                reader vs. a reader thread per stream: children/s, MB/s, threads and incomplete output on exit
+*                (default 256 MB)
+*   escapes      removing ANSI escape sequences from plain and colored log lines, GB/s in memory of the vectorized
+*                STDREDIRECT_stripEscapes() vs. a byte-by-byte state machine and MB/s through the pipe with a
+*                stripping callback vs. isStrippingEscapes (default 1024 MB)
+*   utf8         GB/s in memory of the vectorized STDREDIRECT_validUtf8Length() and STDREDIRECT_utf8ToUtf16() vs.
+*                byte-by-byte loops on ASCII, mixed and CJK text, MB/s through the pipe of the UTF-16 callback vs. a
+*                data callback transcoding on its own and code units it loses to split code points (default 1024 MB)
+*
+*
+* MIT License
+*
+* Copyright (c) 2018 Matthias Albrecht
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+***********************************************************************************************************************/
+
+/* the threads scenario routes write() through STDREDIRECT_threadWrite(), inactive until STDREDIRECT_interposeWrite() */
+#define STDREDIRECT_INTERPOSE_WRITE
+
+#include "stdredirect.h"
+#include "stdredirect_benchmark.h"
+#include "stdredirect_capture.h"
+#include "stdredirect_fanout.h"
+#include "stdredirect_filesink.h"
+#include "stdredirect_router.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+
+/** @brief Bytes seen by the benchmark callback. */
+static size_t BENCHMARK_bytesReceived;
+
+/** @brief Number of benchmark callback invocations. */
+static size_t BENCHMARK_callbacks;
+
+/** @brief File written by the fwrite() callback. */
+static FILE* BENCHMARK_file;
+
+/** @brief Latencies in microseconds collected by the latency callbacks. */
+static long long* BENCHMARK_latencies;
+
+/** @brief Number of collected latencies. */
+static size_t BENCHMARK_numLatencies;
+
+/** @brief Capacity of BENCHMARK_latencies. */
+static size_t BENCHMARK_maxLatencies;
+
+/** @brief Callback delay in microseconds of the slow callback. */
+static long long BENCHMARK_callbackDelay;
+
+/** @brief Output collected by the string-building callback, grown per chunk. */
+static char* BENCHMARK_captured;
+
+/** @brief Number of bytes in BENCHMARK_captured. */
+static size_t BENCHMARK_capturedLength;
+
+/** @brief Protects BENCHMARK_captured against the pipe reader threads. */
+static STDREDIRECT_MUTEX BENCHMARK_captureLock;
+
+
+/** @brief Callback counting received bytes. */
+static void BENCHMARK_countingCallback(const char* str) {
+    BENCHMARK_bytesReceived += strlen(str);
+    ++BENCHMARK_callbacks;
+}
+
+
+/** @brief Data callback counting received bytes. */
+static void BENCHMARK_countingDataCallback(const char* data, size_t length, void* userdata) {
+    (void) data;
+    (void) userdata;
+
+    BENCHMARK_bytesReceived += length;
+    ++BENCHMARK_callbacks;
+}
+
+
+/** @brief Batch callback counting received bytes. */
+static void BENCHMARK_countingBatchCallback(const STDREDIRECT_SEGMENT* segments, size_t count, void* userdata) {
+    size_t i;
+
+    (void) userdata;
+
+    for (i = 0; i < count; ++i) {
+        BENCHMARK_bytesReceived += segments[i].length;
+    }
+    ++BENCHMARK_callbacks;
+}
+
+
+/** @brief Batch callback recording latency of each line, lines start with their STDREDIRECT_now() write time. */
+static void BENCHMARK_latencyBatchCallback(const STDREDIRECT_SEGMENT* segments, size_t count, void* userdata) {
+    long long now = STDREDIRECT_now();
+    size_t    i;
+
+    (void) userdata;
+
+    for (i = 0; i < count; ++i) {
+        if (BENCHMARK_numLatencies < BENCHMARK_maxLatencies) {
+            BENCHMARK_latencies[BENCHMARK_numLatencies++] = now - atoll(segments[i].data);
+        }
+        BENCHMARK_bytesReceived += segments[i].length;
+    }
+    ++BENCHMARK_callbacks;
+}
+
+
+/** @brief Data callback recording latency of each line, lines start with their STDREDIRECT_now() write time. */
+static void BENCHMARK_latencyDataCallback(const char* data, size_t length, void* userdata) {
+    long long now = STDREDIRECT_now();
+
+    (void) userdata;
+
+    if (BENCHMARK_numLatencies < BENCHMARK_maxLatencies) {
+        BENCHMARK_latencies[BENCHMARK_numLatencies++] = now - atoll(data);
+    }
+    BENCHMARK_bytesReceived += length;
+    ++BENCHMARK_callbacks;
+}
+
+
+/** @brief qsort() comparison of latencies. */
+static int BENCHMARK_compareLatencies(const void* first, const void* second) {
+    long long difference = *(const long long*) first - *(const long long*) second;
+
+    return difference < 0 ? -1 : difference > 0;
+}
+
+
+/** @brief Percentile of collected latencies, sorts them. */
+static long long BENCHMARK_percentile(double percentile) {
+    if (BENCHMARK_numLatencies == 0) {
+        return 0;
+    }
+    qsort(BENCHMARK_latencies, BENCHMARK_numLatencies, sizeof(long long), &BENCHMARK_compareLatencies);
+
+    return BENCHMARK_latencies[(size_t) (percentile / 100.0 * (double) (BENCHMARK_numLatencies - 1))];
+}
+
+
+/** @brief Sleep for microseconds. */
+static void BENCHMARK_sleep(long long microseconds) {
+    struct timespec duration;
+
+    duration.tv_sec  = (time_t) (microseconds / 1000000);
+    duration.tv_nsec = (long) (microseconds % 1000000 * 1000);
+    nanosleep(&duration, NULL);
+}
+
+
+/** @brief User plus system CPU time of all threads in seconds. */
+static double BENCHMARK_cpuTime() {
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+
+    return (double) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) + (double) (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+
+/** @brief Write totalSize bytes in chunks of writeSize to file descriptor. */
+static int BENCHMARK_writeChunks(int fileDescriptor, const char* chunk, size_t writeSize, size_t totalSize) {
+    size_t written;
+
+    for (written = 0; written < totalSize; written += writeSize) {
+        if (STDREDIRECT_writeAll(fileDescriptor, chunk, totalSize - written < writeSize ? totalSize - written : writeSize) == -1) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+/** @brief Baseline: write to a temporary file, returns MB/s. */
+static double BENCHMARK_fileThroughput(const char* chunk, size_t writeSize, size_t totalSize) {
+    char   path[] = "/tmp/stdredirect_benchmark_XXXXXX";
+    int    fileDescriptor;
+    double start;
+    double seconds;
+
+    fileDescriptor = mkstemp(path);
+    if (fileDescriptor == -1) {
+        return 0.0;
+    }
+    unlink(path);
+
+    start = BENCHMARK_now();
+    BENCHMARK_writeChunks(fileDescriptor, chunk, writeSize, totalSize);
+    seconds = BENCHMARK_now() - start;
+
+    close(fileDescriptor);
+
+    return (double) totalSize / (1024.0 * 1024.0) / seconds;
+}
+
+
+/** @brief Write through stdout redirection, returns MB/s including the drain on unredirect. */
+static double BENCHMARK_redirectThroughput(STDREDIRECT_REDIRECTION* redirection, const char* chunk, size_t writeSize, size_t totalSize) {
+    double start;
+    double seconds;
+
+    if (redirection == NULL) {
+        return 0.0;
+    }
+
+    BENCHMARK_bytesReceived = 0;
+    BENCHMARK_callbacks = 0;
+    start = BENCHMARK_now();
+    if (STDREDIRECT_redirect(redirection) != STDREDIRECT_ERROR_NO_ERROR) {
+        STDREDIRECT_destroy(redirection);
+        return 0.0;
+    }
+    BENCHMARK_writeChunks(STDOUT_FILENO, chunk, writeSize, totalSize);
+    STDREDIRECT_destroy(redirection);
+    seconds = BENCHMARK_now() - start;
+
+    if (BENCHMARK_bytesReceived != totalSize) {
+        fprintf(stderr, "lost output: %zu of %zu bytes received\n", BENCHMARK_bytesReceived, totalSize);
+    }
+
+    return (double) totalSize / (1024.0 * 1024.0) / seconds;
+}
+
+
+/** @brief Redirected vs. plain file throughput for several write sizes. */
+static void BENCHMARK_throughput(size_t totalSize) {
+    static const size_t writeSizes[] = { 16, 128, 1024, 4096, 65536 };
+    static char         chunk[65536];
+    size_t              i;
+
+    memset(chunk, 'x', sizeof(chunk));
+
+    for (i = 0; i < sizeof(writeSizes) / sizeof(writeSizes[0]); ++i) {
+        STDREDIRECT_OPTIONS options = STDREDIRECT_defaultOptions();
+        double              fileThroughput;
+        double              redirectThroughput;
+
+        options.dataCallback = &BENCHMARK_countingDataCallback;
+
+        fileThroughput     = BENCHMARK_fileThroughput(chunk, writeSizes[i], totalSize);
+        redirectThroughput = BENCHMARK_redirectThroughput(STDREDIRECT_createWithOptions(STDREDIRECT_STREAM_STDOUT, &options), chunk, writeSizes[i], totalSize);
+
+        BENCHMARK_beginRow("throughput");
+        BENCHMARK_number("write size", (double) writeSizes[i], 0);
+        BENCHMARK_number("file MB/s", fileThroughput, 1);
+        BENCHMARK_number("redirect MB/s", redirectThroughput, 1);
+        BENCHMARK_endRow();
+    }
+}
+
+
+/** @brief String callback with the former 81 byte buffer vs. data callback with the default buffer. */
+static void BENCHMARK_callback(size_t totalSize) {
+    static char         chunk[65536];
+    STDREDIRECT_OPTIONS options = STDREDIRECT_defaultOptions();
+    double              throughput;
+    double              megabytes = (double) totalSize / (1024.0 * 1024.0);
+
+    memset(chunk, 'x', sizeof(chunk));
+
+    /* before: 80 usable bytes per read, null-terminated string callback */
+    options.bufferSize = 80;
+    {
+        STDREDIRECT_REDIRECTION* redirection = STDREDIRECT_createWithOptions(STDREDIRECT_STREAM_STDOUT, &options);
+        if (redirection) {
+            redirection->callback = &BENCHMARK_countingCallback;
+        }
+        throughput = BENCHMARK_redirectThroughput(redirection, chunk, sizeof(chunk), totalSize);
+    }
+    BENCHMARK_beginRow("callback");
+    BENCHMARK_label("callback", "string, 81 byte buffer");
+    BENCHMARK_number("MB/s", throughput, 1);
+    BENCHMARK_number("callbacks/MB", (double) BENCHMARK_callbacks / megabytes, 1);
+    BENCHMARK_endRow();
+
+    /* after: length-delimited data callback, default buffer */
+    options = STDREDIRECT_defaultOptions();
+    options.dataCallback = &BENCHMARK_countingDataCallback;
+    throughput = BENCHMARK_redirectThroughput(STDREDIRECT_createWithOptions(STDREDIRECT_STREAM_STDOUT, &options), chunk, sizeof(chunk), totalSize);
+    BENCHMARK_beginRow("callback");
+    BENCHMARK_label("callback", "data, default buffer");
+    BENCHMARK_number("MB/s", throughput, 1);
+    BENCHMARK_number("callbacks/MB", (double) BENCHMARK_callbacks / megabytes, 1);
+    BENCHMARK_endRow();
+}
+
+
+/** @brief Scan buffer with lines of lineLength bytes, returns GB/s. */
+static double BENCHMARK_scanThroughput(const char* (*find)(const char*, size_t, char), const char* buffer, size_t bufferSize, size_t totalSize, size_t* numLines) {
+    const char* position;
+    const char* end = buffer + bufferSize;
+    size_t      scanned;
+    double      start;
+
+    *numLines = 0;
+    start = BENCHMARK_now();
+    for (scanned = 0; scanned < totalSize; scanned += bufferSize) {
+        for (position = buffer; (position = find(position, (size_t) (end - position), '\n')) != NULL; ++position) {
+            ++*numLines;
+        }
+    }
+
+    return (double) totalSize / (1024.0 * 1024.0 * 1024.0) / (BENCHMARK_now() - start);
+}
+
+
+/** @brief memchr() with the signature of STDREDIRECT_findByte(). */
+static const char* BENCHMARK_memchr(const char* data, size_t length, char byte) {
+    return (const char*) memchr(data, byte, length);
+}
+
+
+/** @brief Newline scan throughput for several line lengths. */
+static void BENCHMARK_scan(size_t totalSize) {
+    static const size_t lineLengths[] = { 16, 80, 256, 4096, 1024 * 1024 };
+    const size_t        bufferSize    = 1024 * 1024;
+    char*               buffer;
+    size_t              numLines;
+    size_t              i;
+    size_t              j;
+
+    buffer = (char*) malloc(bufferSize);
+    if (buffer == NULL) {
+        return;
+    }
+
+    for (i = 0; i < sizeof(lineLengths) / sizeof(lineLengths[0]); ++i) {
+        double vectorized;
+        double reference;
+
+        for (j = 0; j < bufferSize; ++j) {
+            buffer[j] = (j + 1) % lineLengths[i] == 0 ? '\n' : 'x';
+        }
+
+        vectorized = BENCHMARK_scanThroughput(&STDREDIRECT_findByte, buffer, bufferSize, totalSize, &numLines);
+        reference  = BENCHMARK_scanThroughput(&BENCHMARK_memchr, buffer, bufferSize, totalSize, &numLines);
+
+        BENCHMARK_beginRow("scan");
+        BENCHMARK_number("line length", (double) lineLengths[i], 0);
+        BENCHMARK_number("findByte GB/s", vectorized, 2);
+        BENCHMARK_number("memchr GB/s", reference, 2);
+        BENCHMARK_endRow();
+    }
+
+    free(buffer);
+}
+
+
+/** @brief Sweep over batch size and delay thresholds. */
+static void BENCHMARK_batch(size_t totalSize) {
+    static const size_t    batchSizes[]  = { 4096, 64 * 1024, 1024 * 1024 };
+    static const long long batchDelays[] = { 100, 1000, 10000 };
+    const size_t           numMessages   = 2000;
+    static char            chunk[100];
+    size_t                 i;
+    size_t                 j;
+    size_t                 k;
+
+    BENCHMARK_latencies = (long long*) malloc(numMessages * sizeof(long long));
+    if (BENCHMARK_latencies == NULL) {
+        return;
+    }
+    BENCHMARK_maxLatencies = numMessages;
+    memset(chunk, 'x', sizeof(chunk) - 1);
+    chunk[sizeof(chunk) - 1] = '\n';
+
+    for (i = 0; i < sizeof(batchSizes) / sizeof(batchSizes[0]); ++i) {
+        for (j = 0; j < sizeof(batchDelays) / sizeof(batchDelays[0]); ++j) {
+            STDREDIRECT_OPTIONS      options = STDREDIRECT_defaultOptions();
+            STDREDIRECT_REDIRECTION* redirection;
+            double                   throughput;
+            double                   batchesPerMegabyte;
+
+            options.batchSize    = batchSizes[i];
+            options.batchDelayUs = batchDelays[j];
+
+            /* throughput: burst of 100 byte lines */
+            options.batchCallback = &BENCHMARK_countingBatchCallback;
+            throughput = BENCHMARK_redirectThroughput(STDREDIRECT_createWithOptions(STDREDIRECT_STREAM_STDOUT, &options), chunk, sizeof(chunk), totalSize);
+            batchesPerMegabyte = (double) BENCHMARK_callbacks / ((double) totalSize / (1024.0 * 1024.0));
+
+            /* latency: one timestamped line every 100 us */
+            options.batchCallback = &BENCHMARK_latencyBatchCallback;
+            options.framing = STDREDIRECT_FRAMING_LINE;
+            BENCHMARK_numLatencies = 0;
+            redirection = STDREDIRECT_createWithOptions(STDREDIRECT_STREAM_STDOUT, &options);
+            if (redirection && STDREDIRECT_redirect(redirection) == STDREDIRECT_ERROR_NO_ERROR) {
+                for (k = 0; k < numMessages; ++k) {
+                    int length = snprintf(chunk, sizeof(chunk), "%lld\n", STDREDIRECT_now());
+                    STDREDIRECT_writeAll(STDOUT_FILENO, chunk, (size_t) length);
+                    BENCHMARK_sleep(100);
+                }
+            }
+            STDREDIRECT_destroy(redirection);
+            memset(chunk, 'x', sizeof(chunk) - 1);
+
+            BENCHMARK_beginRow("batch");
+            BENCHMARK_number("batch size", (double) batchSizes[i], 0);
+            BENCHMARK_number("delay us", (double) batchDelays[j], 0);
+            BENCHMARK_number("MB/s", throughput, 1);
+            BENCHMARK_number("batches/MB", batchesPerMegabyte, 1);
+            BENCHMARK_number("p50 us", (double) BENCHMARK_percentile(50.0), 0);
+            BENCHMARK_number("p99 us", (double) BENCHMARK_percentile(99.0), 0);
+            BENCHMARK_number("max us", (double) BENCHMARK_percentile(100.0), 0);
+            BENCHMARK_endRow();
+        }
+    }
+
+    free(BENCHMARK_latencies);
+}
+
+
+/** @brief Record callback counting bytes and records of both streams. */
+static void BENCHMARK_countingRecordCallback(const STDREDIRECT_RECORD* record, void* userdata) {
+    (void) userdata;
+
+    BENCHMARK_bytesReceived += record->length;
+    ++BENCHMARK_callbacks;
+}
+
+
+/** @brief Alternate writes to stdout and stderr, shared reader vs. dedicated reader threads. */
+static void BENCHMARK_streams(size_t totalSize) {
+    static const STDREDIRECT_READER_MODE readerModes[] = { STDREDIRECT_READER_MODE_SHARED, STDREDIRECT_READER_MODE_DEDICATED };
+    static const char* const             names[]       = { "shared", "dedicated" };
+    static const size_t                  writeSizes[]  = { 128, 4096 };
+    static char                          chunk[4096];
+    size_t                               i;
+    size_t                               j;
+    size_t                               written;
+
+    memset(chunk, 'x', sizeof(chunk));
+
+    for (i = 0; i < sizeof(readerModes) / sizeof(readerModes[0]); ++i) {
+        for (j = 0; j < sizeof(writeSizes) / sizeof(writeSizes[0]); ++j) {
+            STDREDIRECT_OPTIONS      options = STDREDIRECT_defaultOptions();
+            STDREDIRECT_REDIRECTION* stdoutRedirection;
+            STDREDIRECT_REDIRECTION* stderrRedirection;
+            double                   start;
+            double                   seconds;
+
+            options.recordCallback = &BENCHMARK_countingRecordCallback;
+            options.readerMode     = readerModes[i];
+
+            BENCHMARK_bytesReceived = 0;
+            BENCHMARK_callbacks = 0;
+            start = BENCHMARK_now();
+            stdoutRedirection = STDREDIRECT_createWithOptions(STDREDIRECT_STREAM_STDOUT, &options);
+            stderrRedirection = STDREDIRECT_createWithOptions(STDREDIRECT_STREAM_STDERR, &options);
+            if (stdoutRedirection && stderrRedirection
+                && STDREDIRECT_redirect(stdoutRedirection) == STDREDIRECT_ERROR_NO_ERROR
+                && STDREDIRECT_redirect(stderrRedirection) == STDREDIRECT_ERROR_NO_ERROR) {
+                for (written = 0; written < totalSize; written += 2 * writeSizes[j]) {
+                    STDREDIRECT_writeAll(STDOUT_FILENO, chunk, writeSizes[j]);
+                    STDREDIRECT_writeAll(STDERR_FILENO, chunk, writeSizes[j]);
+                }
+            }
+            STDREDIRECT_destroy(stderrRedirection);
+            STDREDIRECT_destroy(stdoutRedirection);
+            seconds = BENCHMARK_now() - start;
+
+            BENCHMARK_beginRow("streams");
+            BENCHMARK_label("reader", names[i]);
+            BENCHMARK_number("write size", (double) writeSizes[j], 0);
+            BENCHMARK_number("MB/s", (double) BENCHMARK_bytesReceived / (1024.0 * 1024.0) / seconds, 1);
+            BENCHMARK_number("records/MB", (double) BENCHMARK_callbacks / ((double) BENCHMARK_bytesReceived / (1024.0 * 1024.0)), 1);
+            BENCHMARK_endRow();
+        }
+    }
+}
+
+
+/** @brief CPU time per GB of duplicating stdout into a temporary file, O_APPEND makes splice() fall back to write(). */
+static void BENCHMARK_duplicate(size_t totalSize) {
+    static const STDREDIRECT_BEHAVIOUR behaviours[] = { STDREDIRECT_BEHAVIOUR_REDIRECT, STDREDIRECT_BEHAVIOUR_DUPLICATE, STDREDIRECT_BEHAVIOUR_DUPLICATE };
+    static const int                   flags[]      = { 0, O_APPEND, 0 };
+    static const char* const           names[]      = { "redirect only", "duplicate, write()", "duplicate, splice()" };
+    static char                        chunk[65536];
+    double                             gigabytes    = (double) totalSize / (1024.0 * 1024.0 * 1024.0);
+    size_t                             i;
+
+    memset(chunk, 'x', sizeof(chunk));
+
+    for (i = 0; i < sizeof(behaviours) / sizeof(behaviours[0]); ++i) {
+        STDREDIRECT_OPTIONS options = STDREDIRECT_defaultOptions();
+        char                path[]  = "/tmp/stdredirect_benchmark_XXXXXX";
+        int                 fileDescriptor;
+        int                 stdoutFileDescriptor;
+        double              start;
+        double              throughput;
+
+        fileDescriptor = mkstemp(path);
+        if (fileDescriptor == -1) {
+            return;
+        }
+        unlink(path);
+        fcntl(fileDescriptor, F_SETFL, fcntl(fileDescriptor, F_GETFL) | flags[i]);
+
+        /* duplicated output goes to the file instead of the terminal */
+        stdoutFileDescriptor = dup(STDOUT_FILENO);
+        dup2(fileDescriptor, STDOUT_FILENO);
+
+        options.behaviour    = behaviours[i];
+        options.dataCallback = &BENCHMARK_countingDataCallback;
+        start = BENCHMARK_cpuTime();
+        throughput = BENCHMARK_redirectThroughput(STDREDIRECT_createWithOptions(STDREDIRECT_STREAM_STDOUT, &options), chunk, sizeof(chunk), totalSize);
+
+        dup2(stdoutFileDescriptor, STDOUT_FILENO);
+        close(stdoutFileDescriptor);
+        if (behaviours[i] == STDREDIRECT_BEHAVIOUR_DUPLICATE && lseek(fileDescriptor, 0, SEEK_END) != (off_t) totalSize) {
+            fprintf(stderr, "lost duplicated output\n");
+        }
+        close(fileDescriptor);
+
+        BENCHMARK_beginRow("duplicate");
+        BENCHMARK_label("mode", names[i]);
+        BENCHMARK_number("MB/s", throughput, 1);
+        BENCHMARK_number("CPU s/GB", (BENCHMARK_cpuTime() - start) / gigabytes, 3);
+        BENCHMARK_endRow();
+    }
+}
+
+
+/** @brief String callback appending to BENCHMARK_file, the usual way to log to a file. */
+static void BENCHMARK_fwriteCallback(const char* str) {
+    size_t length = strlen(str);
+
+    fwrite(str, 1, length, BENCHMARK_file);
+    BENCHMARK_bytesReceived += length;
+}
+
+
+/** @brief Pass chunk on to the file sink and count it. */
+static void BENCHMARK_fileSinkCallback(const char* data, size_t length, void* userdata) {
+    STDREDIRECT_fileSinkCallback(data, length, userdata);
+    BENCHMARK_bytesReceived += length;
+}
+
+
+/** @brief Memory-mapped file sink vs. fwrite() from the string callback. */
+static void BENCHMARK_filesink(size_t totalSize) {
+    static const size_t writeSizes[] = { 100, 65536 };
+    static char         chunk[65536];
+    double              gigabytes    = (double) totalSize / (1024.0 * 1024.0 * 1024.0);
+    size_t              i;
+
+    memset(chunk, 'x', sizeof(chunk));
+
+    for (i = 0; i < sizeof(writeSizes) / sizeof(writeSizes[0]); ++i) {
+        char                         path[] = "/tmp/stdredirect_benchmark_XXXXXX";
+        STDREDIRECT_FILESINK_OPTIONS sinkOptions;
+        STDREDIRECT_FILESINK*        sink;
+        STDREDIRECT_OPTIONS          options = STDREDIRECT_defaultOptions();
+        STDREDIRECT_REDIRECTION*     redirection;
+        double                       start;
+        double                       throughput;
+        int                          fileDescriptor;
+
+        fileDescriptor = mkstemp(path);
+        if (fileDescriptor == -1) {
+            return;
+        }
+
+        /* before: fwrite() per chunk */
+        BENCHMARK_file = fdopen(fileDescriptor, "wb");
+        redirection = STDREDIRECT_create(STDREDIRECT_STREAM_STDOUT, &BENCHMARK_fwriteCallback, STDREDIRECT_BEHAVIOUR_REDIRECT);
+        start = BENCHMARK_cpuTime();
+        throughput = BENCHMARK_redirectThroughput(redirection, chunk, writeSizes[i], totalSize);
+        fclose(BENCHMARK_file);
+        BENCHMARK_beginRow("filesink");
+        BENCHMARK_label("sink", "fwrite");
+        BENCHMARK_number("write size", (double) writeSizes[i], 0);
+        BENCHMARK_number("MB/s", throughput, 1);
+        BENCHMARK_number("CPU s/GB", (BENCHMARK_cpuTime() - start) / gigabytes, 3);
+        BENCHMARK_endRow();
+
+        /* after: memory-mapped sink, files of 256 MB */
+        unlink(path);
+        sinkOptions = STDREDIRECT_defaultFileSinkOptions(path);
+        sinkOptions.fileSize = 256 * 1024 * 1024;
+        sinkOptions.maxFiles = 1;
+        start = BENCHMARK_cpuTime();
+        sink = STDREDIRECT_createFileSink(&sinkOptions);
+        if (sink == NULL) {
+            return;
+        }
+        options.dataCallback = &BENCHMARK_fileSinkCallback;
+        options.userdata     = sink;
+        throughput = BENCHMARK_redirectThroughput(STDREDIRECT_createWithOptions(STDREDIRECT_STREAM_STDOUT, &options), chunk, writeSizes[i], totalSize);
+        STDREDIRECT_destroyFileSink(sink);
+        BENCHMARK_beginRow("filesink");
+        BENCHMARK_label("sink", "mmap");
+        BENCHMARK_number("write size", (double) writeSizes[i], 0);
+        BENCHMARK_number("MB/s", throughput, 1);
+        BENCHMARK_number("CPU s/GB", (BENCHMARK_cpuTime() - start) / gigabytes, 3);
+        BENCHMARK_endRow();
+
+        unlink(path);
+        strcat(path, ".1");
+        unlink(path);
+    }
+}
+
+
+/** @brief Data callback taking BENCHMARK_callbackDelay microseconds per call. */
+static void BENCHMARK_slowDataCallback(const char* data, size_t length, void* userdata) {
+    (void) data;
+    (void) userdata;
+
+    if (BENCHMARK_callbackDelay > 0) {
+        BENCHMARK_sleep(BENCHMARK_callbackDelay);
+    }
+    BENCHMARK_bytesReceived += length;
+    ++BENCHMARK_callbacks;
+}
+
+
+/** @brief Latency from write() to callback entry of paced lines, p999 needs at least a few thousand of them. */
+static void BENCHMARK_latency() {
+    static const size_t      writeSizes[] = { 16, 128, 1024, 4096 };
+    static const char* const names[]      = { "sync", "async" };
+    const size_t             numMessages  = 10000;
+    static char              chunk[4096];
+    size_t                   i;
+    size_t                   j;
+    size_t                   k;
+
+    BENCHMARK_latencies = (long long*) malloc(numMessages * sizeof(long long));
+    if (BENCHMARK_latencies == NULL) {
+        return;
+    }
+    BENCHMARK_maxLatencies = numMessages;
+
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        for (j = 0; j < sizeof(writeSizes) / sizeof(writeSizes[0]); ++j) {
+            STDREDIRECT_OPTIONS      options = STDREDIRECT_defaultOptions();
+            STDREDIRECT_REDIRECTION* redirection;
+
+            options.dataCallback = &BENCHMARK_latencyDataCallback;
+            options.framing      = STDREDIRECT_FRAMING_LINE;
+            options.ringCapacity = i == 1 ? STDREDIRECT_RING_CAPACITY : 0;
+
+            BENCHMARK_numLatencies = 0;
+            memset(chunk, 'x', writeSizes[j] - 1);
+            chunk[writeSizes[j] - 1] = '\n';
+            redirection = STDREDIRECT_createWithOptions(STDREDIRECT_STREAM_STDOUT, &options);
+            if (redirection && STDREDIRECT_redirect(redirection) == STDREDIRECT_ERROR_NO_ERROR) {
+                for (k = 0; k < numMessages; ++k) {
+                    /* timestamp overwrites the start of the line, its terminator is replaced by padding again */
+                    int length = snprintf(chunk, writeSizes[j], "%lld", STDREDIRECT_now());
+                    chunk[length] = 'x';
+                    STDREDIRECT_writeAll(STDOUT_FILENO, chunk, writeSizes[j]);
+                    BENCHMARK_sleep(50);
+                }
+            }
+            STDREDIRECT_destroy(redirection);
+
+            if (BENCHMARK_numLatencies != numMessages) {
+                fprintf(stderr, "lost output: %zu of %zu lines received\n", BENCHMARK_numLatencies, numMessages);
+            }
+
+            BENCHMARK_beginRow("latency");
+            BENCHMARK_label("mode", names[i]);
+            BENCHMARK_number("write size", (double) writeSizes[j], 0);
+            BENCHMARK_number("p50 us", (double) BENCHMARK_percentile(50.0), 0);
+            BENCHMARK_number("p99 us", (double) BENCHMARK_percentile(99.0), 0);
+            BENCHMARK_number("p999 us", (double) BENCHMARK_percentile(99.9), 0);
+            BENCHMARK_number("max us", (double) BENCHMARK_percentile(100.0), 0);
+            BENCHMARK_endRow();
+        }
+    }
+
+    free(BENCHMARK_latencies);
+}
+
+
+/**
+ * @brief Cost of STDREDIRECT_redirect() plus STDREDIRECT_unredirect() of one redirection writing a line in between, in
+ *        nanoseconds, with and without persistence. The line must have been delivered when unredirect returns.
+ */
+static void BENCHMARK_cycle() {
+    static const STDREDIRECT_READER_MODE readerModes[] = { STDREDIRECT_READER_MODE_SHARED, STDREDIRECT_READER_MODE_DEDICATED };
+    static const char* const             names[]       = { "shared, sync", "shared, async", "dedicated, sync", "dedicated, async" };
+    static const char                    line[]        = "cycle\n";
+    const size_t                         numCycles     = 1000;
+    size_t                               i;
+    size_t                               j;
+    size_t                               k;
+    size_t                               p;
+
+    BENCHMARK_latencies = (long long*) malloc(numCycles * sizeof(long long));
+    if (BENCHMARK_latencies == NULL) {
+        return;
+    }
+
+    for (p = 0; p < 2; ++p) {
+        for (i = 0; i < sizeof(readerModes) / sizeof(readerModes[0]); ++i) {
+            for (j = 0; j < 2; ++j) {
+                STDREDIRECT_OPTIONS      options   = STDREDIRECT_defaultOptions();
+                STDREDIRECT_REDIRECTION* redirection;
+                double                   total     = 0.0;
+                size_t                   numLate   = 0;
+
+                options.dataCallback = &BENCHMARK_countingDataCallback;
+                options.readerMode   = readerModes[i];
+                options.ringCapacity = j == 1 ? STDREDIRECT_RING_CAPACITY : 0;
+                options.isPersistent = (int) p;
+
+                BENCHMARK_numLatencies = 0;
+                BENCHMARK_bytesReceived = 0;
+                redirection = STDREDIRECT_createWithOptions(STDREDIRECT_STREAM_STDOUT, &options);
+                if (redirection == NULL) {
+                    break;
+                }
+                for (k = 0; k < numCycles; ++k) {
+                    double start = BENCHMARK_now();
+                    double seconds;
+
+                    if (STDREDIRECT_redirect(redirection) != STDREDIRECT_ERROR_NO_ERROR) {
+                        break;
+                    }
+                    fputs(line, stdout);
+                    if (STDREDIRECT_unredirect(redirection) != STDREDIRECT_ERROR_NO_ERROR) {
+                        break;
+                    }
+                    seconds = BENCHMARK_now() - start;
+                    total += seconds;
+                    BENCHMARK_latencies[BENCHMARK_numLatencies++] = (long long) (seconds * 1e9);
+                    if (BENCHMARK_bytesReceived != (k + 1) * (sizeof(line) - 1)) {
+                        ++numLate;
+                        BENCHMARK_bytesReceived = (k + 1) * (sizeof(line) - 1);
+                    }
+                }
+                STDREDIRECT_destroy(redirection);
+
+                if (numLate > 0) {
+                    fprintf(stderr, "late output: %zu of %zu cycles not delivered on unredirect\n", numLate, BENCHMARK_numLatencies);
+                }
+
+                BENCHMARK_beginRow("cycle");
+                BENCHMARK_label("mode", names[2 * i + j]);
+                BENCHMARK_label("persistent", p ? "yes" : "no");
+                BENCHMARK_number("cycles", (double) BENCHMARK_numLatencies, 0);
+                BENCHMARK_number("cycles/s", total > 0.0 ? (double) BENCHMARK_numLatencies / total : 0.0, 0);
+                BENCHMARK_number("mean us", BENCHMARK_numLatencies ? total * 1e6 / (double) BENCHMARK_numLatencies : 0.0, 1);
+                BENCHMARK_number("p50 us", (double) BENCHMARK_percentile(50.0) / 1000.0, 1);
+                BENCHMARK_number("p99 us", (double) BENCHMARK_percentile(99.0) / 1000.0, 1);
+                BENCHMARK_number("max us", (double) BENCHMARK_percentile(100.0) / 1000.0, 1);
+                BENCHMARK_endRow();
+            }
+        }
+    }
+
+    free(BENCHMARK_latencies);
+}
+
+
+/** @brief Time spent in write() by a writer while the callback takes a fixed time per call. */
+static void BENCHMARK_stall(size_t totalSize) {
+    static const long long   callbackDelays[] = { 0, 100, 1000 };
+    static const char* const names[]          = { "sync", "async" };
+    const size_t             writeSize        = 4096;
+    static char              chunk[4096];
+    size_t                   i;
+    size_t                   j;
+    size_t                   written;
+
+    BENCHMARK_latencies = (long long*) malloc((totalSize / writeSize + 1) * sizeof(long long));
+    if (BENCHMARK_latencies == NULL) {
+        return;
+    }
+    memset(chunk, 'x', sizeof(chunk));
+
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        for (j = 0; j < sizeof(callbackDelays) / sizeof(callbackDelays[0]); ++j) {
+            STDREDIRECT_OPTIONS      options = STDREDIRECT_defaultOptions();
+            STDREDIRECT_REDIRECTION* redirection;
+            double                   stalled = 0.0;
+            double                   start;
+            double                   seconds;
+
+            options.dataCallback = &BENCHMARK_slowDataCallback;
+            options.ringCapacity = i == 1 ? STDREDIRECT_RING_CAPACITY : 0;
+            BENCHMARK_callbackDelay = callbackDelays[j];
+
+            BENCHMARK_numLatencies = 0;
+            BENCHMARK_bytesReceived = 0;
+            redirection = STDREDIRECT_createWithOptions(STDREDIRECT_STREAM_STDOUT, &options);
+            if (redirection == NULL || STDREDIRECT_redirect(redirection) != STDREDIRECT_ERROR_NO_ERROR) {
+                STDREDIRECT_destroy(redirection);
+                break;
+            }
+            start = BENCHMARK_now();
+            for (written = 0; written < totalSize; written += writeSize) {
+                double writeStart = BENCHMARK_now();
+                double writeSeconds;
+
+                STDREDIRECT_writeAll(STDOUT_FILENO, chunk, writeSize);
+                writeSeconds = BENCHMARK_now() - writeStart;
+                stalled += writeSeconds;
+                BENCHMARK_latencies[BENCHMARK_numLatencies++] = (long long) (writeSeconds * 1e9);
+            }
+            seconds = BENCHMARK_now() - start;
+            STDREDIRECT_destroy(redirection);
+
+            if (BENCHMARK_bytesReceived != written) {
+                fprintf(stderr, "lost output: %zu of %zu bytes received\n", BENCHMARK_bytesReceived, written);
+            }
+
+            BENCHMARK_beginRow("stall");
+            BENCHMARK_label("mode", names[i]);
+            BENCHMARK_number("callback us", (double) callbackDelays[j], 0);
+            BENCHMARK_number("writer MB/s", (double) written / (1024.0 * 1024.0) / seconds, 1);
+            BENCHMARK_number("stalled ms", stalled * 1e3, 1);
+            BENCHMARK_number("p99 write us", (double) BENCHMARK_percentile(99.0) / 1000.0, 1);
+            BENCHMARK_number("max write us", (double) BENCHMARK_percentile(100.0) / 1000.0, 1);
+            BENCHMARK_endRow();
+        }
+    }
+
+    free(BENCHMARK_latencies);
+}
+
+
+/** @brief Bursts of 512 KB with pauses in between, the callback takes 200 us per call, fixed vs. adaptive sizes. */
+static void BENCHMARK_burst(size_t totalSize) {
+    static const int         isAdaptive[] = { FALSE, TRUE };
+    static const char* const names[]      = { "fixed", "adaptive" };
+    const size_t             burstSize    = 512 * 1024;
+    const size_t             writeSize    = 4096;
+    static char              chunk[4096];
+    size_t                   numBursts    = totalSize / burstSize;
+    size_t                   i;
+    size_t                   j;
+    size_t                   written;
+
+    BENCHMARK_latencies = (long long*) malloc((numBursts + 1) * sizeof(long long));
+    if (BENCHMARK_latencies == NULL) {
+        return;
+    }
+    memset(chunk, 'x', sizeof(chunk));
+    BENCHMARK_callbackDelay = 200;
+
+    for (i = 0; i < sizeof(isAdaptive) / sizeof(isAdaptive[0]); ++i) {
+        STDREDIRECT_OPTIONS      options = STDREDIRECT_defaultOptions();
+        STDREDIRECT_REDIRECTION* redirection;
+        STDREDIRECT_STATS        stats;
+        double                   stalled = 0.0;
+
+        options.dataCallback = &BENCHMARK_slowDataCallback;
+        options.isAdaptive   = isAdaptive[i];
+
+        BENCHMARK_numLatencies = 0;
+        BENCHMARK_bytesReceived = 0;
+        redirection = STDREDIRECT_createWithOptions(STDREDIRECT_STREAM_STDOUT, &options);
+        if (redirection == NULL || STDREDIRECT_redirect(redirection) != STDREDIRECT_ERROR_NO_ERROR) {
+            STDREDIRECT_destroy(redirection);
+            break;
+        }
+        for (j = 0; j < numBursts; ++j) {
+            double start = BENCHMARK_now();
+            double seconds;
+
+            for (written = 0; written < burstSize; written += writeSize) {
+                STDREDIRECT_writeAll(STDOUT_FILENO, chunk, writeSize);
+            }
+            seconds = BENCHMARK_now() - start;
+            stalled += seconds;
+            BENCHMARK_latencies[BENCHMARK_numLatencies++] = (long long) (seconds * 1e6);
+
+            /* let the reader catch up */
+            BENCHMARK_sleep(20000);
+        }
+        STDREDIRECT_getStats(redirection, &stats);
+        STDREDIRECT_destroy(redirection);
+
+        if (BENCHMARK_bytesReceived != numBursts * burstSize) {
+            fprintf(stderr, "lost output: %zu of %zu bytes received\n", BENCHMARK_bytesReceived, numBursts * burstSize);
+        }
+
+        BENCHMARK_beginRow("burst");
+        BENCHMARK_label("sizes", names[i]);
+        BENCHMARK_number("bursts", (double) numBursts, 0);
+        BENCHMARK_number("stalled ms", stalled * 1e3, 1);
+        BENCHMARK_number("p50 burst us", (double) BENCHMARK_percentile(50.0), 0);
+        BENCHMARK_number("max burst us", (double) BENCHMARK_percentile(100.0), 0);
+        BENCHMARK_number("pipe KB", (double) stats.pipeSize / 1024.0, 0);
+        BENCHMARK_number("buffer KB", (double) stats.bufferSize / 1024.0, 0);
+        BENCHMARK_endRow();
+    }
+
+    free(BENCHMARK_latencies);
+}
+
+
+/** @brief Bytes routed to the alert, trace and default sink. */
+static size_t BENCHMARK_routed[3];
+
+
+/** @brief Data callback adding the number of bytes to the counter passed as userdata. */
+static void BENCHMARK_sinkCallback(const char* data, size_t length, void* userdata) {
+    (void) data;
+
+    *(size_t*) userdata += length;
+}
+
+
+/** @brief The hand-written way: split chunk into lines and search every line for every pattern. */
+static void BENCHMARK_searchCallback(const char* data, size_t length, void* userdata) {
+    const char* newline;
+    size_t      lineLength;
+    int         isRouted;
+
+    (void) userdata;
+
+    while (length > 0) {
+        newline = (const char*) memchr(data, '\n', length);
+        lineLength = newline ? (size_t) (newline - data) + 1 : length;
+
+        isRouted = FALSE;
+        if (memmem(data, lineLength, "ERROR", 5) || memmem(data, lineLength, "WARN", 4)) {
+            BENCHMARK_sinkCallback(data, lineLength, &BENCHMARK_routed[0]);
+            isRouted = TRUE;
+        }
+        if (lineLength >= 6 && memcmp(data, "TRACE:", 6) == 0) {
+            BENCHMARK_sinkCallback(data, lineLength, &BENCHMARK_routed[1]);
+            isRouted = TRUE;
+        }
+        if (!isRouted) {
+            BENCHMARK_sinkCallback(data, lineLength, &BENCHMARK_routed[2]);
+        }
+
+        data += lineLength;
+        length -= lineLength;
+    }
+}
+
+
+/** @brief Fill buffer with whole log lines, 1% errors, 2% warnings and 5% traces, returns their length. */
+static size_t BENCHMARK_fillLog(char* buffer, size_t size) {
+    char   line[256];
+    size_t length = 0;
+    size_t i;
+    int    lineLength;
+
+    for (i = 0; ; ++i) {
+        if (i % 100 == 7) {
+            lineLength = snprintf(line, sizeof(line), "2026-10-17 12:%02zu:%02zu.%06zu [ERROR] worker %zu: request id=%zu failed, status=%zu\n", i / 60 % 60, i % 60, i * 7919 % 1000000, i % 16, i, i % 600);
+        }
+        else if (i % 50 == 3) {
+            lineLength = snprintf(line, sizeof(line), "2026-10-17 12:%02zu:%02zu.%06zu [WARN] worker %zu: queue depth %zu above limit\n", i / 60 % 60, i % 60, i * 7919 % 1000000, i % 16, i % 1000);
+        }
+        else if (i % 20 == 11) {
+            lineLength = snprintf(line, sizeof(line), "TRACE: enter handler id=%zu depth=%zu\n", i, i % 8);
+        }
+        else {
+            lineLength = snprintf(line, sizeof(line), "2026-10-17 12:%02zu:%02zu.%06zu [INFO] worker %zu: processed request id=%zu in %zu us\n", i / 60 % 60, i % 60, i * 7919 % 1000000, i % 16, i, i * 31 % 997);
+        }
+        if (length + (size_t) lineLength > size) {
+            return length;
+        }
+        memcpy(buffer + length, line, (size_t) lineLength);
+        length += (size_t) lineLength;
+    }
+}
+
+
+/** @brief Pass chunk to callback until totalSize bytes are passed, returns GB/s. */
+static double BENCHMARK_routeThroughput(STDREDIRECT_DATA_CALLBACK callback, void* userdata, const char* chunk, size_t chunkSize, size_t totalSize) {
+    size_t passed;
+    double start;
+
+    memset(BENCHMARK_routed, 0, sizeof(BENCHMARK_routed));
+    start = BENCHMARK_now();
+    for (passed = 0; passed < totalSize; passed += chunkSize) {
+        callback(chunk, chunkSize, userdata);
+    }
+
+    return (double) passed / (1024.0 * 1024.0 * 1024.0) / (BENCHMARK_now() - start);
+}
+
+
+/** @brief Write totalSize bytes of chunk to redirected stdout passing it to callback, returns GB/s. */
+static double BENCHMARK_routePipeThroughput(STDREDIRECT_DATA_CALLBACK callback, void* userdata, const char* chunk, size_t chunkSize, size_t totalSize) {
+    STDREDIRECT_OPTIONS      options = STDREDIRECT_defaultOptions();
+    STDREDIRECT_REDIRECTION* redirection;
+    double                   start;
+
+    options.dataCallback = callback;
+    options.userdata     = userdata;
+    redirection = STDREDIRECT_createWithOptions(STDREDIRECT_STREAM_STDOUT, &options);
+    if (redirection == NULL) {
+        return 0.0;
+    }
+
+    memset(BENCHMARK_routed, 0, sizeof(BENCHMARK_routed));
+    start = BENCHMARK_now();
+    if (STDREDIRECT_redirect(redirection) != STDREDIRECT_ERROR_NO_ERROR) {
+        STDREDIRECT_destroy(redirection);
+        return 0.0;
+    }
+    BENCHMARK_writeChunks(STDOUT_FILENO, chunk, chunkSize, totalSize);
+    STDREDIRECT_destroy(redirection);
+
+    return (double) totalSize / (1024.0 * 1024.0 * 1024.0) / (BENCHMARK_now() - start);
+}
+
+
+/** @brief Routing log lines by content, compiled router vs. searching every line. */
+static void BENCHMARK_route(size_t totalSize) {
+    static char         chunk[64 * 1024];
+    size_t              chunkSize;
+    size_t              expected[3] = { 0, 0, 0 };
+    STDREDIRECT_SINK    sinks[3];
+    STDREDIRECT_ROUTE   routes[3];
+    STDREDIRECT_ROUTER* router;
+    double              throughput;
+    int                 i;
+    int                 j;
+
+    /* whole lines only, so the last write splits no line */
+    chunkSize = BENCHMARK_fillLog(chunk, sizeof(chunk));
+    totalSize -= totalSize % chunkSize;
+
+    for (i = 0; i < 3; ++i) {
+        sinks[i].callback = &BENCHMARK_sinkCallback;
+        sinks[i].userdata = &BENCHMARK_routed[i];
+    }
+    routes[0].pattern = "ERROR";
+    routes[0].match   = STDREDIRECT_MATCH_SUBSTRING;
+    routes[0].sink    = 0;
+    routes[1].pattern = "WARN";
+    routes[1].match   = STDREDIRECT_MATCH_SUBSTRING;
+    routes[1].sink    = 0;
+    routes[2].pattern = "TRACE:";
+    routes[2].match   = STDREDIRECT_MATCH_PREFIX;
+    routes[2].sink    = 1;
+
+    for (i = 0; i < 4; ++i) {
+        int isPipe   = i >= 2;
+        int isRouter = i % 2 == 1;
+
+        router = STDREDIRECT_createRouter(sinks, 3, routes, 3, 2);
+        if (router == NULL) {
+            return;
+        }
+        if (isPipe) {
+            throughput = isRouter ? BENCHMARK_routePipeThroughput(&STDREDIRECT_routerCallback, router, chunk, chunkSize, totalSize)
+                                  : BENCHMARK_routePipeThroughput(&BENCHMARK_searchCallback, NULL, chunk, chunkSize, totalSize);
+        }
+        else {
+            throughput = isRouter ? BENCHMARK_routeThroughput(&STDREDIRECT_routerCallback, router, chunk, chunkSize, totalSize)
+                                  : BENCHMARK_routeThroughput(&BENCHMARK_searchCallback, NULL, chunk, chunkSize, totalSize);
+        }
+        STDREDIRECT_destroyRouter(router);
+
+        /* both ways must route the same bytes */
+        for (j = 0; j < 3; ++j) {
+            if (i == 0) {
+                expected[j] = BENCHMARK_routed[j];
+            }
+            else if (BENCHMARK_routed[j] != expected[j]) {
+                fprintf(stderr, "routing differs: sink %d got %zu of %zu bytes\n", j, BENCHMARK_routed[j], expected[j]);
+            }
+        }
+
+        BENCHMARK_beginRow("route");
+        BENCHMARK_label("path", isPipe ? "pipe" : "memory");
+        BENCHMARK_label("matcher", isRouter ? "router" : "memmem per line");
+        BENCHMARK_number("GB/s", throughput, 2);
+        BENCHMARK_number("alert MB", (double) BENCHMARK_routed[0] / (1024.0 * 1024.0), 1);
+        BENCHMARK_number("trace MB", (double) BENCHMARK_routed[1] / (1024.0 * 1024.0), 1);
+        BENCHMARK_number("default MB", (double) BENCHMARK_routed[2] / (1024.0 * 1024.0), 1);
+        BENCHMARK_endRow();
+    }
+}
+
+
+/** @brief Per-line latency through the pipe vs. STDREDIRECT_inject(). */
+static void BENCHMARK_inject() {
+    static const char* const modes[]     = { "sync", "async" };
+    static const char* const paths[]     = { "pipe", "inject" };
+    const size_t             numMessages = 10000;
+    const size_t             lineLength  = 64;
+    char                     line[64];
+    double                   writeTime;
+    double                   start;
+    size_t                   i;
+    size_t                   j;
+    size_t                   k;
+
+    BENCHMARK_latencies = (long long*) malloc(numMessages * sizeof(long long));
+    if (BENCHMARK_latencies == NULL) {
+        return;
+    }
+    BENCHMARK_maxLatencies = numMessages;
+
+    for (i = 0; i < sizeof(modes) / sizeof(modes[0]); ++i) {
+        for (j = 0; j < sizeof(paths) / sizeof(paths[0]); ++j) {
+            STDREDIRECT_OPTIONS      options = STDREDIRECT_defaultOptions();
+            STDREDIRECT_REDIRECTION* redirection;
+
+            options.dataCallback = &BENCHMARK_latencyDataCallback;
+            options.framing      = STDREDIRECT_FRAMING_LINE;
+            options.ringCapacity = i == 1 ? STDREDIRECT_RING_CAPACITY : 0;
+
+            BENCHMARK_numLatencies = 0;
+            writeTime = 0.0;
+            memset(line, 'x', lineLength - 1);
+            line[lineLength - 1] = '\n';
+            redirection = STDREDIRECT_createWithOptions(STDREDIRECT_STREAM_STDOUT, &options);
+            if (redirection && STDREDIRECT_redirect(redirection) == STDREDIRECT_ERROR_NO_ERROR) {
+                for (k = 0; k < numMessages; ++k) {
+                    /* timestamp overwrites the start of the line, its terminator is replaced by padding again */
+                    int length = snprintf(line, lineLength, "%lld", STDREDIRECT_now());
+                    line[length] = 'x';
+
+                    /* std::cout synchronized with stdio ends up in fwrite(), std::endl flushes */
+                    start = BENCHMARK_now();
+                    if (j == 0) {
+                        fwrite(line, 1, lineLength, stdout);
+                        fflush(stdout);
+                    }
+                    else {
+                        STDREDIRECT_inject(redirection, line, lineLength);
+                    }
+                    writeTime += BENCHMARK_now() - start;
+                    BENCHMARK_sleep(50);
+                }
+            }
+            STDREDIRECT_destroy(redirection);
+
+            if (BENCHMARK_numLatencies != numMessages) {
+                fprintf(stderr, "lost output: %zu of %zu lines received\n", BENCHMARK_numLatencies, numMessages);
+            }
+
+            BENCHMARK_beginRow("inject");
+            BENCHMARK_label("mode", modes[i]);
+            BENCHMARK_label("path", paths[j]);
+            BENCHMARK_number("write ns", writeTime / (double) numMessages * 1e9, 0);
+            BENCHMARK_number("p50 us", (double) BENCHMARK_percentile(50.0), 0);
+            BENCHMARK_number("p99 us", (double) BENCHMARK_percentile(99.0), 0);
+            BENCHMARK_number("max us", (double) BENCHMARK_percentile(100.0), 0);
+            BENCHMARK_endRow();
+        }
+    }
+
+    free(BENCHMARK_latencies);
+}
+
+
+/** @brief Sink of the fanout scenario. */
+typedef struct BENCHMARK_FANOUT_SINK {
+    size_t                bytesReceived;        /**< bytes passed to the sink                 */
+    long long             delay;                /**< microseconds the sink takes per call     */
+} BENCHMARK_FANOUT_SINK;
+
+
+/** @brief Data callback of a fanout scenario sink. */
+static void BENCHMARK_fanoutSinkCallback(const char* data, size_t length, void* userdata) {
+    BENCHMARK_FANOUT_SINK* sink = (BENCHMARK_FANOUT_SINK*) userdata;
+
+    (void) data;
+
+    if (sink->delay > 0) {
+        BENCHMARK_sleep(sink->delay);
+    }
+    sink->bytesReceived += length;
+}
+
+
+/** @brief Data callback passing each line to all three sinks in turn, the fan-out without stdredirect_fanout.h. */
+static void BENCHMARK_allSinksCallback(const char* data, size_t length, void* userdata) {
+    BENCHMARK_FANOUT_SINK* sinks = (BENCHMARK_FANOUT_SINK*) userdata;
+
+    BENCHMARK_fanoutSinkCallback(data, length, &sinks[0]);
+    BENCHMARK_fanoutSinkCallback(data, length, &sinks[1]);
+    BENCHMARK_fanoutSinkCallback(data, length, &sinks[2]);
+}
+
+
+/** @brief Lines to a file, a forwarder and a debugger taking 20 us per line, one callback vs. fanout subscribers. */
+static void BENCHMARK_fanout(size_t totalSize) {
+    static const char* const variants[] = { "one callback", "fanout, wait", "fanout, lap" };
+    const size_t             lineLength = 256;
+    static char              chunk[4096];
+    size_t                   i;
+    size_t                   j;
+
+    for (i = 0; i < sizeof(chunk); ++i) {
+        chunk[i] = i % lineLength == lineLength - 1 ? '\n' : 'x';
+    }
+
+    for (i = 0; i < sizeof(variants) / sizeof(variants[0]); ++i) {
+        STDREDIRECT_OPTIONS      options   = STDREDIRECT_defaultOptions();
+        BENCHMARK_FANOUT_SINK    sinks[3]  = { { 0, 0 }, { 0, 0 }, { 0, 20 } };
+        STDREDIRECT_FANOUT*      fanout    = NULL;
+        STDREDIRECT_SUBSCRIBER*  debugger  = NULL;
+        STDREDIRECT_REDIRECTION* redirection;
+        long long                lostRecords = 0;
+        long long                lostBytes   = 0;
+        size_t                   written;
+        double                   start;
+        double                   writerSeconds;
+        double                   seconds;
+
+        options.framing = STDREDIRECT_FRAMING_LINE;
+        if (i == 0) {
+            options.dataCallback = &BENCHMARK_allSinksCallback;
+            options.userdata     = sinks;
+        }
+        else {
+            fanout = STDREDIRECT_createFanout(0);
+            if (!fanout) {
+                return;
+            }
+            STDREDIRECT_subscribe(fanout, &BENCHMARK_fanoutSinkCallback, &sinks[0], STDREDIRECT_SLOW_POLICY_WAIT);
+            STDREDIRECT_subscribe(fanout, &BENCHMARK_fanoutSinkCallback, &sinks[1], STDREDIRECT_SLOW_POLICY_WAIT);
+            debugger = STDREDIRECT_subscribe(fanout, &BENCHMARK_fanoutSinkCallback, &sinks[2], i == 1 ? STDREDIRECT_SLOW_POLICY_WAIT : STDREDIRECT_SLOW_POLICY_LAP);
+            options.dataCallback = &STDREDIRECT_fanoutCallback;
+            options.userdata     = fanout;
+        }
+
+        redirection = STDREDIRECT_createWithOptions(STDREDIRECT_STREAM_STDOUT, &options);
+        if (redirection == NULL || STDREDIRECT_redirect(redirection) != STDREDIRECT_ERROR_NO_ERROR) {
+            STDREDIRECT_destroy(redirection);
+            STDREDIRECT_destroyFanout(fanout);
+            return;
+        }
+        start = BENCHMARK_now();
+        for (written = 0; written < totalSize; written += sizeof(chunk)) {
+            STDREDIRECT_writeAll(STDOUT_FILENO, chunk, sizeof(chunk));
+        }
+        writerSeconds = BENCHMARK_now() - start;
+        STDREDIRECT_destroy(redirection);
+        STDREDIRECT_getLoss(debugger, &lostRecords, &lostBytes);
+        STDREDIRECT_destroyFanout(fanout);
+        seconds = BENCHMARK_now() - start;
+
+        for (j = 0; j < 3; ++j) {
+            if (sinks[j].bytesReceived + (j == 2 ? (size_t) lostBytes : 0) != written) {
+                fprintf(stderr, "lost output: %zu of %zu bytes received by sink %zu\n", sinks[j].bytesReceived, written, j);
+            }
+        }
+
+        BENCHMARK_beginRow("fanout");
+        BENCHMARK_label("variant", variants[i]);
+        BENCHMARK_number("writer MB/s", (double) written / (1024.0 * 1024.0) / writerSeconds, 1);
+        BENCHMARK_number("total s", seconds, 2);
+        BENCHMARK_number("debugger lost", (double) lostRecords, 0);
+        BENCHMARK_endRow();
+    }
+}
+
+
+/** @brief Filter cost on distinct lines in memory, then a flood of one repeated line through the pipe and a slow callback. */
+static void BENCHMARK_filter(size_t totalSize) {
+    static const char* const filters[]   = { "none", "collapse", "rate limit", "both" };
+    const size_t             lineLength  = 64;
+    const size_t             numRepeats  = 100000;
+    static char              chunk[64 * 1024];
+    char                     line[64];
+    STDREDIRECT_STATS        stats;
+    double                   start;
+    double                   seconds;
+    size_t                   written;
+    size_t                   i;
+
+    /* numbered lines, no two consecutive ones are equal */
+    for (i = 0; i < sizeof(chunk) / lineLength; ++i) {
+        memset(chunk + i * lineLength, 'x', lineLength - 1);
+        memcpy(chunk + i * lineLength, line, (size_t) snprintf(line, sizeof(line), "%zu", i));
+        chunk[i * lineLength + lineLength - 1] = '\n';
+    }
+
+    for (i = 0; i < sizeof(filters) / sizeof(filters[0]); ++i) {
+        STDREDIRECT_OPTIONS      options = STDREDIRECT_defaultOptions();
+        STDREDIRECT_REDIRECTION* redirection;
+
+        options.dataCallback = &BENCHMARK_slowDataCallback;
+        options.framing      = STDREDIRECT_FRAMING_LINE;
+        options.isCollapsing = i == 1 || i == 3;
+        options.rateLimit    = i >= 2 ? (size_t) 1 << 40 : 0;
+
+        BENCHMARK_callbackDelay = 0;
+        BENCHMARK_bytesReceived = 0;
+        redirection = STDREDIRECT_createWithOptions(STDREDIRECT_STREAM_STDOUT, &options);
+        if (redirection == NULL || STDREDIRECT_redirect(redirection) != STDREDIRECT_ERROR_NO_ERROR) {
+            STDREDIRECT_destroy(redirection);
+            return;
+        }
+        start = BENCHMARK_now();
+        for (written = 0; written < totalSize; written += sizeof(chunk)) {
+            STDREDIRECT_inject(redirection, chunk, sizeof(chunk));
+        }
+        seconds = BENCHMARK_now() - start;
+        STDREDIRECT_destroy(redirection);
+
+        if (BENCHMARK_bytesReceived != written) {
+            fprintf(stderr, "lost output: %zu of %zu bytes received\n", BENCHMARK_bytesReceived, written);
+        }
+
+        BENCHMARK_beginRow("filter");
+        BENCHMARK_label("lines", "distinct");
+        BENCHMARK_label("filter", filters[i]);
+        BENCHMARK_number("MB/s", (double) written / (1024.0 * 1024.0) / seconds, 1);
+        BENCHMARK_number("ns/line", seconds * 1e9 / (double) (written / lineLength), 1);
+        BENCHMARK_endRow();
+    }
+
+    /* a component stuck in a loop, the callback stands in for OutputDebugString() */
+    memset(line, 'x', lineLength - 1);
+    line[lineLength - 1] = '\n';
+    for (i = 0; i < sizeof(filters) / sizeof(filters[0]); ++i) {
+        STDREDIRECT_OPTIONS      options = STDREDIRECT_defaultOptions();
+        STDREDIRECT_REDIRECTION* redirection;
+
+        options.dataCallback = &BENCHMARK_slowDataCallback;
+        options.framing      = STDREDIRECT_FRAMING_LINE;
+        options.isCollapsing = i == 1 || i == 3;
+        options.rateLimit    = i >= 2 ? 64 * 1024 : 0;
+
+        BENCHMARK_callbackDelay = 10;
+        BENCHMARK_callbacks     = 0;
+        redirection = STDREDIRECT_createWithOptions(STDREDIRECT_STREAM_STDOUT, &options);
+        if (redirection == NULL || STDREDIRECT_redirect(redirection) != STDREDIRECT_ERROR_NO_ERROR) {
+            STDREDIRECT_destroy(redirection);
+            return;
+        }
+        start = BENCHMARK_now();
+        for (written = 0; written < numRepeats; ++written) {
+            STDREDIRECT_writeAll(STDOUT_FILENO, line, lineLength);
+        }
+        STDREDIRECT_unredirect(redirection);
+        seconds = BENCHMARK_now() - start;
+        STDREDIRECT_getStats(redirection, &stats);
+        STDREDIRECT_destroy(redirection);
+
+        BENCHMARK_beginRow("filter");
+        BENCHMARK_label("lines", "repeated");
+        BENCHMARK_label("filter", filters[i]);
+        BENCHMARK_number("seconds", seconds, 3);
+        BENCHMARK_number("callbacks", (double) BENCHMARK_callbacks, 0);
+        BENCHMARK_number("collapsed", (double) stats.collapsedLines, 0);
+        BENCHMARK_number("rate limited", (double) stats.rateLimitedLines, 0);
+        BENCHMARK_endRow();
+    }
+}
+
+
+/** @brief Data callback of the spill scenario, the sink is unavailable for BENCHMARK_callbackDelay microseconds once. */
+static void BENCHMARK_outageDataCallback(const char* data, size_t length, void* userdata) {
+    (void) data;
+    (void) userdata;
+
+    if (BENCHMARK_callbackDelay > 0) {
+        BENCHMARK_sleep(BENCHMARK_callbackDelay);
+        BENCHMARK_callbackDelay = 0;
+    }
+    BENCHMARK_bytesReceived += length;
+}
+
+
+/** @brief Writer stall and lost output of the full ring policies while the sink is unavailable for a while. */
+static void BENCHMARK_spill(size_t totalSize) {
+    static const STDREDIRECT_FULL_POLICY policies[] = { STDREDIRECT_FULL_POLICY_BLOCK, STDREDIRECT_FULL_POLICY_DROP_NEWEST, STDREDIRECT_FULL_POLICY_SPILL };
+    static const char* const             names[]    = { "block", "drop newest", "spill" };
+    const size_t                         writeSize  = 4096;
+    static char                          chunk[4096];
+    STDREDIRECT_STATS                    stats;
+    double                               start;
+    double                               writeStart;
+    double                               writeSeconds;
+    double                               maxWriteSeconds;
+    double                               seconds;
+    size_t                               written;
+    size_t                               i;
+
+    for (i = 0; i < sizeof(chunk); ++i) {
+        chunk[i] = (i + 1) % 64 == 0 ? '\n' : 'x';
+    }
+
+    for (i = 0; i < sizeof(policies) / sizeof(policies[0]); ++i) {
+        STDREDIRECT_OPTIONS      options = STDREDIRECT_defaultOptions();
+        STDREDIRECT_REDIRECTION* redirection;
+
+        options.dataCallback = &BENCHMARK_outageDataCallback;
+        options.ringCapacity = 1024 * 1024;
+        options.fullPolicy   = policies[i];
+
+        BENCHMARK_callbackDelay = 250000;
+        BENCHMARK_bytesReceived = 0;
+        maxWriteSeconds = 0.0;
+        redirection = STDREDIRECT_createWithOptions(STDREDIRECT_STREAM_STDOUT, &options);
+        if (redirection == NULL || STDREDIRECT_redirect(redirection) != STDREDIRECT_ERROR_NO_ERROR) {
+            STDREDIRECT_destroy(redirection);
+            return;
+        }
+        start = BENCHMARK_now();
+        for (written = 0; written < totalSize; written += writeSize) {
+            writeStart = BENCHMARK_now();
+            STDREDIRECT_writeAll(STDOUT_FILENO, chunk, writeSize);
+            writeSeconds = BENCHMARK_now() - writeStart;
+            if (writeSeconds > maxWriteSeconds) {
+                maxWriteSeconds = writeSeconds;
+            }
+        }
+        seconds = BENCHMARK_now() - start;
+        STDREDIRECT_unredirect(redirection);
+        STDREDIRECT_getStats(redirection, &stats);
+        STDREDIRECT_destroy(redirection);
+
+        BENCHMARK_beginRow("spill");
+        BENCHMARK_label("policy", names[i]);
+        BENCHMARK_number("writer MB/s", (double) written / (1024.0 * 1024.0) / seconds, 1);
+        BENCHMARK_number("max write ms", maxWriteSeconds * 1e3, 1);
+        BENCHMARK_number("received MB", (double) BENCHMARK_bytesReceived / (1024.0 * 1024.0), 1);
+        BENCHMARK_number("dropped MB", (double) stats.droppedBytes / (1024.0 * 1024.0), 1);
+        BENCHMARK_number("spilled MB", (double) stats.spilledBytes / (1024.0 * 1024.0), 1);
+        BENCHMARK_endRow();
+    }
+}
+
+
+/** @brief Number of writing threads of the threads scenario. */
+#define BENCHMARK_NUM_THREADS 8
+
+
+/** @brief Writing thread of the threads scenario. */
+typedef struct BENCHMARK_WRITER {
+    STDREDIRECT_REDIRECTION* redirection;       /**< redirection written to                                     */
+    int                      isThreadWrite;     /**< STDREDIRECT_threadWrite() instead of write()               */
+    size_t                   index;             /**< fills its lines with 'a' + index                           */
+    size_t                   numLines;          /**< lines to write                                             */
+} BENCHMARK_WRITER;
+
+
+/** @brief STDREDIRECT_threadId() of the writing threads. */
+static long long BENCHMARK_threadIds[BENCHMARK_NUM_THREADS];
+
+
+/** @brief Lines received by the threads scenario, with bytes of several threads and with the wrong thread id. */
+static size_t BENCHMARK_lines;
+static size_t BENCHMARK_tornLines;
+static size_t BENCHMARK_misattributedLines;
+
+
+/** @brief Record callback of the threads scenario echoes every line with write(), as a console forwarder would. */
+static int BENCHMARK_isEchoing;
+
+
+/** @brief Lines of the threads scenario must carry the id of their writing thread, not 0 as pipe reads do. */
+static int BENCHMARK_isTagged;
+
+
+/** @brief Number of scenarios whose output was wrong, main() then fails. */
+static int BENCHMARK_numFailures;
+
+
+/** @brief Writing thread of the threads scenario, every line takes three writes. */
+static STDREDIRECT_THREAD_RESULT BENCHMARK_writer(void* parameter) {
+    static const size_t fragments[] = { 20, 20, 24 };
+    BENCHMARK_WRITER*   writer      = (BENCHMARK_WRITER*) parameter;
+    char                line[64];
+    size_t              offset;
+    size_t              i;
+    size_t              j;
+
+    BENCHMARK_threadIds[writer->index] = STDREDIRECT_threadId();
+    memset(line, 'a' + (int) writer->index, sizeof(line) - 1);
+    line[sizeof(line) - 1] = '\n';
+
+    for (i = 0; i < writer->numLines; ++i) {
+        for (j = 0, offset = 0; j < sizeof(fragments) / sizeof(fragments[0]); offset += fragments[j++]) {
+            if (writer->isThreadWrite) {
+                STDREDIRECT_threadWrite(writer->redirection, line + offset, fragments[j]);
+            }
+            else {
+                STDREDIRECT_writeAll(STDOUT_FILENO, line + offset, fragments[j]);
+            }
+        }
+    }
+    STDREDIRECT_threadFlush(writer->redirection);
+
+    return 0;
+}
+
+
+/** @brief Record callback of the threads scenario, checks every line came whole from one thread. */
+static void BENCHMARK_threadRecordCallback(const STDREDIRECT_RECORD* record, void* userdata) {
+    size_t index = (size_t) (unsigned char) record->data[0] - 'a';
+    size_t i;
+
+    (void) userdata;
+
+    BENCHMARK_bytesReceived += record->length;
+    ++BENCHMARK_lines;
+    if (BENCHMARK_isEchoing) {
+        /* stdout is interposed, the write goes to the original stdout instead of back to the redirection */
+        if (write(STDOUT_FILENO, record->data, record->length) != (ssize_t) record->length) {
+            ++BENCHMARK_tornLines;
+        }
+    }
+    if (record->length != 64 || index >= BENCHMARK_NUM_THREADS) {
+        ++BENCHMARK_tornLines;
+        return;
+    }
+    for (i = 1; i < 63; ++i) {
+        if (record->data[i] != record->data[0]) {
+            ++BENCHMARK_tornLines;
+            return;
+        }
+    }
+    if ((BENCHMARK_isTagged || record->threadId != 0) && record->threadId != BENCHMARK_threadIds[index]) {
+        ++BENCHMARK_misattributedLines;
+    }
+}
+
+
+/** @brief Threads writing fragmented lines at once through the pipe, per-thread buffers and the write() interposer. */
+static void BENCHMARK_threads(size_t totalSize) {
+    static const char* const modes[]    = { "sync", "async" };
+    static const char* const writers[]  = { "write", "threadWrite", "interposed", "interposed, echo" };
+    const size_t             lineLength = 64;
+    BENCHMARK_WRITER         threads[BENCHMARK_NUM_THREADS];
+    STDREDIRECT_THREAD       handles[BENCHMARK_NUM_THREADS];
+    double                   start;
+    double                   seconds;
+    int                      savedStdout = -1;
+    int                      nullFileDescriptor;
+    size_t                   i;
+    size_t                   j;
+    size_t                   k;
+
+    for (i = 0; i < sizeof(modes) / sizeof(modes[0]); ++i) {
+        for (j = 0; j < sizeof(writers) / sizeof(writers[0]); ++j) {
+            STDREDIRECT_OPTIONS      options = STDREDIRECT_defaultOptions();
+            STDREDIRECT_REDIRECTION* redirection;
+
+            options.recordCallback = &BENCHMARK_threadRecordCallback;
+            options.framing        = STDREDIRECT_FRAMING_LINE;
+            options.ringCapacity   = i == 1 ? STDREDIRECT_RING_CAPACITY : 0;
+
+            BENCHMARK_bytesReceived      = 0;
+            BENCHMARK_lines              = 0;
+            BENCHMARK_tornLines          = 0;
+            BENCHMARK_misattributedLines = 0;
+            BENCHMARK_isEchoing          = j == 3;
+            BENCHMARK_isTagged           = j >= 1;
+            if (BENCHMARK_isEchoing) {
+                /* the echo goes to /dev/null rather than between the result rows */
+                savedStdout = dup(STDOUT_FILENO);
+                nullFileDescriptor = open("/dev/null", O_WRONLY);
+                dup2(nullFileDescriptor, STDOUT_FILENO);
+                close(nullFileDescriptor);
+            }
+            redirection = STDREDIRECT_createWithOptions(STDREDIRECT_STREAM_STDOUT, &options);
+            if (redirection == NULL || STDREDIRECT_redirect(redirection) != STDREDIRECT_ERROR_NO_ERROR) {
+                STDREDIRECT_destroy(redirection);
+                return;
+            }
+            if (j >= 2) {
+                STDREDIRECT_interposeWrite(STDREDIRECT_STREAM_STDOUT, redirection);
+            }
+
+            start = BENCHMARK_now();
+            for (k = 0; k < BENCHMARK_NUM_THREADS; ++k) {
+                threads[k].redirection   = redirection;
+                threads[k].isThreadWrite = j == 1;
+                threads[k].index         = k;
+                threads[k].numLines      = totalSize / BENCHMARK_NUM_THREADS / lineLength;
+                STDREDIRECT_startThread(&handles[k], &BENCHMARK_writer, &threads[k]);
+            }
+            for (k = 0; k < BENCHMARK_NUM_THREADS; ++k) {
+                STDREDIRECT_joinThread(handles[k]);
+            }
+            STDREDIRECT_interposeWrite(STDREDIRECT_STREAM_STDOUT, NULL);
+            STDREDIRECT_unredirect(redirection);
+            seconds = BENCHMARK_now() - start;
+            STDREDIRECT_destroy(redirection);
+            if (BENCHMARK_isEchoing) {
+                dup2(savedStdout, STDOUT_FILENO);
+                close(savedStdout);
+                BENCHMARK_isEchoing = FALSE;
+            }
+
+            if (BENCHMARK_bytesReceived != totalSize / BENCHMARK_NUM_THREADS / lineLength * BENCHMARK_NUM_THREADS * lineLength) {
+                fprintf(stderr, "lost output: %zu bytes received\n", BENCHMARK_bytesReceived);
+            }
+
+            BENCHMARK_beginRow("threads");
+            BENCHMARK_label("mode", modes[i]);
+            BENCHMARK_label("writer", writers[j]);
+            BENCHMARK_number("MB/s", (double) BENCHMARK_bytesReceived / (1024.0 * 1024.0) / seconds, 1);
+            BENCHMARK_number("lines", (double) BENCHMARK_lines, 0);
+            BENCHMARK_number("torn", (double) BENCHMARK_tornLines, 0);
+            BENCHMARK_number("wrong thread", (double) BENCHMARK_misattributedLines, 0);
+            BENCHMARK_endRow();
+
+            /* torn lines are expected of plain write(), not of the per-thread buffers */
+            if (BENCHMARK_isTagged && (BENCHMARK_tornLines != 0 || BENCHMARK_misattributedLines != 0)) {
+                fprintf(stderr, "wrong output: %zu lines torn, %zu lines with the wrong thread\n", BENCHMARK_tornLines, BENCHMARK_misattributedLines);
+                ++BENCHMARK_numFailures;
+            }
+        }
+    }
+}
+
+
+
+/** @brief Data callback appending to BENCHMARK_captured under a lock, the usual way to collect output. */
+static void BENCHMARK_capturingDataCallback(const char* data, size_t length, void* userdata) {
+    char* captured;
+
+    (void) userdata;
+
+    STDREDIRECT_lock(&BENCHMARK_captureLock);
+    captured = (char*) realloc(BENCHMARK_captured, BENCHMARK_capturedLength + length);
+    if (captured) {
+        BENCHMARK_captured = captured;
+        memcpy(BENCHMARK_captured + BENCHMARK_capturedLength, data, length);
+        BENCHMARK_capturedLength += length;
+    }
+    STDREDIRECT_unlock(&BENCHMARK_captureLock);
+}
+
+
+/**
+ * @brief Cost of capturing one line of stdout and stderr output, e.g. around a test assertion, and MB/s of one large
+ *        capture: stdout and stderr redirections with a string-building callback vs. stdredirect_capture.h.
+ */
+static void BENCHMARK_capture(size_t totalSize) {
+    static const char* const names[]     = { "callback", "capture", "capture, nested", "capture, tagged" };
+    const size_t             numCaptures = 10000;
+    const size_t             writeSize   = 4096;
+    static char              chunk[4096];
+    char                     expected[64];
+    size_t                   expectedLength;
+    const char*              data;
+    size_t                   length;
+    size_t                   i;
+    size_t                   k;
+
+    BENCHMARK_latencies = (long long*) malloc(numCaptures * sizeof(long long));
+    if (BENCHMARK_latencies == NULL) {
+        return;
+    }
+    memset(chunk, 'x', sizeof(chunk));
+    STDREDIRECT_initMutex(&BENCHMARK_captureLock);
+
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        STDREDIRECT_OPTIONS      options      = STDREDIRECT_defaultOptions();
+        STDREDIRECT_REDIRECTION* redirections[2];
+        STDREDIRECT_CAPTURE*     capture      = NULL;
+        double                   total        = 0.0;
+        double                   start;
+        double                   seconds;
+        size_t                   numWrong     = 0;
+
+        options.dataCallback = &BENCHMARK_capturingDataCallback;
+        redirections[0] = NULL;
+        redirections[1] = NULL;
+        if (i == 0) {
+            redirections[0] = STDREDIRECT_createWithOptions(STDREDIRECT_STREAM_STDOUT, &options);
+            redirections[1] = STDREDIRECT_createWithOptions(STDREDIRECT_STREAM_STDERR, &options);
+            if (redirections[0] == NULL || redirections[1] == NULL) {
+                STDREDIRECT_destroy(redirections[0]);
+                STDREDIRECT_destroy(redirections[1]);
+                break;
+            }
+        }
+        else {
+            capture = STDREDIRECT_createCapture(STDREDIRECT_CAPTURE_STDOUT | STDREDIRECT_CAPTURE_STDERR | (i == 3 ? STDREDIRECT_CAPTURE_TAGGED : 0), 0);
+            if (capture == NULL || (i == 2 && STDREDIRECT_beginCapture(capture) != STDREDIRECT_ERROR_NO_ERROR)) {
+                STDREDIRECT_destroyCapture(capture);
+                break;
+            }
+        }
+
+        BENCHMARK_numLatencies = 0;
+        for (k = 0; k < numCaptures; ++k) {
+            expectedLength = (size_t) sprintf(expected, "assertion %zu failed\n", k);
+
+            start = BENCHMARK_now();
+            if (capture) {
+                STDREDIRECT_beginCapture(capture);
+                fputs(expected, stdout);
+                STDREDIRECT_endCapture(capture, &data, &length);
+            }
+            else {
+                BENCHMARK_capturedLength = 0;
+                STDREDIRECT_redirect(redirections[0]);
+                STDREDIRECT_redirect(redirections[1]);
+                fputs(expected, stdout);
+                STDREDIRECT_unredirect(redirections[0]);
+                STDREDIRECT_unredirect(redirections[1]);
+                data = BENCHMARK_captured;
+                length = BENCHMARK_capturedLength;
+            }
+            seconds = BENCHMARK_now() - start;
+            total += seconds;
+            BENCHMARK_latencies[BENCHMARK_numLatencies++] = (long long) (seconds * 1e9);
+
+            /* a tagged capture holds one run */
+            if (i == 3 && length >= sizeof(STDREDIRECT_CAPTURE_TAG)) {
+                data += sizeof(STDREDIRECT_CAPTURE_TAG);
+                length -= sizeof(STDREDIRECT_CAPTURE_TAG);
+            }
+            if (length != expectedLength || memcmp(data, expected, length) != 0) {
+                ++numWrong;
+            }
+        }
+
+        /* one large capture, not nested, the arena has grown to it by the second round, tags come on top of the output */
+        if (i == 2) {
+            STDREDIRECT_endCapture(capture, NULL, NULL);
+        }
+        for (k = 0; k < 2; ++k) {
+            start = BENCHMARK_now();
+            if (capture) {
+                STDREDIRECT_beginCapture(capture);
+                for (length = 0; length < totalSize; length += writeSize) {
+                    fwrite(chunk, 1, writeSize, stdout);
+                }
+                STDREDIRECT_endCapture(capture, &data, &length);
+            }
+            else {
+                BENCHMARK_capturedLength = 0;
+                STDREDIRECT_redirect(redirections[0]);
+                STDREDIRECT_redirect(redirections[1]);
+                for (length = 0; length < totalSize; length += writeSize) {
+                    fwrite(chunk, 1, writeSize, stdout);
+                }
+                STDREDIRECT_unredirect(redirections[0]);
+                STDREDIRECT_unredirect(redirections[1]);
+                length = BENCHMARK_capturedLength;
+            }
+            seconds = BENCHMARK_now() - start;
+        }
+        if (length < totalSize) {
+            fprintf(stderr, "lost output: %zu of %zu bytes captured\n", length, totalSize);
+        }
+        if (numWrong > 0) {
+            fprintf(stderr, "wrong output: %zu of %zu captures\n", numWrong, numCaptures);
+        }
+
+        BENCHMARK_beginRow("capture");
+        BENCHMARK_label("mode", names[i]);
+        BENCHMARK_number("captures/s", total > 0.0 ? (double) BENCHMARK_numLatencies / total : 0.0, 0);
+        BENCHMARK_number("mean us", BENCHMARK_numLatencies ? total * 1e6 / (double) BENCHMARK_numLatencies : 0.0, 1);
+        BENCHMARK_number("p99 us", (double) BENCHMARK_percentile(99.0) / 1000.0, 1);
+        BENCHMARK_number("MB/s", (double) totalSize / (1024.0 * 1024.0) / seconds, 1);
+        BENCHMARK_endRow();
+
+        STDREDIRECT_destroyCapture(capture);
+        STDREDIRECT_destroy(redirections[0]);
+        STDREDIRECT_destroy(redirections[1]);
+    }
+
+    STDREDIRECT_destroyMutex(&BENCHMARK_captureLock);
+    free(BENCHMARK_captured);
+    BENCHMARK_captured = NULL;
+    free(BENCHMARK_latencies);
+}
+
+/** @brief Output of one child process of the spawn scenario. */
+typedef struct BENCHMARK_CHILD {
+    size_t                   bytesReceived;     /**< bytes passed to the callbacks, both streams                */
+    size_t                   bytesAtExit;       /**< bytesReceived when the exit callback ran                   */
+    int                      exitCode;          /**< exit code passed to the exit callback                      */
+} BENCHMARK_CHILD;
+
+
+/** @brief Data callback of the spawn scenario, both streams of a child share its counter. */
+static void BENCHMARK_childDataCallback(const char* data, size_t length, void* userdata) {
+    BENCHMARK_CHILD* child = (BENCHMARK_CHILD*) userdata;
+
+    (void) data;
+
+    /* the streams of a child may be read by two dedicated reader threads */
+    STDREDIRECT_lock(&BENCHMARK_captureLock);
+    child->bytesReceived += length;
+    STDREDIRECT_unlock(&BENCHMARK_captureLock);
+}
+
+
+/** @brief Exit callback of the spawn scenario, notes how much output arrived before it. */
+static void BENCHMARK_childExitCallback(STDREDIRECT_PROCESS* process, int exitCode, void* userdata) {
+    BENCHMARK_CHILD* child = (BENCHMARK_CHILD*) userdata;
+
+    (void) process;
+
+    STDREDIRECT_lock(&BENCHMARK_captureLock);
+    child->bytesAtExit = child->bytesReceived;
+    child->exitCode = exitCode;
+    STDREDIRECT_unlock(&BENCHMARK_captureLock);
+}
+
+
+/** @brief Number of threads of this process, 0 if unknown. */
+static long BENCHMARK_numThreads() {
+    char  line[256];
+    long  numThreads = 0;
+    FILE* status     = fopen("/proc/self/status", "r");
+
+    if (status == NULL) {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), status)) {
+        if (strncmp(line, "Threads:", 8) == 0) {
+            numThreads = atol(line + 8);
+            break;
+        }
+    }
+    fclose(status);
+
+    return numThreads;
+}
+
+
+/**
+ * @brief Many child processes writing to stdout and stderr at once, captured by STDREDIRECT_spawn() with the shared
+ *        reader vs. a reader thread per stream: children/s, MB/s, threads while they run and children whose output
+ *        was not complete when their exit was reported.
+ */
+static void BENCHMARK_spawn(size_t totalSize) {
+    static const char* const modes[]       = { "shared", "dedicated" };
+    static const size_t      numChildren[] = { 16, 256 };
+    STDREDIRECT_PROCESS**    processes;
+    BENCHMARK_CHILD*         children;
+    char                     command[128];
+    char*                    arguments[4];
+    double                   start;
+    double                   seconds;
+    size_t                   childSize;
+    size_t                   numIncomplete;
+    size_t                   numFailed;
+    long                     numThreads;
+    size_t                   i;
+    size_t                   j;
+    size_t                   k;
+
+    processes = (STDREDIRECT_PROCESS**) malloc(numChildren[1] * sizeof(STDREDIRECT_PROCESS*));
+    children  = (BENCHMARK_CHILD*) malloc(numChildren[1] * sizeof(BENCHMARK_CHILD));
+    if (processes == NULL || children == NULL) {
+        free(processes);
+        free(children);
+        return;
+    }
+    STDREDIRECT_initMutex(&BENCHMARK_captureLock);
+
+    for (i = 0; i < sizeof(modes) / sizeof(modes[0]); ++i) {
+        for (j = 0; j < sizeof(numChildren) / sizeof(numChildren[0]); ++j) {
+            STDREDIRECT_OPTIONS options = STDREDIRECT_defaultOptions();
+
+            options.dataCallback = &BENCHMARK_childDataCallback;
+            options.readerMode   = i == 0 ? STDREDIRECT_READER_MODE_SHARED : STDREDIRECT_READER_MODE_DEDICATED;
+
+            /* every child writes half of its share to stdout and half to stderr */
+            childSize = totalSize / numChildren[j] / 2;
+            snprintf(command, sizeof(command), "head -c %zu /dev/zero; head -c %zu /dev/zero >&2", childSize, childSize);
+            arguments[0] = (char*) "/bin/sh";
+            arguments[1] = (char*) "-c";
+            arguments[2] = command;
+            arguments[3] = NULL;
+
+            start = BENCHMARK_now();
+            for (k = 0; k < numChildren[j]; ++k) {
+                children[k].bytesReceived = 0;
+                children[k].bytesAtExit   = 0;
+                children[k].exitCode      = STDREDIRECT_EXIT_CODE_UNKNOWN;
+                options.userdata = &children[k];
+                processes[k] = STDREDIRECT_spawn(arguments, NULL, &options, &options, &BENCHMARK_childExitCallback, &children[k]);
+            }
+            numThreads = BENCHMARK_numThreads();
+            for (k = 0; k < numChildren[j]; ++k) {
+                STDREDIRECT_waitProcess(processes[k], NULL);
+            }
+            seconds = BENCHMARK_now() - start;
+
+            numIncomplete = 0;
+            numFailed     = 0;
+            for (k = 0; k < numChildren[j]; ++k) {
+                if (processes[k] == NULL || children[k].exitCode != 0) {
+                    ++numFailed;
+                }
+                else if (children[k].bytesAtExit != 2 * childSize) {
+                    ++numIncomplete;
+                }
+                STDREDIRECT_destroyProcess(processes[k]);
+            }
+            if (numFailed > 0) {
+                fprintf(stderr, "failed: %zu of %zu children\n", numFailed, numChildren[j]);
+            }
+
+            BENCHMARK_beginRow("spawn");
+            BENCHMARK_label("reader", modes[i]);
+            BENCHMARK_number("children", (double) numChildren[j], 0);
+            BENCHMARK_number("children/s", (double) numChildren[j] / seconds, 0);
+            BENCHMARK_number("MB/s", (double) (2 * childSize * numChildren[j]) / (1024.0 * 1024.0) / seconds, 1);
+            BENCHMARK_number("threads", (double) numThreads, 0);
+            BENCHMARK_number("incomplete", (double) numIncomplete, 0);
+            BENCHMARK_endRow();
+        }
+    }
+
+    STDREDIRECT_destroyMutex(&BENCHMARK_captureLock);
+    free(children);
+    free(processes);
+}
+
+/** @brief Escape sequence state of the byte-by-byte stripping callback. */
+static int BENCHMARK_escapeState;
+
+/** @brief Output of the byte-by-byte stripping callback. */
+static char* BENCHMARK_stripped;
+
+
+/** @brief Byte-by-byte CSI/OSC stripping, the way a callback would do it, copies into @p out. */
+static size_t BENCHMARK_stripBytewise(int* state, const char* data, size_t length, char* out) {
+    size_t        numBytes = 0;
+    size_t        i;
+    unsigned char byte;
+
+    for (i = 0; i < length; ++i) {
+        byte = (unsigned char) data[i];
+        switch (*state) {
+        case 0:
+            if (byte == 0x1b) {
+                *state = 1;
+            }
+            else {
+                out[numBytes++] = (char) byte;
+            }
+            break;
+        case 1:
+            *state = byte == '[' ? 2 : byte == ']' ? 3 : 0;
+            break;
+        case 2:
+            if (byte >= 0x40 && byte <= 0x7e) {
+                *state = 0;
+            }
+            break;
+        case 3:
+            if (byte == 0x07) {
+                *state = 0;
+            }
+            else if (byte == 0x1b) {
+                *state = 4;
+            }
+            break;
+        default:
+            *state = 0;
+            break;
+        }
+    }
+
+    return numBytes;
+}
+
+
+/** @brief Data callback stripping escape sequences byte by byte before counting. */
+static void BENCHMARK_strippingDataCallback(const char* data, size_t length, void* userdata) {
+    (void) userdata;
+
+    BENCHMARK_bytesReceived += BENCHMARK_stripBytewise(&BENCHMARK_escapeState, data, length, BENCHMARK_stripped);
+    ++BENCHMARK_callbacks;
+}
+
+
+/** @brief Fill buffer with whole log lines, colored with SGR sequences and an OSC title now and then, returns length. */
+static size_t BENCHMARK_fillColoredLog(char* buffer, size_t size, int isColored) {
+    static const char* const levels[]  = { "INFO", "DEBUG", "WARN", "ERROR" };
+    static const char* const colors[]  = { "\x1b[32m", "\x1b[2;37m", "\x1b[1;33m", "\x1b[1;31m" };
+    char                     line[256];
+    size_t                   length    = 0;
+    size_t                   i;
+    int                      lineLength;
+
+    for (i = 0; ; ++i) {
+        if (isColored) {
+            lineLength = snprintf(line, sizeof(line), "%s2026-10-17 12:%02zu:%02zu.%03zu \x1b[0m%s%-5s\x1b[0m request %zu handled in \x1b[1m%zu\x1b[22m ms%s\n",
+                                  "\x1b[90m", i / 60 % 60, i % 60, i % 1000, colors[i % 4], levels[i % 4], i, i % 97, i % 64 == 0 ? "\x1b]0;progress\x07" : "");
+        }
+        else {
+            lineLength = snprintf(line, sizeof(line), "2026-10-17 12:%02zu:%02zu.%03zu %-5s request %zu handled in %zu ms\n",
+                                  i / 60 % 60, i % 60, i % 1000, levels[i % 4], i, i % 97);
+        }
+        if (length + (size_t) lineLength > size) {
+            return length;
+        }
+        memcpy(buffer + length, line, (size_t) lineLength);
+        length += (size_t) lineLength;
+    }
+}
+
+
+/**
+ * @brief Removing ANSI escape sequences from plain and colored log lines: GB/s in memory of STDREDIRECT_stripEscapes()
+ *        vs. a byte-by-byte state machine, and MB/s through the pipe with a stripping callback vs. isStrippingEscapes.
+ */
+static void BENCHMARK_escapes(size_t totalSize) {
+    static const char* const inputs[]   = { "plain", "colored" };
+    static const char* const modes[]    = { "none", "callback", "built-in" };
+    const size_t             bufferSize = 1024 * 1024;
+    char*                    buffer;
+    char*                    work;
+    size_t                   length;
+    size_t                   written;
+    size_t                   i;
+    size_t                   j;
+
+    buffer             = (char*) malloc(bufferSize);
+    work               = (char*) malloc(bufferSize);
+    BENCHMARK_stripped = (char*) malloc(STDREDIRECT_MAX_BUFFER_SIZE);
+    if (buffer == NULL || work == NULL || BENCHMARK_stripped == NULL) {
+        free(buffer);
+        free(work);
+        free(BENCHMARK_stripped);
+        return;
+    }
+
+    for (i = 0; i < sizeof(inputs) / sizeof(inputs[0]); ++i) {
+        length = BENCHMARK_fillColoredLog(buffer, bufferSize, i == 1);
+
+        for (j = 0; j < sizeof(modes) / sizeof(modes[0]); ++j) {
+            STDREDIRECT_OPTIONS      options = STDREDIRECT_defaultOptions();
+            STDREDIRECT_REDIRECTION* redirection;
+            STDREDIRECT_ESCAPE_STATE state   = STDREDIRECT_ESCAPE_STATE_TEXT;
+            size_t                   numBytes = 0;
+            double                   memoryThroughput;
+            double                   start;
+            double                   seconds;
+
+            /* in memory, every pass copies the input once: memcpy() alone, copying while stripping, copy then strip */
+            BENCHMARK_escapeState = 0;
+            start = BENCHMARK_now();
+            for (written = 0; written < totalSize; written += length) {
+                if (j == 1) {
+                    numBytes = BENCHMARK_stripBytewise(&BENCHMARK_escapeState, buffer, length, work);
+                }
+                else {
+                    memcpy(work, buffer, length);
+                    numBytes = j == 2 ? STDREDIRECT_stripEscapes(&state, work, length) : length;
+                }
+            }
+            memoryThroughput = (double) written / (1024.0 * 1024.0 * 1024.0) / (BENCHMARK_now() - start);
+
+            /* through the pipe */
+            options.dataCallback       = j == 1 ? &BENCHMARK_strippingDataCallback : &BENCHMARK_countingDataCallback;
+            options.isStrippingEscapes = j == 2;
+            BENCHMARK_bytesReceived = 0;
+            BENCHMARK_callbacks     = 0;
+            BENCHMARK_escapeState   = 0;
+            redirection = STDREDIRECT_createWithOptions(STDREDIRECT_STREAM_STDOUT, &options);
+            if (redirection == NULL || STDREDIRECT_redirect(redirection) != STDREDIRECT_ERROR_NO_ERROR) {
+                STDREDIRECT_destroy(redirection);
+                break;
+            }
+            start = BENCHMARK_now();
+            for (written = 0; written < totalSize; written += length) {
+                STDREDIRECT_writeAll(STDOUT_FILENO, buffer, length);
+            }
+            STDREDIRECT_unredirect(redirection);
+            seconds = BENCHMARK_now() - start;
+            STDREDIRECT_destroy(redirection);
+
+            if (BENCHMARK_bytesReceived != written / length * numBytes) {
+                fprintf(stderr, "wrong output: %zu of %zu bytes received\n", BENCHMARK_bytesReceived, written / length * numBytes);
+            }
+
+            BENCHMARK_beginRow("escapes");
+            BENCHMARK_label("input", inputs[i]);
+            BENCHMARK_label("stripping", modes[j]);
+            BENCHMARK_number("memory GB/s", memoryThroughput, 2);
+            BENCHMARK_number("pipe MB/s", (double) written / (1024.0 * 1024.0) / seconds, 1);
+            BENCHMARK_number("kept %", 100.0 * (double) numBytes / (double) length, 1);
+            BENCHMARK_endRow();
+        }
+    }
+
+    free(buffer);
+    free(work);
+    free(BENCHMARK_stripped);
+    BENCHMARK_stripped = NULL;
+}
+
+/** @brief Code units transcoded by the UTF-16 callbacks. */
+static size_t BENCHMARK_utf16Units;
+
+/** @brief Output of the byte-by-byte transcoding callback. */
+static unsigned short* BENCHMARK_utf16;
+
+
+/** @brief Validate UTF-8 one sequence at a time, no vectorized skipping of ASCII. */
+static size_t BENCHMARK_validUtf8Bytewise(const char* data, size_t length) {
+    size_t i = 0;
+    int    sequenceLength;
+
+    while (i < length) {
+        sequenceLength = STDREDIRECT_utf8SequenceLength((const unsigned char*) data + i, length - i);
+        if (sequenceLength <= 0) {
+            break;
+        }
+        i += (size_t) sequenceLength;
+    }
+
+    return i;
+}
+
+
+/** @brief Transcode valid UTF-8 to UTF-16 one byte at a time, the way a sink converting on its own would. */
+static size_t BENCHMARK_utf8ToUtf16Bytewise(const char* data, size_t length, unsigned short* utf16) {
+    const unsigned char* bytes    = (const unsigned char*) data;
+    size_t               numUnits = 0;
+    size_t               i        = 0;
+    unsigned int         codePoint;
+
+    while (i < length) {
+        if (bytes[i] < 0x80) {
+            codePoint = bytes[i++];
+        }
+        else if (bytes[i] < 0xe0) {
+            codePoint = (unsigned int) (bytes[i] & 0x1f) << 6 | (bytes[i + 1] & 0x3f);
+            i += 2;
+        }
+        else if (bytes[i] < 0xf0) {
+            codePoint = (unsigned int) (bytes[i] & 0x0f) << 12 | (unsigned int) (bytes[i + 1] & 0x3f) << 6 | (bytes[i + 2] & 0x3f);
+            i += 3;
+        }
+        else {
+            codePoint = (unsigned int) (bytes[i] & 0x07) << 18 | (unsigned int) (bytes[i + 1] & 0x3f) << 12 | (unsigned int) (bytes[i + 2] & 0x3f) << 6 | (bytes[i + 3] & 0x3f);
+            i += 4;
+        }
+        if (codePoint >= 0x10000) {
+            utf16[numUnits++] = (unsigned short) (0xd800 | (codePoint - 0x10000) >> 10);
+            utf16[numUnits++] = (unsigned short) (0xdc00 | (codePoint & 0x3ff));
+        }
+        else {
+            utf16[numUnits++] = (unsigned short) codePoint;
+        }
+    }
+
+    return numUnits;
+}
+
+
+/** @brief Data callback validating and transcoding chunks on its own, code points cut off between reads are not handled. */
+static void BENCHMARK_transcodingDataCallback(const char* data, size_t length, void* userdata) {
+    (void) userdata;
+
+    BENCHMARK_utf16Units += BENCHMARK_utf8ToUtf16Bytewise(data, BENCHMARK_validUtf8Bytewise(data, length), BENCHMARK_utf16);
+    BENCHMARK_bytesReceived += length;
+}
+
+
+/** @brief UTF-16 callback counting code units. */
+static void BENCHMARK_countingUtf16Callback(const unsigned short* data, size_t length, void* userdata) {
+    (void) data;
+    (void) userdata;
+
+    BENCHMARK_utf16Units += length;
+}
+
+
+/** @brief Fill buffer with whole lines of ASCII log output, mixed European/CJK/emoji text or CJK text only, returns length. */
+static size_t BENCHMARK_fillText(char* buffer, size_t size, int kind) {
+    static const char* const mixed[] = { "request handled in 12 ms\n", "Größe der Datei: 12 µs, naïve café ✓\n", "東京 reply ok 😀\n", "plain ASCII line of log output\n" };
+    static const char* const cjk[]   = { "日本語のテキストを出力します。\n", "中文输出内容，测试数据。\n", "한국어 출력 테스트입니다.\n" };
+    const char*              line;
+    size_t                   length  = 0;
+    size_t                   lineLength;
+    size_t                   i;
+
+    for (i = 0; ; ++i) {
+        line = kind == 0 ? "2026-10-17 12:00:00.000 INFO request handled in 12 ms\n" : kind == 1 ? mixed[i % 4] : cjk[i % 3];
+        lineLength = strlen(line);
+        if (length + lineLength > size) {
+            return length;
+        }
+        memcpy(buffer + length, line, lineLength);
+        length += lineLength;
+    }
+}
+
+
+/**
+ * @brief UTF-8 stage on ASCII, mixed and CJK text: GB/s in memory of STDREDIRECT_validUtf8Length() and
+ *        STDREDIRECT_utf8ToUtf16() vs. byte-by-byte loops, and MB/s through the pipe of the UTF-16 callback vs. a data
+ *        callback transcoding on its own.
+ */
+static void BENCHMARK_utf8(size_t totalSize) {
+    static const char* const inputs[]   = { "ascii", "mixed", "cjk" };
+    const size_t             bufferSize = 1024 * 1024;
+    char*                    buffer;
+    unsigned short*          utf16;
+    size_t                   length;
+    size_t                   written;
+    size_t                   i;
+    size_t                   j;
+
+    buffer          = (char*) malloc(bufferSize);
+    utf16           = (unsigned short*) malloc(bufferSize * sizeof(unsigned short));
+    BENCHMARK_utf16 = (unsigned short*) malloc(STDREDIRECT_MAX_BUFFER_SIZE * sizeof(unsigned short));
+    if (buffer == NULL || utf16 == NULL || BENCHMARK_utf16 == NULL) {
+        free(buffer);
+        free(utf16);
+        free(BENCHMARK_utf16);
+        return;
+    }
+
+    for (i = 0; i < sizeof(inputs) / sizeof(inputs[0]); ++i) {
+        length = BENCHMARK_fillText(buffer, bufferSize, (int) i);
+
+        for (j = 0; j < 2; ++j) {
+            STDREDIRECT_OPTIONS      options  = STDREDIRECT_defaultOptions();
+            STDREDIRECT_REDIRECTION* redirection;
+            size_t                   numValid = 0;
+            size_t                   numUnits = 0;
+            double                   validateThroughput;
+            double                   transcodeThroughput;
+            double                   start;
+            double                   seconds;
+
+            /* in memory */
+            start = BENCHMARK_now();
+            for (written = 0; written < totalSize; written += length) {
+                numValid += j == 0 ? BENCHMARK_validUtf8Bytewise(buffer, length) : STDREDIRECT_validUtf8Length(buffer, length);
+            }
+            validateThroughput = (double) written / (1024.0 * 1024.0 * 1024.0) / (BENCHMARK_now() - start);
+            if (numValid != written) {
+                fprintf(stderr, "invalid UTF-8: %zu of %zu bytes valid\n", numValid, written);
+            }
+
+            start = BENCHMARK_now();
+            for (written = 0; written < totalSize; written += length) {
+                numUnits = j == 0 ? BENCHMARK_utf8ToUtf16Bytewise(buffer, length, utf16) : STDREDIRECT_utf8ToUtf16(buffer, length, utf16);
+            }
+            transcodeThroughput = (double) written / (1024.0 * 1024.0 * 1024.0) / (BENCHMARK_now() - start);
+
+            /* through the pipe */
+            if (j == 0) {
+                options.dataCallback = &BENCHMARK_transcodingDataCallback;
+            }
+            else {
+                options.utf16Callback = &BENCHMARK_countingUtf16Callback;
+            }
+            BENCHMARK_bytesReceived = 0;
+            BENCHMARK_utf16Units    = 0;
+            redirection = STDREDIRECT_createWithOptions(STDREDIRECT_STREAM_STDOUT, &options);
+            if (redirection == NULL || STDREDIRECT_redirect(redirection) != STDREDIRECT_ERROR_NO_ERROR) {
+                STDREDIRECT_destroy(redirection);
+                break;
+            }
+            start = BENCHMARK_now();
+            for (written = 0; written < totalSize; written += length) {
+                STDREDIRECT_writeAll(STDOUT_FILENO, buffer, length);
+            }
+            STDREDIRECT_unredirect(redirection);
+            seconds = BENCHMARK_now() - start;
+            STDREDIRECT_destroy(redirection);
+
+            BENCHMARK_beginRow("utf8");
+            BENCHMARK_label("input", inputs[i]);
+            BENCHMARK_label("implementation", j == 0 ? "byte-by-byte" : "vectorized");
+            BENCHMARK_number("validate GB/s", validateThroughput, 2);
+            BENCHMARK_number("to UTF-16 GB/s", transcodeThroughput, 2);
+            BENCHMARK_number("pipe MB/s", (double) written / (1024.0 * 1024.0) / seconds, 1);
+            BENCHMARK_number("units lost %", 100.0 - 100.0 * (double) BENCHMARK_utf16Units / (double) (written / length * numUnits), 2);
+            BENCHMARK_endRow();
+        }
+    }
+
+    free(buffer);
+    free(utf16);
+    free(BENCHMARK_utf16);
+    BENCHMARK_utf16 = NULL;
+}
+
+int main(int argc, char* argv[]) {
+    const char* scenario;
+    size_t      megabytes;
+
+    if (argc > 1 && strcmp(argv[1], "--json") == 0) {
+        BENCHMARK_isJson = 1;
+        --argc;
+        ++argv;
+    }
+    scenario  = argc > 1 ? argv[1] : NULL;
+    megabytes = argc > 2 ? (size_t) atol(argv[2]) : 0;
+
+    if (!scenario || strcmp(scenario, "throughput") == 0) {
+        BENCHMARK_throughput((megabytes ? megabytes : 256) * 1024 * 1024);
+    }
+    if (!scenario || strcmp(scenario, "callback") == 0) {
+        BENCHMARK_callback((megabytes ? megabytes : 1024) * 1024 * 1024);
+    }
+    if (!scenario || strcmp(scenario, "scan") == 0) {
+        BENCHMARK_scan((megabytes ? megabytes : 1024) * 1024 * 1024);
+    }
+    if (!scenario || strcmp(scenario, "batch") == 0) {
+        BENCHMARK_batch((megabytes ? megabytes : 128) * 1024 * 1024);
+    }
+    if (!scenario || strcmp(scenario, "streams") == 0) {
+        BENCHMARK_streams((megabytes ? megabytes : 256) * 1024 * 1024);
+    }
+    if (!scenario || strcmp(scenario, "duplicate") == 0) {
+        BENCHMARK_duplicate((megabytes ? megabytes : 1024) * 1024 * 1024);
+    }
+    if (!scenario || strcmp(scenario, "filesink") == 0) {
+        BENCHMARK_filesink((megabytes ? megabytes : 1024) * 1024 * 1024);
+    }
+    if (!scenario || strcmp(scenario, "latency") == 0) {
+        BENCHMARK_latency();
+    }
+    if (!scenario || strcmp(scenario, "cycle") == 0) {
+        BENCHMARK_cycle();
+    }
+    if (!scenario || strcmp(scenario, "stall") == 0) {
+        BENCHMARK_stall((megabytes ? megabytes : 4) * 1024 * 1024);
+    }
+    if (!scenario || strcmp(scenario, "burst") == 0) {
+        BENCHMARK_burst((megabytes ? megabytes : 32) * 1024 * 1024);
+    }
+    if (!scenario || strcmp(scenario, "route") == 0) {
+        BENCHMARK_route((megabytes ? megabytes : 1024) * 1024 * 1024);
+    }
+    if (!scenario || strcmp(scenario, "inject") == 0) {
+        BENCHMARK_inject();
+    }
+    if (!scenario || strcmp(scenario, "fanout") == 0) {
+        BENCHMARK_fanout((megabytes ? megabytes : 16) * 1024 * 1024);
+    }
+    if (!scenario || strcmp(scenario, "filter") == 0) {
+        BENCHMARK_filter((megabytes ? megabytes : 1024) * 1024 * 1024);
+    }
+    if (!scenario || strcmp(scenario, "spill") == 0) {
+        BENCHMARK_spill((megabytes ? megabytes : 64) * 1024 * 1024);
+    }
+    if (!scenario || strcmp(scenario, "threads") == 0) {
+        BENCHMARK_threads((megabytes ? megabytes : 64) * 1024 * 1024);
+    }
+    if (!scenario || strcmp(scenario, "capture") == 0) {
+        BENCHMARK_capture((megabytes ? megabytes : 256) * 1024 * 1024);
+    }
+    if (!scenario || strcmp(scenario, "spawn") == 0) {
+        BENCHMARK_spawn((megabytes ? megabytes : 256) * 1024 * 1024);
+    }
+    if (!scenario || strcmp(scenario, "escapes") == 0) {
+        BENCHMARK_escapes((megabytes ? megabytes : 1024) * 1024 * 1024);
+    }
+    if (!scenario || strcmp(scenario, "utf8") == 0) {
+        BENCHMARK_utf8((megabytes ? megabytes : 1024) * 1024 * 1024);
+    }
+
+    return BENCHMARK_numFailures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
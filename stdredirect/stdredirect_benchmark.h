@@ -0,0 +1,160 @@
+/***********************************************************************************************************************
+* stdredirect_benchmark.h
+*
+* Result rows shared by stdredirect_benchmark.c and stdredirect_benchmark_cpp.cpp, printed as tables or JSON lines.
+*
+*
+* MIT License
+*
+* Copyright (c) 2018 Matthias Albrecht
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+***********************************************************************************************************************/
+
+#ifndef STDREDIRECT_BENCHMARK_H
+#define STDREDIRECT_BENCHMARK_H
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+
+/** @brief Print JSON lines instead of tables. */
+static int BENCHMARK_isJson;
+
+/** @brief Column names of the current row. */
+static char BENCHMARK_header[1024];
+
+/** @brief Column names of the last printed table. */
+static char BENCHMARK_lastHeader[1024];
+
+/** @brief Values of the current row. */
+static char BENCHMARK_row[1024];
+
+
+/** @brief Seconds on the monotonic clock. */
+static double BENCHMARK_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double) now.tv_sec + (double) now.tv_nsec * 1e-9;
+}
+
+
+/** @brief Append formatted text to a row buffer. */
+static void BENCHMARK_append(char* buffer, size_t size, const char* format, ...) {
+    size_t  length = strlen(buffer);
+    va_list arguments;
+
+    va_start(arguments, format);
+    vsnprintf(buffer + length, size - length, format, arguments);
+    va_end(arguments);
+}
+
+
+/** @brief Append column name as JSON key, lower case with anything but letters and digits replaced by '_'. */
+static void BENCHMARK_appendKey(const char* name) {
+    char   key[64];
+    size_t length = 0;
+
+    for (; *name && length < sizeof(key) - 1; ++name) {
+        if ((*name >= 'a' && *name <= 'z') || (*name >= '0' && *name <= '9')) {
+            key[length++] = *name;
+        }
+        else if (*name >= 'A' && *name <= 'Z') {
+            key[length++] = (char) (*name - 'A' + 'a');
+        }
+        else if (length > 0 && key[length - 1] != '_') {
+            key[length++] = '_';
+        }
+    }
+    while (length > 0 && key[length - 1] == '_') {
+        --length;
+    }
+    key[length] = '\0';
+
+    BENCHMARK_append(BENCHMARK_row, sizeof(BENCHMARK_row), ",\"%s\":", key);
+}
+
+
+/** @brief Start a result row of scenario. */
+static void BENCHMARK_beginRow(const char* scenario) {
+    BENCHMARK_header[0] = '\0';
+    BENCHMARK_row[0]    = '\0';
+    if (BENCHMARK_isJson) {
+        BENCHMARK_append(BENCHMARK_row, sizeof(BENCHMARK_row), "{\"scenario\":\"%s\"", scenario);
+    }
+}
+
+
+/** @brief Add text column to the current row. */
+static void BENCHMARK_label(const char* name, const char* value) {
+    if (BENCHMARK_isJson) {
+        BENCHMARK_appendKey(name);
+        BENCHMARK_append(BENCHMARK_row, sizeof(BENCHMARK_row), "\"%s\"", value);
+    }
+    else {
+        BENCHMARK_append(BENCHMARK_header, sizeof(BENCHMARK_header), "%-22s ", name);
+        BENCHMARK_append(BENCHMARK_row, sizeof(BENCHMARK_row), "%-22s ", value);
+    }
+}
+
+
+/** @brief Add numeric column with precision decimals to the current row. */
+static void BENCHMARK_number(const char* name, double value, int precision) {
+    int width = strlen(name) > 10 ? (int) strlen(name) : 10;
+
+    if (BENCHMARK_isJson) {
+        BENCHMARK_appendKey(name);
+        if (value - value != 0.0) {
+            /* no infinity or NaN in JSON */
+            BENCHMARK_append(BENCHMARK_row, sizeof(BENCHMARK_row), "null");
+        }
+        else {
+            BENCHMARK_append(BENCHMARK_row, sizeof(BENCHMARK_row), "%.*f", precision, value);
+        }
+    }
+    else {
+        BENCHMARK_append(BENCHMARK_header, sizeof(BENCHMARK_header), "%*s ", width, name);
+        BENCHMARK_append(BENCHMARK_row, sizeof(BENCHMARK_row), "%*.*f ", width, precision, value);
+    }
+}
+
+
+/** @brief Print the current row, preceded by the table header if the columns changed. */
+static void BENCHMARK_endRow() {
+    if (BENCHMARK_isJson) {
+        printf("%s}\n", BENCHMARK_row);
+    }
+    else {
+        /* drop the separator after the last column */
+        BENCHMARK_header[strlen(BENCHMARK_header) - 1] = '\0';
+        BENCHMARK_row[strlen(BENCHMARK_row) - 1]       = '\0';
+        if (strcmp(BENCHMARK_header, BENCHMARK_lastHeader) != 0) {
+            printf("%s%s\n", BENCHMARK_lastHeader[0] ? "\n" : "", BENCHMARK_header);
+            strcpy(BENCHMARK_lastHeader, BENCHMARK_header);
+        }
+        printf("%s\n", BENCHMARK_row);
+    }
+    fflush(stdout);
+}
+
+#endif /* STDREDIRECT_BENCHMARK_H */
@@ -0,0 +1,420 @@
+/***********************************************************************************************************************
+* stdredirect_benchmark_cpp.cpp
+*
+* stdredirect::Redirection with a lambda sink compared against the C callbacks.
+* POSIX only, build with CMake or e.g. "c++ -std=c++11 -O2 -pthread stdredirect_benchmark_cpp.cpp".
+*
+* Usage: stdredirect_benchmark_cpp [--json] [scenario] [megabytes]
+*   --json       print one JSON object per result row instead of tables, for comparing runs
+*
+*   pipe         MB/s of 32 byte lines written to the redirected stdout, raw vs. line framing (default 256 MB)
+*   dispatch     the same lines passed on with STDREDIRECT_inject(), callback cost without the pipe (default 1024 MB)
+*   coroutine    the lines consumed on another thread, from a queue filled by a lambda sink vs. co_await on
+*                stdredirect::AsyncReader resumed inline or by an event loop thread, needs C++20 (default 256 MB)
+*
+*
+* MIT License
+*
+* Copyright (c) 2018 Matthias Albrecht
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+***********************************************************************************************************************/
+
+#include "stdredirect.hpp"
+#include "stdredirect_benchmark.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef STDREDIRECT_CPP20
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#endif
+
+
+/** @brief Length of the benchmark lines. */
+static const size_t BENCHMARK_LINE_LENGTH = 32;
+
+
+/** @brief Bytes seen by the C callbacks, the function pointer callback has no userdata. */
+static size_t BENCHMARK_bytesReceived;
+
+/** @brief Number of string callback invocations. */
+static size_t BENCHMARK_callbacks;
+
+
+/** @brief What the sinks count. */
+struct BENCHMARK_COUNTER {
+    size_t bytesReceived;
+    size_t callbacks;
+};
+
+
+/** @brief String callback counting into globals, the plain STDREDIRECT_CALLBACK path. */
+static void BENCHMARK_stringCallback(const char* str) {
+    BENCHMARK_bytesReceived += strlen(str);
+    ++BENCHMARK_callbacks;
+}
+
+
+/** @brief Data callback counting into the counter passed as userdata. */
+static void BENCHMARK_dataCallback(const char* data, size_t length, void* userdata) {
+    BENCHMARK_COUNTER* counter = (BENCHMARK_COUNTER*) userdata;
+
+    (void) data;
+
+    counter->bytesReceived += length;
+    ++counter->callbacks;
+}
+
+
+/** @brief Fill buffer with lines of BENCHMARK_LINE_LENGTH bytes. */
+static void BENCHMARK_fillLines(char* buffer, size_t size) {
+    size_t i;
+
+    memset(buffer, 'x', size);
+    for (i = BENCHMARK_LINE_LENGTH - 1; i < size; i += BENCHMARK_LINE_LENGTH) {
+        buffer[i] = '\n';
+    }
+}
+
+
+/** @brief Write totalSize bytes of lines to stdout, or inject them if isInjected, then unredirect, returns seconds. */
+static double BENCHMARK_writeLines(STDREDIRECT_REDIRECTION* redirection, int isInjected, size_t totalSize) {
+    static char buffer[64 * 1024];
+    size_t      written;
+    size_t      numBytesToWrite;
+    ssize_t     result;
+    double      start;
+
+    BENCHMARK_fillLines(buffer, sizeof(buffer));
+
+    start = BENCHMARK_now();
+    for (written = 0; written < totalSize; written += numBytesToWrite) {
+        numBytesToWrite = totalSize - written < sizeof(buffer) ? totalSize - written : sizeof(buffer);
+        if (isInjected) {
+            STDREDIRECT_inject(redirection, buffer, numBytesToWrite);
+        }
+        else {
+            result = write(STDOUT_FILENO, buffer, numBytesToWrite);
+            if (result <= 0) {
+                break;
+            }
+            numBytesToWrite = (size_t) result;
+        }
+    }
+    STDREDIRECT_unredirect(redirection);
+
+    return BENCHMARK_now() - start;
+}
+
+
+/** @brief Print result row of a sink variant. */
+static void BENCHMARK_report(const char* scenario, const char* framing, const char* sink, double seconds, size_t totalSize, size_t bytesReceived) {
+    if (bytesReceived != totalSize) {
+        fprintf(stderr, "lost output: %zu of %zu bytes received\n", bytesReceived, totalSize);
+    }
+
+    BENCHMARK_beginRow(scenario);
+    BENCHMARK_label("framing", framing);
+    BENCHMARK_label("sink", sink);
+    BENCHMARK_number("MB/s", (double) totalSize / (1024.0 * 1024.0) / seconds, 1);
+    BENCHMARK_number("ns/line", seconds * 1e9 / (double) (totalSize / BENCHMARK_LINE_LENGTH), 1);
+    BENCHMARK_endRow();
+}
+
+
+/** @brief Run the three sink variants with framing, through the pipe or injected. */
+template <STDREDIRECT_FRAMING Framing>
+static void BENCHMARK_sinks(const char* scenario, int isInjected, size_t totalSize) {
+    const char*              framing = Framing == STDREDIRECT_FRAMING_LINE ? "line" : "raw";
+    STDREDIRECT_OPTIONS      options = STDREDIRECT_defaultOptions();
+    STDREDIRECT_REDIRECTION* redirection;
+    BENCHMARK_COUNTER        counter = { 0, 0 };
+    double                   seconds;
+
+    options.framing = Framing;
+
+    /* function pointer without userdata, counts into globals */
+    BENCHMARK_bytesReceived = 0;
+    BENCHMARK_callbacks     = 0;
+    redirection = STDREDIRECT_createWithOptions(STDREDIRECT_STREAM_STDOUT, &options);
+    if (!redirection) {
+        return;
+    }
+    redirection->callback = &BENCHMARK_stringCallback;
+    if (STDREDIRECT_redirect(redirection) != STDREDIRECT_ERROR_NO_ERROR) {
+        STDREDIRECT_destroy(redirection);
+        return;
+    }
+    seconds = BENCHMARK_writeLines(redirection, isInjected, totalSize);
+    STDREDIRECT_destroy(redirection);
+    BENCHMARK_report(scenario, framing, "string callback", seconds, totalSize, BENCHMARK_bytesReceived);
+
+    /* data callback with userdata */
+    options.dataCallback = &BENCHMARK_dataCallback;
+    options.userdata     = &counter;
+    redirection = STDREDIRECT_createWithOptions(STDREDIRECT_STREAM_STDOUT, &options);
+    if (!redirection || STDREDIRECT_redirect(redirection) != STDREDIRECT_ERROR_NO_ERROR) {
+        STDREDIRECT_destroy(redirection);
+        return;
+    }
+    seconds = BENCHMARK_writeLines(redirection, isInjected, totalSize);
+    STDREDIRECT_destroy(redirection);
+    BENCHMARK_report(scenario, framing, "data callback", seconds, totalSize, counter.bytesReceived);
+
+    /* stateful lambda, called from a callback instantiated for it */
+    counter.bytesReceived = 0;
+    counter.callbacks     = 0;
+    {
+        auto sinkRedirection = stdredirect::makeRedirection<Framing>(STDREDIRECT_STREAM_STDOUT, [&counter](const char* data, size_t length) {
+            (void) data;
+            counter.bytesReceived += length;
+            ++counter.callbacks;
+        });
+        if (sinkRedirection.getError() != STDREDIRECT_ERROR_NO_ERROR) {
+            return;
+        }
+        seconds = BENCHMARK_writeLines(sinkRedirection.get(), isInjected, totalSize);
+    }
+    BENCHMARK_report(scenario, framing, "lambda sink", seconds, totalSize, counter.bytesReceived);
+}
+
+
+#ifdef STDREDIRECT_CPP20
+/** @brief Coroutine started right away and never awaited, what an application's task type does for the benchmark. */
+struct BENCHMARK_Task {
+    struct promise_type {
+        BENCHMARK_Task get_return_object() {
+            return BENCHMARK_Task();
+        }
+        std::suspend_never initial_suspend() {
+            return std::suspend_never();
+        }
+        std::suspend_never final_suspend() noexcept {
+            return std::suspend_never();
+        }
+        void return_void() {
+        }
+        void unhandled_exception() {
+            abort();
+        }
+    };
+};
+
+
+/** @brief Event loop thread running posted coroutines, stands in for the executor of a consumer. */
+class BENCHMARK_EventLoop {
+public:
+    BENCHMARK_EventLoop()
+        : isStopped(false)
+        , thread(&BENCHMARK_EventLoop::run, this) {
+    }
+
+    ~BENCHMARK_EventLoop() {
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            isStopped = true;
+        }
+        condition.notify_one();
+        thread.join();
+    }
+
+    void post(std::coroutine_handle<> handle) {
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            handles.push_back(handle);
+        }
+        condition.notify_one();
+    }
+
+private:
+    void run() {
+        std::unique_lock<std::mutex> guard(mutex);
+
+        for (;;) {
+            condition.wait(guard, [this] { return isStopped || !handles.empty(); });
+            if (handles.empty()) {
+                break;
+            }
+            std::coroutine_handle<> handle = handles.front();
+            handles.pop_front();
+            guard.unlock();
+            handle.resume();
+            guard.lock();
+        }
+    }
+
+    std::mutex                          mutex;
+    std::condition_variable             condition;
+    std::deque<std::coroutine_handle<>> handles;
+    bool                                isStopped;
+    std::thread                         thread;
+};
+
+
+/** @brief Executor posting to a BENCHMARK_EventLoop. */
+struct BENCHMARK_LoopExecutor {
+    BENCHMARK_EventLoop* loop;
+
+    void operator()(std::coroutine_handle<> handle) const {
+        loop->post(handle);
+    }
+};
+
+
+/** @brief Consumer counting the lines of reader, sets isDone at the end. */
+template <typename Reader>
+static BENCHMARK_Task BENCHMARK_consume(Reader& reader, BENCHMARK_COUNTER& counter, std::atomic<bool>& isDone) {
+    while (std::optional<std::string_view> line = co_await reader.next()) {
+        counter.bytesReceived += line->size();
+        ++counter.callbacks;
+    }
+    isDone = true;
+}
+
+
+/** @brief Write lines to the redirected stdout of reader, close it and wait for the consumer, returns seconds. */
+template <typename Reader>
+static double BENCHMARK_readAsync(Reader& reader, std::atomic<bool>& isDone, size_t totalSize) {
+    static char buffer[64 * 1024];
+    size_t      written;
+    size_t      numBytesToWrite;
+    double      start;
+
+    BENCHMARK_fillLines(buffer, sizeof(buffer));
+
+    start = BENCHMARK_now();
+    for (written = 0; written < totalSize; written += numBytesToWrite) {
+        numBytesToWrite = totalSize - written < sizeof(buffer) ? totalSize - written : sizeof(buffer);
+        STDREDIRECT_writeAll(STDOUT_FILENO, buffer, numBytesToWrite);
+    }
+    reader.close();
+    while (!isDone) {
+        std::this_thread::yield();
+    }
+
+    return BENCHMARK_now() - start;
+}
+
+
+/** @brief Lines consumed from a queue on another thread vs. by a coroutine, inline and on an event loop thread. */
+static void BENCHMARK_coroutine(size_t totalSize) {
+    BENCHMARK_COUNTER counter = { 0, 0 };
+    double            seconds;
+
+    /* what consumers do without the awaitable: the sink pushes into their queue and wakes their thread */
+    {
+        std::mutex              mutex;
+        std::condition_variable condition;
+        std::deque<std::string> lines;
+        bool                    isClosed = false;
+        double                  start;
+
+        std::thread consumer([&] {
+            std::unique_lock<std::mutex> guard(mutex);
+
+            for (;;) {
+                condition.wait(guard, [&] { return isClosed || !lines.empty(); });
+                if (lines.empty()) {
+                    break;
+                }
+                counter.bytesReceived += lines.front().size();
+                ++counter.callbacks;
+                lines.pop_front();
+            }
+        });
+        auto redirection = stdredirect::makeRedirection<STDREDIRECT_FRAMING_LINE>(STDREDIRECT_STREAM_STDOUT, [&](const char* data, size_t length) {
+            {
+                std::lock_guard<std::mutex> guard(mutex);
+                lines.emplace_back(data, length);
+            }
+            condition.notify_one();
+        });
+        start = BENCHMARK_now();
+        BENCHMARK_writeLines(redirection.get(), 0, totalSize);
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            isClosed = true;
+        }
+        condition.notify_one();
+        consumer.join();
+        seconds = BENCHMARK_now() - start;
+    }
+    BENCHMARK_report("coroutine", "line", "queue + thread", seconds, totalSize, counter.bytesReceived);
+
+    counter.bytesReceived = 0;
+    counter.callbacks     = 0;
+    {
+        stdredirect::AsyncReader<> reader(STDREDIRECT_STREAM_STDOUT);
+        std::atomic<bool>          isDone(false);
+
+        BENCHMARK_consume(reader, counter, isDone);
+        seconds = BENCHMARK_readAsync(reader, isDone, totalSize);
+    }
+    BENCHMARK_report("coroutine", "line", "co_await inline", seconds, totalSize, counter.bytesReceived);
+
+    counter.bytesReceived = 0;
+    counter.callbacks     = 0;
+    {
+        BENCHMARK_EventLoop                              loop;
+        stdredirect::AsyncReader<BENCHMARK_LoopExecutor> reader(STDREDIRECT_STREAM_STDOUT, BENCHMARK_LoopExecutor { &loop });
+        std::atomic<bool>                                isDone(false);
+
+        BENCHMARK_consume(reader, counter, isDone);
+        seconds = BENCHMARK_readAsync(reader, isDone, totalSize);
+    }
+    BENCHMARK_report("coroutine", "line", "co_await event loop", seconds, totalSize, counter.bytesReceived);
+}
+#endif /* STDREDIRECT_CPP20 */
+
+
+int main(int argc, char* argv[]) {
+    const char* scenario;
+    size_t      megabytes;
+
+    if (argc > 1 && strcmp(argv[1], "--json") == 0) {
+        BENCHMARK_isJson = 1;
+        --argc;
+        ++argv;
+    }
+    scenario  = argc > 1 ? argv[1] : NULL;
+    megabytes = argc > 2 ? (size_t) atol(argv[2]) : 0;
+
+    if (!scenario || strcmp(scenario, "pipe") == 0) {
+        BENCHMARK_sinks<STDREDIRECT_FRAMING_RAW>("pipe", 0, (megabytes ? megabytes : 256) * 1024 * 1024);
+        BENCHMARK_sinks<STDREDIRECT_FRAMING_LINE>("pipe", 0, (megabytes ? megabytes : 256) * 1024 * 1024);
+    }
+    if (!scenario || strcmp(scenario, "dispatch") == 0) {
+        BENCHMARK_sinks<STDREDIRECT_FRAMING_RAW>("dispatch", 1, (megabytes ? megabytes : 1024) * 1024 * 1024);
+        BENCHMARK_sinks<STDREDIRECT_FRAMING_LINE>("dispatch", 1, (megabytes ? megabytes : 1024) * 1024 * 1024);
+    }
+#ifdef STDREDIRECT_CPP20
+    if (!scenario || strcmp(scenario, "coroutine") == 0) {
+        BENCHMARK_coroutine((megabytes ? megabytes : 256) * 1024 * 1024);
+    }
+#endif
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,459 @@
+/***********************************************************************************************************************
+* stdredirect_capture.h
+*
+* Capture everything a block of code prints to stdout and stderr into memory, e.g. around a test assertion.
+* https://github.com/biosmanager/stdredirect
+*
+*
+* MIT License
+*
+* Copyright (c) 2018 Matthias Albrecht
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+***********************************************************************************************************************/
+
+/**
+ * @file stdredirect_capture.h
+ * @author Matthias Albrecht
+ * @brief Capture everything a block of code prints to stdout and stderr into memory.
+ *
+ * A capture collects the output written between STDREDIRECT_beginCapture() and STDREDIRECT_endCapture() in one
+ * contiguous arena and hands it out when the capture ends, no callback, lock or sleep needed by the caller:
+ *
+ *     STDREDIRECT_CAPTURE* capture = STDREDIRECT_createCapture(STDREDIRECT_CAPTURE_STDOUT | STDREDIRECT_CAPTURE_STDERR, 0);
+ *     STDREDIRECT_beginCapture(capture);
+ *     runTest();
+ *     STDREDIRECT_endCapture(capture, &output, &length);
+ *
+ * The arena grows geometrically and is kept between captures, so capturing allocates nothing once it has reached the
+ * size of the largest output. Captures nest: an inner capture gets what was written between its begin and end, the
+ * enclosing one everything including that. With ::STDREDIRECT_CAPTURE_TAGGED every run of output of one stream is
+ * preceded by a ::STDREDIRECT_CAPTURE_TAG, STDREDIRECT_nextCaptured() walks them.
+ *
+ * The redirections are persistent, see STDREDIRECT_OPTIONS::isPersistent, and synchronous, so on POSIX a capture
+ * costs two cheap redirect/unredirect cycles and the output is complete as soon as STDREDIRECT_endCapture() returns.
+ */
+
+#ifndef STDREDIRECT_CAPTURE_H
+#define STDREDIRECT_CAPTURE_H
+
+#if defined (_MSC_VER) && (_MSC_VER >= 1020)
+#pragma once
+#endif
+
+#include "stdredirect.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/** @brief Maximum nesting depth of captures. */
+#define STDREDIRECT_CAPTURE_MAX_DEPTH 64
+
+
+/** @brief Default initial arena capacity of a capture. */
+const size_t STDREDIRECT_CAPTURE_CAPACITY = 64 * 1024;
+
+
+/** @brief Captured streams and format of the captured output, combined with |. */
+typedef enum STDREDIRECT_CAPTURE_FLAGS {
+    STDREDIRECT_CAPTURE_STDOUT = 1,     /**< capture stdout                                                      */
+    STDREDIRECT_CAPTURE_STDERR = 2,     /**< capture stderr                                                      */
+    STDREDIRECT_CAPTURE_TAGGED = 4      /**< precede every run of output of one stream with its tag              */
+} STDREDIRECT_CAPTURE_FLAGS;
+
+
+/** @brief Header of a run of output of one stream in a ::STDREDIRECT_CAPTURE_TAGGED capture.
+ *
+ *  Followed by length bytes of output, stored unaligned, see STDREDIRECT_nextCaptured(). Runs are in the order the
+ *  pipe reader read them, output written to both streams in quick succession may be grouped by stream.
+ */
+typedef struct STDREDIRECT_CAPTURE_TAG {
+    STDREDIRECT_STREAM    stream;               /**< stream the output was written to                              */
+    size_t                length;               /**< number of bytes following the tag                             */
+} STDREDIRECT_CAPTURE_TAG;
+
+
+/** @brief Start of a capture in the arena. */
+typedef struct STDREDIRECT_CAPTURE_MARK {
+    size_t                offset;               /**< arena length at STDREDIRECT_beginCapture()                    */
+    size_t                droppedBytes;         /**< STDREDIRECT_CAPTURE::droppedBytes at STDREDIRECT_beginCapture() */
+} STDREDIRECT_CAPTURE_MARK;
+
+
+/** @brief Capture.
+ *
+ *  Use STDREDIRECT_createCapture() to create one. Begin and end it from one thread, output of any thread is captured.
+ */
+typedef struct STDREDIRECT_CAPTURE {
+    /** @name Internal
+     *  DO NOT CHANGE THESE VARIABLES AT RUNTIME!
+     */
+    /*@{*/
+    STDREDIRECT_REDIRECTION* redirections[2];   /**< stdout and stderr redirection, NULL if not captured           */
+    int                   isTagged;             /**< precede runs of output with a ::STDREDIRECT_CAPTURE_TAG       */
+    char*                 arena;                /**< captured output of all open captures                          */
+    size_t                capacity;             /**< arena capacity                                                */
+    size_t                length;               /**< number of bytes in the arena                                  */
+    size_t                lastTag;              /**< arena offset of the tag of the current run, -1 if the next
+                                                     output starts a new run                                       */
+    STDREDIRECT_STREAM    lastStream;           /**< stream of the current run                                     */
+    size_t                droppedBytes;         /**< output lost because the arena could not grow                  */
+    STDREDIRECT_CAPTURE_MARK marks[STDREDIRECT_CAPTURE_MAX_DEPTH]; /**< starts of the open captures                 */
+    size_t                depth;                /**< number of open captures                                       */
+    STDREDIRECT_MUTEX     lock;                 /**< protects the arena against the pipe reader                    */
+    /*@}*/
+} STDREDIRECT_CAPTURE;
+
+
+/* forward declarations */
+
+static STDREDIRECT_CAPTURE*     STDREDIRECT_createCapture(int flags, size_t capacity);
+static void                     STDREDIRECT_destroyCapture(STDREDIRECT_CAPTURE* capture);
+static STDREDIRECT_ERROR        STDREDIRECT_beginCapture(STDREDIRECT_CAPTURE* capture);
+static STDREDIRECT_ERROR        STDREDIRECT_endCapture(STDREDIRECT_CAPTURE* capture, const char** data, size_t* length);
+static int                      STDREDIRECT_nextCaptured(const char* data, size_t length, size_t* offset, STDREDIRECT_STREAM* stream, const char** chunk, size_t* chunkLength);
+static STDREDIRECT_ERROR        STDREDIRECT_syncCapture(STDREDIRECT_CAPTURE* capture);
+static void                     STDREDIRECT_captureCallback(const STDREDIRECT_RECORD* record, void* userdata);
+static int                      STDREDIRECT_reserveCapture(STDREDIRECT_CAPTURE* capture, size_t length);
+
+
+/**
+ * @brief Create capture, nothing is redirected before STDREDIRECT_beginCapture().
+ *
+ * @param flags ::STDREDIRECT_CAPTURE_FLAGS, at least one stream.
+ * @param capacity Initial arena capacity in bytes, 0 for STDREDIRECT_CAPTURE_CAPACITY.
+ * @return Pointer to capture, NULL on error.
+ */
+static STDREDIRECT_CAPTURE* STDREDIRECT_createCapture(int flags, size_t capacity) {
+    STDREDIRECT_CAPTURE* capture;
+    STDREDIRECT_OPTIONS  options = STDREDIRECT_defaultOptions();
+
+    if (!(flags & (STDREDIRECT_CAPTURE_STDOUT | STDREDIRECT_CAPTURE_STDERR))) {
+        return NULL;
+    }
+
+    capture = (STDREDIRECT_CAPTURE*) malloc(sizeof(STDREDIRECT_CAPTURE));
+    if (!capture) {
+        return NULL;
+    }
+
+    capture->capacity = capacity > 0 ? capacity : STDREDIRECT_CAPTURE_CAPACITY;
+    capture->arena = (char*) malloc(capture->capacity);
+    if (!capture->arena) {
+        free(capture);
+        return NULL;
+    }
+    capture->redirections[STDREDIRECT_STREAM_STDOUT] = NULL;
+    capture->redirections[STDREDIRECT_STREAM_STDERR] = NULL;
+    capture->isTagged                                = (flags & STDREDIRECT_CAPTURE_TAGGED) != 0;
+    capture->length                                  = 0;
+    capture->lastTag                                 = (size_t) -1;
+    capture->lastStream                              = STDREDIRECT_STREAM_STDOUT;
+    capture->droppedBytes                            = 0;
+    capture->depth                                   = 0;
+    STDREDIRECT_initMutex(&capture->lock);
+
+    /* synchronous, so the output is in the arena when unredirect returns, and parked between captures */
+    options.recordCallback = &STDREDIRECT_captureCallback;
+    options.userdata       = capture;
+    options.isPersistent   = TRUE;
+
+    if (flags & STDREDIRECT_CAPTURE_STDOUT) {
+        capture->redirections[STDREDIRECT_STREAM_STDOUT] = STDREDIRECT_createWithOptions(STDREDIRECT_STREAM_STDOUT, &options);
+        if (!capture->redirections[STDREDIRECT_STREAM_STDOUT]) {
+            goto Error;
+        }
+    }
+    if (flags & STDREDIRECT_CAPTURE_STDERR) {
+        capture->redirections[STDREDIRECT_STREAM_STDERR] = STDREDIRECT_createWithOptions(STDREDIRECT_STREAM_STDERR, &options);
+        if (!capture->redirections[STDREDIRECT_STREAM_STDERR]) {
+            goto Error;
+        }
+    }
+
+    return capture;
+
+Error:
+    STDREDIRECT_destroyCapture(capture);
+
+    return NULL;
+}
+
+
+/**
+ * @brief End all open captures and destroy capture, data returned by STDREDIRECT_endCapture() becomes invalid.
+ *
+ * @param capture Pointer to capture.
+ */
+static void STDREDIRECT_destroyCapture(STDREDIRECT_CAPTURE* capture) {
+    if (capture) {
+        STDREDIRECT_destroy(capture->redirections[STDREDIRECT_STREAM_STDOUT]);
+        STDREDIRECT_destroy(capture->redirections[STDREDIRECT_STREAM_STDERR]);
+        STDREDIRECT_destroyMutex(&capture->lock);
+        free(capture->arena);
+        free(capture);
+    }
+}
+
+
+/**
+ * @brief Start capturing, redirects the streams unless a capture is open already.
+ *
+ * @param capture Pointer to capture.
+ * @return ::STDREDIRECT_ERROR, ::STDREDIRECT_ERROR_SINK if STDREDIRECT_CAPTURE_MAX_DEPTH captures are open.
+ */
+static STDREDIRECT_ERROR STDREDIRECT_beginCapture(STDREDIRECT_CAPTURE* capture) {
+    STDREDIRECT_ERROR error;
+    size_t            i;
+
+    if (!capture) {
+        return STDREDIRECT_ERROR_NULLPTR;
+    }
+    if (capture->depth == STDREDIRECT_CAPTURE_MAX_DEPTH) {
+        return STDREDIRECT_ERROR_SINK;
+    }
+
+    if (capture->depth == 0) {
+        for (i = 0; i < 2; ++i) {
+            if (capture->redirections[i] && (error = STDREDIRECT_redirect(capture->redirections[i])) != STDREDIRECT_ERROR_NO_ERROR) {
+                while (i-- > 0) {
+                    STDREDIRECT_unredirect(capture->redirections[i]);
+                }
+                return error;
+            }
+        }
+    }
+    /* output written before belongs to the enclosing capture only */
+    else if ((error = STDREDIRECT_syncCapture(capture)) != STDREDIRECT_ERROR_NO_ERROR) {
+        return error;
+    }
+
+    STDREDIRECT_lock(&capture->lock);
+    capture->marks[capture->depth].offset       = capture->length;
+    capture->marks[capture->depth].droppedBytes = capture->droppedBytes;
+    capture->lastTag                            = (size_t) -1;
+    ++capture->depth;
+    STDREDIRECT_unlock(&capture->lock);
+
+    return STDREDIRECT_ERROR_NO_ERROR;
+}
+
+
+/**
+ * @brief End the innermost capture and return everything written since it began.
+ *
+ * The data of the outermost capture stays valid until the next STDREDIRECT_beginCapture(), that of an inner one until
+ * the enclosing capture captures more output.
+ *
+ * @param capture Pointer to capture.
+ * @param data Receives pointer to the captured output, may be NULL.
+ * @param length Receives number of captured bytes, including tags, may be NULL.
+ * @return ::STDREDIRECT_ERROR, ::STDREDIRECT_ERROR_NOT_REDIRECTED if no capture is open, ::STDREDIRECT_ERROR_SINK if
+ *         output was lost because the arena could not grow.
+ */
+static STDREDIRECT_ERROR STDREDIRECT_endCapture(STDREDIRECT_CAPTURE* capture, const char** data, size_t* length) {
+    STDREDIRECT_ERROR        error = STDREDIRECT_ERROR_NO_ERROR;
+    STDREDIRECT_CAPTURE_MARK mark;
+    size_t                   i;
+
+    if (!capture) {
+        return STDREDIRECT_ERROR_NULLPTR;
+    }
+    if (capture->depth == 0) {
+        return STDREDIRECT_ERROR_NOT_REDIRECTED;
+    }
+
+    /* unredirect passes on everything written so far before it returns */
+    if (capture->depth == 1) {
+        for (i = 0; i < 2; ++i) {
+            if (capture->redirections[i] && STDREDIRECT_unredirect(capture->redirections[i]) != STDREDIRECT_ERROR_NO_ERROR) {
+                error = STDREDIRECT_ERROR_UNREDIRECT;
+            }
+        }
+    }
+    else {
+        error = STDREDIRECT_syncCapture(capture);
+    }
+
+    STDREDIRECT_lock(&capture->lock);
+    mark = capture->marks[--capture->depth];
+    if (data) {
+        *data = capture->arena + mark.offset;
+    }
+    if (length) {
+        *length = capture->length - mark.offset;
+    }
+    if (capture->droppedBytes != mark.droppedBytes && error == STDREDIRECT_ERROR_NO_ERROR) {
+        error = STDREDIRECT_ERROR_SINK;
+    }
+    capture->lastTag = (size_t) -1;
+    if (capture->depth == 0) {
+        capture->length = 0;
+        capture->droppedBytes = 0;
+    }
+    STDREDIRECT_unlock(&capture->lock);
+
+    return error;
+}
+
+
+/**
+ * @brief Walk the runs of output of a ::STDREDIRECT_CAPTURE_TAGGED capture.
+ *
+ * @param data Captured output returned by STDREDIRECT_endCapture().
+ * @param length Number of captured bytes.
+ * @param offset Offset of the next run, start with 0.
+ * @param stream Receives stream of the run.
+ * @param chunk Receives pointer to the output of the run.
+ * @param chunkLength Receives number of bytes of the run.
+ * @return TRUE if there was another run, FALSE at the end.
+ */
+static int STDREDIRECT_nextCaptured(const char* data, size_t length, size_t* offset, STDREDIRECT_STREAM* stream, const char** chunk, size_t* chunkLength) {
+    STDREDIRECT_CAPTURE_TAG tag;
+
+    if (*offset + sizeof(tag) > length) {
+        return FALSE;
+    }
+    memcpy(&tag, data + *offset, sizeof(tag));
+    if (tag.length > length - *offset - sizeof(tag)) {
+        return FALSE;
+    }
+
+    *stream = tag.stream;
+    *chunk = data + *offset + sizeof(tag);
+    *chunkLength = tag.length;
+    *offset += sizeof(tag) + tag.length;
+
+    return TRUE;
+}
+
+
+/**
+ * @brief Pass on everything written to the captured streams so far, the streams stay redirected.
+ *
+ * On POSIX an empty injection drains the pipe, on Windows only unredirect waits for the pipe reader.
+ *
+ * @param capture Pointer to capture.
+ * @return ::STDREDIRECT_ERROR
+ */
+static STDREDIRECT_ERROR STDREDIRECT_syncCapture(STDREDIRECT_CAPTURE* capture) {
+    STDREDIRECT_ERROR error;
+    size_t            i;
+
+    for (i = 0; i < 2; ++i) {
+        if (!capture->redirections[i]) {
+            continue;
+        }
+#ifdef _WIN32
+        if ((error = STDREDIRECT_unredirect(capture->redirections[i])) != STDREDIRECT_ERROR_NO_ERROR
+            || (error = STDREDIRECT_redirect(capture->redirections[i])) != STDREDIRECT_ERROR_NO_ERROR) {
+            return error;
+        }
+#else
+        if ((error = STDREDIRECT_inject(capture->redirections[i], NULL, 0)) != STDREDIRECT_ERROR_NO_ERROR) {
+            return error;
+        }
+#endif /* _WIN32 */
+    }
+
+    return STDREDIRECT_ERROR_NO_ERROR;
+}
+
+
+/**
+ * @brief Record callback appending the output to the arena, runs on the pipe reader thread.
+ *
+ * @param record Record.
+ * @param userdata Pointer to capture.
+ */
+static void STDREDIRECT_captureCallback(const STDREDIRECT_RECORD* record, void* userdata) {
+    STDREDIRECT_CAPTURE*    capture = (STDREDIRECT_CAPTURE*) userdata;
+    STDREDIRECT_CAPTURE_TAG tag;
+
+    STDREDIRECT_lock(&capture->lock);
+    if (!capture->isTagged || (capture->lastTag != (size_t) -1 && capture->lastStream == record->stream)) {
+        if (!STDREDIRECT_reserveCapture(capture, record->length)) {
+            capture->droppedBytes += record->length;
+        }
+        else {
+            /* untagged, or same stream as before: extend the current run */
+            if (capture->isTagged) {
+                memcpy(&tag, capture->arena + capture->lastTag, sizeof(tag));
+                tag.length += record->length;
+                memcpy(capture->arena + capture->lastTag, &tag, sizeof(tag));
+            }
+            memcpy(capture->arena + capture->length, record->data, record->length);
+            capture->length += record->length;
+        }
+    }
+    else if (STDREDIRECT_reserveCapture(capture, sizeof(tag) + record->length)) {
+        tag.stream = record->stream;
+        tag.length = record->length;
+        capture->lastTag = capture->length;
+        capture->lastStream = record->stream;
+        memcpy(capture->arena + capture->length, &tag, sizeof(tag));
+        memcpy(capture->arena + capture->length + sizeof(tag), record->data, record->length);
+        capture->length += sizeof(tag) + record->length;
+    }
+    else {
+        capture->droppedBytes += record->length;
+    }
+    STDREDIRECT_unlock(&capture->lock);
+}
+
+
+/**
+ * @brief Make room for length more bytes in the arena, doubling its capacity as often as needed.
+ *
+ * Called with STDREDIRECT_CAPTURE::lock held.
+ *
+ * @param capture Pointer to capture.
+ * @param length Number of bytes to append.
+ * @return TRUE if there is room, FALSE otherwise.
+ */
+static int STDREDIRECT_reserveCapture(STDREDIRECT_CAPTURE* capture, size_t length) {
+    size_t capacity = capture->capacity;
+    char*  arena;
+
+    if (capture->length + length <= capacity) {
+        return TRUE;
+    }
+
+    while (capacity < capture->length + length) {
+        capacity *= 2;
+    }
+    arena = (char*) realloc(capture->arena, capacity);
+    if (!arena) {
+        return FALSE;
+    }
+    capture->arena = arena;
+    capture->capacity = capacity;
+
+    return TRUE;
+}
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* STDREDIRECT_CAPTURE_H */
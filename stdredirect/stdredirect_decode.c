@@ -0,0 +1,198 @@
+/***********************************************************************************************************************
+* stdredirect_decode.c
+*
+* Print records written by STDREDIRECT_RECORD_WRITER (see stdredirect_records.h) as text.
+* Build with e.g. "cc -O2 stdredirect_decode.c -o stdredirect_decode".
+*
+* Usage: stdredirect_decode [-s] [-d] [file]
+*   -s   sort records by global sequence number, i.e. merge streams in the order they were read
+*   -d   print data only, without the "<seconds> <stream> <sequence> <global sequence>" prefix
+*   file encoded records, defaults to stdin
+*
+*
+* MIT License
+*
+* Copyright (c) 2018 Matthias Albrecht
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+***********************************************************************************************************************/
+
+#include "stdredirect_records.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#endif /* _WIN32 */
+
+
+/** @brief Read whole file into memory, returns NULL on error. */
+static unsigned char* DECODE_readAll(FILE* file, size_t* length) {
+    unsigned char* data     = NULL;
+    unsigned char* grown;
+    size_t         capacity = 0;
+    size_t         numBytesRead;
+
+    *length = 0;
+    for (;;) {
+        if (*length == capacity) {
+            capacity = capacity ? capacity * 2 : 1024 * 1024;
+            grown = (unsigned char*) realloc(data, capacity);
+            if (!grown) {
+                free(data);
+                return NULL;
+            }
+            data = grown;
+        }
+        numBytesRead = fread(data + *length, 1, capacity - *length, file);
+        if (numBytesRead == 0) {
+            break;
+        }
+        *length += numBytesRead;
+    }
+
+    if (ferror(file)) {
+        free(data);
+        return NULL;
+    }
+
+    return data;
+}
+
+
+/** @brief Order records by global sequence number, then by per-redirection sequence number. */
+static int DECODE_compareRecords(const void* first, const void* second) {
+    const STDREDIRECT_RECORD* a = (const STDREDIRECT_RECORD*) first;
+    const STDREDIRECT_RECORD* b = (const STDREDIRECT_RECORD*) second;
+
+    if (a->globalSequence != b->globalSequence) {
+        return a->globalSequence < b->globalSequence ? -1 : 1;
+    }
+    if (a->sequence != b->sequence) {
+        return a->sequence < b->sequence ? -1 : 1;
+    }
+
+    return 0;
+}
+
+
+int main(int argc, char* argv[]) {
+    FILE*               file        = stdin;
+    unsigned char*      data;
+    size_t              length;
+    size_t              position    = 0;
+    STDREDIRECT_RECORD* records     = NULL;
+    STDREDIRECT_RECORD* grown;
+    size_t              numRecords  = 0;
+    size_t              capacity    = 0;
+    int                 isSorted    = 0;
+    int                 isDataOnly  = 0;
+    int                 headerSize;
+    long long           start;
+    size_t              i;
+
+    for (i = 1; i < (size_t) argc; ++i) {
+        if (strcmp(argv[i], "-s") == 0) {
+            isSorted = 1;
+        }
+        else if (strcmp(argv[i], "-d") == 0) {
+            isDataOnly = 1;
+        }
+        else {
+            file = fopen(argv[i], "rb");
+            if (!file) {
+                fprintf(stderr, "cannot open %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+#ifdef _WIN32
+    /* encoded records are binary */
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif /* _WIN32 */
+
+    data = DECODE_readAll(file, &length);
+    if (!data) {
+        fprintf(stderr, "cannot read input\n");
+        return EXIT_FAILURE;
+    }
+
+    /* decode all records, a truncated last record is dropped */
+    while (position < length) {
+        if (numRecords == capacity) {
+            capacity = capacity ? capacity * 2 : 1024;
+            grown = (STDREDIRECT_RECORD*) realloc(records, capacity * sizeof(STDREDIRECT_RECORD));
+            if (!grown) {
+                fprintf(stderr, "out of memory\n");
+                return EXIT_FAILURE;
+            }
+            records = grown;
+        }
+
+        headerSize = STDREDIRECT_decodeRecordHeader(data + position, length - position, &records[numRecords]);
+        if (headerSize == -1) {
+            fprintf(stderr, "invalid record at offset %zu\n", position);
+            return EXIT_FAILURE;
+        }
+        if (headerSize == 0 || records[numRecords].length > length - position - (size_t) headerSize) {
+            fprintf(stderr, "truncated record at offset %zu\n", position);
+            break;
+        }
+        position += (size_t) headerSize + records[numRecords].length;
+        ++numRecords;
+    }
+
+    if (isSorted) {
+        qsort(records, numRecords, sizeof(STDREDIRECT_RECORD), &DECODE_compareRecords);
+    }
+
+    /* timestamps relative to the earliest record */
+    start = numRecords > 0 ? records[0].timestamp : 0;
+    for (i = 0; i < numRecords; ++i) {
+        if (records[i].timestamp < start) {
+            start = records[i].timestamp;
+        }
+    }
+
+    for (i = 0; i < numRecords; ++i) {
+        const STDREDIRECT_RECORD* record = &records[i];
+
+        if (!isDataOnly) {
+            printf("%lld.%06lld %s %lld %lld ", (record->timestamp - start) / 1000000, (record->timestamp - start) % 1000000,
+                   record->stream == STDREDIRECT_STREAM_STDOUT ? "stdout" : "stderr", record->sequence, record->globalSequence);
+        }
+        fwrite(record->data, 1, record->length, stdout);
+        if (!isDataOnly && (record->length == 0 || record->data[record->length - 1] != '\n')) {
+            putchar('\n');
+        }
+    }
+
+    free(records);
+    free(data);
+    if (file != stdin) {
+        fclose(file);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -49,14 +49,7 @@ int main() {
         /* this goes directly to the console window */
         STDREDIRECT_printToConsole("This string bypasses the redirection.\n");
 
-        /* give the thread some time to read from the pipe before unredirecting
-           if you unredirect or exit the process too soon after a write to the stream,
-           it may be swallowed and will never appear
-           may be longer on your system
-         */
-        Sleep(1);
-
-        /* stdout/stderr are displayed on the console again */
+        /* stdout/stderr are displayed on the console again, everything written so far has been passed on */
         if (STDREDIRECT_unredirectAll() != STDREDIRECT_ERROR_NO_ERROR) {
             std::getchar();
             return EXIT_FAILURE;
@@ -0,0 +1,575 @@
+/***********************************************************************************************************************
+* stdredirect_fanout.h
+*
+* Pass captured output to several subscribers through one shared ring, each reading at its own pace.
+* https://github.com/biosmanager/stdredirect
+*
+*
+* MIT License
+*
+* Copyright (c) 2018 Matthias Albrecht
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+***********************************************************************************************************************/
+
+/**
+ * @file stdredirect_fanout.h
+ * @author Matthias Albrecht
+ * @brief Pass captured output to several subscribers through one shared ring.
+ *
+ * The fanout is a data callback that writes each chunk (or line) once into a ring. Every subscriber has a thread
+ * reading the ring with its own cursor and calling its callback, so a slow subscriber does not hold up the others:
+ *
+ *     STDREDIRECT_FANOUT* fanout = STDREDIRECT_createFanout(0);
+ *     STDREDIRECT_subscribe(fanout, &fileCallback, logFile, STDREDIRECT_SLOW_POLICY_WAIT);
+ *     STDREDIRECT_subscribe(fanout, &debuggerCallback, NULL, STDREDIRECT_SLOW_POLICY_LAP);
+ *     STDREDIRECT_REDIRECTION* redirection = STDREDIRECT_createWithFanout(STDREDIRECT_STREAM_STDOUT, fanout, STDREDIRECT_BEHAVIOUR_REDIRECT);
+ *
+ * When the ring is full, records not yet read by a ::STDREDIRECT_SLOW_POLICY_WAIT subscriber make the publisher wait,
+ * which holds back the pipe reader and eventually the writers. Records only ::STDREDIRECT_SLOW_POLICY_LAP subscribers
+ * have not read are overwritten; such a subscriber notices that it was lapped, skips to the oldest record left and
+ * counts what it missed, see STDREDIRECT_getLoss(). Subscribers may come and go while output is flowing.
+ */
+
+#ifndef STDREDIRECT_FANOUT_H
+#define STDREDIRECT_FANOUT_H
+
+#if defined (_MSC_VER) && (_MSC_VER >= 1020)
+#pragma once
+#endif
+
+#include "stdredirect.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/** @brief Maximum number of subscribers of a fanout. */
+#define STDREDIRECT_FANOUT_MAX_SUBSCRIBERS 16
+
+
+/** @brief Default ring capacity of a fanout. */
+const size_t STDREDIRECT_FANOUT_CAPACITY = 4 * 1024 * 1024;
+
+
+/** @brief Largest record in the ring, longer chunks are published in pieces. */
+const size_t STDREDIRECT_FANOUT_MAX_RECORD_LENGTH = 64 * 1024;
+
+
+/** @brief What the publisher does about a subscriber that has fallen a whole ring behind. */
+typedef enum STDREDIRECT_SLOW_POLICY {
+    STDREDIRECT_SLOW_POLICY_WAIT,       /**< wait for the subscriber, nothing is lost                            */
+    STDREDIRECT_SLOW_POLICY_LAP         /**< overwrite what it has not read, it skips ahead and counts the loss  */
+} STDREDIRECT_SLOW_POLICY;
+
+
+/** @brief Subscriber slot state. */
+typedef enum STDREDIRECT_SUBSCRIBER_STATE {
+    STDREDIRECT_SUBSCRIBER_STATE_FREE,      /**< slot unused                                                     */
+    STDREDIRECT_SUBSCRIBER_STATE_ACTIVE,    /**< reading                                                         */
+    STDREDIRECT_SUBSCRIBER_STATE_CLOSING    /**< reading up to closeAt, then its thread exits                    */
+} STDREDIRECT_SUBSCRIBER_STATE;
+
+
+/** @brief Ring record header. */
+typedef struct STDREDIRECT_FANOUT_RECORD {
+    size_t                length;               /**< number of bytes following the header                          */
+    long long             sequence;             /**< number of records published before                            */
+    long long             offset;               /**< number of bytes published before                              */
+} STDREDIRECT_FANOUT_RECORD;
+
+
+struct STDREDIRECT_FANOUT;
+
+
+/** @brief Subscriber of a fanout.
+ *
+ *  Returned by STDREDIRECT_subscribe(), valid until STDREDIRECT_unsubscribe().
+ */
+typedef struct STDREDIRECT_SUBSCRIBER {
+    /** @name Internal
+     *  DO NOT CHANGE THESE VARIABLES AT RUNTIME!
+     */
+    /*@{*/
+    struct STDREDIRECT_FANOUT* fanout;          /**< fanout the subscriber reads                                   */
+    STDREDIRECT_DATA_CALLBACK callback;         /**< receives one record per call                                  */
+    void*                 userdata;             /**< passed to callback                                            */
+    STDREDIRECT_SLOW_POLICY policy;             /**< what the publisher does when the subscriber falls behind      */
+    STDREDIRECT_ATOMIC    state;                /**< ::STDREDIRECT_SUBSCRIBER_STATE                                */
+    STDREDIRECT_ATOMIC    cursor;               /**< ring position of the next record to read                      */
+    STDREDIRECT_ATOMIC    closeAt;              /**< ring head when unsubscribing, read up to there                */
+    STDREDIRECT_ATOMIC    lostRecords;          /**< records overwritten before they were read                     */
+    STDREDIRECT_ATOMIC    lostBytes;            /**< bytes of these records                                        */
+    long long             nextSequence;         /**< sequence of the next record, -1 before the first one          */
+    long long             nextOffset;           /**< offset of the next record                                     */
+    char*                 buffer;               /**< record copied out of the ring                                 */
+    STDREDIRECT_THREAD    thread;               /**< subscriber thread                                             */
+    char                  padding[64];          /**< keep cursors of different subscribers in separate cache lines */
+    /*@}*/
+} STDREDIRECT_SUBSCRIBER;
+
+
+/** @brief Fanout.
+ *
+ *  Use STDREDIRECT_createFanout() to create one. Published to by one redirection at a time.
+ */
+typedef struct STDREDIRECT_FANOUT {
+    /** @name Internal
+     *  DO NOT CHANGE THESE VARIABLES AT RUNTIME!
+     */
+    /*@{*/
+    STDREDIRECT_RING      ring;                 /**< records, head is the end of the last one, tail the start of
+                                                     the oldest one not overwritten                                */
+    long long             sequence;             /**< records published                                             */
+    long long             offset;               /**< bytes published                                               */
+    STDREDIRECT_SUBSCRIBER subscribers[STDREDIRECT_FANOUT_MAX_SUBSCRIBERS]; /**< subscriber slots                   */
+    STDREDIRECT_MUTEX     subscribeLock;        /**< serializes subscribe and unsubscribe                          */
+    STDREDIRECT_MUTEX     waitLock;             /**< protects sleeping on the conditions                           */
+    STDREDIRECT_CONDITION dataCondition;        /**< wakes subscribers sleeping until a record is published        */
+    STDREDIRECT_CONDITION roomCondition;        /**< wakes the publisher sleeping until there is room              */
+    STDREDIRECT_ATOMIC    numSleeping;          /**< number of subscribers sleeping on dataCondition               */
+    STDREDIRECT_ATOMIC    isPublisherWaiting;   /**< publisher sleeps on roomCondition                             */
+    /*@}*/
+} STDREDIRECT_FANOUT;
+
+
+/* forward declarations */
+
+static STDREDIRECT_FANOUT*      STDREDIRECT_createFanout(size_t capacity);
+static void                     STDREDIRECT_destroyFanout(STDREDIRECT_FANOUT* fanout);
+static STDREDIRECT_REDIRECTION* STDREDIRECT_createWithFanout(STDREDIRECT_STREAM stream, STDREDIRECT_FANOUT* fanout, STDREDIRECT_BEHAVIOUR redirectionBehaviour);
+static STDREDIRECT_SUBSCRIBER*  STDREDIRECT_subscribe(STDREDIRECT_FANOUT* fanout, STDREDIRECT_DATA_CALLBACK callback, void* userdata, STDREDIRECT_SLOW_POLICY policy);
+static STDREDIRECT_ERROR        STDREDIRECT_unsubscribe(STDREDIRECT_SUBSCRIBER* subscriber);
+static STDREDIRECT_ERROR        STDREDIRECT_getLoss(STDREDIRECT_SUBSCRIBER* subscriber, long long* lostRecords, long long* lostBytes);
+static void                     STDREDIRECT_fanoutCallback(const char* data, size_t length, void* userdata);
+static void                     STDREDIRECT_publish(STDREDIRECT_FANOUT* fanout, const char* data, size_t length);
+static long long                STDREDIRECT_slowestCursor(STDREDIRECT_FANOUT* fanout, long long head);
+static STDREDIRECT_THREAD_RESULT STDREDIRECT_subscriberThread(void* parameter);
+
+
+/**
+ * @brief Create fanout without subscribers.
+ *
+ * @param capacity Ring capacity in bytes, rounded up to a power of two, 0 for STDREDIRECT_FANOUT_CAPACITY.
+ * @return Pointer to fanout, NULL on error.
+ */
+static STDREDIRECT_FANOUT* STDREDIRECT_createFanout(size_t capacity) {
+    STDREDIRECT_FANOUT* fanout;
+    size_t              i;
+
+    fanout = (STDREDIRECT_FANOUT*) malloc(sizeof(STDREDIRECT_FANOUT));
+    if (!fanout) {
+        return NULL;
+    }
+
+    if (capacity == 0) {
+        capacity = STDREDIRECT_FANOUT_CAPACITY;
+    }
+    for (fanout->ring.capacity = 1; fanout->ring.capacity < capacity || fanout->ring.capacity < 2 * (sizeof(STDREDIRECT_FANOUT_RECORD) + STDREDIRECT_FANOUT_MAX_RECORD_LENGTH); fanout->ring.capacity *= 2);
+    fanout->ring.data = (char*) malloc(fanout->ring.capacity);
+    if (!fanout->ring.data) {
+        free(fanout);
+        return NULL;
+    }
+    fanout->ring.head          = 0;
+    fanout->ring.tail          = 0;
+    fanout->sequence           = 0;
+    fanout->offset             = 0;
+    fanout->numSleeping        = 0;
+    fanout->isPublisherWaiting = FALSE;
+    for (i = 0; i < STDREDIRECT_FANOUT_MAX_SUBSCRIBERS; ++i) {
+        fanout->subscribers[i].state = STDREDIRECT_SUBSCRIBER_STATE_FREE;
+    }
+    STDREDIRECT_initMutex(&fanout->subscribeLock);
+    STDREDIRECT_initMutex(&fanout->waitLock);
+    STDREDIRECT_initCondition(&fanout->dataCondition);
+    STDREDIRECT_initCondition(&fanout->roomCondition);
+
+    return fanout;
+}
+
+
+/**
+ * @brief Unsubscribe all subscribers, after they read what was published, and destroy fanout.
+ *
+ * Redirections publishing to the fanout must have been unredirected.
+ *
+ * @param fanout Pointer to fanout.
+ */
+static void STDREDIRECT_destroyFanout(STDREDIRECT_FANOUT* fanout) {
+    size_t i;
+
+    if (fanout) {
+        for (i = 0; i < STDREDIRECT_FANOUT_MAX_SUBSCRIBERS; ++i) {
+            if (STDREDIRECT_atomicLoad(&fanout->subscribers[i].state) != STDREDIRECT_SUBSCRIBER_STATE_FREE) {
+                STDREDIRECT_unsubscribe(&fanout->subscribers[i]);
+            }
+        }
+        STDREDIRECT_destroyCondition(&fanout->roomCondition);
+        STDREDIRECT_destroyCondition(&fanout->dataCondition);
+        STDREDIRECT_destroyMutex(&fanout->waitLock);
+        STDREDIRECT_destroyMutex(&fanout->subscribeLock);
+        free(fanout->ring.data);
+        free(fanout);
+    }
+}
+
+
+/**
+ * @brief Allocate redirection object publishing its output to fanout.
+ *
+ * @param stream Stream to redirect.
+ * @param fanout Pointer to fanout.
+ * @param redirectionBehaviour Redirection behaviour.
+ * @return Pointer to allocated redirection object, NULL on error.
+ */
+static STDREDIRECT_REDIRECTION* STDREDIRECT_createWithFanout(STDREDIRECT_STREAM stream, STDREDIRECT_FANOUT* fanout, STDREDIRECT_BEHAVIOUR redirectionBehaviour) {
+    STDREDIRECT_OPTIONS options = STDREDIRECT_defaultOptions();
+
+    if (!fanout) {
+        return NULL;
+    }
+
+    options.behaviour    = redirectionBehaviour;
+    options.dataCallback = &STDREDIRECT_fanoutCallback;
+    options.userdata     = fanout;
+
+    return STDREDIRECT_createWithOptions(stream, &options);
+}
+
+
+/**
+ * @brief Add subscriber, also while output is flowing.
+ *
+ * The subscriber gets what is published from now on, its callback is called on a thread of its own. Losses of a
+ * lapped subscriber are counted from the first record it reads on.
+ *
+ * @param fanout Pointer to fanout.
+ * @param callback Receives the records, one per call.
+ * @param userdata Passed to callback.
+ * @param policy What the publisher does when the subscriber falls a whole ring behind.
+ * @return Pointer to subscriber, NULL on error or if all STDREDIRECT_FANOUT_MAX_SUBSCRIBERS slots are taken.
+ */
+static STDREDIRECT_SUBSCRIBER* STDREDIRECT_subscribe(STDREDIRECT_FANOUT* fanout, STDREDIRECT_DATA_CALLBACK callback, void* userdata, STDREDIRECT_SLOW_POLICY policy) {
+    STDREDIRECT_SUBSCRIBER* subscriber = NULL;
+    size_t                  i;
+
+    if (!fanout || !callback) {
+        return NULL;
+    }
+
+    STDREDIRECT_lock(&fanout->subscribeLock);
+    for (i = 0; i < STDREDIRECT_FANOUT_MAX_SUBSCRIBERS; ++i) {
+        if (STDREDIRECT_atomicLoad(&fanout->subscribers[i].state) == STDREDIRECT_SUBSCRIBER_STATE_FREE) {
+            subscriber = &fanout->subscribers[i];
+            break;
+        }
+    }
+    if (!subscriber) {
+        goto Error;
+    }
+
+    subscriber->buffer = (char*) malloc(STDREDIRECT_FANOUT_MAX_RECORD_LENGTH);
+    if (!subscriber->buffer) {
+        goto Error;
+    }
+    subscriber->fanout       = fanout;
+    subscriber->callback     = callback;
+    subscriber->userdata     = userdata;
+    subscriber->policy       = policy;
+    subscriber->lostRecords  = 0;
+    subscriber->lostBytes    = 0;
+    subscriber->nextSequence = -1;
+    subscriber->nextOffset   = 0;
+
+    /* once the publisher sees the slot, it keeps the records from the cursor on; the ones it overwrote while the
+       slot became visible are skipped by taking the head again */
+    STDREDIRECT_atomicStore(&subscriber->cursor, STDREDIRECT_atomicLoad(&fanout->ring.head));
+    STDREDIRECT_atomicStore(&subscriber->state, STDREDIRECT_SUBSCRIBER_STATE_ACTIVE);
+    STDREDIRECT_atomicStore(&subscriber->cursor, STDREDIRECT_atomicLoad(&fanout->ring.head));
+
+    if (STDREDIRECT_startThread(&subscriber->thread, &STDREDIRECT_subscriberThread, subscriber) == -1) {
+        STDREDIRECT_atomicStore(&subscriber->state, STDREDIRECT_SUBSCRIBER_STATE_FREE);
+        free(subscriber->buffer);
+        goto Error;
+    }
+    STDREDIRECT_unlock(&fanout->subscribeLock);
+
+    return subscriber;
+
+Error:
+    STDREDIRECT_unlock(&fanout->subscribeLock);
+
+    return NULL;
+}
+
+
+/**
+ * @brief Remove subscriber, also while output is flowing.
+ *
+ * Returns once the subscriber read what was published before the call and its thread exited. Must not be called from
+ * the callback of the subscriber.
+ *
+ * @param subscriber Pointer to subscriber.
+ * @return ::STDREDIRECT_ERROR, ::STDREDIRECT_ERROR_NOT_REDIRECTED if it is not subscribed (any more).
+ */
+static STDREDIRECT_ERROR STDREDIRECT_unsubscribe(STDREDIRECT_SUBSCRIBER* subscriber) {
+    STDREDIRECT_FANOUT* fanout;
+
+    if (!subscriber) {
+        return STDREDIRECT_ERROR_NULLPTR;
+    }
+    fanout = subscriber->fanout;
+
+    STDREDIRECT_lock(&fanout->subscribeLock);
+    if (STDREDIRECT_atomicLoad(&subscriber->state) != STDREDIRECT_SUBSCRIBER_STATE_ACTIVE) {
+        STDREDIRECT_unlock(&fanout->subscribeLock);
+        return STDREDIRECT_ERROR_NOT_REDIRECTED;
+    }
+
+    STDREDIRECT_atomicStore(&subscriber->closeAt, STDREDIRECT_atomicLoad(&fanout->ring.head));
+    STDREDIRECT_atomicStore(&subscriber->state, STDREDIRECT_SUBSCRIBER_STATE_CLOSING);
+    STDREDIRECT_lock(&fanout->waitLock);
+    STDREDIRECT_broadcast(&fanout->dataCondition);
+    STDREDIRECT_unlock(&fanout->waitLock);
+
+    STDREDIRECT_joinThread(subscriber->thread);
+    free(subscriber->buffer);
+
+    /* a publisher waiting for this subscriber may go on */
+    STDREDIRECT_atomicStore(&subscriber->state, STDREDIRECT_SUBSCRIBER_STATE_FREE);
+    STDREDIRECT_lock(&fanout->waitLock);
+    STDREDIRECT_broadcast(&fanout->roomCondition);
+    STDREDIRECT_unlock(&fanout->waitLock);
+    STDREDIRECT_unlock(&fanout->subscribeLock);
+
+    return STDREDIRECT_ERROR_NO_ERROR;
+}
+
+
+/**
+ * @brief Get what a lapped subscriber missed.
+ *
+ * @param subscriber Pointer to subscriber.
+ * @param lostRecords Receives the number of records overwritten before the subscriber read them.
+ * @param lostBytes Receives the number of bytes of these records.
+ * @return ::STDREDIRECT_ERROR
+ */
+static STDREDIRECT_ERROR STDREDIRECT_getLoss(STDREDIRECT_SUBSCRIBER* subscriber, long long* lostRecords, long long* lostBytes) {
+    if (!subscriber || !lostRecords || !lostBytes) {
+        return STDREDIRECT_ERROR_NULLPTR;
+    }
+
+    *lostRecords = STDREDIRECT_atomicLoad(&subscriber->lostRecords);
+    *lostBytes   = STDREDIRECT_atomicLoad(&subscriber->lostBytes);
+
+    return STDREDIRECT_ERROR_NO_ERROR;
+}
+
+
+/**
+ * @brief Data callback publishing a chunk to the subscribers.
+ *
+ * Set as STDREDIRECT_OPTIONS::dataCallback with the fanout as STDREDIRECT_OPTIONS::userdata. Chunks longer than
+ * STDREDIRECT_FANOUT_MAX_RECORD_LENGTH are published in pieces.
+ *
+ * @param data Chunk.
+ * @param length Number of bytes.
+ * @param userdata Pointer to fanout.
+ */
+static void STDREDIRECT_fanoutCallback(const char* data, size_t length, void* userdata) {
+    STDREDIRECT_FANOUT* fanout = (STDREDIRECT_FANOUT*) userdata;
+    size_t              numBytesToPublish;
+
+    for (; length > 0; data += numBytesToPublish, length -= numBytesToPublish) {
+        numBytesToPublish = length < STDREDIRECT_FANOUT_MAX_RECORD_LENGTH ? length : STDREDIRECT_FANOUT_MAX_RECORD_LENGTH;
+        STDREDIRECT_publish(fanout, data, numBytesToPublish);
+    }
+}
+
+
+/**
+ * @brief Write record into the ring and wake sleeping subscribers, the only writer of the ring.
+ *
+ * Waits until the slowest ::STDREDIRECT_SLOW_POLICY_WAIT subscriber leaves room, then overwrites the oldest records,
+ * which only lapping subscribers may not have read yet.
+ *
+ * @param fanout Pointer to fanout.
+ * @param data Data.
+ * @param length Number of bytes, at most STDREDIRECT_FANOUT_MAX_RECORD_LENGTH.
+ */
+static void STDREDIRECT_publish(STDREDIRECT_FANOUT* fanout, const char* data, size_t length) {
+    STDREDIRECT_RING*         ring     = &fanout->ring;
+    long long                 capacity = (long long) ring->capacity;
+    long long                 head     = STDREDIRECT_atomicLoad(&ring->head);
+    long long                 end      = head + (long long) (sizeof(STDREDIRECT_FANOUT_RECORD) + length);
+    long long                 tail     = STDREDIRECT_atomicLoad(&ring->tail);
+    long long                 oldTail  = tail;
+    STDREDIRECT_FANOUT_RECORD record;
+
+    if (end - STDREDIRECT_slowestCursor(fanout, head) > capacity) {
+        STDREDIRECT_lock(&fanout->waitLock);
+        STDREDIRECT_atomicStore(&fanout->isPublisherWaiting, TRUE);
+        while (end - STDREDIRECT_slowestCursor(fanout, head) > capacity) {
+            STDREDIRECT_wait(&fanout->roomCondition, &fanout->waitLock);
+        }
+        STDREDIRECT_atomicStore(&fanout->isPublisherWaiting, FALSE);
+        STDREDIRECT_unlock(&fanout->waitLock);
+    }
+
+    /* move tail past the records about to be overwritten before writing, so lapped subscribers notice torn copies */
+    while (end - tail > capacity) {
+        STDREDIRECT_ringCopyOut(ring, tail, &record, sizeof(record));
+        tail += (long long) (sizeof(record) + record.length);
+    }
+    if (tail != oldTail) {
+        STDREDIRECT_atomicCompareExchange(&ring->tail, oldTail, tail);
+    }
+
+    record.length   = length;
+    record.sequence = fanout->sequence++;
+    record.offset   = fanout->offset;
+    fanout->offset += (long long) length;
+    STDREDIRECT_ringCopyIn(ring, head, &record, sizeof(record));
+    STDREDIRECT_ringCopyIn(ring, head + (long long) sizeof(record), data, length);
+    STDREDIRECT_atomicStore(&ring->head, end);
+
+    if (STDREDIRECT_atomicLoad(&fanout->numSleeping) > 0) {
+        STDREDIRECT_lock(&fanout->waitLock);
+        STDREDIRECT_broadcast(&fanout->dataCondition);
+        STDREDIRECT_unlock(&fanout->waitLock);
+    }
+}
+
+
+/**
+ * @brief Cursor of the slowest subscriber the publisher waits for.
+ *
+ * @param fanout Pointer to fanout.
+ * @param head Ring head.
+ * @return Smallest cursor of the ::STDREDIRECT_SLOW_POLICY_WAIT subscribers, @p head if there are none.
+ */
+static long long STDREDIRECT_slowestCursor(STDREDIRECT_FANOUT* fanout, long long head) {
+    STDREDIRECT_SUBSCRIBER* subscriber;
+    long long               slowest = head;
+    long long               cursor;
+    size_t                  i;
+
+    for (i = 0; i < STDREDIRECT_FANOUT_MAX_SUBSCRIBERS; ++i) {
+        subscriber = &fanout->subscribers[i];
+        if (STDREDIRECT_atomicLoad(&subscriber->state) != STDREDIRECT_SUBSCRIBER_STATE_FREE && subscriber->policy == STDREDIRECT_SLOW_POLICY_WAIT) {
+            cursor = STDREDIRECT_atomicLoad(&subscriber->cursor);
+            if (cursor < slowest) {
+                slowest = cursor;
+            }
+        }
+    }
+
+    return slowest;
+}
+
+
+/**
+ * @brief Subscriber thread, reads the ring and calls the subscriber callback until unsubscribed.
+ *
+ * A waiting subscriber gets records that do not wrap around straight from the ring, the publisher does not overwrite
+ * them before the cursor moves on. A lapping subscriber copies each record and checks the tail afterwards, if the
+ * publisher moved it past the cursor meanwhile the copy may be torn and the subscriber continues at the tail.
+ *
+ * @param parameter Pointer to subscriber.
+ * @return 0.
+ */
+static STDREDIRECT_THREAD_RESULT STDREDIRECT_subscriberThread(void* parameter) {
+    STDREDIRECT_SUBSCRIBER*   subscriber = (STDREDIRECT_SUBSCRIBER*) parameter;
+    STDREDIRECT_FANOUT*       fanout     = subscriber->fanout;
+    STDREDIRECT_RING*         ring       = &fanout->ring;
+    long long                 cursor     = STDREDIRECT_atomicLoad(&subscriber->cursor);
+    STDREDIRECT_FANOUT_RECORD record;
+    const char*               data;
+    size_t                    offset;
+    long long                 tail;
+
+    for (;;) {
+        if (STDREDIRECT_atomicLoad(&subscriber->state) == STDREDIRECT_SUBSCRIBER_STATE_CLOSING && cursor >= STDREDIRECT_atomicLoad(&subscriber->closeAt)) {
+            break;
+        }
+
+        if (cursor == STDREDIRECT_atomicLoad(&ring->head)) {
+            /* sleep until the publisher wrote a record or unsubscribe is requested */
+            STDREDIRECT_lock(&fanout->waitLock);
+            STDREDIRECT_atomicAdd(&fanout->numSleeping, 1);
+            if (cursor == STDREDIRECT_atomicLoad(&ring->head) && STDREDIRECT_atomicLoad(&subscriber->state) == STDREDIRECT_SUBSCRIBER_STATE_ACTIVE) {
+                STDREDIRECT_wait(&fanout->dataCondition, &fanout->waitLock);
+            }
+            STDREDIRECT_atomicAdd(&fanout->numSleeping, -1);
+            STDREDIRECT_unlock(&fanout->waitLock);
+            continue;
+        }
+
+        STDREDIRECT_ringCopyOut(ring, cursor, &record, sizeof(record));
+        offset = (size_t) (cursor + (long long) sizeof(record)) & (ring->capacity - 1);
+        if (subscriber->policy == STDREDIRECT_SLOW_POLICY_WAIT && offset + record.length <= ring->capacity) {
+            data = ring->data + offset;
+        }
+        else {
+            if (record.length <= STDREDIRECT_FANOUT_MAX_RECORD_LENGTH) {
+                STDREDIRECT_ringCopyOut(ring, cursor + (long long) sizeof(record), subscriber->buffer, record.length);
+            }
+            data = subscriber->buffer;
+        }
+
+        if (subscriber->policy == STDREDIRECT_SLOW_POLICY_LAP) {
+            /* the copy is complete before the tail is looked at */
+            STDREDIRECT_acquireFence();
+            tail = STDREDIRECT_atomicLoad(&ring->tail);
+            if (cursor < tail) {
+                cursor = tail;
+                continue;
+            }
+        }
+
+        if (subscriber->nextSequence != -1 && record.sequence != subscriber->nextSequence) {
+            STDREDIRECT_atomicAdd(&subscriber->lostRecords, record.sequence - subscriber->nextSequence);
+            STDREDIRECT_atomicAdd(&subscriber->lostBytes, record.offset - subscriber->nextOffset);
+        }
+        subscriber->nextSequence = record.sequence + 1;
+        subscriber->nextOffset = record.offset + (long long) record.length;
+
+        subscriber->callback(data, record.length, subscriber->userdata);
+
+        cursor += (long long) (sizeof(record) + record.length);
+        STDREDIRECT_atomicStore(&subscriber->cursor, cursor);
+        if (STDREDIRECT_atomicLoad(&fanout->isPublisherWaiting)) {
+            STDREDIRECT_lock(&fanout->waitLock);
+            STDREDIRECT_broadcast(&fanout->roomCondition);
+            STDREDIRECT_unlock(&fanout->waitLock);
+        }
+    }
+
+    return 0;
+}
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* STDREDIRECT_FANOUT_H */
@@ -0,0 +1,554 @@
+/***********************************************************************************************************************
+* stdredirect_filesink.h
+*
+* Memory-mapped rotating log file sink for stdredirect.
+* https://github.com/biosmanager/stdredirect
+*
+*
+* MIT License
+*
+* Copyright (c) 2018 Matthias Albrecht
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+***********************************************************************************************************************/
+
+/**
+ * @file stdredirect_filesink.h
+ * @author Matthias Albrecht
+ * @brief Memory-mapped rotating log file sink for stdredirect.
+ *
+ * Chunks are copied straight into a preallocated, memory-mapped file. Once the file is full it is renamed to
+ * "<path>.1" (older files move on to "<path>.2" and so on) and a new one is started. Everything copied into the
+ * mapping is in the page cache right away and survives a crash of the process; how often it is written back to disk
+ * is set by ::STDREDIRECT_FILESINK_SYNC. The file is truncated to the written length when it is closed, the file of
+ * a crashed process is padded with null bytes up to its preallocated size and is continued after the last non-null
+ * byte when it is opened again.
+ */
+
+#ifndef STDREDIRECT_FILESINK_H
+#define STDREDIRECT_FILESINK_H
+
+#if defined (_MSC_VER) && (_MSC_VER >= 1020)
+#pragma once
+#endif
+
+#include "stdredirect.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif /* _WIN32 */
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/** @brief Default size of a log file. */
+const size_t STDREDIRECT_FILESINK_FILE_SIZE = 64 * 1024 * 1024;
+
+
+/** @brief Default number of rotated log files kept. */
+const unsigned int STDREDIRECT_FILESINK_MAX_FILES = 4;
+
+
+/** @brief Default number of bytes between sync points. */
+const size_t STDREDIRECT_FILESINK_SYNC_SIZE = 1024 * 1024;
+
+
+/** @brief When written data is pushed to disk. */
+typedef enum STDREDIRECT_FILESINK_SYNC {
+    STDREDIRECT_FILESINK_SYNC_NONE,         /**< left to the OS, survives a crash of the process but not of the system     */
+    STDREDIRECT_FILESINK_SYNC_ASYNC,        /**< start write-back at every sync point (msync(MS_ASYNC), FlushViewOfFile())  */
+    STDREDIRECT_FILESINK_SYNC_SYNC          /**< wait for write-back at every sync point (msync(MS_SYNC), also
+                                                 FlushFileBuffers() on Windows), survives a crash of the system           */
+} STDREDIRECT_FILESINK_SYNC;
+
+
+/** @brief Access pattern hint for the mapping, ignored on Windows. */
+typedef enum STDREDIRECT_FILESINK_ADVICE {
+    STDREDIRECT_FILESINK_ADVICE_NORMAL,     /**< no hint                                                                    */
+    STDREDIRECT_FILESINK_ADVICE_SEQUENTIAL, /**< madvise(MADV_SEQUENTIAL) on the mapping                                    */
+    STDREDIRECT_FILESINK_ADVICE_DONTNEED    /**< also madvise(MADV_DONTNEED) written pages at every sync point, keeps the
+                                                 resident set small                                                        */
+} STDREDIRECT_FILESINK_ADVICE;
+
+
+/** @brief File sink options.
+ *
+ *  Use STDREDIRECT_defaultFileSinkOptions() to initialize, then pass to STDREDIRECT_createFileSink().
+ */
+typedef struct STDREDIRECT_FILESINK_OPTIONS {
+    const char*               path;             /**< log file path, copied                                          */
+    size_t                    fileSize;         /**< size of a log file, defaults to STDREDIRECT_FILESINK_FILE_SIZE  */
+    unsigned int              maxFiles;         /**< rotated files kept next to the active one, defaults to
+                                                     STDREDIRECT_FILESINK_MAX_FILES, 0 starts over in place        */
+    STDREDIRECT_FILESINK_SYNC sync;             /**< sync policy, defaults to ::STDREDIRECT_FILESINK_SYNC_NONE      */
+    size_t                    syncSize;         /**< bytes between sync points, defaults to
+                                                     STDREDIRECT_FILESINK_SYNC_SIZE                                 */
+    STDREDIRECT_FILESINK_ADVICE advice;         /**< mapping hint, defaults to ::STDREDIRECT_FILESINK_ADVICE_SEQUENTIAL */
+    int                       isStrippingEscapes; /**< redirections created with STDREDIRECT_createWithFileSink() remove
+                                                     ANSI escape sequences, so colored output is logged as plain text,
+                                                     defaults to FALSE                                              */
+} STDREDIRECT_FILESINK_OPTIONS;
+
+
+/** @brief Memory-mapped rotating log file.
+ *
+ *  Use STDREDIRECT_createFileSink() to create one. Can be shared by several redirections.
+ */
+typedef struct STDREDIRECT_FILESINK {
+    /** @name State
+     *  Use the these variables to check the state of the sink. Read only!
+     */
+    /*@{*/
+    STDREDIRECT_ERROR     error;                /**< [read] ::STDREDIRECT_ERROR_SINK once writing failed, data is dropped */
+    size_t                droppedBytes;         /**< [read] bytes dropped after writing failed                       */
+    /*@}*/
+
+    /** @name Internal
+     *  DO NOT CHANGE THESE VARIABLES AT RUNTIME!
+     */
+    /*@{*/
+    STDREDIRECT_FILESINK_OPTIONS options;       /**< options, path points to path                                   */
+    char*                 path;                 /**< log file path                                                  */
+    char*                 rotatedPath;          /**< room for log file path with rotation suffix                    */
+    char*                 olderPath;            /**< room for log file path with next rotation suffix               */
+#ifdef _WIN32
+    HANDLE                file;                 /**< active log file                                                */
+    HANDLE                mapping;              /**< file mapping object of active log file                         */
+#else
+    int                   fileDescriptor;       /**< active log file                                                */
+#endif /* _WIN32 */
+    char*                 data;                 /**< mapping of active log file                                     */
+    size_t                mappingSize;          /**< size of mapping                                                */
+    size_t                length;               /**< bytes written to active log file                               */
+    size_t                syncedLength;         /**< bytes of active log file up to the last sync point             */
+    STDREDIRECT_MUTEX     lock;                 /**< serializes redirections sharing the sink                       */
+    /*@}*/
+
+} STDREDIRECT_FILESINK;
+
+
+/* forward declarations */
+
+static STDREDIRECT_FILESINK*        STDREDIRECT_createFileSink(const STDREDIRECT_FILESINK_OPTIONS* options);
+static STDREDIRECT_FILESINK_OPTIONS STDREDIRECT_defaultFileSinkOptions(const char* path);
+static STDREDIRECT_ERROR            STDREDIRECT_destroyFileSink(STDREDIRECT_FILESINK* sink);
+static STDREDIRECT_REDIRECTION*     STDREDIRECT_createWithFileSink(STDREDIRECT_STREAM stream, STDREDIRECT_FILESINK* sink, STDREDIRECT_BEHAVIOUR redirectionBehaviour);
+static void                         STDREDIRECT_fileSinkCallback(const char* data, size_t length, void* userdata);
+static int                          STDREDIRECT_openFileSinkFile(STDREDIRECT_FILESINK* sink);
+static int                          STDREDIRECT_closeFileSinkFile(STDREDIRECT_FILESINK* sink);
+static int                          STDREDIRECT_rotateFileSink(STDREDIRECT_FILESINK* sink);
+static void                         STDREDIRECT_syncFileSink(STDREDIRECT_FILESINK* sink);
+
+
+/**
+ * @brief Create file sink and open its log file.
+ *
+ * @param options File sink options, see STDREDIRECT_defaultFileSinkOptions().
+ * @return Pointer to file sink, NULL on error.
+ */
+static STDREDIRECT_FILESINK* STDREDIRECT_createFileSink(const STDREDIRECT_FILESINK_OPTIONS* options) {
+    STDREDIRECT_FILESINK* sink;
+    size_t                pathLength;
+
+    if (!options || !options->path || options->fileSize == 0 || options->syncSize == 0) {
+        return NULL;
+    }
+
+    sink = (STDREDIRECT_FILESINK*) malloc(sizeof(STDREDIRECT_FILESINK));
+    if (!sink) {
+        return NULL;
+    }
+
+    /* rotated path gets a "." and up to 10 digits appended */
+    pathLength = strlen(options->path);
+    sink->path = (char*) malloc(pathLength + 1);
+    sink->rotatedPath = (char*) malloc(pathLength + 12);
+    sink->olderPath = (char*) malloc(pathLength + 12);
+    if (!sink->path || !sink->rotatedPath || !sink->olderPath) {
+        free(sink->path);
+        free(sink->rotatedPath);
+        free(sink->olderPath);
+        free(sink);
+        return NULL;
+    }
+    memcpy(sink->path, options->path, pathLength + 1);
+
+    sink->error                 = STDREDIRECT_ERROR_NO_ERROR;
+    sink->droppedBytes          = 0;
+    sink->options               = *options;
+    sink->options.path          = sink->path;
+#ifdef _WIN32
+    sink->file                  = INVALID_HANDLE_VALUE;
+    sink->mapping               = NULL;
+#else
+    sink->fileDescriptor        = -1;
+#endif /* _WIN32 */
+    sink->data                  = NULL;
+    sink->mappingSize           = 0;
+    sink->length                = 0;
+    sink->syncedLength          = 0;
+
+    if (STDREDIRECT_openFileSinkFile(sink) == -1) {
+        STDREDIRECT_closeFileSinkFile(sink);
+        free(sink->path);
+        free(sink->rotatedPath);
+        free(sink->olderPath);
+        free(sink);
+        return NULL;
+    }
+
+    STDREDIRECT_initMutex(&sink->lock);
+
+    return sink;
+}
+
+
+/**
+ * @brief Get default file sink options.
+ *
+ * @param path Log file path.
+ * @return Options with files of STDREDIRECT_FILESINK_FILE_SIZE bytes, STDREDIRECT_FILESINK_MAX_FILES rotated files, ::STDREDIRECT_FILESINK_SYNC_NONE and ::STDREDIRECT_FILESINK_ADVICE_SEQUENTIAL.
+ */
+static STDREDIRECT_FILESINK_OPTIONS STDREDIRECT_defaultFileSinkOptions(const char* path) {
+    STDREDIRECT_FILESINK_OPTIONS options;
+
+    options.path     = path;
+    options.fileSize = STDREDIRECT_FILESINK_FILE_SIZE;
+    options.maxFiles = STDREDIRECT_FILESINK_MAX_FILES;
+    options.sync     = STDREDIRECT_FILESINK_SYNC_NONE;
+    options.syncSize = STDREDIRECT_FILESINK_SYNC_SIZE;
+    options.advice   = STDREDIRECT_FILESINK_ADVICE_SEQUENTIAL;
+    options.isStrippingEscapes = FALSE;
+
+    return options;
+}
+
+
+/**
+ * @brief Close log file and destroy file sink.
+ *
+ * Redirections writing to the sink must have been unredirected.
+ *
+ * @param sink Pointer to file sink.
+ * @return ::STDREDIRECT_ERROR
+ */
+static STDREDIRECT_ERROR STDREDIRECT_destroyFileSink(STDREDIRECT_FILESINK* sink) {
+    STDREDIRECT_ERROR error;
+
+    if (!sink) {
+        return STDREDIRECT_ERROR_NULLPTR;
+    }
+
+    error = sink->error;
+    if (STDREDIRECT_closeFileSinkFile(sink) == -1) {
+        error = STDREDIRECT_ERROR_SINK;
+    }
+    STDREDIRECT_destroyMutex(&sink->lock);
+    free(sink->path);
+    free(sink->rotatedPath);
+    free(sink->olderPath);
+    free(sink);
+
+    return error;
+}
+
+
+/**
+ * @brief Allocate redirection object writing to file sink.
+ *
+ * @param stream Stream to redirect.
+ * @param sink Pointer to file sink.
+ * @param redirectionBehaviour Redirection behaviour.
+ * @return Pointer to allocated redirection object, NULL on error.
+ */
+static STDREDIRECT_REDIRECTION* STDREDIRECT_createWithFileSink(STDREDIRECT_STREAM stream, STDREDIRECT_FILESINK* sink, STDREDIRECT_BEHAVIOUR redirectionBehaviour) {
+    STDREDIRECT_OPTIONS options = STDREDIRECT_defaultOptions();
+
+    if (!sink) {
+        return NULL;
+    }
+
+    options.behaviour          = redirectionBehaviour;
+    options.dataCallback       = &STDREDIRECT_fileSinkCallback;
+    options.userdata           = sink;
+    options.isStrippingEscapes = sink->options.isStrippingEscapes;
+
+    return STDREDIRECT_createWithOptions(stream, &options);
+}
+
+
+/**
+ * @brief Data callback copying chunk into the log file, rotates it when full.
+ *
+ * Set as STDREDIRECT_OPTIONS::dataCallback with the file sink as STDREDIRECT_OPTIONS::userdata.
+ *
+ * @param data Chunk.
+ * @param length Number of bytes.
+ * @param userdata Pointer to file sink.
+ */
+static void STDREDIRECT_fileSinkCallback(const char* data, size_t length, void* userdata) {
+    STDREDIRECT_FILESINK* sink = (STDREDIRECT_FILESINK*) userdata;
+    size_t                numBytesToCopy;
+
+    STDREDIRECT_lock(&sink->lock);
+
+    while (length > 0) {
+        if (sink->error != STDREDIRECT_ERROR_NO_ERROR) {
+            sink->droppedBytes += length;
+            break;
+        }
+
+        numBytesToCopy = sink->options.fileSize - sink->length;
+        if (numBytesToCopy > length) {
+            numBytesToCopy = length;
+        }
+        memcpy(sink->data + sink->length, data, numBytesToCopy);
+        sink->length += numBytesToCopy;
+        data += numBytesToCopy;
+        length -= numBytesToCopy;
+
+        if (sink->length - sink->syncedLength >= sink->options.syncSize) {
+            STDREDIRECT_syncFileSink(sink);
+        }
+        if (sink->length == sink->options.fileSize && STDREDIRECT_rotateFileSink(sink) == -1) {
+            sink->error = STDREDIRECT_ERROR_SINK;
+        }
+    }
+
+    STDREDIRECT_unlock(&sink->lock);
+}
+
+
+/**
+ * @brief Open and map log file, preallocating it to STDREDIRECT_FILESINK_OPTIONS::fileSize bytes.
+ *
+ * An existing log file is continued after its last non-null byte.
+ *
+ * @param sink Pointer to file sink.
+ * @return 0 on success, -1 on error.
+ */
+static int STDREDIRECT_openFileSinkFile(STDREDIRECT_FILESINK* sink) {
+    size_t existingSize;
+#ifdef _WIN32
+    LARGE_INTEGER fileSize;
+
+    sink->file = CreateFileA(sink->path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (sink->file == INVALID_HANDLE_VALUE) {
+        return -1;
+    }
+    if (!GetFileSizeEx(sink->file, &fileSize)) {
+        return -1;
+    }
+    existingSize = (size_t) fileSize.QuadPart;
+
+    /* mapping grows the file to its size */
+    sink->mappingSize = existingSize > sink->options.fileSize ? existingSize : sink->options.fileSize;
+    fileSize.QuadPart = (LONGLONG) sink->mappingSize;
+    sink->mapping = CreateFileMappingA(sink->file, NULL, PAGE_READWRITE, (DWORD) (fileSize.QuadPart >> 32), (DWORD) fileSize.QuadPart, NULL);
+    if (sink->mapping == NULL) {
+        return -1;
+    }
+    sink->data = (char*) MapViewOfFile(sink->mapping, FILE_MAP_WRITE, 0, 0, 0);
+    if (sink->data == NULL) {
+        return -1;
+    }
+#else
+    struct stat status;
+
+    sink->fileDescriptor = open(sink->path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (sink->fileDescriptor == -1) {
+        return -1;
+    }
+    if (fstat(sink->fileDescriptor, &status) == -1) {
+        return -1;
+    }
+    existingSize = (size_t) status.st_size;
+
+    /* reserve disk blocks up front so writing to the mapping cannot fail with SIGBUS on a full disk */
+    sink->mappingSize = existingSize > sink->options.fileSize ? existingSize : sink->options.fileSize;
+#ifdef __linux__
+    if (posix_fallocate(sink->fileDescriptor, 0, (off_t) sink->mappingSize) != 0 && ftruncate(sink->fileDescriptor, (off_t) sink->mappingSize) == -1) {
+        return -1;
+    }
+#else
+    if (ftruncate(sink->fileDescriptor, (off_t) sink->mappingSize) == -1) {
+        return -1;
+    }
+#endif /* __linux__ */
+
+    sink->data = (char*) mmap(NULL, sink->mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, sink->fileDescriptor, 0);
+    if (sink->data == MAP_FAILED) {
+        sink->data = NULL;
+        return -1;
+    }
+    if (sink->options.advice != STDREDIRECT_FILESINK_ADVICE_NORMAL) {
+        madvise(sink->data, sink->mappingSize, MADV_SEQUENTIAL);
+    }
+#endif /* _WIN32 */
+
+    /* continue after data written before, possibly by a crashed process */
+    sink->length = existingSize;
+    while (sink->length > 0 && sink->data[sink->length - 1] == '\0') {
+        --sink->length;
+    }
+    sink->syncedLength = sink->length;
+
+    /* rotate right away if there is no room left */
+    if (sink->length >= sink->options.fileSize) {
+        return STDREDIRECT_rotateFileSink(sink);
+    }
+
+    return 0;
+}
+
+
+/**
+ * @brief Sync, unmap and close log file, truncating it to the written length.
+ *
+ * @param sink Pointer to file sink.
+ * @return 0 on success, -1 on error.
+ */
+static int STDREDIRECT_closeFileSinkFile(STDREDIRECT_FILESINK* sink) {
+    int result = 0;
+#ifdef _WIN32
+    LARGE_INTEGER length;
+
+    if (sink->data) {
+        STDREDIRECT_syncFileSink(sink);
+        if (!UnmapViewOfFile(sink->data)) {
+            result = -1;
+        }
+        sink->data = NULL;
+    }
+    if (sink->mapping) {
+        if (!CloseHandle(sink->mapping)) {
+            result = -1;
+        }
+        sink->mapping = NULL;
+    }
+    if (sink->file != INVALID_HANDLE_VALUE) {
+        length.QuadPart = (LONGLONG) sink->length;
+        if (!SetFilePointerEx(sink->file, length, NULL, FILE_BEGIN) || !SetEndOfFile(sink->file) || !CloseHandle(sink->file)) {
+            result = -1;
+        }
+        sink->file = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (sink->data) {
+        STDREDIRECT_syncFileSink(sink);
+        if (munmap(sink->data, sink->mappingSize) == -1) {
+            result = -1;
+        }
+        sink->data = NULL;
+    }
+    if (sink->fileDescriptor != -1) {
+        if (ftruncate(sink->fileDescriptor, (off_t) sink->length) == -1) {
+            result = -1;
+        }
+        if (close(sink->fileDescriptor) == -1) {
+            result = -1;
+        }
+        sink->fileDescriptor = -1;
+    }
+#endif /* _WIN32 */
+
+    sink->length = 0;
+    sink->syncedLength = 0;
+
+    return result;
+}
+
+
+/**
+ * @brief Close full log file, shift rotated files and open a new one.
+ *
+ * @param sink Pointer to file sink.
+ * @return 0 on success, -1 on error.
+ */
+static int STDREDIRECT_rotateFileSink(STDREDIRECT_FILESINK* sink) {
+    unsigned int i;
+
+    if (STDREDIRECT_closeFileSinkFile(sink) == -1) {
+        return -1;
+    }
+
+    /* <path>.(n-1) -> <path>.n, ..., <path> -> <path>.1, the oldest one is replaced; missing files are skipped */
+    for (i = sink->options.maxFiles; i > 0; --i) {
+        sprintf(sink->olderPath, "%s.%u", sink->path, i);
+        if (i > 1) {
+            sprintf(sink->rotatedPath, "%s.%u", sink->path, i - 1);
+        }
+        else {
+            strcpy(sink->rotatedPath, sink->path);
+        }
+#ifdef _WIN32
+        MoveFileExA(sink->rotatedPath, sink->olderPath, MOVEFILE_REPLACE_EXISTING);
+#else
+        rename(sink->rotatedPath, sink->olderPath);
+#endif /* _WIN32 */
+    }
+    if (sink->options.maxFiles == 0) {
+        remove(sink->path);
+    }
+
+    return STDREDIRECT_openFileSinkFile(sink);
+}
+
+
+/**
+ * @brief Sync point, apply sync policy and advice to the bytes written since the last one.
+ *
+ * @param sink Pointer to file sink.
+ */
+static void STDREDIRECT_syncFileSink(STDREDIRECT_FILESINK* sink) {
+#ifdef _WIN32
+    if (sink->options.sync != STDREDIRECT_FILESINK_SYNC_NONE && sink->length > sink->syncedLength) {
+        FlushViewOfFile(sink->data + sink->syncedLength, sink->length - sink->syncedLength);
+        if (sink->options.sync == STDREDIRECT_FILESINK_SYNC_SYNC) {
+            FlushFileBuffers(sink->file);
+        }
+    }
+#else
+    size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+    size_t begin    = sink->syncedLength / pageSize * pageSize;
+    size_t end      = sink->length / pageSize * pageSize;
+
+    if (sink->options.sync != STDREDIRECT_FILESINK_SYNC_NONE && sink->length > begin) {
+        msync(sink->data + begin, sink->length - begin, sink->options.sync == STDREDIRECT_FILESINK_SYNC_SYNC ? MS_SYNC : MS_ASYNC);
+    }
+
+    /* only whole pages, the last one is still written to */
+    if (sink->options.advice == STDREDIRECT_FILESINK_ADVICE_DONTNEED && end > begin) {
+        madvise(sink->data + begin, end - begin, MADV_DONTNEED);
+    }
+#endif /* _WIN32 */
+
+    sink->syncedLength = sink->length;
+}
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* STDREDIRECT_FILESINK_H */
@@ -0,0 +1,259 @@
+/***********************************************************************************************************************
+* stdredirect_records.h
+*
+* Compact binary encoding of stdredirect records.
+* https://github.com/biosmanager/stdredirect
+*
+*
+* MIT License
+*
+* Copyright (c) 2018 Matthias Albrecht
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+***********************************************************************************************************************/
+
+/**
+ * @file stdredirect_records.h
+ * @author Matthias Albrecht
+ * @brief Compact binary encoding of stdredirect records.
+ *
+ * Every record is self-contained, so a stream of them can be appended to any file and decoded from the start:
+ *
+ *     tag             1 byte   0xA0 | STDREDIRECT_STREAM
+ *     length          varint
+ *     timestamp       varint   STDREDIRECT_RECORD::timestamp in microseconds
+ *     sequence        varint   STDREDIRECT_RECORD::sequence
+ *     globalSequence  varint   STDREDIRECT_RECORD::globalSequence
+ *     data            length bytes
+ *
+ * Varints are unsigned LEB128, 7 bits per byte, least significant group first, high bit set on all but the last byte.
+ * A typical line costs about a dozen bytes of header and no text formatting. Use STDREDIRECT_RECORD_WRITER to encode
+ * records into a data callback such as STDREDIRECT_fileSinkCallback(), stdredirect_decode.c prints them as text.
+ */
+
+#ifndef STDREDIRECT_RECORDS_H
+#define STDREDIRECT_RECORDS_H
+
+#if defined (_MSC_VER) && (_MSC_VER >= 1020)
+#pragma once
+#endif
+
+#include "stdredirect.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/** @brief Maximum size of an encoded record header: tag and four varints of up to 10 bytes. */
+const size_t STDREDIRECT_RECORD_MAX_HEADER_SIZE = 1 + 4 * 10;
+
+
+/** @brief Record tag, the low bits hold the stream. */
+const unsigned char STDREDIRECT_RECORD_TAG = 0xA0;
+
+
+/** @brief Encodes records and passes them on to a data callback.
+ *
+ *  Use STDREDIRECT_initRecordWriter() to initialize, then set STDREDIRECT_recordWriterCallback() as
+ *  STDREDIRECT_OPTIONS::recordCallback with the writer as STDREDIRECT_OPTIONS::userdata. Can be shared by several
+ *  redirections.
+ */
+typedef struct STDREDIRECT_RECORD_WRITER {
+    STDREDIRECT_DATA_CALLBACK output;           /**< receives header and data of every record                       */
+    void*                     userdata;         /**< passed to output                                               */
+    STDREDIRECT_MUTEX         lock;             /**< keeps header and data of a record together                     */
+} STDREDIRECT_RECORD_WRITER;
+
+
+/* forward declarations */
+
+static void   STDREDIRECT_initRecordWriter(STDREDIRECT_RECORD_WRITER* writer, STDREDIRECT_DATA_CALLBACK output, void* userdata);
+static void   STDREDIRECT_destroyRecordWriter(STDREDIRECT_RECORD_WRITER* writer);
+static void   STDREDIRECT_recordWriterCallback(const STDREDIRECT_RECORD* record, void* userdata);
+static size_t STDREDIRECT_encodeRecordHeader(const STDREDIRECT_RECORD* record, unsigned char* header);
+static int    STDREDIRECT_decodeRecordHeader(const unsigned char* data, size_t length, STDREDIRECT_RECORD* record);
+static size_t STDREDIRECT_encodeVarint(unsigned long long value, unsigned char* data);
+static int    STDREDIRECT_decodeVarint(const unsigned char* data, size_t length, unsigned long long* value);
+
+
+/**
+ * @brief Initialize record writer.
+ *
+ * @param writer Record writer.
+ * @param output Data callback receiving the encoded records, e.g. STDREDIRECT_fileSinkCallback().
+ * @param userdata Passed to @p output.
+ */
+static void STDREDIRECT_initRecordWriter(STDREDIRECT_RECORD_WRITER* writer, STDREDIRECT_DATA_CALLBACK output, void* userdata) {
+    writer->output   = output;
+    writer->userdata = userdata;
+    STDREDIRECT_initMutex(&writer->lock);
+}
+
+
+/**
+ * @brief Destroy record writer.
+ *
+ * Redirections writing to it must have been unredirected.
+ *
+ * @param writer Record writer.
+ */
+static void STDREDIRECT_destroyRecordWriter(STDREDIRECT_RECORD_WRITER* writer) {
+    STDREDIRECT_destroyMutex(&writer->lock);
+}
+
+
+/**
+ * @brief Record callback encoding the record and passing it on to the output of the writer.
+ *
+ * @param record Record.
+ * @param userdata Pointer to record writer.
+ */
+static void STDREDIRECT_recordWriterCallback(const STDREDIRECT_RECORD* record, void* userdata) {
+    STDREDIRECT_RECORD_WRITER* writer = (STDREDIRECT_RECORD_WRITER*) userdata;
+    unsigned char              header[1 + 4 * 10];
+    size_t                     headerSize;
+
+    headerSize = STDREDIRECT_encodeRecordHeader(record, header);
+
+    STDREDIRECT_lock(&writer->lock);
+    writer->output((const char*) header, headerSize, writer->userdata);
+    if (record->length > 0) {
+        writer->output(record->data, record->length, writer->userdata);
+    }
+    STDREDIRECT_unlock(&writer->lock);
+}
+
+
+/**
+ * @brief Encode record header.
+ *
+ * @param record Record.
+ * @param header Receives the header, room for STDREDIRECT_RECORD_MAX_HEADER_SIZE bytes.
+ * @return Header size.
+ */
+static size_t STDREDIRECT_encodeRecordHeader(const STDREDIRECT_RECORD* record, unsigned char* header) {
+    size_t headerSize = 0;
+
+    header[headerSize++] = (unsigned char) (STDREDIRECT_RECORD_TAG | (unsigned char) record->stream);
+    headerSize += STDREDIRECT_encodeVarint((unsigned long long) record->length, header + headerSize);
+    headerSize += STDREDIRECT_encodeVarint((unsigned long long) record->timestamp, header + headerSize);
+    headerSize += STDREDIRECT_encodeVarint((unsigned long long) record->sequence, header + headerSize);
+    headerSize += STDREDIRECT_encodeVarint((unsigned long long) record->globalSequence, header + headerSize);
+
+    return headerSize;
+}
+
+
+/**
+ * @brief Decode record header.
+ *
+ * On success STDREDIRECT_RECORD::data points right behind the header, the caller checks that STDREDIRECT_RECORD::length
+ * bytes of data are available. STDREDIRECT_RECORD::threadId is not encoded and decodes as 0.
+ *
+ * @param data Encoded data.
+ * @param length Number of bytes available.
+ * @param record Receives the record.
+ * @return Header size, 0 if @p data ends within the header, -1 if it is not a record header.
+ */
+static int STDREDIRECT_decodeRecordHeader(const unsigned char* data, size_t length, STDREDIRECT_RECORD* record) {
+    unsigned long long values[4];
+    int                headerSize = 1;
+    int                varintSize;
+    int                i;
+
+    if (length == 0) {
+        return 0;
+    }
+    if ((data[0] & 0xF0) != STDREDIRECT_RECORD_TAG || (data[0] & 0x0F) > STDREDIRECT_STREAM_STDERR) {
+        return -1;
+    }
+
+    for (i = 0; i < 4; ++i) {
+        varintSize = STDREDIRECT_decodeVarint(data + headerSize, length - (size_t) headerSize, &values[i]);
+        if (varintSize <= 0) {
+            return varintSize;
+        }
+        headerSize += varintSize;
+    }
+
+    record->stream         = (STDREDIRECT_STREAM) (data[0] & 0x0F);
+    record->length         = (size_t) values[0];
+    record->timestamp      = (long long) values[1];
+    record->sequence       = (long long) values[2];
+    record->globalSequence = (long long) values[3];
+    record->threadId       = 0;
+    record->data           = (const char*) data + headerSize;
+
+    return headerSize;
+}
+
+
+/**
+ * @brief Encode unsigned LEB128 varint.
+ *
+ * @param value Value.
+ * @param data Receives up to 10 bytes.
+ * @return Number of bytes written.
+ */
+static size_t STDREDIRECT_encodeVarint(unsigned long long value, unsigned char* data) {
+    size_t size = 0;
+
+    while (value >= 0x80) {
+        data[size++] = (unsigned char) (value | 0x80);
+        value >>= 7;
+    }
+    data[size++] = (unsigned char) value;
+
+    return size;
+}
+
+
+/**
+ * @brief Decode unsigned LEB128 varint.
+ *
+ * @param data Encoded data.
+ * @param length Number of bytes available.
+ * @param value Receives the value.
+ * @return Number of bytes read, 0 if @p data ends within the varint, -1 if it is longer than 10 bytes.
+ */
+static int STDREDIRECT_decodeVarint(const unsigned char* data, size_t length, unsigned long long* value) {
+    int size;
+
+    *value = 0;
+    for (size = 0; size < 10; ++size) {
+        if ((size_t) size == length) {
+            return 0;
+        }
+        *value |= (unsigned long long) (data[size] & 0x7F) << (7 * size);
+        if (!(data[size] & 0x80)) {
+            return size + 1;
+        }
+    }
+
+    return -1;
+}
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* STDREDIRECT_RECORDS_H */
@@ -0,0 +1,579 @@
+/***********************************************************************************************************************
+* stdredirect_router.h
+*
+* Route lines of captured output to several sinks by literal patterns.
+* https://github.com/biosmanager/stdredirect
+*
+*
+* MIT License
+*
+* Copyright (c) 2018 Matthias Albrecht
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*
+***********************************************************************************************************************/
+
+/**
+ * @file stdredirect_router.h
+ * @author Matthias Albrecht
+ * @brief Route lines of captured output to several sinks by literal patterns.
+ *
+ * A rule table of literal substrings and line prefixes is compiled once into an Aho-Corasick automaton. The router is
+ * a data callback that runs every chunk through the automaton in a single pass and passes each line to the sinks of
+ * all rules it matches, or to the default sinks if it matches none:
+ *
+ *     STDREDIRECT_SINK  sinks[]  = { { &alertCallback, NULL }, { &traceCallback, traceFile }, { &debuggerCallback, NULL } };
+ *     STDREDIRECT_ROUTE routes[] = { { "ERROR", STDREDIRECT_MATCH_SUBSTRING, 0 },
+ *                                    { "WARN", STDREDIRECT_MATCH_SUBSTRING, 0 },
+ *                                    { "TRACE:", STDREDIRECT_MATCH_PREFIX, 1 } };
+ *     STDREDIRECT_ROUTER* router = STDREDIRECT_createRouter(sinks, 3, routes, 3, 2);
+ *     STDREDIRECT_REDIRECTION* redirection = STDREDIRECT_createWithRouter(STDREDIRECT_STREAM_STDOUT, router, STDREDIRECT_BEHAVIOUR_REDIRECT);
+ *
+ * Between lines the automaton sits in its start state, there the router skips ahead to the next byte that can start a
+ * pattern or end a line with a vectorized scan, so output that rarely matches costs little more than finding the
+ * newlines. Consecutive lines going to the same sinks are passed on in one call.
+ */
+
+#ifndef STDREDIRECT_ROUTER_H
+#define STDREDIRECT_ROUTER_H
+
+#if defined (_MSC_VER) && (_MSC_VER >= 1020)
+#pragma once
+#endif
+
+#include "stdredirect.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+/** @brief Maximum number of sinks of a router. */
+#define STDREDIRECT_ROUTER_MAX_SINKS 32
+
+
+/** @brief Maximum number of distinct first pattern bytes for which the router skips ahead with a vectorized scan. */
+#define STDREDIRECT_ROUTER_MAX_START_BYTES 8
+
+
+/** @brief Default sink index of a router without default sink, lines matching no rule are dropped. */
+const size_t STDREDIRECT_ROUTER_NO_SINK = (size_t) -1;
+
+
+/** @brief How a rule pattern matches a line. */
+typedef enum STDREDIRECT_MATCH {
+    STDREDIRECT_MATCH_SUBSTRING,        /**< pattern anywhere in the line */
+    STDREDIRECT_MATCH_PREFIX            /**< line starts with pattern     */
+} STDREDIRECT_MATCH;
+
+
+/** @brief Sink of a router. */
+typedef struct STDREDIRECT_SINK {
+    STDREDIRECT_DATA_CALLBACK callback;         /**< receives one or more complete lines per call                   */
+    void*                     userdata;         /**< passed to callback                                              */
+} STDREDIRECT_SINK;
+
+
+/** @brief Routing rule. */
+typedef struct STDREDIRECT_ROUTE {
+    const char*               pattern;          /**< literal, not empty and without '\n', copied into the automaton  */
+    STDREDIRECT_MATCH         match;            /**< substring or prefix                                             */
+    size_t                    sink;             /**< index of the sink receiving matching lines                      */
+} STDREDIRECT_ROUTE;
+
+
+/** @brief Router compiled from a rule table.
+ *
+ *  Use STDREDIRECT_createRouter() to create one. Used by one redirection at a time, the sinks may be shared.
+ */
+typedef struct STDREDIRECT_ROUTER {
+    /** @name Internal
+     *  DO NOT CHANGE THESE VARIABLES AT RUNTIME!
+     */
+    /*@{*/
+    STDREDIRECT_SINK      sinks[STDREDIRECT_ROUTER_MAX_SINKS]; /**< sinks                                             */
+    size_t                numSinks;             /**< number of sinks                                                 */
+    unsigned int          defaultMask;          /**< sinks of lines matching no rule                                 */
+    int*                  transitions;          /**< next state for every state and byte, 256 per state              */
+    unsigned int*         outputs;              /**< sinks of the rules matched on entering a state                  */
+    size_t                numStates;            /**< number of states, 0 is the start state                          */
+    int                   lineStartState;       /**< state after a newline, start of the prefix rules                */
+    char                  startBytes[STDREDIRECT_ROUTER_MAX_START_BYTES + 1]; /**< '\n' and first pattern bytes     */
+    size_t                numStartBytes;        /**< number of start bytes, 0 if there are too many to skip ahead    */
+    int                   state;                /**< state at the end of the last chunk                              */
+    unsigned int          lineMask;             /**< sinks matched by the current line so far                        */
+    char*                 lineBuffer;           /**< carried partial line                                            */
+    size_t                lineLength;           /**< number of carried bytes                                         */
+    size_t                maxLineLength;        /**< carried bytes that are passed on as a piece of a line           */
+    /*@}*/
+} STDREDIRECT_ROUTER;
+
+
+/* forward declarations */
+
+static STDREDIRECT_ROUTER*      STDREDIRECT_createRouter(const STDREDIRECT_SINK* sinks, size_t numSinks, const STDREDIRECT_ROUTE* routes, size_t numRoutes, size_t defaultSink);
+static void                     STDREDIRECT_destroyRouter(STDREDIRECT_ROUTER* router);
+static STDREDIRECT_REDIRECTION* STDREDIRECT_createWithRouter(STDREDIRECT_STREAM stream, STDREDIRECT_ROUTER* router, STDREDIRECT_BEHAVIOUR redirectionBehaviour);
+static void                     STDREDIRECT_routerCallback(const char* data, size_t length, void* userdata);
+static void                     STDREDIRECT_flushRouter(STDREDIRECT_ROUTER* router);
+static int                      STDREDIRECT_compileRouter(STDREDIRECT_ROUTER* router, const STDREDIRECT_ROUTE* routes, size_t numRoutes);
+static void                     STDREDIRECT_routeToSinks(STDREDIRECT_ROUTER* router, unsigned int mask, const char* data, size_t length);
+static void                     STDREDIRECT_carryLine(STDREDIRECT_ROUTER* router, const char* data, size_t length);
+static const char*              STDREDIRECT_findAnyByte(const char* data, size_t length, const char* bytes, size_t numBytes);
+
+
+/**
+ * @brief Create router and compile its rule table.
+ *
+ * @param sinks Sinks, copied.
+ * @param numSinks Number of sinks, at most STDREDIRECT_ROUTER_MAX_SINKS.
+ * @param routes Rules, a line goes to the sinks of all rules it matches, each sink gets it once.
+ * @param numRoutes Number of rules.
+ * @param defaultSink Index of the sink receiving lines matching no rule, STDREDIRECT_ROUTER_NO_SINK to drop them.
+ * @return Pointer to router, NULL on error or invalid rule.
+ */
+static STDREDIRECT_ROUTER* STDREDIRECT_createRouter(const STDREDIRECT_SINK* sinks, size_t numSinks, const STDREDIRECT_ROUTE* routes, size_t numRoutes, size_t defaultSink) {
+    STDREDIRECT_ROUTER* router;
+    size_t              i;
+
+    if (!sinks || numSinks == 0 || numSinks > STDREDIRECT_ROUTER_MAX_SINKS || (!routes && numRoutes > 0)) {
+        return NULL;
+    }
+    if (defaultSink != STDREDIRECT_ROUTER_NO_SINK && defaultSink >= numSinks) {
+        return NULL;
+    }
+    for (i = 0; i < numSinks; ++i) {
+        if (!sinks[i].callback) {
+            return NULL;
+        }
+    }
+
+    router = (STDREDIRECT_ROUTER*) malloc(sizeof(STDREDIRECT_ROUTER));
+    if (!router) {
+        return NULL;
+    }
+
+    memcpy(router->sinks, sinks, numSinks * sizeof(STDREDIRECT_SINK));
+    router->numSinks      = numSinks;
+    router->defaultMask   = defaultSink == STDREDIRECT_ROUTER_NO_SINK ? 0 : 1u << defaultSink;
+    router->transitions   = NULL;
+    router->outputs       = NULL;
+    router->numStates     = 0;
+    router->lineMask      = 0;
+    router->lineLength    = 0;
+    router->maxLineLength = STDREDIRECT_MAX_LINE_LENGTH;
+    router->lineBuffer    = (char*) malloc(router->maxLineLength);
+
+    if (!router->lineBuffer || STDREDIRECT_compileRouter(router, routes, numRoutes) == -1) {
+        free(router->lineBuffer);
+        free(router->transitions);
+        free(router->outputs);
+        free(router);
+        return NULL;
+    }
+    router->state = router->lineStartState;
+
+    return router;
+}
+
+
+/**
+ * @brief Pass on a carried partial line and destroy router.
+ *
+ * Redirections using the router must have been unredirected.
+ *
+ * @param router Pointer to router.
+ */
+static void STDREDIRECT_destroyRouter(STDREDIRECT_ROUTER* router) {
+    if (router) {
+        STDREDIRECT_flushRouter(router);
+        free(router->lineBuffer);
+        free(router->transitions);
+        free(router->outputs);
+        free(router);
+    }
+}
+
+
+/**
+ * @brief Allocate redirection object passing its output through router.
+ *
+ * @param stream Stream to redirect.
+ * @param router Pointer to router.
+ * @param redirectionBehaviour Redirection behaviour.
+ * @return Pointer to allocated redirection object, NULL on error.
+ */
+static STDREDIRECT_REDIRECTION* STDREDIRECT_createWithRouter(STDREDIRECT_STREAM stream, STDREDIRECT_ROUTER* router, STDREDIRECT_BEHAVIOUR redirectionBehaviour) {
+    STDREDIRECT_OPTIONS options = STDREDIRECT_defaultOptions();
+
+    if (!router) {
+        return NULL;
+    }
+
+    options.behaviour    = redirectionBehaviour;
+    options.dataCallback = &STDREDIRECT_routerCallback;
+    options.userdata     = router;
+
+    return STDREDIRECT_createWithOptions(stream, &options);
+}
+
+
+/**
+ * @brief Data callback routing the lines of a chunk to the sinks.
+ *
+ * Set as STDREDIRECT_OPTIONS::dataCallback with the router as STDREDIRECT_OPTIONS::userdata. Works with either
+ * framing, ::STDREDIRECT_FRAMING_RAW is faster since the router finds the lines itself. A line split across chunks is
+ * carried until its end, lines longer than STDREDIRECT_MAX_LINE_LENGTH are passed on in pieces, each routed by what
+ * the line matched so far.
+ *
+ * @param data Chunk.
+ * @param length Number of bytes.
+ * @param userdata Pointer to router.
+ */
+static void STDREDIRECT_routerCallback(const char* data, size_t length, void* userdata) {
+    STDREDIRECT_ROUTER* router         = (STDREDIRECT_ROUTER*) userdata;
+    const int*          transitions    = router->transitions;
+    const unsigned int* outputs        = router->outputs;
+    const int           lineStartState = router->lineStartState;
+    const char*         skipTo;
+    int                 state          = router->state;
+    unsigned int        lineMask       = router->lineMask;
+    unsigned int        mask;
+    unsigned int        runMask        = 0;
+    size_t              runStart       = 0;
+    size_t              lineStart      = 0;
+    size_t              i              = 0;
+
+    while (i < length) {
+        /* nothing matched since the start of the line, only a start byte or newline leaves the start states */
+        if (router->numStartBytes > 0 && (state == 0 || state == lineStartState)) {
+            skipTo = STDREDIRECT_findAnyByte(data + i, length - i, router->startBytes, router->numStartBytes);
+            if (!skipTo) {
+                state = 0;
+                break;
+            }
+            if (skipTo != data + i) {
+                state = 0;
+                i = (size_t) (skipTo - data);
+            }
+        }
+
+        if (data[i] != '\n') {
+            state = transitions[(size_t) state * 256 + (unsigned char) data[i]];
+            lineMask |= outputs[state];
+            ++i;
+            continue;
+        }
+
+        /* end of line */
+        ++i;
+        mask = lineMask ? lineMask : router->defaultMask;
+        if (router->lineLength > 0) {
+            /* complete carried line */
+            router->lineMask = lineMask;
+            STDREDIRECT_carryLine(router, data, i);
+            STDREDIRECT_routeToSinks(router, mask, router->lineBuffer, router->lineLength);
+            router->lineLength = 0;
+            runStart = i;
+        }
+        else if (mask != runMask) {
+            /* lines going to the same sinks are passed on together */
+            STDREDIRECT_routeToSinks(router, runMask, data + runStart, lineStart - runStart);
+            runStart = lineStart;
+            runMask = mask;
+        }
+        lineStart = i;
+        state = lineStartState;
+        lineMask = 0;
+    }
+
+    STDREDIRECT_routeToSinks(router, runMask, data + runStart, lineStart - runStart);
+    router->state = state;
+    router->lineMask = lineMask;
+    if (lineStart < length) {
+        STDREDIRECT_carryLine(router, data + lineStart, length - lineStart);
+    }
+}
+
+
+/**
+ * @brief Pass on a carried partial line, e.g. the last line of the output lacking its '\n'.
+ *
+ * Called by STDREDIRECT_destroyRouter().
+ *
+ * @param router Pointer to router.
+ */
+static void STDREDIRECT_flushRouter(STDREDIRECT_ROUTER* router) {
+    if (router->lineLength > 0) {
+        STDREDIRECT_routeToSinks(router, router->lineMask ? router->lineMask : router->defaultMask, router->lineBuffer, router->lineLength);
+        router->lineLength = 0;
+    }
+    router->state = router->lineStartState;
+    router->lineMask = 0;
+}
+
+
+/**
+ * @brief Build the Aho-Corasick automaton of the rules.
+ *
+ * Prefix rules are compiled as "\n" followed by the pattern, the router starts every line in the state reached by
+ * "\n", so they only match at the start of a line. The failure links are resolved into a full transition table.
+ *
+ * @param router Pointer to router.
+ * @param routes Rules.
+ * @param numRoutes Number of rules.
+ * @return 0 on success, -1 on error or invalid rule.
+ */
+static int STDREDIRECT_compileRouter(STDREDIRECT_ROUTER* router, const STDREDIRECT_ROUTE* routes, size_t numRoutes) {
+    int*          transitions;
+    unsigned int* outputs;
+    int*          failures = NULL;
+    int*          queue    = NULL;
+    size_t        maxStates = 1;
+    size_t        numStates = 1;
+    size_t        head;
+    size_t        tail;
+    size_t        patternLength;
+    size_t        i;
+    size_t        j;
+    int           state;
+    int           next;
+    int           isPrefix;
+    unsigned char byte;
+
+    for (i = 0; i < numRoutes; ++i) {
+        if (!routes[i].pattern || routes[i].pattern[0] == '\0' || strchr(routes[i].pattern, '\n') || routes[i].sink >= router->numSinks) {
+            return -1;
+        }
+        maxStates += strlen(routes[i].pattern) + 1;
+    }
+
+    transitions = (int*) malloc(maxStates * 256 * sizeof(int));
+    outputs = (unsigned int*) calloc(maxStates, sizeof(unsigned int));
+    failures = (int*) malloc(maxStates * sizeof(int));
+    queue = (int*) malloc(maxStates * sizeof(int));
+    router->transitions = transitions;
+    router->outputs = outputs;
+    if (!transitions || !outputs || !failures || !queue) {
+        goto Error;
+    }
+    memset(transitions, 0xFF, maxStates * 256 * sizeof(int));
+
+    /* trie of the patterns, -1 marks a missing edge */
+    for (i = 0; i < numRoutes; ++i) {
+        isPrefix = routes[i].match == STDREDIRECT_MATCH_PREFIX;
+        patternLength = strlen(routes[i].pattern);
+        state = 0;
+        for (j = isPrefix ? 0 : 1; j <= patternLength; ++j) {
+            byte = (unsigned char) (j == 0 ? '\n' : routes[i].pattern[j - 1]);
+            next = transitions[(size_t) state * 256 + byte];
+            if (next == -1) {
+                next = (int) numStates++;
+                transitions[(size_t) state * 256 + byte] = next;
+            }
+            state = next;
+        }
+        outputs[state] |= 1u << routes[i].sink;
+    }
+
+    /* breadth-first, every state inherits the output of its failure state and its missing edges */
+    head = 0;
+    tail = 0;
+    for (i = 0; i < 256; ++i) {
+        next = transitions[i];
+        if (next == -1) {
+            transitions[i] = 0;
+        }
+        else {
+            failures[next] = 0;
+            queue[tail++] = next;
+        }
+    }
+    while (head < tail) {
+        state = queue[head++];
+        for (i = 0; i < 256; ++i) {
+            next = transitions[(size_t) state * 256 + i];
+            if (next == -1) {
+                transitions[(size_t) state * 256 + i] = transitions[(size_t) failures[state] * 256 + i];
+            }
+            else {
+                failures[next] = transitions[(size_t) failures[state] * 256 + i];
+                outputs[next] |= outputs[failures[next]];
+                queue[tail++] = next;
+            }
+        }
+    }
+    router->numStates = numStates;
+    router->lineStartState = transitions['\n'];
+
+    /* bytes leaving the start states, besides '\n' only the first bytes of the patterns */
+    router->startBytes[0] = '\n';
+    router->numStartBytes = 1;
+    for (i = 0; i < 256; ++i) {
+        if (i != '\n' && (transitions[i] != 0 || transitions[(size_t) router->lineStartState * 256 + i] != 0)) {
+            if (router->numStartBytes > STDREDIRECT_ROUTER_MAX_START_BYTES) {
+                router->numStartBytes = 0;
+                break;
+            }
+            router->startBytes[router->numStartBytes++] = (char) i;
+        }
+    }
+
+    free(failures);
+    free(queue);
+
+    return 0;
+
+Error:
+    /* cleanup */
+    free(failures);
+    free(queue);
+
+    return -1;
+}
+
+
+/**
+ * @brief Pass data to every sink in mask.
+ *
+ * @param router Pointer to router.
+ * @param mask Sinks, bit i for sink i.
+ * @param data One or more lines.
+ * @param length Number of bytes.
+ */
+static void STDREDIRECT_routeToSinks(STDREDIRECT_ROUTER* router, unsigned int mask, const char* data, size_t length) {
+    unsigned int i;
+
+    if (length == 0) {
+        return;
+    }
+    while (mask) {
+        i = STDREDIRECT_countTrailingZeros(mask);
+        router->sinks[i].callback(data, length, router->sinks[i].userdata);
+        mask &= mask - 1;
+    }
+}
+
+
+/**
+ * @brief Append to carried partial line, passes it on as a piece of the line once it reaches maxLineLength.
+ *
+ * @param router Pointer to router.
+ * @param data Data.
+ * @param length Number of bytes.
+ */
+static void STDREDIRECT_carryLine(STDREDIRECT_ROUTER* router, const char* data, size_t length) {
+    size_t numBytesToCopy;
+
+    while (length > 0) {
+        numBytesToCopy = router->maxLineLength - router->lineLength;
+        if (numBytesToCopy > length) {
+            numBytesToCopy = length;
+        }
+        memcpy(router->lineBuffer + router->lineLength, data, numBytesToCopy);
+        router->lineLength += numBytesToCopy;
+        data += numBytesToCopy;
+        length -= numBytesToCopy;
+
+        if (router->lineLength == router->maxLineLength && length > 0) {
+            STDREDIRECT_routeToSinks(router, router->lineMask ? router->lineMask : router->defaultMask, router->lineBuffer, router->lineLength);
+            router->lineLength = 0;
+        }
+    }
+}
+
+
+/**
+ * @brief Find first occurrence of any of a few bytes.
+ *
+ * @param data Data.
+ * @param length Number of bytes.
+ * @param bytes Bytes to look for.
+ * @param numBytes Number of bytes to look for, at least 1 and at most STDREDIRECT_ROUTER_MAX_START_BYTES + 1.
+ * @return Pointer to the first occurrence, NULL if there is none.
+ */
+static const char* STDREDIRECT_findAnyByte(const char* data, size_t length, const char* bytes, size_t numBytes) {
+    size_t       i;
+#if defined (STDREDIRECT_AVX2)
+    __m256i      patterns256[STDREDIRECT_ROUTER_MAX_START_BYTES + 1];
+    __m256i      block256;
+    __m256i      matches256;
+#endif
+#if defined (STDREDIRECT_SSE2)
+    __m128i      patterns[STDREDIRECT_ROUTER_MAX_START_BYTES + 1];
+    __m128i      block;
+    __m128i      matches;
+    unsigned int mask;
+#endif
+
+#if defined (STDREDIRECT_AVX2)
+    for (i = 0; i < numBytes; ++i) {
+        patterns256[i] = _mm256_set1_epi8(bytes[i]);
+    }
+    while (length >= 32) {
+        block256 = _mm256_loadu_si256((const __m256i*) data);
+        matches256 = _mm256_cmpeq_epi8(block256, patterns256[0]);
+        for (i = 1; i < numBytes; ++i) {
+            matches256 = _mm256_or_si256(matches256, _mm256_cmpeq_epi8(block256, patterns256[i]));
+        }
+        mask = (unsigned int) _mm256_movemask_epi8(matches256);
+        if (mask) {
+            return data + STDREDIRECT_countTrailingZeros(mask);
+        }
+        data += 32;
+        length -= 32;
+    }
+#endif
+#if defined (STDREDIRECT_SSE2)
+    for (i = 0; i < numBytes; ++i) {
+        patterns[i] = _mm_set1_epi8(bytes[i]);
+    }
+    while (length >= 16) {
+        block = _mm_loadu_si128((const __m128i*) data);
+        matches = _mm_cmpeq_epi8(block, patterns[0]);
+        for (i = 1; i < numBytes; ++i) {
+            matches = _mm_or_si128(matches, _mm_cmpeq_epi8(block, patterns[i]));
+        }
+        mask = (unsigned int) _mm_movemask_epi8(matches);
+        if (mask) {
+            return data + STDREDIRECT_countTrailingZeros(mask);
+        }
+        data += 16;
+        length -= 16;
+    }
+#endif
+
+    /* scalar fallback and tail */
+    for (; length > 0; ++data, --length) {
+        for (i = 0; i < numBytes; ++i) {
+            if (*data == bytes[i]) {
+                return data;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* STDREDIRECT_ROUTER_H */